@@ -7584,6 +7584,7 @@ void GPUEngineA::_RenderLine_DisplayCapture(const GPUEngineCompositorInfo &compI
 	const void *srcAPtr;
 	const void *srcBPtr;
 	u16 *dstNative16 = this->_VRAMNativeBlockPtr[DISPCAPCNT.VRAMWriteBlock] + dstNativeOffset;
+	MMU_VRAMmarkWritten(dstNative16, CAPTURELENGTH * sizeof(u16));
 	
 	if (!willWriteVRAMLineNative)
 	{
@@ -8718,13 +8719,19 @@ GPUSubsystem::GPUSubsystem()
 	{
 		_asyncEngineBufferSetupTask = new Task;
 		_asyncEngineBufferSetupTask->start(false);
+		
+		_asyncEngineSubRenderTask = new Task;
+		_asyncEngineSubRenderTask->start(false);
 	}
 	else
 	{
 		_asyncEngineBufferSetupTask = NULL;
+		_asyncEngineSubRenderTask = NULL;
 	}
 	
 	_asyncEngineBufferSetupIsRunning = false;
+	_asyncEngineSubRenderIsRunning = false;
+	_asyncEngineSubRenderLine = 0;
 	
 	_pending3DRendererID = RENDERID_NULL;
 	_needChange3DRenderer = false;
@@ -8811,6 +8818,13 @@ GPUSubsystem::~GPUSubsystem()
 		this->_asyncEngineBufferSetupTask = NULL;
 	}
 	
+	if (this->_asyncEngineSubRenderTask != NULL)
+	{
+		this->AsyncRenderLineSubFinish();
+		delete this->_asyncEngineSubRenderTask;
+		this->_asyncEngineSubRenderTask = NULL;
+	}
+	
 	free_aligned(this->_masterFramebuffer);
 	free_aligned(this->_customVRAM);
 	
@@ -9549,9 +9563,45 @@ void GPUSubsystem::AsyncSetupEngineBuffersFinish()
 	this->_asyncEngineBufferSetupIsRunning = false;
 }
 
+size_t GPUSubsystem::GetAsyncEngineSubRenderLine() const
+{
+	return this->_asyncEngineSubRenderLine;
+}
+
+template <NDSColorFormat OUTPUTFORMAT>
+static void* GPUSubsystem_AsyncRenderLineSub(void *arg)
+{
+	GPUSubsystem *gpuSubystem = (GPUSubsystem *)arg;
+	gpuSubystem->GetEngineSub()->RenderLine<OUTPUTFORMAT>(gpuSubystem->GetAsyncEngineSubRenderLine());
+	
+	return NULL;
+}
+
+template <NDSColorFormat OUTPUTFORMAT>
+void GPUSubsystem::AsyncRenderLineSubStart(const size_t l)
+{
+	this->AsyncRenderLineSubFinish();
+	this->_asyncEngineSubRenderLine = l;
+	this->_asyncEngineSubRenderTask->execute(&GPUSubsystem_AsyncRenderLineSub<OUTPUTFORMAT>, this);
+	this->_asyncEngineSubRenderIsRunning = true;
+}
+
+void GPUSubsystem::AsyncRenderLineSubFinish()
+{
+	if (!this->_asyncEngineSubRenderIsRunning)
+	{
+		return;
+	}
+	
+	this->_asyncEngineSubRenderTask->finish();
+	this->_asyncEngineSubRenderIsRunning = false;
+}
+
 template <NDSColorFormat OUTPUTFORMAT>
 void GPUSubsystem::RenderLine(const size_t l)
 {
+	NDS_ProfileScope profileScope(NDS_PROFILE_GPU_RENDERLINE);
+	
 	if (!this->_frameNeedsFinish)
 	{
 		this->_event->DidApplyGPUSettingsBegin();
@@ -9591,6 +9641,24 @@ void GPUSubsystem::RenderLine(const size_t l)
 		this->_engineSub->UpdateRenderStates<OUTPUTFORMAT>(l);
 	}
 	
+	// The sub engine has no 3D layer and cannot capture, so its line can be rendered alongside the
+	// main engine's line. The only state the two engines share is the main engine's per-block
+	// capture tracking, which the sub engine consults when its BG/OBJ VRAM lies in banks A-D. A
+	// capture destination or a VRAM display source must be LCDC-mapped, so it can never be one of
+	// the sub engine's banks -- but to stay on the safe side, any line where the main engine
+	// captures or displays VRAM is still rendered serially.
+	const bool willRenderSubAsync = CommonSettings.GPU2D_ParallelSubEngine &&
+	                                (this->_asyncEngineSubRenderTask != NULL) &&
+	                                isFramebufferRenderNeeded[GPUEngineID_Sub] &&
+	                                !this->_willFrameSkip &&
+	                                !isDisplayCaptureNeeded &&
+	                                (this->_engineMain->GetIORegisterMap().DISPCNT.DisplayMode != GPUDisplayMode_VRAM);
+	
+	if (willRenderSubAsync)
+	{
+		this->AsyncRenderLineSubStart<OUTPUTFORMAT>(l);
+	}
+	
 	if ( (isFramebufferRenderNeeded[GPUEngineID_Main] || isDisplayCaptureNeeded) && !this->_willFrameSkip )
 	{
 		// GPUEngineA:WillRender3DLayer() and GPUEngineA:WillCapture3DLayerDirect() both rely on register
@@ -9626,7 +9694,11 @@ void GPUSubsystem::RenderLine(const size_t l)
 		this->_engineMain->UpdatePropertiesWithoutRender(l);
 	}
 	
-	if (isFramebufferRenderNeeded[GPUEngineID_Sub] && !this->_willFrameSkip)
+	if (willRenderSubAsync)
+	{
+		this->AsyncRenderLineSubFinish();
+	}
+	else if (isFramebufferRenderNeeded[GPUEngineID_Sub] && !this->_willFrameSkip)
 	{
 		this->_engineSub->RenderLine<OUTPUTFORMAT>(l);
 	}
@@ -1847,6 +1847,10 @@ private:
 	Task *_asyncEngineBufferSetupTask;
 	bool _asyncEngineBufferSetupIsRunning;
 	
+	Task *_asyncEngineSubRenderTask;
+	bool _asyncEngineSubRenderIsRunning;
+	size_t _asyncEngineSubRenderLine;
+	
 	int _pending3DRendererID;
 	bool _needChange3DRenderer;
 	
@@ -1950,6 +1954,13 @@ public:
 	void AsyncSetupEngineBuffersStart();
 	void AsyncSetupEngineBuffersFinish();
 	
+	// When CommonSettings.GPU2D_ParallelSubEngine is set, RenderLine() hands the sub engine's
+	// line to a worker thread and renders the main engine's line concurrently. The worker is
+	// always joined before RenderLine() returns, so no emulated state changes while it runs.
+	size_t GetAsyncEngineSubRenderLine() const;
+	template<NDSColorFormat OUTPUTFORMAT> void AsyncRenderLineSubStart(const size_t l);
+	void AsyncRenderLineSubFinish();
+	
 	template<NDSColorFormat OUTPUTFORMAT> void RenderLine(const size_t l);
 	void UpdateAverageBacklightIntensityTotal();
 	void ClearWithColor(const u16 colorBGRA5551);
@@ -793,13 +793,23 @@ static inline void MMU_VRAMmapControl(u8 block, u8 VRAMBankCnt)
 	//handle WRAM, first of all
 	if(block == 7)
 	{
-		MMU.WRAMCNT = VRAMBankCnt & 3;
+		if(MMU.WRAMCNT != (VRAMBankCnt & 3))
+		{
+			MMU.WRAMCNT = VRAMBankCnt & 3;
+			MMU_RebuildPages(0x03000000, 0x04000000);
+		}
 		return;
 	}
 
 	//first, save the texture info so we can check it for changes and trigger purges of the texcache
 	MMU_struct::TextureInfo oldTexInfo = MMU.texInfo;
 
+	//and the cpu mappings, so the page tables are only rebuilt when they actually move
+	u8 oldArm9Map[VRAM_ARM9_PAGES], oldLcdcMap[VRAM_LCDC_PAGES], oldArm7Map[2];
+	memcpy(oldArm9Map, vram_arm9_map, sizeof(vram_arm9_map));
+	memcpy(oldLcdcMap, vram_lcdc_map, sizeof(vram_lcdc_map));
+	memcpy(oldArm7Map, vram_arm7_map, sizeof(vram_arm7_map));
+
 	//unmap everything
 	MMU_VRAM_unmap_all();
 
@@ -896,6 +906,129 @@ static inline void MMU_VRAMmapControl(u8 block, u8 VRAMBankCnt)
 	}
 
 	//-------------------------------
+
+	if(memcmp(oldArm9Map, vram_arm9_map, sizeof(vram_arm9_map))
+		|| memcmp(oldLcdcMap, vram_lcdc_map, sizeof(vram_lcdc_map))
+		|| memcmp(oldArm7Map, vram_arm7_map, sizeof(vram_arm7_map)))
+		MMU_RebuildPages(0x06000000, 0x07000000);
+}
+
+//////////////////////////////////////////////////////////////
+//cpu page tables
+//////////////////////////////////////////////////////////////
+
+MMU_PageTable MMU_pages[2];
+static bool MMU_pagesThreaded = false;
+
+//the host memory a plain access to the given page lands in, or NULL if it needs the full handler.
+//this must agree with what the inline accessors and the _MMU_ARMx_read* routines would do for every address in the page.
+template<int PROCNUM>
+static u8* MMU_pageHostMemory(u32 adr, const bool code)
+{
+	//data accesses check the dtcm before anything else
+	if(PROCNUM==ARMCPU_ARM9 && !code && (adr & ~0x3FFF) == MMU.DTCMRegion)
+		return MMU.ARM9_DTCM + (adr & 0x3FFF);
+
+	switch(adr >> 24)
+	{
+		case 0x00:
+		case 0x01:
+			//the arm7 bios is only readable by code inside of it
+			if(PROCNUM==ARMCPU_ARM9)
+				return MMU.ARM9_ITCM + (adr & 0x7FFF);
+			return NULL;
+
+		case 0x02:
+			return MMU.MAIN_MEM + (adr & _MMU_MAIN_MEM_MASK);
+
+		case 0x03:
+		case 0x06:
+		{
+			if(MMU_pagesThreaded && MMU_isSharedAccess(adr))
+				return NULL;
+			//the arm9 lcdc mirror beyond the banks doesn't keep offsets within a page
+			if(PROCNUM==ARMCPU_ARM9 && adr >= 0x068A4000)
+				return NULL;
+			bool unmapped, restricted;
+			adr = MMU_LCDmap<PROCNUM>(adr, unmapped, restricted);
+			if(unmapped)
+				return NULL;
+			return MMU.MMU_MEM[PROCNUM][adr>>20] + (adr & MMU.MMU_MASK[PROCNUM][adr>>20]);
+		}
+
+		default:
+			return NULL;
+	}
+}
+
+static bool MMU_pageHasBreakPoint(const std::vector<int> &breakPoints, const u32 adr)
+{
+	for(size_t i = 0; i < breakPoints.size(); i++)
+		if(((u32)breakPoints[i] & ~MMU_PAGE_MASK) == adr)
+			return true;
+	return false;
+}
+
+#ifdef HAVE_LUA
+static bool MMU_pageHasLuaHook(const LuaMemHookType hookType, const u32 adr)
+{
+	return hookedRegions[hookType].NotEmpty() && hookedRegions[hookType].Contains(adr, MMU_PAGE_SIZE);
+}
+#endif
+
+template<int PROCNUM>
+static void MMU_rebuildPages(const u32 first, const u32 last)
+{
+	MMU_PageTable &pages = MMU_pages[PROCNUM];
+	for(u32 page = first; page < last; page++)
+	{
+		const u32 adr = page << MMU_PAGE_SHIFT;
+		const bool dtcm = (PROCNUM==ARMCPU_ARM9) && (adr & ~0x3FFF) == MMU.DTCMRegion;
+
+		bool readSlow = MMU_pageHasBreakPoint(memReadBreakPoints, adr);
+		bool writeSlow = MMU_pageHasBreakPoint(memWriteBreakPoints, adr);
+#ifdef HAVE_LUA
+		readSlow = readSlow || MMU_pageHasLuaHook(LUAMEMHOOK_READ, adr);
+		writeSlow = writeSlow || MMU_pageHasLuaHook(LUAMEMHOOK_WRITE, adr);
+#endif
+
+		//each entry is stored once with its final value, since the other cpu's thread may be reading the table
+		u8 *host = readSlow ? NULL : MMU_pageHostMemory<PROCNUM>(adr, false);
+		pages.read[page] = host;
+		pages.code[page] = (readSlow || !dtcm) ? host : MMU_pageHostMemory<PROCNUM>(adr, true);
+		pages.write[page] = (dtcm && !writeSlow) ? MMU.ARM9_DTCM + (adr & 0x3FFF) : NULL;
+	}
+}
+
+void MMU_RebuildPages(u32 start, u32 end)
+{
+	if(start >= 0x10000000) return;
+	if(end > 0x10000000) end = 0x10000000;
+	const u32 first = start >> MMU_PAGE_SHIFT;
+	const u32 last = (end + MMU_PAGE_MASK) >> MMU_PAGE_SHIFT;
+	MMU_rebuildPages<ARMCPU_ARM9>(first, last);
+	MMU_rebuildPages<ARMCPU_ARM7>(first, last);
+}
+
+void MMU_RebuildPageTables()
+{
+	MMU_RebuildPages(0, 0x10000000);
+}
+
+void MMU_SetDTCMRegion(u32 region)
+{
+	const u32 oldRegion = MMU.DTCMRegion;
+	MMU.DTCMRegion = region;
+	if(region == oldRegion) return;
+	MMU_RebuildPages(oldRegion & ~0x3FFF, (oldRegion & ~0x3FFF) + 0x4000);
+	MMU_RebuildPages(region & ~0x3FFF, (region & ~0x3FFF) + 0x4000);
+}
+
+void MMU_SetPageTablesThreaded(bool threaded)
+{
+	if(MMU_pagesThreaded == threaded) return;
+	MMU_pagesThreaded = threaded;
+	MMU_RebuildPages(0x03000000, 0x04000000);
 }
 
 //////////////////////////////////////////////////////////////
@@ -952,10 +1085,12 @@ void MMU_Reset()
 	memset(MMU.ARM9_DTCM, 0, sizeof(MMU.ARM9_DTCM));
 	memset(MMU.ARM9_ITCM, 0, sizeof(MMU.ARM9_ITCM));
 	memset(MMU.ARM9_LCD,  0, sizeof(MMU.ARM9_LCD));
+	MMU_VRAMmarkAllWritten();
 	memset(MMU.ARM9_OAM,  0, sizeof(MMU.ARM9_OAM));
 	memset(MMU.ARM9_REG,  0, sizeof(MMU.ARM9_REG));
 	memset(MMU.ARM9_VMEM, 0, sizeof(MMU.ARM9_VMEM));
 	memset(MMU.MAIN_MEM,  0, sizeof(MMU.MAIN_MEM));
+	memset(MMU.mainMemDirtyPage, 1, sizeof(MMU.mainMemDirtyPage));
 
 	memset(MMU.UNUSED_RAM,    0, sizeof(MMU.UNUSED_RAM));
 	memset(MMU.MORE_UNUSED_RAM,    0, sizeof(MMU.UNUSED_RAM));
@@ -1044,6 +1179,7 @@ void SetupMMU(bool debugConsole, bool dsi) {
 	if(dsi) _MMU_MAIN_MEM_MASK = 0xFFFFFF;
 	_MMU_MAIN_MEM_MASK16 = _MMU_MAIN_MEM_MASK & ~1;
 	_MMU_MAIN_MEM_MASK32 = _MMU_MAIN_MEM_MASK & ~3;
+	MMU_RebuildPageTables();
 }
 
 static void execsqrt() {
@@ -1066,7 +1202,7 @@ static void execsqrt() {
 	MMU.sqrtCycles = nds_timer + 26;
 	MMU.sqrtResult = ret;
 	MMU.sqrtRunning = TRUE;
-	NDS_Reschedule();
+	NDS_RescheduleSqrt();
 }
 
 static void execdiv() {
@@ -1125,7 +1261,7 @@ static void execdiv() {
 	MMU.divResult = res;
 	MMU.divMod = mod;
 	MMU.divRunning = TRUE;
-	NDS_Reschedule();
+	NDS_RescheduleDivider();
 }
 
 DSI_TSC::DSI_TSC()
@@ -1877,7 +2013,7 @@ static INLINE u16 read_timer(int proc, int timerIndex)
 		return MMU.timer[proc][timerIndex];
 
 	//for unchained timers, we do not keep the timer up to date. its value will need to be calculated here
-	s32 diff = (s32)(nds.timerCycle[proc][timerIndex] - nds_timer);
+	s32 diff = (s32)(nds.timerCycle[proc][timerIndex] - NDS_GetTimer(proc));
 	assert(diff>=0);
 	if(diff<0) 
 		printf("NEW EMULOOP BAD NEWS PLEASE REPORT: TIME READ DIFF < 0 (%d) (%d) (%d)\n",diff,timerIndex,MMU.timerMODE[proc][timerIndex]);
@@ -1935,7 +2071,7 @@ static INLINE void write_timer(int proc, int timerIndex, u16 val)
 	}
 
 	int remain = 65536 - MMU.timerReload[proc][timerIndex];
-	nds.timerCycle[proc][timerIndex] = nds_timer + (remain<<MMU.timerMODE[proc][timerIndex]);
+	nds.timerCycle[proc][timerIndex] = NDS_GetTimer(proc) + (remain<<MMU.timerMODE[proc][timerIndex]);
 
 	T1WriteWord(MMU.MMU_MEM[proc][0x40], 0x102+timerIndex*4, val);
 	NDS_RescheduleTimers();
@@ -2392,8 +2528,8 @@ void DmaController::tryTrigger(EDMAMode mode)
 void DmaController::doSchedule()
 {
 	dmaCheck = TRUE;
-	nextEvent = nds_timer;
-	NDS_RescheduleDMA();
+	nextEvent = NDS_GetTimer(procnum);
+	NDS_RescheduleDMA(procnum, chan);
 }
 
 
@@ -3224,9 +3360,10 @@ void FASTCALL _MMU_ARM9_write08(u32 adr, u8 val)
 	if (adrBank < 0x02)
 	{
 #ifdef HAVE_JIT
-		JIT_COMPILED_FUNC_KNOWNBANK(adr, ARM9_ITCM, 0x7FFF, 0) = 0;
+		JIT_INVALIDATE_KNOWNBANK(adr, ARM9_ITCM, 0x7FFF, 1);
 #endif
 		T1WriteByte(MMU.ARM9_ITCM, adr & 0x7FFF, val);
+		MMU_codeMarkDirty(MMU.ARM9_ITCM + (adr & 0x7FFF), 1);
 		return;
 	}
 
@@ -3695,12 +3832,15 @@ void FASTCALL _MMU_ARM9_write08(u32 adr, u8 val)
 	if(restricted) return; //block 8bit vram writes
 
 #ifdef HAVE_JIT
-	if (JIT_MAPPED(adr, ARMCPU_ARM9))
-		JIT_COMPILED_FUNC_PREMASKED(adr, ARMCPU_ARM9, 0) = 0;
+	JIT_INVALIDATE(adr, ARMCPU_ARM9, 1);
 #endif
 
+	MMU_VRAMmarkWritten(adr);
+	MMU_mainMemMarkWritten(adr);
+
 	// Removed the &0xFF as they are implicit with the adr&0x0FFFFFFF [shash]
 	MMU.MMU_MEM[ARMCPU_ARM9][adr>>20][adr&MMU.MMU_MASK[ARMCPU_ARM9][adr>>20]]=val;
+	MMU_codeMarkDirty(MMU.MMU_MEM[ARMCPU_ARM9][adr>>20] + (adr&MMU.MMU_MASK[ARMCPU_ARM9][adr>>20]), 1);
 }
 
 //================================================= MMU ARM9 write 16
@@ -3714,9 +3854,10 @@ void FASTCALL _MMU_ARM9_write16(u32 adr, u16 val)
 	if (adrBank < 0x02)
 	{
 #ifdef HAVE_JIT
-		JIT_COMPILED_FUNC_KNOWNBANK(adr, ARM9_ITCM, 0x7FFF, 0) = 0;
+		JIT_INVALIDATE_KNOWNBANK(adr, ARM9_ITCM, 0x7FFF, 1);
 #endif
 		T1WriteWord(MMU.ARM9_ITCM, adr & 0x7FFF, val);
+		MMU_codeMarkDirty(MMU.ARM9_ITCM + (adr & 0x7FFF), 2);
 		return;
 	}
 
@@ -4271,12 +4412,15 @@ void FASTCALL _MMU_ARM9_write16(u32 adr, u16 val)
 	if(unmapped) return;
 
 #ifdef HAVE_JIT
-	if (JIT_MAPPED(adr, ARMCPU_ARM9))
-		JIT_COMPILED_FUNC_PREMASKED(adr, ARMCPU_ARM9, 0) = 0;
+	JIT_INVALIDATE(adr, ARMCPU_ARM9, 1);
 #endif
 
+	MMU_VRAMmarkWritten(adr);
+	MMU_mainMemMarkWritten(adr);
+
 	// Removed the &0xFF as they are implicit with the adr&0x0FFFFFFF [shash]
 	T1WriteWord(MMU.MMU_MEM[ARMCPU_ARM9][adr>>20], adr&MMU.MMU_MASK[ARMCPU_ARM9][adr>>20], val);
+	MMU_codeMarkDirty(MMU.MMU_MEM[ARMCPU_ARM9][adr>>20] + (adr&MMU.MMU_MASK[ARMCPU_ARM9][adr>>20]), 2);
 } 
 
 //================================================= MMU ARM9 write 32
@@ -4290,10 +4434,10 @@ void FASTCALL _MMU_ARM9_write32(u32 adr, u32 val)
 	if (adrBank < 0x02)
 	{
 #ifdef HAVE_JIT
-		JIT_COMPILED_FUNC_KNOWNBANK(adr, ARM9_ITCM, 0x7FFF, 0) = 0;
-		JIT_COMPILED_FUNC_KNOWNBANK(adr, ARM9_ITCM, 0x7FFF, 1) = 0;
+		JIT_INVALIDATE_KNOWNBANK(adr, ARM9_ITCM, 0x7FFF, 2);
 #endif
 		T1WriteLong(MMU.ARM9_ITCM, adr & 0x7FFF, val);
+		MMU_codeMarkDirty(MMU.ARM9_ITCM + (adr & 0x7FFF), 4);
 		return ;
 	}
 
@@ -4780,15 +4924,15 @@ void FASTCALL _MMU_ARM9_write32(u32 adr, u32 val)
 	if(unmapped) return;
 
 #ifdef HAVE_JIT
-	if (JIT_MAPPED(adr, ARMCPU_ARM9))
-	{
-		JIT_COMPILED_FUNC_PREMASKED(adr, ARMCPU_ARM9, 0) = 0;
-		JIT_COMPILED_FUNC_PREMASKED(adr, ARMCPU_ARM9, 1) = 0;
-	}
+	JIT_INVALIDATE(adr, ARMCPU_ARM9, 2);
 #endif
 
+	MMU_VRAMmarkWritten(adr);
+	MMU_mainMemMarkWritten(adr);
+
 	// Removed the &0xFF as they are implicit with the adr&0x0FFFFFFF [shash]
 	T1WriteLong(MMU.MMU_MEM[ARMCPU_ARM9][adr>>20], adr&MMU.MMU_MASK[ARMCPU_ARM9][adr>>20], val);
+	MMU_codeMarkDirty(MMU.MMU_MEM[ARMCPU_ARM9][adr>>20] + (adr&MMU.MMU_MASK[ARMCPU_ARM9][adr>>20]), 4);
 }
 
 //================================================= MMU ARM9 read 08
@@ -5275,12 +5419,15 @@ void FASTCALL _MMU_ARM7_write08(u32 adr, u8 val)
 	if(unmapped) return;
 
 #ifdef HAVE_JIT
-	if (JIT_MAPPED(adr, ARMCPU_ARM7))
-		JIT_COMPILED_FUNC_PREMASKED(adr, ARMCPU_ARM7, 0) = 0;
+	JIT_INVALIDATE(adr, ARMCPU_ARM7, 1);
 #endif
 	
+	MMU_VRAMmarkWritten(adr);
+	MMU_mainMemMarkWritten(adr);
+
 	// Removed the &0xFF as they are implicit with the adr&0x0FFFFFFF [shash]
 	MMU.MMU_MEM[ARMCPU_ARM7][adr>>20][adr&MMU.MMU_MASK[ARMCPU_ARM7][adr>>20]]=val;
+	MMU_codeMarkDirty(MMU.MMU_MEM[ARMCPU_ARM7][adr>>20] + (adr&MMU.MMU_MASK[ARMCPU_ARM7][adr>>20]), 1);
 }
 
 //================================================= MMU ARM7 write 16
@@ -5461,12 +5608,15 @@ void FASTCALL _MMU_ARM7_write16(u32 adr, u16 val)
 	if(unmapped) return;
 
 #ifdef HAVE_JIT
-	if (JIT_MAPPED(adr, ARMCPU_ARM7))
-		JIT_COMPILED_FUNC_PREMASKED(adr, ARMCPU_ARM7, 0) = 0;
+	JIT_INVALIDATE(adr, ARMCPU_ARM7, 1);
 #endif
 
+	MMU_VRAMmarkWritten(adr);
+	MMU_mainMemMarkWritten(adr);
+
 	// Removed the &0xFF as they are implicit with the adr&0x0FFFFFFF [shash]
 	T1WriteWord(MMU.MMU_MEM[ARMCPU_ARM7][adr>>20], adr&MMU.MMU_MASK[ARMCPU_ARM7][adr>>20], val);
+	MMU_codeMarkDirty(MMU.MMU_MEM[ARMCPU_ARM7][adr>>20] + (adr&MMU.MMU_MASK[ARMCPU_ARM7][adr>>20]), 2);
 }
 //================================================= MMU ARM7 write 32
 void FASTCALL _MMU_ARM7_write32(u32 adr, u32 val)
@@ -5560,15 +5710,15 @@ void FASTCALL _MMU_ARM7_write32(u32 adr, u32 val)
 	if(unmapped) return;
 
 #ifdef HAVE_JIT
-	if (JIT_MAPPED(adr, ARMCPU_ARM7))
-	{
-		JIT_COMPILED_FUNC_PREMASKED(adr, ARMCPU_ARM7, 0) = 0;
-		JIT_COMPILED_FUNC_PREMASKED(adr, ARMCPU_ARM7, 1) = 0;
-	}
+	JIT_INVALIDATE(adr, ARMCPU_ARM7, 2);
 #endif
 
+	MMU_VRAMmarkWritten(adr);
+	MMU_mainMemMarkWritten(adr);
+
 	// Removed the &0xFF as they are implicit with the adr&0x0FFFFFFF [shash]
 	T1WriteLong(MMU.MMU_MEM[ARMCPU_ARM7][adr>>20], adr&MMU.MMU_MASK[ARMCPU_ARM7][adr>>20], val);
+	MMU_codeMarkDirty(MMU.MMU_MEM[ARMCPU_ARM7][adr>>20] + (adr&MMU.MMU_MASK[ARMCPU_ARM7][adr>>20]), 4);
 }
 
 //================================================= MMU ARM7 read 08
@@ -359,6 +359,14 @@ typedef union
 #define DUP8(x)  x, x, x, x,  x, x, x, x
 #define DUP16(x) x, x, x, x,  x, x, x, x,  x, x, x, x,  x, x, x, x
 
+//granularity of the vram write tracking (see MMU_VRAMmarkWritten). 256 pages of 4KB covers ARM9_LCD
+#define VRAM_EPOCH_PAGE_SHIFT 12
+#define VRAM_EPOCH_PAGES 256
+
+//granularity of the main memory write tracking used by delta savestates
+#define MAIN_MEM_DIRTY_PAGE_SHIFT 12
+#define MAIN_MEM_DIRTY_PAGES ((16*1024*1024) >> MAIN_MEM_DIRTY_PAGE_SHIFT)
+
 struct MMU_struct 
 {
 	//ARM9 mem
@@ -388,6 +396,16 @@ struct MMU_struct
 		u8* textureSlotAddr[4];
 	} texInfo;
 
+	//the epoch at which each 4KB page of ARM9_LCD was last written.
+	//the texture cache advances vramEpoch whenever it revalidates, so that it can skip
+	//comparing textures whose pages havent been touched since they were last checked.
+	u32 vramEpoch;
+	u32 vramPageEpoch[VRAM_EPOCH_PAGES];
+
+	//nonzero for each 4KB page of MAIN_MEM written since the last delta savestate was taken.
+	//these are bytes rather than bits so that marking a page never needs a read-modify-write.
+	u8 mainMemDirtyPage[MAIN_MEM_DIRTY_PAGES];
+
 	//ARM7 mem
 	u8 ARM7_BIOS[0x4000];
 	u8 ARM7_ERAM[0x10000]; //64KB of exclusive WRAM
@@ -622,6 +640,46 @@ FORCEINLINE void* MMU_gpu_map(const u32 vram_addr)
 	return MMU.ARM9_LCD + (vram_page << 14) + ofs;
 }
 
+//notes a write to vram, given an address as returned by MMU_LCDmap (that is, relative to LCDC_HACKY_LOCATION)
+FORCEINLINE void MMU_VRAMmarkWritten(const u32 adr)
+{
+	if((adr & 0xFF000000) == 0x06000000)
+		MMU.vramPageEpoch[(adr >> VRAM_EPOCH_PAGE_SHIFT) & (VRAM_EPOCH_PAGES - 1)] = MMU.vramEpoch;
+}
+
+//notes a write to a range of host memory inside ARM9_LCD, for writers which dont go through the MMU
+FORCEINLINE void MMU_VRAMmarkWritten(const void *ptr, const size_t len)
+{
+	const size_t ofs = (const u8 *)ptr - MMU.ARM9_LCD;
+	if(len == 0 || ofs >= sizeof(MMU.ARM9_LCD)) return;
+
+	const size_t last = std::min<size_t>(ofs + len, sizeof(MMU.ARM9_LCD)) - 1;
+	for(size_t page = ofs >> VRAM_EPOCH_PAGE_SHIFT; page <= (last >> VRAM_EPOCH_PAGE_SHIFT); page++)
+		MMU.vramPageEpoch[page] = MMU.vramEpoch;
+}
+
+//notes that all of vram may have changed (after a reset or a savestate load, for instance)
+FORCEINLINE void MMU_VRAMmarkAllWritten()
+{
+	for(size_t page = 0; page < VRAM_EPOCH_PAGES; page++)
+		MMU.vramPageEpoch[page] = MMU.vramEpoch;
+}
+
+//returns true if any page of ARM9_LCD covered by the given range was written at or after the given epoch
+FORCEINLINE bool MMU_VRAMwrittenSince(const void *ptr, const size_t len, const u32 epoch)
+{
+	const size_t ofs = (const u8 *)ptr - MMU.ARM9_LCD;
+	if(len == 0) return false;
+	if(ofs >= sizeof(MMU.ARM9_LCD)) return true;
+
+	const size_t last = std::min<size_t>(ofs + len, sizeof(MMU.ARM9_LCD)) - 1;
+	for(size_t page = ofs >> VRAM_EPOCH_PAGE_SHIFT; page <= (last >> VRAM_EPOCH_PAGE_SHIFT); page++)
+	{
+		if((s32)(MMU.vramPageEpoch[page] - epoch) >= 0) return true;
+	}
+	return false;
+}
+
 
 template<int PROCNUM, MMU_ACCESS_TYPE AT> u8 _MMU_read08(u32 addr);
 template<int PROCNUM, MMU_ACCESS_TYPE AT> u16 _MMU_read16(u32 addr);
@@ -656,6 +714,19 @@ extern u32 partie;
 extern u32 _MMU_MAIN_MEM_MASK;
 extern u32 _MMU_MAIN_MEM_MASK16;
 extern u32 _MMU_MAIN_MEM_MASK32;
+
+//notes a write to main memory for the delta savestates
+FORCEINLINE void MMU_mainMemMarkDirty(const u32 addr)
+{
+	MMU.mainMemDirtyPage[(addr & _MMU_MAIN_MEM_MASK) >> MAIN_MEM_DIRTY_PAGE_SHIFT] = 1;
+}
+
+//same as above, for the tails of the _MMU_ARMx_write* routines which see all kinds of addresses
+FORCEINLINE void MMU_mainMemMarkWritten(const u32 adr)
+{
+	if((adr & 0x0F000000) == 0x02000000)
+		MMU_mainMemMarkDirty(adr);
+}
 void SetupMMU(bool debugConsole, bool dsi);
 
 FORCEINLINE void CheckMemoryDebugEvent(EDEBUG_EVENT event, const MMU_ACCESS_TYPE type, const u32 procnum, const u32 addr, const u32 size, const u32 val)
@@ -675,12 +746,103 @@ FORCEINLINE void CheckMemoryDebugEvent(EDEBUG_EVENT event, const MMU_ACCESS_TYPE
 }
 
 
+//with the arm7 on its own thread (CommonSettings.threaded_arm7), the registers and memory both cpus can reach
+//are only touched by whichever cpu is behind in emulated time. main memory is deliberately left out:
+//it is reached through too many fast paths, and software already has to treat it as racy between the cpus.
+FORCEINLINE bool MMU_isSharedAccess(const u32 addr)
+{
+	switch(addr >> 24)
+	{
+		case 0x03:
+			return addr < 0x03800000; //shared wram (and whatever wramcnt mirrors there)
+		case 0x04:
+			if(addr >= 0x040000B0 && addr < 0x04000110) return true; //dma, timers: rescheduling them touches both cpus' events
+			if(addr >= 0x04000180 && addr < 0x040001C0) return true; //ipc, gamecard
+			if(addr >= 0x04000204 && addr < 0x04000218) return true; //exmemcnt, ime, ie, if
+			if(addr >= 0x04000240 && addr < 0x04000250) return true; //vramcnt, wramcnt
+			if(addr >= 0x04100000 && addr < 0x04100014) return true; //ipc fifo, gamecard data
+			return false;
+		default:
+			return false;
+	}
+}
+
+FORCEINLINE void MMU_syncShared(const int PROCNUM, const MMU_ACCESS_TYPE AT, const u32 addr)
+{
+	if(nds_threadedSlice && AT != MMU_AT_DEBUG && MMU_isSharedAccess(addr))
+		NDS_SyncSharedAccess(PROCNUM);
+}
+
+//the inline accessors below first look the address up in a per-cpu table of 4KB pages.
+//an entry points at the host memory backing that page, or is NULL when accesses to it must take the full path:
+//io, the protected arm7 bios, unmapped vram, wram shared with a threaded arm7, and pages with a watchpoint or lua hook.
+//only dtcm gets write entries; writes to main memory, wram and vram carry jit and dirty-page bookkeeping.
+#define MMU_PAGE_SHIFT 12
+#define MMU_PAGE_SIZE (1<<MMU_PAGE_SHIFT)
+#define MMU_PAGE_MASK (MMU_PAGE_SIZE-1)
+#define MMU_PAGE_COUNT (0x10000000>>MMU_PAGE_SHIFT)
+
+struct MMU_PageTable
+{
+	u8 *read[MMU_PAGE_COUNT];
+	u8 *code[MMU_PAGE_COUNT]; //arm9 instruction fetches don't see the dtcm
+	u8 *write[MMU_PAGE_COUNT];
+};
+
+extern MMU_PageTable MMU_pages[2];
+
+//rebuilds both cpus' tables entirely. needed after a reset, a savestate load, or a watchpoint or lua hook change
+void MMU_RebuildPageTables();
+//rebuilds the pages covering [start,end) of both cpus' tables, after that range got remapped
+void MMU_RebuildPages(u32 start, u32 end);
+//moves the arm9 dtcm, updating the pages it leaves and the pages it now covers
+void MMU_SetDTCMRegion(u32 region);
+//drops (or restores) the shared wram pages when the arm7 starts (or stops) running on its own thread
+void MMU_SetPageTablesThreaded(bool threaded);
+
+//one bit per 4KB of MMU_struct that the predecoding interpreter has cached code from (see armcpu_exec_predecoded).
+//blocks are found through the code pages above, so every memory they can come from lives in MMU.
+#define MMU_CODE_PAGES ((sizeof(MMU_struct) + MMU_PAGE_MASK) >> MMU_PAGE_SHIFT)
+extern u32 armcpu_predecode_pages[(MMU_CODE_PAGES + 31) / 32];
+void armcpu_predecode_invalidate(u32 ofs, u32 bytes);
+
+//notes a write of bytes bytes to host memory which may hold predecoded code
+FORCEINLINE void MMU_codeMarkDirty(const u8 *host, const u32 bytes)
+{
+	const size_t ofs = host - (const u8*)&MMU;
+	if(ofs < sizeof(MMU_struct) && (armcpu_predecode_pages[ofs >> (MMU_PAGE_SHIFT+5)] & (1 << ((ofs >> MMU_PAGE_SHIFT) & 31))))
+		armcpu_predecode_invalidate((u32)ofs, bytes);
+}
+
+FORCEINLINE u8* MMU_readPage(const int PROCNUM, const MMU_ACCESS_TYPE AT, const u32 addr)
+{
+	//dma and debug reads have their own rules for the tcms and the arm7 bios
+	if(AT == MMU_AT_DMA || AT == MMU_AT_DEBUG) return NULL;
+	if(addr >= 0x10000000) return NULL;
+	if(CheckDebugEvent(DEBUG_EVENT_READ)) return NULL;
+	if(AT == MMU_AT_CODE) return MMU_pages[PROCNUM].code[addr >> MMU_PAGE_SHIFT];
+	return MMU_pages[PROCNUM].read[addr >> MMU_PAGE_SHIFT];
+}
+
+FORCEINLINE u8* MMU_writePage(const int PROCNUM, const MMU_ACCESS_TYPE AT, const u32 addr)
+{
+	//the arm7 has no plain writable pages
+	if(PROCNUM != ARMCPU_ARM9) return NULL;
+	if(AT == MMU_AT_DMA || AT == MMU_AT_DEBUG) return NULL;
+	if(addr >= 0x10000000) return NULL;
+	if(CheckDebugEvent(DEBUG_EVENT_WRITE)) return NULL;
+	return MMU_pages[PROCNUM].write[addr >> MMU_PAGE_SHIFT];
+}
+
 //ALERT!!!!!!!!!!!!!!
 //the following inline functions dont do the 0x0FFFFFFF mask.
 //this may result in some unexpected behavior
 
 FORCEINLINE u8 _MMU_read08(const int PROCNUM, const MMU_ACCESS_TYPE AT, const u32 addr)
 {
+	u8 *page = MMU_readPage(PROCNUM,AT,addr);
+	if(page) return T1ReadByte(page, addr & MMU_PAGE_MASK);
+
 	CheckMemoryDebugEvent(DEBUG_EVENT_READ,AT,PROCNUM,addr,8,0);
 
 	//special handling to un-protect the ARM7 bios during debug reading
@@ -720,12 +882,16 @@ FORCEINLINE u8 _MMU_read08(const int PROCNUM, const MMU_ACCESS_TYPE AT, const u3
 	if ( (addr & 0x0F000000) == 0x02000000)
 		return T1ReadByte( MMU.MAIN_MEM, addr & _MMU_MAIN_MEM_MASK);
 
+	MMU_syncShared(PROCNUM,AT,addr);
 	if(PROCNUM==ARMCPU_ARM9) return _MMU_ARM9_read08(addr);
 	else return _MMU_ARM7_read08(addr);
 }
 
 FORCEINLINE u16 _MMU_read16(const int PROCNUM, const MMU_ACCESS_TYPE AT, const u32 addr) 
 {
+	u8 *page = MMU_readPage(PROCNUM,AT,addr);
+	if(page) return T1ReadWord_guaranteedAligned(page, addr & (MMU_PAGE_MASK & ~1));
+
 	CheckMemoryDebugEvent(DEBUG_EVENT_READ,AT,PROCNUM,addr,16,0);
 
 	//special handling to un-protect the ARM7 bios during debug reading
@@ -778,12 +944,16 @@ FORCEINLINE u16 _MMU_read16(const int PROCNUM, const MMU_ACCESS_TYPE AT, const u
 		return T1ReadWord_guaranteedAligned( MMU.MAIN_MEM, addr & _MMU_MAIN_MEM_MASK16);
 
 dunno:
+	MMU_syncShared(PROCNUM,AT,addr);
 	if(PROCNUM==ARMCPU_ARM9) return _MMU_ARM9_read16(addr);
 	else return _MMU_ARM7_read16(addr);
 }
 
 FORCEINLINE u32 _MMU_read32(const int PROCNUM, const MMU_ACCESS_TYPE AT, const u32 addr)
 {
+	u8 *page = MMU_readPage(PROCNUM,AT,addr);
+	if(page) return T1ReadLong_guaranteedAligned(page, addr & (MMU_PAGE_MASK & ~3));
+
 	CheckMemoryDebugEvent(DEBUG_EVENT_READ,AT,PROCNUM,addr,32,0);
 
 	//special handling to un-protect the ARM7 bios during debug reading
@@ -852,12 +1022,20 @@ FORCEINLINE u32 _MMU_read32(const int PROCNUM, const MMU_ACCESS_TYPE AT, const u
 	}
 
 dunno:
+	MMU_syncShared(PROCNUM,AT,addr);
 	if(PROCNUM==ARMCPU_ARM9) return _MMU_ARM9_read32(addr);
 	else return _MMU_ARM7_read32(addr);
 }
 
 FORCEINLINE void _MMU_write08(const int PROCNUM, const MMU_ACCESS_TYPE AT, const u32 addr, u8 val)
 {
+	u8 *page = MMU_writePage(PROCNUM,AT,addr);
+	if(page)
+	{
+		T1WriteByte(page, addr & MMU_PAGE_MASK, val);
+		return;
+	}
+
 	CheckMemoryDebugEvent(DEBUG_EVENT_WRITE,AT,PROCNUM,addr,8,val);
 
 	//special handling for DMA: discard writes to TCM
@@ -889,15 +1067,18 @@ FORCEINLINE void _MMU_write08(const int PROCNUM, const MMU_ACCESS_TYPE AT, const
 
 	if ( (addr & 0x0F000000) == 0x02000000) {
 #ifdef HAVE_JIT
-		JIT_COMPILED_FUNC_KNOWNBANK(addr, MAIN_MEM, _MMU_MAIN_MEM_MASK, 0) = 0;
+		JIT_INVALIDATE_KNOWNBANK(addr, MAIN_MEM, _MMU_MAIN_MEM_MASK, 1);
 #endif
 		T1WriteByte( MMU.MAIN_MEM, addr & _MMU_MAIN_MEM_MASK, val);
+		MMU_mainMemMarkDirty(addr);
+		MMU_codeMarkDirty(MMU.MAIN_MEM + (addr & _MMU_MAIN_MEM_MASK), 1);
 #ifdef HAVE_LUA
 		CallRegisteredLuaMemHook(addr, 1, val, LUAMEMHOOK_WRITE);
 #endif
 		return;
 	}
 
+	MMU_syncShared(PROCNUM,AT,addr);
 	if(PROCNUM==ARMCPU_ARM9) _MMU_ARM9_write08(addr,val);
 	else _MMU_ARM7_write08(addr,val);
 #ifdef HAVE_LUA
@@ -907,6 +1088,13 @@ FORCEINLINE void _MMU_write08(const int PROCNUM, const MMU_ACCESS_TYPE AT, const
 
 FORCEINLINE void _MMU_write16(const int PROCNUM, const MMU_ACCESS_TYPE AT, const u32 addr, u16 val)
 {
+	u8 *page = MMU_writePage(PROCNUM,AT,addr);
+	if(page)
+	{
+		T1WriteWord(page, addr & (MMU_PAGE_MASK & ~1), val);
+		return;
+	}
+
 	CheckMemoryDebugEvent(DEBUG_EVENT_WRITE,AT,PROCNUM,addr,16,val);
 
 	//special handling for DMA: discard writes to TCM
@@ -938,15 +1126,18 @@ FORCEINLINE void _MMU_write16(const int PROCNUM, const MMU_ACCESS_TYPE AT, const
 
 	if ( (addr & 0x0F000000) == 0x02000000) {
 #ifdef HAVE_JIT
-		JIT_COMPILED_FUNC_KNOWNBANK(addr, MAIN_MEM, _MMU_MAIN_MEM_MASK16, 0) = 0;
+		JIT_INVALIDATE_KNOWNBANK(addr, MAIN_MEM, _MMU_MAIN_MEM_MASK16, 1);
 #endif
 		T1WriteWord( MMU.MAIN_MEM, addr & _MMU_MAIN_MEM_MASK16, val);
+		MMU_mainMemMarkDirty(addr);
+		MMU_codeMarkDirty(MMU.MAIN_MEM + (addr & _MMU_MAIN_MEM_MASK16), 2);
 #ifdef HAVE_LUA
 		CallRegisteredLuaMemHook(addr, 2, val, LUAMEMHOOK_WRITE);
 #endif
 		return;
 	}
 
+	MMU_syncShared(PROCNUM,AT,addr);
 	if(PROCNUM==ARMCPU_ARM9) _MMU_ARM9_write16(addr,val);
 	else _MMU_ARM7_write16(addr,val);
 #ifdef HAVE_LUA
@@ -956,6 +1147,13 @@ FORCEINLINE void _MMU_write16(const int PROCNUM, const MMU_ACCESS_TYPE AT, const
 
 FORCEINLINE void _MMU_write32(const int PROCNUM, const MMU_ACCESS_TYPE AT, const u32 addr, u32 val)
 {
+	u8 *page = MMU_writePage(PROCNUM,AT,addr);
+	if(page)
+	{
+		T1WriteLong(page, addr & (MMU_PAGE_MASK & ~3), val);
+		return;
+	}
+
 	CheckMemoryDebugEvent(DEBUG_EVENT_WRITE,AT,PROCNUM,addr,32,val);
 
 	//special handling for DMA: discard writes to TCM
@@ -987,16 +1185,18 @@ FORCEINLINE void _MMU_write32(const int PROCNUM, const MMU_ACCESS_TYPE AT, const
 
 	if ( (addr & 0x0F000000) == 0x02000000) {
 #ifdef HAVE_JIT
-		JIT_COMPILED_FUNC_KNOWNBANK(addr, MAIN_MEM, _MMU_MAIN_MEM_MASK32, 0) = 0;
-		JIT_COMPILED_FUNC_KNOWNBANK(addr, MAIN_MEM, _MMU_MAIN_MEM_MASK32, 1) = 0;
+		JIT_INVALIDATE_KNOWNBANK(addr, MAIN_MEM, _MMU_MAIN_MEM_MASK32, 2);
 #endif
 		T1WriteLong( MMU.MAIN_MEM, addr & _MMU_MAIN_MEM_MASK32, val);
+		MMU_mainMemMarkDirty(addr);
+		MMU_codeMarkDirty(MMU.MAIN_MEM + (addr & _MMU_MAIN_MEM_MASK32), 4);
 #ifdef HAVE_LUA
 		CallRegisteredLuaMemHook(addr, 4, val, LUAMEMHOOK_WRITE);
 #endif
 		return;
 	}
 
+	MMU_syncShared(PROCNUM,AT,addr);
 	if(PROCNUM==ARMCPU_ARM9) _MMU_ARM9_write32(addr,val);
 	else _MMU_ARM7_write32(addr,val);
 #ifdef HAVE_LUA
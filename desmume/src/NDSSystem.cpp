@@ -20,6 +20,9 @@
 #include <string.h>
 #include <stdlib.h>
 #include <algorithm>
+#include <atomic>
+#include <thread>
+#include <limits.h>
 #include <math.h>
 
 #include <features/features_cpu.h>
@@ -93,6 +96,8 @@ static NDSError _lastNDSError;
 
 GameInfo gameInfo;
 NDSSystem nds;
+NDS_PROFILE nds_profile;
+thread_local NDS_ProfileScope *NDS_ProfileScope::_current = NULL;
 CFIRMWARE *extFirmwareObj = NULL;
 
 std::vector<int> memReadBreakPoints;
@@ -199,6 +204,8 @@ int NDS_Init()
 	return 0;
 }
 
+static void armThreadClose();
+
 void NDS_DeInit(void)
 {
 	gameInfo.closeROM();
@@ -222,6 +229,8 @@ void NDS_DeInit(void)
 	arm_jit_close();
 #endif
 
+	armThreadClose();
+
 #ifdef LOG_ARM7
 	if (fp_dis7 != NULL) 
 	{
@@ -418,7 +427,14 @@ bool GameInfo::loadROM(std::string fname, u32 type)
 	char *noext = strdup(fname.c_str());
 	reader = ROMReaderInit(&noext); free(noext);
 	fROM = reader->Init(fname.c_str());
-	if (!fROM) return false;
+	//not every file can be mapped or indexed; stream those through the plain readers instead
+	while (!fROM)
+	{
+		ROMReader_struct *fallback = ROMReaderFallback(reader, fname.c_str());
+		if (!fallback) return false;
+		reader = fallback;
+		fROM = reader->Init(fname.c_str());
+	}
 
 	headerOffset = (type == ROM_DSGBA)?DSGBA_LOADER_SIZE:0;
 	romsize = reader->Size(fROM) - headerOffset;
@@ -519,8 +535,9 @@ bool GameInfo::loadROM(std::string fname, u32 type)
 			reader->Read(fROM, &secureArea[0], 0x4000);
 		}
 
+		//a reader which already holds the image (a mapped file) reads at memory speed without a private copy
+		bool loadToMemory = CommonSettings.loadToMemory && (reader->Data == NULL);
 		//for now, we have to do this, because the DLDI patching requires it
-		bool loadToMemory = CommonSettings.loadToMemory;
 		if(isHomebrew())
 			loadToMemory = true;
 
@@ -572,6 +589,9 @@ bool GameInfo::loadROM(std::string fname, u32 type)
 				banner.palette[i] = LE_TO_LOCAL_16(banner.palette[i]);
 			}
 		}
+		romImage = (reader->Data != NULL) ? reader->Data(fROM) : NULL;
+		romImageSize = (romImage != NULL) ? reader->Size(fROM) : 0;
+
 		reader->Seek(fROM, headerOffset, SEEK_SET);
 		return true;
 	}
@@ -598,6 +618,8 @@ void GameInfo::closeROM()
 	fROM = NULL;
 	reader = NULL;
 	romdataForReader = NULL;
+	romImage = NULL;
+	romImageSize = 0;
 	romsize = 0;
 }
 
@@ -606,6 +628,12 @@ u32 GameInfo::readROM(u32 pos)
 	u32 num;
 	u32 data;
 
+	if (romImage != NULL && pos < romImageSize && romImageSize - pos >= 4)
+	{
+		memcpy(&data, romImage + pos, 4);
+		return LE_TO_LOCAL_32(data);
+	}
+
 	//reader must try to be efficient and not do unneeded seeks
 	reader->Seek(fROM, pos, SEEK_SET);
 	num = reader->Read(fROM, &data, 4);
@@ -931,6 +959,8 @@ u64 nds_timer;
 u64 nds_arm9_timer, nds_arm7_timer;
 
 static const u64 kNever = 0xFFFFFFFFFFFFFFFFULL;
+static const u32 kAllEvents = (1<<NDS_EVENT_COUNT)-1;
+#define EVENT_BIT(X) (1<<(X))
 
 struct TSequenceItem
 {
@@ -1196,10 +1226,97 @@ struct TSequenceItem_sqrtunit : public TSequenceItem
 
 };
 
+//binary min-heap over all the sequencer events, keyed by the time each one is next due (kNever when idle).
+//every event always has a slot, so cancelling one is just re-keying it to kNever.
+struct SequencerQueue
+{
+	u64 key[NDS_EVENT_COUNT];
+	u8 heap[NDS_EVENT_COUNT]; //event ids in heap order
+	u8 pos[NDS_EVENT_COUNT]; //where each event currently sits in the heap
+
+	void init()
+	{
+		for(int i=0;i<NDS_EVENT_COUNT;i++)
+		{
+			key[i] = kNever;
+			heap[i] = pos[i] = i;
+		}
+	}
+
+	FORCEINLINE u64 top() const { return key[heap[0]]; }
+
+	void update(int id, u64 when)
+	{
+		const u64 old = key[id];
+		key[id] = when;
+		if(when < old) siftUp(pos[id]);
+		else if(when > old) siftDown(pos[id]);
+	}
+
+	//collects every event due at or before now, visiting only the due part of the heap
+	u32 due(u64 now) const
+	{
+		u32 mask = 0;
+		u8 stack[NDS_EVENT_COUNT];
+		int sp = 0;
+		if(key[heap[0]] <= now) stack[sp++] = 0;
+		while(sp)
+		{
+			const int i = stack[--sp];
+			mask |= 1<<heap[i];
+			for(int c=i*2+1;c<=i*2+2 && c<NDS_EVENT_COUNT;c++)
+				if(key[heap[c]] <= now) stack[sp++] = c;
+		}
+		return mask;
+	}
+
+private:
+	FORCEINLINE void place(int i, int id)
+	{
+		heap[i] = id;
+		pos[id] = i;
+	}
+
+	void siftUp(int i)
+	{
+		const int id = heap[i];
+		while(i > 0)
+		{
+			const int parent = (i-1)>>1;
+			if(key[heap[parent]] <= key[id]) break;
+			place(i, heap[parent]);
+			i = parent;
+		}
+		place(i, id);
+	}
+
+	void siftDown(int i)
+	{
+		const int id = heap[i];
+		for(;;)
+		{
+			int child = i*2+1;
+			if(child >= NDS_EVENT_COUNT) break;
+			if(child+1 < NDS_EVENT_COUNT && key[heap[child+1]] < key[heap[child]]) child++;
+			if(key[id] <= key[heap[child]]) break;
+			place(i, heap[child]);
+			i = child;
+		}
+		place(i, id);
+	}
+};
+
 struct Sequencer
 {
 	bool nds_vblankEnded;
 	bool reschedule;
+
+	//events whose timestamp may have moved since the queue last saw them. they can be marked from the
+	//arm7 thread, and are re-keyed lazily the next time the queue is consulted, so an event which is
+	//moved several times in one slice costs a single heap update, and nothing costs anything when idle.
+	std::atomic<u32> dirty;
+	SequencerQueue queue;
+
 	TSequenceItem dispcnt;
 	TSequenceItem wifi;
 	TSequenceItem_divider divider;
@@ -1215,11 +1332,31 @@ struct Sequencer
 	TSequenceItem_Timer<1,0> timer_1_0; TSequenceItem_Timer<1,1> timer_1_1;
 	TSequenceItem_Timer<1,2> timer_1_2; TSequenceItem_Timer<1,3> timer_1_3;
 
+	Sequencer() : dirty(0) { queue.init(); }
+
 	void init();
 
 	void execHardware();
 	u64 findNext();
 
+	FORCEINLINE void markDirty(u32 mask)
+	{
+		//the release publishes the event's new timestamp to the acquire in refreshDirty. it has to happen even
+		//when the bit is already set, or a timestamp written after the last mark could be missed
+		dirty.fetch_or(mask, std::memory_order_release);
+	}
+
+	FORCEINLINE void refresh()
+	{
+		if(dirty.load(std::memory_order_relaxed) != 0)
+			refreshDirty();
+	}
+
+	void refreshDirty();
+	u64 when(int id);
+	bool exec(int id);
+	void execDispcnt();
+
 	void save(EMUFILE &os)
 	{
 		os.write_64LE(nds_timer);
@@ -1257,6 +1394,7 @@ struct Sequencer
 		LOAD(dma,1,0); LOAD(dma,1,1); LOAD(dma,1,2); LOAD(dma,1,3); 
 #undef LOAD
 
+		markDirty(kAllEvents);
 		return true;
 	}
 
@@ -1269,6 +1407,7 @@ void NDS_RescheduleGXFIFO(u32 cost)
 		sequencer.gxfifo.enabled = true;
 	}
 	MMU.gfx3dCycles += cost;
+	sequencer.markDirty(EVENT_BIT(NDS_EVENT_GXFIFO));
 	NDS_Reschedule();
 }
 
@@ -1279,6 +1418,7 @@ void NDS_RescheduleTimers()
 	check(1,0); check(1,1); check(1,2); check(1,3);
 #undef check
 
+	sequencer.markDirty(EVENT_BIT(NDS_EVENT_TIMER9_0)*0xFF);
 	NDS_Reschedule();
 }
 
@@ -1299,17 +1439,29 @@ void NDS_RescheduleReadSlot1(int procnum, int size)
 	delay *= 2;
 
 	sequencer.readslot1.param = procnum;
-	sequencer.readslot1.timestamp = nds_timer + delay;
+	sequencer.readslot1.timestamp = NDS_GetTimer(procnum) + delay;
 	sequencer.readslot1.enabled = true;
 
+	sequencer.markDirty(EVENT_BIT(NDS_EVENT_READSLOT1));
+	NDS_Reschedule();
+}
+
+void NDS_RescheduleDMA(int procnum, int chan)
+{
+	sequencer.markDirty(EVENT_BIT(NDS_EVENT_DMA9_0 + procnum*4 + chan));
 	NDS_Reschedule();
 }
 
-void NDS_RescheduleDMA()
+void NDS_RescheduleDivider()
 {
-	//TBD
+	sequencer.markDirty(EVENT_BIT(NDS_EVENT_DIVIDER));
 	NDS_Reschedule();
+}
 
+void NDS_RescheduleSqrt()
+{
+	sequencer.markDirty(EVENT_BIT(NDS_EVENT_SQRT));
+	NDS_Reschedule();
 }
 
 static void initSchedule()
@@ -1335,7 +1487,6 @@ const u64 kWifiCycles = 67;//34*2;
 void Sequencer::init()
 {
 	NDS_RescheduleTimers();
-	NDS_RescheduleDMA();
 
 	reschedule = false;
 	nds_timer = 0;
@@ -1366,6 +1517,9 @@ void Sequencer::init()
 	{
 		wifi.enabled = false;
 	}
+
+	queue.init();
+	markDirty(kAllEvents);
 }
 
 static void execHardware_hblank()
@@ -1559,7 +1713,9 @@ static void execHardware_hstart()
 	//this should be 214, but we are going to be generous for games with tight timing
 	//they shouldnt be changing any textures at 262 but they might accidentally still be at 214
 	//so..
-	if ( (CommonSettings.rigorous_timing && nds.VCount == 214) || (!CommonSettings.rigorous_timing && nds.VCount == 262) )
+	//pipelined 3d starts at 214 as well, since that is what leaves it emulated cpu time to overlap with.
+	const bool early3DStart = CommonSettings.rigorous_timing || CommonSettings.GFX3D_Renderer_Pipelined;
+	if ( (early3DStart && nds.VCount == 214) || (!early3DStart && nds.VCount == 262) )
 	{
 		gfx3d_VBlankEndSignal(frameSkipper.ShouldSkip3D());
 	}
@@ -1656,119 +1812,131 @@ FORCEINLINE u32 _fast_min32(u32 a, u32 b, u32 c, u32 d)
 	return ((( ((s32)(a-b)) >> (32-1)) & (c^d)) ^ d);
 }
 
-FORCEINLINE u64 _fast_min(u64 a, u64 b)
+u64 Sequencer::when(int id)
 {
-	//you might find that this is faster on a 64bit system; someone should try it
-	//http://aggregate.org/MAGIC/#Integer%20Selection
-	//u64 ret = (((((s64)(a-b)) >> (64-1)) & (a^b)) ^ b);
-	//assert(ret==min(a,b));
-	//return ret;	
-	
-	//but this ends up being the fastest on 32bits
-	return a<b?a:b;
-
-	//just for the record, I tried to do the 64bit math on a 32bit proc
-	//using sse2 and it was really slow
-	//__m128i __a; __a.m128i_u64[0] = a;
-	//__m128i __b; __b.m128i_u64[0] = b;
-	//__m128i xorval = _mm_xor_si128(__a,__b);
-	//__m128i temp = _mm_sub_epi64(__a,__b);
-	//temp.m128i_i64[0] >>= 63; //no 64bit shra in sse2, what a disappointment
-	//temp = _mm_and_si128(temp,xorval);
-	//temp = _mm_xor_si128(temp,__b);
-	//return temp.m128i_u64[0];
-}
-
-
-
-u64 Sequencer::findNext()
-{
-	//this one is always enabled so dont bother to check it
-	u64 next = dispcnt.next();
-
-	if(divider.isEnabled()) next = _fast_min(next,divider.next());
-	if(sqrtunit.isEnabled()) next = _fast_min(next,sqrtunit.next());
-	if(gxfifo.enabled) next = _fast_min(next,gxfifo.next());
-	if(readslot1.isEnabled()) next = _fast_min(next,readslot1.next());
-	if (wifi.enabled) next = _fast_min(next,wifi.next());
-
-#define test(X,Y) if(dma_##X##_##Y .isEnabled()) next = _fast_min(next,dma_##X##_##Y .next());
+	switch(id)
+	{
+	case NDS_EVENT_DISPCNT: return dispcnt.next(); //always enabled
+	case NDS_EVENT_WIFI: return wifi.enabled ? wifi.next() : kNever;
+	case NDS_EVENT_DIVIDER: return divider.isEnabled() ? divider.next() : kNever;
+	case NDS_EVENT_SQRT: return sqrtunit.isEnabled() ? sqrtunit.next() : kNever;
+	case NDS_EVENT_GXFIFO: return gxfifo.next();
+	case NDS_EVENT_READSLOT1: return readslot1.isEnabled() ? readslot1.next() : kNever;
+#define test(X,Y) case NDS_EVENT_DMA9_0 + X*4 + Y: return dma_##X##_##Y .isEnabled() ? dma_##X##_##Y .next() : kNever;
 	test(0,0); test(0,1); test(0,2); test(0,3);
 	test(1,0); test(1,1); test(1,2); test(1,3);
 #undef test
-#define test(X,Y) if(timer_##X##_##Y .enabled) next = _fast_min(next,timer_##X##_##Y .next());
+#define test(X,Y) case NDS_EVENT_TIMER9_0 + X*4 + Y: return timer_##X##_##Y .enabled ? timer_##X##_##Y .next() : kNever;
 	test(0,0); test(0,1); test(0,2); test(0,3);
 	test(1,0); test(1,1); test(1,2); test(1,3);
 #undef test
+	}
+	return kNever;
+}
 
-	return next;
+void Sequencer::refreshDirty()
+{
+	u32 mask = dirty.exchange(0, std::memory_order_acquire);
+	for(int id=0;mask;id++,mask>>=1)
+		if(mask&1) queue.update(id, when(id));
 }
 
-void Sequencer::execHardware()
+u64 Sequencer::findNext()
 {
-	if(dispcnt.isTriggered())
-	{
+	refresh();
+	return queue.top();
+}
 
-		IF_DEVELOPER(DEBUG_statistics.sequencerExecutionCounters[1]++);
+void Sequencer::execDispcnt()
+{
+	IF_DEVELOPER(DEBUG_statistics.sequencerExecutionCounters[1]++);
 
-		switch(dispcnt.param)
-		{
-		case ESI_DISPCNT_HStart:
-			execHardware_hstart();
-			//(used to be 3168)
-			//hstart is actually 8 dots before the visible drawing begins
-			//we're going to run 1 here and then run 7 in the next case
-			dispcnt.timestamp += 1*6*2;
-			dispcnt.param = ESI_DISPCNT_HStartIRQ;
-			break;
-		case ESI_DISPCNT_HStartIRQ:
-			execHardware_hstart_irq();
-			dispcnt.timestamp += 7*6*2;
-			dispcnt.param = ESI_DISPCNT_HDraw;
-			break;
-			
-		case ESI_DISPCNT_HDraw:
-			execHardware_hdraw();
-			//duration of non-blanking period is ~1606 clocks (gbatek agrees) [but says its different on arm7]
-			//im gonna call this 267 dots = 267*6=1602
-			//so, this event lasts 267 dots minus the 8 dot preroll
-			dispcnt.timestamp += (267-8)*6*2;
-			dispcnt.param = ESI_DISPCNT_HBlank;
-			break;
+	switch(dispcnt.param)
+	{
+	case ESI_DISPCNT_HStart:
+		execHardware_hstart();
+		//(used to be 3168)
+		//hstart is actually 8 dots before the visible drawing begins
+		//we're going to run 1 here and then run 7 in the next case
+		dispcnt.timestamp += 1*6*2;
+		dispcnt.param = ESI_DISPCNT_HStartIRQ;
+		break;
+	case ESI_DISPCNT_HStartIRQ:
+		execHardware_hstart_irq();
+		dispcnt.timestamp += 7*6*2;
+		dispcnt.param = ESI_DISPCNT_HDraw;
+		break;
+		
+	case ESI_DISPCNT_HDraw:
+		execHardware_hdraw();
+		//duration of non-blanking period is ~1606 clocks (gbatek agrees) [but says its different on arm7]
+		//im gonna call this 267 dots = 267*6=1602
+		//so, this event lasts 267 dots minus the 8 dot preroll
+		dispcnt.timestamp += (267-8)*6*2;
+		dispcnt.param = ESI_DISPCNT_HBlank;
+		break;
 
-		case ESI_DISPCNT_HBlank:
-			execHardware_hblank();
-			//(once this was 1092 or 1092/12=91 dots.)
-			//there are surely 355 dots per scanline, less 267 for non-blanking period. the rest is hblank and then after that is hstart
-			dispcnt.timestamp += (355-267)*6*2;
-			dispcnt.param = ESI_DISPCNT_HStart;
-			break;
-		}
+	case ESI_DISPCNT_HBlank:
+		execHardware_hblank();
+		//(once this was 1092 or 1092/12=91 dots.)
+		//there are surely 355 dots per scanline, less 267 for non-blanking period. the rest is hblank and then after that is hstart
+		dispcnt.timestamp += (355-267)*6*2;
+		dispcnt.param = ESI_DISPCNT_HStart;
+		break;
 	}
+}
 
-	if (wifiHandler->GetCurrentEmulationLevel() != WifiEmulationLevel_Off)
+//runs one due event, if it is still due; returns whether it ran
+bool Sequencer::exec(int id)
+{
+	switch(id)
 	{
-		if (wifi.isTriggered())
-		{
-			wifiHandler->CommTrigger();
-			wifi.timestamp += kWifiCycles;
-		}
-	}
-	
-	if(divider.isTriggered()) divider.exec();
-	if(sqrtunit.isTriggered()) sqrtunit.exec();
-	if(gxfifo.isTriggered()) gxfifo.exec();
-	if(readslot1.isTriggered()) readslot1.exec();
-
-
-#define test(X,Y) if(dma_##X##_##Y .isTriggered()) dma_##X##_##Y .exec();
+	case NDS_EVENT_DISPCNT:
+		if(!dispcnt.isTriggered()) return false;
+		execDispcnt();
+		return true;
+	case NDS_EVENT_WIFI:
+		if(wifiHandler->GetCurrentEmulationLevel() == WifiEmulationLevel_Off) return false;
+		if(!wifi.isTriggered()) return false;
+		wifiHandler->CommTrigger();
+		wifi.timestamp += kWifiCycles;
+		return true;
+#define test(ID,I) case ID: if(!I.isTriggered()) return false; I.exec(); return true;
+	test(NDS_EVENT_DIVIDER, divider);
+	test(NDS_EVENT_SQRT, sqrtunit);
+	test(NDS_EVENT_GXFIFO, gxfifo);
+	test(NDS_EVENT_READSLOT1, readslot1);
+#undef test
+#define test(X,Y) case NDS_EVENT_DMA9_0 + X*4 + Y: if(!dma_##X##_##Y .isTriggered()) return false; dma_##X##_##Y .exec(); return true;
 	test(0,0); test(0,1); test(0,2); test(0,3);
 	test(1,0); test(1,1); test(1,2); test(1,3);
 #undef test
-#define test(X,Y) if(timer_##X##_##Y .enabled) if(timer_##X##_##Y .isTriggered()) timer_##X##_##Y .exec();
+#define test(X,Y) case NDS_EVENT_TIMER9_0 + X*4 + Y: if(!timer_##X##_##Y .enabled || !timer_##X##_##Y .isTriggered()) return false; timer_##X##_##Y .exec(); return true;
 	test(0,0); test(0,1); test(0,2); test(0,3);
 	test(1,0); test(1,1); test(1,2); test(1,3);
 #undef test
+	}
+	return false;
+}
+
+void Sequencer::execHardware()
+{
+	refresh();
+	u32 due = queue.due(nds_timer);
+
+	//due events run in id order, same as the old fixed sequence of checks. an event can make another one due
+	//(hblank starting a dma, say); if that one comes later in the order, it still gets to run in this pass.
+	for(int id=0;id<NDS_EVENT_COUNT && due;id++)
+	{
+		if(!(due & EVENT_BIT(id))) continue;
+
+		if(exec(id))
+			nds_profile.events[id]++;
+
+		queue.update(id, when(id));
+		refresh();
+		due = queue.due(nds_timer) & ~((EVENT_BIT(id)<<1)-1);
+	}
 }
 
 void execHardware_interrupts();
@@ -1910,6 +2078,231 @@ static FORCEINLINE s32 minarmtime(s32 arm9, s32 arm7)
 		return arm7;
 }
 
+//threaded arm7: for each slice the arm7 runs armInnerLoop<false,true> on armThread while the arm9 runs
+//armInnerLoop<true,false> on the emulation thread, and they meet again before the sequencer runs.
+//each cpu publishes its clock after every step and waits while it is more than the skew budget ahead of the other one.
+//state both cpus can reach is only touched by the cpu that is behind (the arm9 wins ties; see NDS_SyncSharedAccess),
+//so ipc, irq and timer traffic still happens in emulated-time order. a cpu that is done publishes INT_MAX.
+//timers, dmas and card reads started during the slice are stamped with the starting cpu's own clock (NDS_GetTimer).
+volatile bool nds_threadedSlice = false;
+
+static struct ArmThread
+{
+	Task *task;
+	volatile bool quit;
+	std::atomic<u32> slice, done;
+	std::atomic<s32> clock[2];
+	s32 skew;
+
+	//handed over with each slice
+	u64 nds_timer_base;
+	s32 s32next;
+	s32 arm7;
+
+	//the arm7's nds_timer while it runs on its own thread; only that thread touches it
+	u64 arm7_timer;
+} armThread;
+
+u64 NDS_GetTimer(int procnum)
+{
+	return (procnum == ARMCPU_ARM7 && nds_threadedSlice) ? armThread.arm7_timer : nds_timer;
+}
+
+//a cpu's accesses during a threaded slice happen at its own clock
+template<int PROCNUM>
+static FORCEINLINE void armThreadedSetTimer(const u64 time)
+{
+	if(PROCNUM == ARMCPU_ARM9)
+		nds_timer = time;
+	else
+		armThread.arm7_timer = time;
+}
+
+//backoff for the spin-waits below: pause for a while (so a hyperthread sibling gets the core's resources),
+//then yield, so a waiting cpu does not hold the core the other one needs to catch up on a busy host
+class ArmSpin
+{
+	u32 spins;
+	bool timed;
+	std::chrono::steady_clock::time_point begin;
+public:
+	ArmSpin() : spins(0), timed(false) {}
+	~ArmSpin()
+	{
+		//time spent waiting for the other cpu is not charged to this one's profile section
+		if(timed)
+			NDS_ProfileScope::exclude((u64)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count());
+	}
+	FORCEINLINE void wait()
+	{
+		if(spins == 0 && nds_profile.enabled)
+		{
+			timed = true;
+			begin = std::chrono::steady_clock::now();
+		}
+		if(++spins < 64)
+		{
+#ifdef ENABLE_SSE2
+			_mm_pause();
+#endif
+		}
+		else
+			std::this_thread::yield();
+	}
+};
+
+template<int PROCNUM>
+static FORCEINLINE void armThreadedStep(const u64 nds_timer_base, const s32 clock)
+{
+	armThread.clock[PROCNUM].store(clock, std::memory_order_release);
+	ArmSpin spin;
+	while(clock - armThread.skew > armThread.clock[PROCNUM^1].load(std::memory_order_acquire))
+	{
+		if(sequencer.reschedule || !execute) break;
+		spin.wait();
+	}
+
+	armThreadedSetTimer<PROCNUM>(nds_timer_base + clock);
+}
+
+void NDS_SyncSharedAccess(int procnum)
+{
+	//clocks only ever grow, so a stale read can only make us wait longer, never let both cpus in.
+	//the acquire pairs with the other cpu's release in armThreadedStep, so its shared writes are visible once we pass.
+	//the wait ends at the latest when the other cpu is done with its slice (its clock is INT_MAX then),
+	//and a cpu parked in armThreadedStep is always ahead of us, so it is never the one we wait for
+	const s32 clock = armThread.clock[procnum].load(std::memory_order_relaxed);
+	ArmSpin spin;
+	if(procnum == ARMCPU_ARM9)
+		while(armThread.clock[ARMCPU_ARM7].load(std::memory_order_acquire) < clock
+			&& armThread.done.load(std::memory_order_acquire) != armThread.slice.load(std::memory_order_relaxed))
+			spin.wait();
+	else
+		while(armThread.clock[ARMCPU_ARM9].load(std::memory_order_acquire) <= clock)
+			spin.wait();
+
+	if(procnum == ARMCPU_ARM9)
+		armThreadedSetTimer<ARMCPU_ARM9>(armThread.nds_timer_base + clock);
+	else
+		armThreadedSetTimer<ARMCPU_ARM7>(armThread.nds_timer_base + clock);
+}
+
+//host time of every 64th step a cpu takes while profiling, to share out the time of a slice that ran both cpus
+class ArmProfileSample
+{
+	u32 steps;
+	bool timing;
+	std::chrono::steady_clock::time_point start;
+public:
+	u64 nanoseconds;
+
+	ArmProfileSample() : steps(0), timing(false), nanoseconds(0) {}
+	FORCEINLINE void begin()
+	{
+		timing = nds_profile.enabled && (steps++ & 63) == 0;
+		if(timing)
+			start = std::chrono::steady_clock::now();
+	}
+	FORCEINLINE void end()
+	{
+		if(timing)
+			nanoseconds += (u64)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+	}
+};
+
+//the cpu just branched back to the start of an idle loop (see armcpu_idleloop_check). nothing the loop reads can change
+//before limit (the next sequencer event, or the point where the other cpu gets to run again), so the clock jumps there
+//and the loop runs once more to see whether it may leave.
+template<int PROCNUM>
+static FORCEINLINE s32 armIdleLoopSkip(const u32 adr, const s32 clock, s32 limit)
+{
+	if(nds_threadedSlice)
+		limit = min(limit, armThread.clock[PROCNUM^1].load(std::memory_order_acquire));
+	if(limit <= clock)
+		return clock;
+	if(ARMPROC.debugStep || ARMPROC.stepOverBreak || ARMPROC.runToRetTmp || !ARMPROC.breakPoints.empty())
+		return clock;
+
+	armcpu_idleloop *loop = armcpu_idleloop_check<PROCNUM>(adr);
+	if(!loop)
+		return clock;
+
+	loop->skips++;
+	loop->cycles += limit - clock;
+	nds.idleCycles[PROCNUM] += limit - clock;
+	return limit;
+}
+
+template<int PROCNUM>
+static FORCEINLINE s32 armInterpExec(s32 clock, const s32 limit)
+{
+	const u32 adr = ARMPROC.instruct_adr;
+	clock += armcpu_exec<PROCNUM>() << PROCNUM; //arm7 cycles count double
+
+	//a short backward branch may have closed an idle loop
+	if(CommonSettings.idle_loop_skip && ARMPROC.instruct_adr < adr && adr - ARMPROC.instruct_adr < ARMCPU_IDLELOOP_MAX_BYTES)
+		clock = armIdleLoopSkip<PROCNUM>(ARMPROC.instruct_adr, clock, limit);
+	return clock;
+}
+
+//runs predecoded blocks (see armcpu_exec_predecoded) one after another for as long as armInnerLoop would have picked
+//this cpu again anyway, the same way armJitExec follows compiled blocks
+template<int PROCNUM>
+static FORCEINLINE s32 armPredecodedExec(const u64 nds_timer_base, s32 clock, const s32 limit)
+{
+	//anything the debugger wants to see between instructions runs them one at a time
+	if(ARMPROC.debugStep || ARMPROC.stepOverBreak || ARMPROC.runToRetTmp || !ARMPROC.breakPoints.empty())
+		return armInterpExec<PROCNUM>(clock, limit);
+
+	for(;;)
+	{
+		const u32 adr = ARMPROC.instruct_adr;
+		clock += armcpu_exec_predecoded<PROCNUM>() << PROCNUM;
+		//a block ends on its branch, which may have gone back to (or before) where the block started
+		if(CommonSettings.idle_loop_skip && ARMPROC.instruct_adr <= adr && adr - ARMPROC.instruct_adr < ARMCPU_IDLELOOP_MAX_BYTES)
+			clock = armIdleLoopSkip<PROCNUM>(ARMPROC.instruct_adr, clock, limit);
+		if(clock >= limit || sequencer.reschedule || !execute || ARMPROC.freeze || nds.freezeBus)
+			break;
+		nds_timer = nds_timer_base + clock;
+	}
+	return clock;
+}
+
+#ifdef HAVE_JIT
+//runs the compiled block at the cpu's PC, then keeps following the links blocks leave to their
+//statically known successors for as long as armInnerLoop would have picked this cpu again anyway
+//(its clock stays below limit). the cpu being run is always the one furthest behind, so nds_timer tracks it.
+template<int PROCNUM>
+static FORCEINLINE s32 armJitExec(const u64 nds_timer_base, s32 clock, const s32 limit)
+{
+	ARMPROC.instruct_adr &= ARMPROC.CPSR.bits.T?0xFFFFFFFE:0xFFFFFFFC;
+	ArmOpCompiled f = (ArmOpCompiled)JIT_COMPILED_FUNC(ARMPROC.instruct_adr, PROCNUM);
+	if(!f)
+		return clock + (arm_jit_compile<PROCNUM>() << PROCNUM);
+
+	//anything the debugger wants to see between blocks disables chaining
+	const bool chain = !ARMPROC.debugStep && !ARMPROC.stepOverBreak && !ARMPROC.runToRetTmp && ARMPROC.breakPoints.empty();
+	for(;;)
+	{
+		const u32 adr = ARMPROC.instruct_adr;
+		clock += f() << PROCNUM; //arm7 cycles count double
+		//a block which branched straight back to its own start may be an idle loop
+		if(CommonSettings.idle_loop_skip && ARMPROC.instruct_adr == adr)
+			clock = armIdleLoopSkip<PROCNUM>(adr, clock, limit);
+		if(!chain || clock >= limit || sequencer.reschedule || !execute || ARMPROC.freeze || nds.freezeBus)
+			break;
+		f = arm_jit_link<PROCNUM>(f);
+		if(!f)
+			break;
+		if(nds_threadedSlice)
+			armThreadedStep<PROCNUM>(nds_timer_base, clock);
+		else
+			nds_timer = nds_timer_base + clock;
+	}
+	return clock;
+}
+#endif
+
 #ifdef HAVE_JIT
 template<bool doarm9, bool doarm7, bool jit>
 #else
@@ -1918,6 +2311,11 @@ template<bool doarm9, bool doarm7>
 static /*donotinline*/ std::pair<s32,s32> armInnerLoop(
 	const u64 nds_timer_base, const s32 s32next, s32 arm9, s32 arm7)
 {
+	//timed per slice rather than per step, since timing a step can cost more than the step itself.
+	//when the slice runs both cpus, the time is shared out in proportion to a sample of their steps
+	NDS_ProfileScope profileScope(doarm9 ? NDS_PROFILE_ARM9 : NDS_PROFILE_ARM7);
+	ArmProfileSample sample9, sample7;
+
 	s32 timer = minarmtime<doarm9,doarm7>(arm9,arm7);
 	while(timer < s32next && !sequencer.reschedule && execute)
 	{
@@ -1953,11 +2351,18 @@ static /*donotinline*/ std::pair<s32,s32> armInnerLoop(
 			{
 				arm9log();
 				debug();
+				const s32 limit = doarm7 ? min(arm7+1, s32next) : s32next;
+				sample9.begin();
 #ifdef HAVE_JIT
-				arm9 += armcpu_exec<ARMCPU_ARM9,jit>();
-#else
-				arm9 += armcpu_exec<ARMCPU_ARM9>();
+				if(jit)
+					arm9 = armJitExec<ARMCPU_ARM9>(nds_timer_base, arm9, limit);
+				else
 #endif
+				if(CommonSettings.interp_predecode && !nds_threadedSlice)
+					arm9 = armPredecodedExec<ARMCPU_ARM9>(nds_timer_base, arm9, limit);
+				else
+					arm9 = armInterpExec<ARMCPU_ARM9>(arm9, limit);
+				sample9.end();
 				#ifdef DEVELOPER
 					nds_debug_continuing[0] = false;
 				#endif
@@ -1994,11 +2399,18 @@ static /*donotinline*/ std::pair<s32,s32> armInnerLoop(
 			if(!cpufreeze && !nds.freezeBus)
 			{
 				arm7log();
+				const s32 limit = doarm9 ? min(arm9, s32next) : s32next;
+				sample7.begin();
 #ifdef HAVE_JIT
-				arm7 += (armcpu_exec<ARMCPU_ARM7,jit>()<<1);
-#else
-				arm7 += (armcpu_exec<ARMCPU_ARM7>()<<1);
+				if(jit)
+					arm7 = armJitExec<ARMCPU_ARM7>(nds_timer_base, arm7, limit);
+				else
 #endif
+				if(CommonSettings.interp_predecode && !nds_threadedSlice)
+					arm7 = armPredecodedExec<ARMCPU_ARM7>(nds_timer_base, arm7, limit);
+				else
+					arm7 = armInterpExec<ARMCPU_ARM7>(arm7, limit);
+				sample7.end();
 				#ifdef DEVELOPER
 					nds_debug_continuing[1] = false;
 				#endif
@@ -2008,8 +2420,10 @@ static /*donotinline*/ std::pair<s32,s32> armInnerLoop(
 				s32 temp = arm7;
 				arm7 = min(s32next, arm7 + kIrqWait);
 				nds.idleCycles[1] += arm7-temp;
-				if(arm7 == s32next)
+				if(doarm9 && arm7 == s32next)
 				{
+					if(sample7.nanoseconds)
+						profileScope.split(sample9.nanoseconds, NDS_PROFILE_ARM7, sample7.nanoseconds);
 					nds_timer = nds_timer_base + minarmtime<doarm9,false>(arm9,arm7);
 #ifdef HAVE_JIT
 					return armInnerLoop<doarm9,false,jit>(nds_timer_base, s32next, arm9, arm7);
@@ -2038,12 +2452,104 @@ static /*donotinline*/ std::pair<s32,s32> armInnerLoop(
 		}
 
 		timer = minarmtime<doarm9,doarm7>(arm9,arm7);
-		nds_timer = nds_timer_base + timer;
+		if(nds_threadedSlice)
+			armThreadedStep<doarm9 ? ARMCPU_ARM9 : ARMCPU_ARM7>(nds_timer_base, timer);
+		else
+			nds_timer = nds_timer_base + timer;
 	}
 
+	if(doarm9 && doarm7 && sample7.nanoseconds)
+		profileScope.split(sample9.nanoseconds, NDS_PROFILE_ARM7, sample7.nanoseconds);
 	return std::make_pair(arm9, arm7);
 }
 
+static void* armThreadProc(void*)
+{
+	for(;;)
+	{
+		//spin for the next slice; there is only a little sequencer work between them
+		ArmSpin spin;
+		while(armThread.slice.load(std::memory_order_acquire) == armThread.done.load(std::memory_order_relaxed))
+		{
+			if(armThread.quit) return NULL;
+			spin.wait();
+		}
+
+		armThread.arm7_timer = armThread.nds_timer_base + armThread.arm7;
+#ifdef HAVE_JIT
+		armThread.arm7 = armInnerLoop<false,true,false>(armThread.nds_timer_base, armThread.s32next, 0, armThread.arm7).second;
+#else
+		armThread.arm7 = armInnerLoop<false,true>(armThread.nds_timer_base, armThread.s32next, 0, armThread.arm7).second;
+#endif
+		armThread.clock[ARMCPU_ARM7].store(INT_MAX, std::memory_order_release);
+		armThread.done.store(armThread.slice.load(std::memory_order_relaxed), std::memory_order_release);
+	}
+}
+
+static std::pair<s32,s32> armThreadedSlice(const u64 nds_timer_base, const s32 s32next, s32 arm9, s32 arm7)
+{
+	armThread.nds_timer_base = nds_timer_base;
+	armThread.s32next = s32next;
+	armThread.arm7 = arm7;
+	armThread.clock[ARMCPU_ARM9].store(arm9, std::memory_order_relaxed);
+	armThread.clock[ARMCPU_ARM7].store(arm7, std::memory_order_relaxed);
+	//both threads would invalidate predecoded blocks on their writes. there are none while either runs threaded
+	armcpu_predecode_reset();
+	nds_threadedSlice = true;
+	const u32 slice = armThread.slice.load(std::memory_order_relaxed) + 1;
+	armThread.slice.store(slice, std::memory_order_release);
+
+#ifdef HAVE_JIT
+	arm9 = CommonSettings.use_jit
+		? armInnerLoop<true,false,true>(nds_timer_base,s32next,arm9,arm7).first
+		: armInnerLoop<true,false,false>(nds_timer_base,s32next,arm9,arm7).first;
+#else
+	arm9 = armInnerLoop<true,false>(nds_timer_base,s32next,arm9,arm7).first;
+#endif
+	armThread.clock[ARMCPU_ARM9].store(INT_MAX, std::memory_order_release);
+	ArmSpin spin;
+	while(armThread.done.load(std::memory_order_acquire) != slice)
+		spin.wait();
+
+	nds_threadedSlice = false;
+	arm7 = armThread.arm7;
+	nds_timer = nds_timer_base + min(arm9,arm7);
+	return std::make_pair(arm9, arm7);
+}
+
+static bool armThreadBegin()
+{
+	if(!CommonSettings.threaded_arm7 || CommonSettings.single_core())
+		return false;
+
+	if(!armThread.task)
+	{
+		armThread.task = new Task();
+		armThread.task->start(false);
+	}
+#ifdef HAVE_JIT
+	//the arm7 is interpreted on its thread, and the interpreter needs its next instruction prefetched
+	if(CommonSettings.use_jit)
+		arm_jit_sync();
+#endif
+	armThread.skew = (s32)CommonSettings.threaded_arm7_skew;
+	armThread.quit = false;
+	armThread.task->execute(armThreadProc, NULL);
+	return true;
+}
+
+static void armThreadEnd()
+{
+	armThread.quit = true;
+	armThread.task->finish();
+}
+
+static void armThreadClose()
+{
+	delete armThread.task;
+	armThread.task = NULL;
+}
+
 void NDS_debug_break()
 {
 	NDS_ARM9.stalled = NDS_ARM7.stalled = 1;
@@ -2091,6 +2597,8 @@ void NDS_exec(s32 nb)
 	}
 	else
 	{
+		const bool threaded = armThreadBegin();
+		MMU_SetPageTablesThreaded(threaded);
 		for(;;)
 		{
 			//trap the debug-stalled condition
@@ -2151,12 +2659,16 @@ void NDS_exec(s32 nb)
 				}
 			#endif
 
+			std::pair<s32,s32> arm9arm7;
+			if(threaded)
+				arm9arm7 = armThreadedSlice(nds_timer_base,s32next,arm9,arm7);
+			else
 #ifdef HAVE_JIT
-			std::pair<s32,s32> arm9arm7 = CommonSettings.use_jit
-				? armInnerLoop<true,true,true>(nds_timer_base,s32next,arm9,arm7)
-				: armInnerLoop<true,true,false>(nds_timer_base,s32next,arm9,arm7);
+				arm9arm7 = CommonSettings.use_jit
+					? armInnerLoop<true,true,true>(nds_timer_base,s32next,arm9,arm7)
+					: armInnerLoop<true,true,false>(nds_timer_base,s32next,arm9,arm7);
 #else
-				std::pair<s32,s32> arm9arm7 = armInnerLoop<true,true>(nds_timer_base,s32next,arm9,arm7);
+				arm9arm7 = armInnerLoop<true,true>(nds_timer_base,s32next,arm9,arm7);
 #endif
 
 			#ifdef DEVELOPER
@@ -2190,6 +2702,8 @@ void NDS_exec(s32 nb)
 				nds_arm7_timer = nds_timer;
 			}
 		}
+		if(threaded)
+			armThreadEnd();
 	}
 
 	//DEBUG_statistics.printSequencerExecutionCounters();
@@ -2673,6 +3187,8 @@ void NDS_Reset()
 	nds.sleeping = FALSE;
 	nds.cardEjected = FALSE;
 	nds.freezeBus = 0;
+	armcpu_idleloop_reset();
+	armcpu_predecode_reset();
 	nds.power1.lcd = nds.power1.gpuMain = nds.power1.gfx3d_render = nds.power1.gfx3d_geometry = nds.power1.gpuSub = nds.power1.dispswap = 1; //is this proper?
 	nds.power_geometry = nds.power_render = TRUE; //whether this is proper follows from prior
 	nds.power2.speakers = 1;
@@ -3263,6 +3779,50 @@ bool ValidateSlot2Access(u32 procnum, u32 demandSRAMSpeed, u32 demand1stROMSpeed
 	return true;
 }
 
+void NDS_ProfileEnable(bool enable)
+{
+	nds_profile.enabled = enable;
+}
+
+void NDS_ProfileReset()
+{
+	memset(nds_profile.nanoseconds, 0, sizeof(nds_profile.nanoseconds));
+	memset(nds_profile.calls, 0, sizeof(nds_profile.calls));
+	memset(nds_profile.events, 0, sizeof(nds_profile.events));
+}
+
+const char* NDS_ProfileSectionName(NDS_PROFILE_SECTION section)
+{
+	static const char *names[NDS_PROFILE_SECTION_COUNT] = {
+		"arm9",
+		"arm7",
+		"gpu_render_line",
+		"gfx3d_execute3d",
+		"render3d",
+		"spu_emulate_core",
+	};
+
+	return (section < NDS_PROFILE_SECTION_COUNT) ? names[section] : "unknown";
+}
+
+const char* NDS_EventName(NDS_EVENT event)
+{
+	static const char *names[NDS_EVENT_COUNT] = {
+		"dispcnt",
+		"wifi",
+		"divider",
+		"sqrt",
+		"gxfifo",
+		"readslot1",
+		"dma9_0", "dma9_1", "dma9_2", "dma9_3",
+		"dma7_0", "dma7_1", "dma7_2", "dma7_3",
+		"timer9_0", "timer9_1", "timer9_2", "timer9_3",
+		"timer7_0", "timer7_1", "timer7_2", "timer7_3",
+	};
+
+	return (event < NDS_EVENT_COUNT) ? names[event] : "unknown";
+}
+
 void NDS_GetCPULoadAverage(u32 &outLoadAvgARM9, u32 &outLoadAvgARM7)
 {
 	//calculate a 16 frame arm9 load average
@@ -22,6 +22,7 @@
 #include <string.h>
 #include <string>
 #include <vector>
+#include <chrono>
 
 #include "types.h"
 #include "ROMReader.h"
@@ -63,6 +64,10 @@ extern buttonstruct<bool> AutoHold;
 extern volatile bool execute;
 extern BOOL click;
 
+//true while NDS_exec runs a slice with the arm7 on its own host thread (see CommonSettings.threaded_arm7)
+extern volatile bool nds_threadedSlice;
+void NDS_SyncSharedAccess(int procnum);
+
 /*
  * The firmware language values
  */
@@ -196,9 +201,14 @@ static void NDS_CurrentCPUInfoToNDSError(NDSError &ndsError);
 void emu_halt(EmuHaltReasonCode reasonCode, NDSErrorTag errorTag);
 
 extern u64 nds_timer;
+//the emulated time for an access by procnum. during a threaded slice each cpu is at its own clock,
+//and nds_timer is only the arm9's (the arm7 thread must not read it)
+u64 NDS_GetTimer(int procnum);
 void NDS_Reschedule();
 void NDS_RescheduleGXFIFO(u32 cost);
-void NDS_RescheduleDMA();
+void NDS_RescheduleDMA(int procnum, int chan);
+void NDS_RescheduleDivider();
+void NDS_RescheduleSqrt();
 void NDS_RescheduleReadSlot1(int procnum, int size);
 void NDS_RescheduleTimers();
 
@@ -335,6 +345,9 @@ struct GameInfo
 	void *fROM;
 	ROMReader_struct *reader;
 	u8 *romdataForReader;
+	//the whole rom when the reader holds it in memory (mapped or preloaded), so readROM can index it directly
+	const u8 *romImage;
+	u32 romImageSize;
 	u32 romsize;
 	u32 cardSize;
 	u32 mask;
@@ -354,6 +367,8 @@ struct GameInfo
 
 	GameInfo() :	fROM(NULL),
 					romdataForReader(NULL),
+					romImage(NULL),
+					romImageSize(0),
 					crc(0),
 					chipID(0x00000FC2),
 					romsize(0),
@@ -492,6 +507,128 @@ int NDS_GetCPUCoreCount();
 void NDS_GetCPULoadAverage(u32 &outLoadAvgARM9, u32 &outLoadAvgARM7);
 void NDS_SetupDefaultFirmware();
 
+//host time spent in the major emulation sections, for benchmarking frontends.
+//collection is off by default and costs one predictable branch per section when off.
+enum NDS_PROFILE_SECTION
+{
+	NDS_PROFILE_ARM9 = 0,
+	NDS_PROFILE_ARM7,
+	NDS_PROFILE_GPU_RENDERLINE,
+	NDS_PROFILE_GFX3D_EXECUTE,
+	NDS_PROFILE_3D_RENDER,
+	NDS_PROFILE_SPU_EMULATE,
+
+	NDS_PROFILE_SECTION_COUNT
+};
+
+//the hardware events driven by the sequencer, in the order they run when several are due at once
+enum NDS_EVENT
+{
+	NDS_EVENT_DISPCNT = 0,
+	NDS_EVENT_WIFI,
+	NDS_EVENT_DIVIDER,
+	NDS_EVENT_SQRT,
+	NDS_EVENT_GXFIFO,
+	NDS_EVENT_READSLOT1,
+	NDS_EVENT_DMA9_0, NDS_EVENT_DMA9_1, NDS_EVENT_DMA9_2, NDS_EVENT_DMA9_3,
+	NDS_EVENT_DMA7_0, NDS_EVENT_DMA7_1, NDS_EVENT_DMA7_2, NDS_EVENT_DMA7_3,
+	NDS_EVENT_TIMER9_0, NDS_EVENT_TIMER9_1, NDS_EVENT_TIMER9_2, NDS_EVENT_TIMER9_3,
+	NDS_EVENT_TIMER7_0, NDS_EVENT_TIMER7_1, NDS_EVENT_TIMER7_2, NDS_EVENT_TIMER7_3,
+
+	NDS_EVENT_COUNT
+};
+
+struct NDS_PROFILE
+{
+	volatile bool enabled;
+	u64 nanoseconds[NDS_PROFILE_SECTION_COUNT];
+	u64 calls[NDS_PROFILE_SECTION_COUNT];
+	u64 events[NDS_EVENT_COUNT]; //times each event fired; counted whether or not collection is enabled
+};
+
+extern NDS_PROFILE nds_profile;
+
+void NDS_ProfileEnable(bool enable);
+void NDS_ProfileReset();
+const char* NDS_ProfileSectionName(NDS_PROFILE_SECTION section);
+const char* NDS_EventName(NDS_EVENT event);
+
+//accumulates the lifetime of the scope into one section, less the time spent in scopes opened inside it on the
+//same thread, so a section nested in another (e.g. gfx3d_execute3D run by an arm9 store) is not counted twice.
+//each section is only ever entered from one host thread at a time (the arm7 section belongs to the arm7 thread
+//in threaded mode), so no atomics are needed.
+class NDS_ProfileScope
+{
+private:
+	NDS_PROFILE_SECTION _section;
+	NDS_PROFILE_SECTION _splitSection;
+	u64 _weight, _splitWeight;
+	const bool _enabled;
+	u64 _nested;
+	NDS_ProfileScope *_parent;
+	std::chrono::steady_clock::time_point _begin;
+
+	static thread_local NDS_ProfileScope *_current;
+
+public:
+	NDS_ProfileScope(NDS_PROFILE_SECTION section)
+		: _section(section)
+		, _splitSection(section)
+		, _weight(1)
+		, _splitWeight(0)
+		, _enabled(nds_profile.enabled)
+		, _nested(0)
+		, _parent(NULL)
+	{
+		if (!_enabled) return;
+		_parent = _current;
+		_current = this;
+		_begin = std::chrono::steady_clock::now();
+	}
+
+	//share the time between the scope's section and another one, in proportion to the weights
+	//(for a slice that ran both cpus). a section with no weight is not charged a call either.
+	void split(u64 weight, NDS_PROFILE_SECTION other, u64 otherWeight)
+	{
+		_weight = weight;
+		_splitSection = other;
+		_splitWeight = otherWeight;
+	}
+
+	//keep time the thread spent on something else (waiting for another thread) out of the innermost open scope
+	static void exclude(u64 nanoseconds)
+	{
+		if (_current)
+			_current->_nested += nanoseconds;
+	}
+
+	~NDS_ProfileScope()
+	{
+		if (!_enabled) return;
+		const std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - _begin;
+		const u64 total = (u64)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+		const u64 self = (total > _nested) ? total - _nested : 0;
+		_current = _parent;
+		if (_parent)
+			_parent->_nested += total;
+
+		if (_splitWeight == 0)
+		{
+			nds_profile.nanoseconds[_section] += self;
+			nds_profile.calls[_section]++;
+			return;
+		}
+		const u64 share = (u64)((double)self * _splitWeight / (_weight + _splitWeight));
+		nds_profile.nanoseconds[_splitSection] += share;
+		nds_profile.calls[_splitSection]++;
+		if (_weight)
+		{
+			nds_profile.nanoseconds[_section] += self - share;
+			nds_profile.calls[_section]++;
+		}
+	}
+};
+
 //void execHardware_doAllDma(EDMAMode modeNum);
 
 template<bool FORCE> void NDS_exec(s32 nb = 560190<<1);
@@ -511,11 +648,14 @@ extern struct TCommonSettings
 		, GFX3D_Renderer_TextureDeposterize(false)
 		, GFX3D_Renderer_TextureSmoothing(false)
 		, GFX3D_TXTHack(false)
+		, GFX3D_Renderer_Pipelined(false)
+		, GPU2D_ParallelSubEngine(false)
 		, OpenGL_Emulation_ShadowPolygon(true)
 		, OpenGL_Emulation_SpecialZeroAlphaBlending(true)
 		, OpenGL_Emulation_NDSDepthCalculation(true)
 		, OpenGL_Emulation_DepthLEqualPolygonFacing(false)
 		, jit_max_block_size(12)
+		, jit_tier2_threshold(0)
 		, loadToMemory(false)
 		, UseExtBIOS(false)
 		, SWIFromBIOS(false)
@@ -529,6 +669,10 @@ extern struct TCommonSettings
 		, cheatsDisable(false)
 		, rigorous_timing(false)
 		, advanced_timing(true)
+		, threaded_arm7(false)
+		, threaded_arm7_skew(1000)
+		, idle_loop_skip(false)
+		, interp_predecode(false)
 		, micMode(InternalNoise)
 		, spuInterpolationMode(2)
 		, manualBackupType(0)
@@ -573,6 +717,14 @@ extern struct TCommonSettings
 	bool GFX3D_Renderer_TextureDeposterize;
 	bool GFX3D_Renderer_TextureSmoothing;
 	bool GFX3D_TXTHack;
+
+	//start 3d rendering at line 214 and let it run on a worker while the cpus go on emulating.
+	//it is only waited for where the 3d framebuffer is read. (SoftRasterizer only)
+	bool GFX3D_Renderer_Pipelined;
+
+	//render each sub engine line on a worker while the main engine renders the same line.
+	//lines where the main engine captures or displays vram are still rendered one engine after the other.
+	bool GPU2D_ParallelSubEngine;
 	
 	bool OpenGL_Emulation_ShadowPolygon;
 	bool OpenGL_Emulation_SpecialZeroAlphaBlending;
@@ -630,6 +782,23 @@ extern struct TCommonSettings
 
 	bool use_jit;
 	u32	jit_max_block_size;
+	//recompile a JIT block with registers kept in host registers once it has run this many times; 0 disables the second tier
+	u32 jit_tier2_threshold;
+	//directory for the persistent JIT block cache (x86 static code buffer only); empty disables it
+	std::string jit_cache_path;
+
+	//run the arm7 on a second host thread. it may drift up to threaded_arm7_skew cycles (arm9 clock) away from the arm9
+	//and is always interpreted, since the jit can only be driven from one thread.
+	bool threaded_arm7;
+	u32 threaded_arm7_skew;
+
+	//let a cpu spinning in a side-effect-free polling loop jump ahead to the next event that could end it
+	//(see armcpu_idleloop_check). the loop still sees every change, only at a coarser granularity.
+	bool idle_loop_skip;
+
+	//interpret from blocks of instructions decoded once and cached per address (see armcpu_exec_predecoded),
+	//for hosts where the jit cannot be used. not used by a threaded arm7.
+	bool interp_predecode;
 	
 	int WifiBridgeDeviceID;
 
@@ -21,6 +21,14 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <stdio.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#ifdef HAVE_MMAP_ROMREADER
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 #ifdef HAVE_LIBZZIP
 #include <zzip/zzip.h>
 #endif
@@ -40,17 +48,46 @@ ROMReader_struct * ROMReaderInit(char ** filename)
 	if(!strcasecmp(".gz", *filename + (strlen(*filename) - 3)))
 	{
 		(*filename)[strlen(*filename) - 3] = '\0';
-		return &GZIPROMReader;
+		return &ZIndexROMReader;
 	}
-#endif
-#ifdef HAVE_LIBZZIP
+	if (!strcasecmp(".zip", *filename + (strlen(*filename) - 4)))
+	{
+		(*filename)[strlen(*filename) - 4] = '\0';
+		return &ZIndexROMReader;
+	}
+#elif defined(HAVE_LIBZZIP)
 	if (!strcasecmp(".zip", *filename + (strlen(*filename) - 4)))
 	{
 		(*filename)[strlen(*filename) - 4] = '\0';
 		return &ZIPROMReader;
 	}
 #endif
+#ifdef HAVE_MMAP_ROMREADER
+	return &MMAPROMReader;
+#else
 	return &STDROMReader;
+#endif
+}
+
+ROMReader_struct * ROMReaderFallback(ROMReader_struct * reader, const char * filename)
+{
+#ifdef HAVE_MMAP_ROMREADER
+	if (reader == &MMAPROMReader)
+		return &STDROMReader;
+#endif
+#ifdef HAVE_LIBZ
+	if (reader == &ZIndexROMReader)
+	{
+		const size_t len = strlen(filename);
+		if (len >= 3 && !strcasecmp(".gz", filename + len - 3))
+			return &GZIPROMReader;
+#ifdef HAVE_LIBZZIP
+		if (len >= 4 && !strcasecmp(".zip", filename + len - 4))
+			return &ZIPROMReader;
+#endif
+	}
+#endif
+	return NULL;
 }
 
 void * STDROMReaderInit(const char * filename);
@@ -69,7 +106,8 @@ ROMReader_struct STDROMReader =
 	STDROMReaderSize,
 	STDROMReaderSeek,
 	STDROMReaderRead,
-	STDROMReaderWrite
+	STDROMReaderWrite,
+	NULL
 };
 
 struct STDROMReaderData
@@ -168,7 +206,8 @@ ROMReader_struct GZIPROMReader =
 	GZIPROMReaderSize,
 	GZIPROMReaderSeek,
 	GZIPROMReaderRead,
-	GZIPROMReaderWrite
+	GZIPROMReaderWrite,
+	NULL
 };
 
 void * GZIPROMReaderInit(const char * filename)
@@ -230,7 +269,8 @@ ROMReader_struct ZIPROMReader =
 	ZIPROMReaderSize,
 	ZIPROMReaderSeek,
 	ZIPROMReaderRead,
-	ZIPROMReaderWrite
+	ZIPROMReaderWrite,
+	NULL
 };
 
 void * ZIPROMReaderInit(const char * filename)
@@ -288,6 +328,749 @@ int ZIPROMReaderWrite(void *, void *, u32)
 }
 #endif
 
+#ifdef HAVE_LIBZ
+//gz and zip images with cheap random access. the first open inflates the whole image once and records a
+//checkpoint (compressed bit position plus the preceding 32KB of output) every ZINDEX_CHECKPOINT_SPAN bytes.
+//the checkpoints are saved next to the rom, so later opens go straight to reading. reads are served from an
+//LRU of decompressed ZINDEX_BLOCK_SIZE blocks, and a miss only inflates forward from the nearest checkpoint.
+//windows are kept deflated, in memory as in the index file: uncompressed they would add up to 1/8 of the image,
+//deflated it is that times the window's compression ratio (about 1/16 for an image that halves when zipped).
+#define ZINDEX_BLOCK_SHIFT 16
+#define ZINDEX_BLOCK_SIZE (1 << ZINDEX_BLOCK_SHIFT)
+#define ZINDEX_BLOCK_MASK (ZINDEX_BLOCK_SIZE - 1)
+#define ZINDEX_CACHE_BLOCKS 64
+#define ZINDEX_CHECKPOINT_SPAN (256 * 1024)
+#define ZINDEX_WINDOW_SIZE 32768
+#define ZINDEX_INPUT_SIZE 16384
+#define ZINDEX_FILE_MAGIC 0x58444E49 //"INDX"
+#define ZINDEX_FILE_VERSION 1
+
+void * ZIndexROMReaderInit(const char * filename);
+void ZIndexROMReaderDeInit(void *);
+u32 ZIndexROMReaderSize(void *);
+int ZIndexROMReaderSeek(void *, int, int);
+int ZIndexROMReaderRead(void *, void *, u32);
+int ZIndexROMReaderWrite(void *, void *, u32);
+
+ROMReader_struct ZIndexROMReader =
+{
+	ROMREADER_ZINDEX,
+	"Indexed Gzip/Zip ROM Reader",
+	ZIndexROMReaderInit,
+	ZIndexROMReaderDeInit,
+	ZIndexROMReaderSize,
+	ZIndexROMReaderSeek,
+	ZIndexROMReaderRead,
+	ZIndexROMReaderWrite,
+	NULL
+};
+
+struct ZIndexCheckpoint
+{
+	u32 out; //offset in the decompressed image
+	u32 in; //file offset of the first byte holding bits of the next deflate block
+	u8 bits; //bits of that byte which still belong to the previous block
+	std::vector<u8> window; //the 32KB of output preceding out, deflated (empty at the start of the stream)
+};
+
+struct ZIndexCacheBlock
+{
+	u32 block;
+	u32 lastUse;
+	std::vector<u8> data;
+};
+
+struct ZIndexROMReaderData
+{
+	FILE *file;
+	bool deflated; //false for stored zip entries, which are read straight from the file
+	int windowBits; //47 (gzip header) for .gz, -15 (raw deflate) for zip entries
+	u32 dataOffset; //start of the compressed stream in the file
+	u32 dataEnd;
+	u32 size;
+	u32 pos;
+	std::vector<ZIndexCheckpoint> checkpoints;
+	std::vector<ZIndexCacheBlock> cache;
+	u32 mru;
+	u32 useCounter;
+};
+
+static u16 zindex_get16(const u8 *p) { return p[0] | (p[1] << 8); }
+static u32 zindex_get32(const u8 *p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((u32)p[3] << 24); }
+
+static bool zindex_read32(FILE *file, u32 &value)
+{
+	u8 buf[4];
+	if (fread(buf, 1, 4, file) != 4) return false;
+	value = zindex_get32(buf);
+	return true;
+}
+
+static void zindex_write32(FILE *file, u32 value)
+{
+	const u8 buf[4] = { (u8)value, (u8)(value >> 8), (u8)(value >> 16), (u8)(value >> 24) };
+	fwrite(buf, 1, 4, file);
+}
+
+static bool zindex_readAt(FILE *file, u32 offset, void *buffer, u32 size)
+{
+	if (fseek(file, offset, SEEK_SET) != 0) return false;
+	return fread(buffer, 1, size, file) == size;
+}
+
+//finds the first file entry of a zip through its central directory, since the local header
+//may leave the sizes to a trailing data descriptor. multi-disk, zip64 and encrypted archives are refused.
+static bool zindex_openZip(ZIndexROMReaderData *z, u32 fileSize)
+{
+	const u32 tailSize = std::min<u32>(fileSize, 0xFFFF + 22);
+	std::vector<u8> tail(tailSize);
+	if (tailSize < 22 || !zindex_readAt(z->file, fileSize - tailSize, &tail[0], tailSize))
+		return false;
+
+	int eocd = -1;
+	for (int i = (int)tailSize - 22; i >= 0; i--)
+	{
+		if (zindex_get32(&tail[i]) == 0x06054B50)
+		{
+			eocd = i;
+			break;
+		}
+	}
+	if (eocd < 0 || zindex_get16(&tail[eocd + 4]) != 0 || zindex_get16(&tail[eocd + 6]) != 0)
+		return false;
+
+	u32 entries = zindex_get16(&tail[eocd + 10]);
+	u32 cdOffset = zindex_get32(&tail[eocd + 16]);
+
+	for (; entries > 0; entries--)
+	{
+		u8 cd[46];
+		if (!zindex_readAt(z->file, cdOffset, cd, sizeof(cd)) || zindex_get32(cd) != 0x02014B50)
+			return false;
+
+		const u16 flags = zindex_get16(&cd[8]);
+		const u16 method = zindex_get16(&cd[10]);
+		const u32 compressedSize = zindex_get32(&cd[20]);
+		const u32 uncompressedSize = zindex_get32(&cd[24]);
+		const u16 nameLength = zindex_get16(&cd[28]);
+		const u32 localOffset = zindex_get32(&cd[42]);
+
+		std::vector<char> name(nameLength + 1, 0);
+		if (nameLength && !zindex_readAt(z->file, cdOffset + 46, &name[0], nameLength))
+			return false;
+		cdOffset += 46 + nameLength + zindex_get16(&cd[30]) + zindex_get16(&cd[32]);
+
+		//skip directories
+		if (nameLength == 0 || name[nameLength - 1] == '/')
+			continue;
+
+		if ((flags & 1) || (method != 0 && method != 8))
+			return false;
+		if (compressedSize == 0xFFFFFFFF || uncompressedSize == 0xFFFFFFFF || localOffset == 0xFFFFFFFF)
+			return false;
+
+		u8 local[30];
+		if (!zindex_readAt(z->file, localOffset, local, sizeof(local)) || zindex_get32(local) != 0x04034B50)
+			return false;
+
+		z->deflated = (method == 8);
+		z->windowBits = -15;
+		z->dataOffset = localOffset + 30 + zindex_get16(&local[26]) + zindex_get16(&local[28]);
+		z->dataEnd = z->dataOffset + compressedSize;
+		z->size = uncompressedSize;
+		return z->dataEnd <= fileSize;
+	}
+
+	return false;
+}
+
+static bool zindex_addCheckpoint(ZIndexROMReaderData *z, u32 out, u32 in, u8 bits, const u8 *window, u32 windowLeft)
+{
+	ZIndexCheckpoint cp;
+	cp.out = out;
+	cp.in = in;
+	cp.bits = bits;
+	if (out != 0)
+	{
+		//the window is circular; the oldest output starts at the write position
+		std::vector<u8> linear(ZINDEX_WINDOW_SIZE);
+		memcpy(&linear[0], window + ZINDEX_WINDOW_SIZE - windowLeft, windowLeft);
+		memcpy(&linear[windowLeft], window, ZINDEX_WINDOW_SIZE - windowLeft);
+
+		uLongf packedSize = compressBound(ZINDEX_WINDOW_SIZE);
+		cp.window.resize(packedSize);
+		if (compress2(&cp.window[0], &packedSize, &linear[0], ZINDEX_WINDOW_SIZE, Z_BEST_SPEED) != Z_OK)
+			return false;
+		cp.window.resize(packedSize);
+	}
+	z->checkpoints.push_back(cp);
+	return true;
+}
+
+//skips the trailer of the gzip member whose deflate stream just ended, and readies strm for the member after it.
+//returns false if there is none
+static bool zindex_nextMember(ZIndexROMReaderData *z, z_stream *strm, u8 *input, u32 &inPos)
+{
+	u32 skip = 8;
+	for (;;)
+	{
+		const u32 n = std::min<u32>(skip, strm->avail_in);
+		strm->next_in += n;
+		strm->avail_in -= n;
+		skip -= n;
+		if (skip == 0 && strm->avail_in != 0)
+			break;
+
+		strm->avail_in = (uInt)fread(input, 1, std::min<u32>(ZINDEX_INPUT_SIZE, z->dataEnd - inPos), z->file);
+		inPos += strm->avail_in;
+		strm->next_in = input;
+		if (strm->avail_in == 0)
+			return false;
+	}
+	return inflateReset2(strm, 31) == Z_OK;
+}
+
+//one full inflate pass, recording a checkpoint at the first deflate block boundary past every span.
+//a gzip image may hold several members back to back (as written by pigz or bgzip); they are one image
+static bool zindex_build(ZIndexROMReaderData *z)
+{
+	z_stream strm;
+	memset(&strm, 0, sizeof(strm));
+	if (inflateInit2(&strm, z->windowBits) != Z_OK)
+		return false;
+
+	std::vector<u8> input(ZINDEX_INPUT_SIZE);
+	std::vector<u8> window(ZINDEX_WINDOW_SIZE, 0);
+	u64 totalIn = 0, totalOut = 0, last = 0;
+	u32 remaining = z->dataEnd - z->dataOffset;
+	int ret = Z_OK;
+
+	z->checkpoints.clear();
+	//raw deflate doesn't stop at the first block boundary, so the start of the stream is added up front
+	if (z->windowBits < 0 && !zindex_addCheckpoint(z, 0, z->dataOffset, 0, NULL, 0))
+	{
+		inflateEnd(&strm);
+		return false;
+	}
+
+	fseek(z->file, z->dataOffset, SEEK_SET);
+	do
+	{
+		strm.avail_in = (uInt)fread(&input[0], 1, std::min<u32>(ZINDEX_INPUT_SIZE, remaining), z->file);
+		remaining -= strm.avail_in;
+		if (strm.avail_in == 0)
+		{
+			//raw deflate only reports the end of the stream on a call past its last block
+			if (strm.avail_out == 0)
+			{
+				strm.avail_out = ZINDEX_WINDOW_SIZE;
+				strm.next_out = &window[0];
+			}
+			totalOut += strm.avail_out;
+			ret = inflate(&strm, Z_BLOCK);
+			totalOut -= strm.avail_out;
+			if (ret != Z_STREAM_END)
+				ret = Z_DATA_ERROR;
+			break;
+		}
+		strm.next_in = &input[0];
+
+		do
+		{
+			if (strm.avail_out == 0)
+			{
+				strm.avail_out = ZINDEX_WINDOW_SIZE;
+				strm.next_out = &window[0];
+			}
+
+			totalIn += strm.avail_in;
+			totalOut += strm.avail_out;
+			ret = inflate(&strm, Z_BLOCK);
+			totalIn -= strm.avail_in;
+			totalOut -= strm.avail_out;
+
+			if (ret == Z_NEED_DICT || ret == Z_BUF_ERROR)
+				ret = Z_DATA_ERROR;
+			if (ret == Z_STREAM_END && z->windowBits > 0 && (strm.avail_in != 0 || remaining != 0))
+			{
+				//another member follows. anything else after the end (padding, garbage) fails to inflate
+				//and the rom is left to the plain gzip reader
+				ret = (inflateReset(&strm) == Z_OK) ? Z_OK : Z_DATA_ERROR;
+				if (ret == Z_OK)
+					continue;
+			}
+			if (ret == Z_MEM_ERROR || ret == Z_DATA_ERROR || ret == Z_STREAM_END)
+				break;
+			if (totalOut > 0xFFFFFFFFULL)
+			{
+				ret = Z_DATA_ERROR;
+				break;
+			}
+
+			if ((strm.data_type & 128) && !(strm.data_type & 64) &&
+			    ((z->checkpoints.empty() && totalOut == 0) || totalOut - last > ZINDEX_CHECKPOINT_SPAN))
+			{
+				if (!zindex_addCheckpoint(z, (u32)totalOut, z->dataOffset + (u32)totalIn, strm.data_type & 7, &window[0], strm.avail_out))
+				{
+					ret = Z_MEM_ERROR;
+					break;
+				}
+				last = totalOut;
+			}
+		} while (strm.avail_in != 0);
+	} while (ret != Z_STREAM_END);
+
+	inflateEnd(&strm);
+
+	if (ret != Z_STREAM_END || z->checkpoints.empty() || totalOut > 0xFFFFFFFFULL)
+		return false;
+	if (z->windowBits < 0 && (u32)totalOut != z->size)
+		return false;
+
+	z->size = (u32)totalOut;
+	return true;
+}
+
+static std::string zindex_path(const char *filename)
+{
+	return std::string(filename) + ".zidx";
+}
+
+//the index is tied to the rom by its size and modification time; windows are stored deflated
+static bool zindex_load(ZIndexROMReaderData *z, FILE *fp, const struct stat &sb)
+{
+	u32 magic, version, romSize, romTime, dataOffset, size, count;
+	if (!zindex_read32(fp, magic) || magic != ZINDEX_FILE_MAGIC) return false;
+	if (!zindex_read32(fp, version) || version != ZINDEX_FILE_VERSION) return false;
+	if (!zindex_read32(fp, romSize) || romSize != (u32)sb.st_size) return false;
+	if (!zindex_read32(fp, romTime) || romTime != (u32)sb.st_mtime) return false;
+	if (!zindex_read32(fp, dataOffset) || dataOffset != z->dataOffset) return false;
+	if (!zindex_read32(fp, size) || !zindex_read32(fp, count) || count == 0) return false;
+
+	std::vector<ZIndexCheckpoint> checkpoints(count);
+	for (u32 i = 0; i < count; i++)
+	{
+		ZIndexCheckpoint &cp = checkpoints[i];
+		u32 bits, packedSize;
+		if (!zindex_read32(fp, cp.out) || !zindex_read32(fp, cp.in) || !zindex_read32(fp, bits) || !zindex_read32(fp, packedSize))
+			return false;
+		if (bits > 7 || cp.in < z->dataOffset || cp.in >= z->dataEnd || (i > 0 && cp.out <= checkpoints[i - 1].out))
+			return false;
+		cp.bits = (u8)bits;
+		if (packedSize == 0)
+		{
+			if (cp.out != 0) return false;
+			continue;
+		}
+		if (packedSize > compressBound(ZINDEX_WINDOW_SIZE))
+			return false;
+
+		//a window that does not inflate is caught by zindex_decode, which then fails the read
+		cp.window.resize(packedSize);
+		if (fread(&cp.window[0], 1, packedSize, fp) != packedSize)
+			return false;
+	}
+	if (checkpoints[0].out != 0)
+		return false;
+
+	z->size = size;
+	z->checkpoints.swap(checkpoints);
+	return true;
+}
+
+static void zindex_save(ZIndexROMReaderData *z, FILE *fp, const struct stat &sb)
+{
+	zindex_write32(fp, ZINDEX_FILE_MAGIC);
+	zindex_write32(fp, ZINDEX_FILE_VERSION);
+	zindex_write32(fp, (u32)sb.st_size);
+	zindex_write32(fp, (u32)sb.st_mtime);
+	zindex_write32(fp, z->dataOffset);
+	zindex_write32(fp, z->size);
+	zindex_write32(fp, (u32)z->checkpoints.size());
+
+	for (size_t i = 0; i < z->checkpoints.size(); i++)
+	{
+		const ZIndexCheckpoint &cp = z->checkpoints[i];
+		zindex_write32(fp, cp.out);
+		zindex_write32(fp, cp.in);
+		zindex_write32(fp, cp.bits);
+		zindex_write32(fp, (u32)cp.window.size());
+		if (!cp.window.empty())
+			fwrite(&cp.window[0], 1, cp.window.size(), fp);
+	}
+}
+
+static ZIndexCacheBlock * zindex_cacheInsert(ZIndexROMReaderData *z, u32 block, std::vector<u8> &data)
+{
+	u32 slot;
+	if (z->cache.size() < ZINDEX_CACHE_BLOCKS)
+	{
+		slot = (u32)z->cache.size();
+		z->cache.push_back(ZIndexCacheBlock());
+	}
+	else
+	{
+		slot = 0;
+		for (u32 i = 1; i < z->cache.size(); i++)
+			if (z->cache[i].lastUse < z->cache[slot].lastUse)
+				slot = i;
+	}
+
+	ZIndexCacheBlock &entry = z->cache[slot];
+	entry.block = block;
+	entry.lastUse = ++z->useCounter;
+	entry.data.swap(data);
+	z->mru = slot;
+	return &entry;
+}
+
+//inflates forward from the last checkpoint at or before the block, caching every whole block it passes
+static ZIndexCacheBlock * zindex_decode(ZIndexROMReaderData *z, u32 block)
+{
+	const u32 start = block << ZINDEX_BLOCK_SHIFT;
+
+	size_t lo = 0, hi = z->checkpoints.size();
+	while (hi - lo > 1)
+	{
+		const size_t mid = (lo + hi) / 2;
+		if (z->checkpoints[mid].out <= start) lo = mid;
+		else hi = mid;
+	}
+	const ZIndexCheckpoint &cp = z->checkpoints[lo];
+
+	z_stream strm;
+	memset(&strm, 0, sizeof(strm));
+	if (inflateInit2(&strm, -15) != Z_OK)
+		return NULL;
+
+	u32 inPos = cp.in - (cp.bits ? 1 : 0);
+	fseek(z->file, inPos, SEEK_SET);
+	if (cp.bits)
+	{
+		const int ch = fgetc(z->file);
+		if (ch == EOF)
+		{
+			inflateEnd(&strm);
+			return NULL;
+		}
+		inflatePrime(&strm, cp.bits, ch >> (8 - cp.bits));
+		inPos++;
+	}
+	if (!cp.window.empty())
+	{
+		std::vector<u8> window(ZINDEX_WINDOW_SIZE);
+		uLongf windowSize = ZINDEX_WINDOW_SIZE;
+		if (uncompress(&window[0], &windowSize, &cp.window[0], (uLong)cp.window.size()) != Z_OK || windowSize != ZINDEX_WINDOW_SIZE)
+		{
+			inflateEnd(&strm);
+			return NULL;
+		}
+		inflateSetDictionary(&strm, &window[0], ZINDEX_WINDOW_SIZE);
+	}
+
+	std::vector<u8> input(ZINDEX_INPUT_SIZE);
+	std::vector<u8> buf;
+	ZIndexCacheBlock *found = NULL;
+	u32 cur = cp.out >> ZINDEX_BLOCK_SHIFT;
+	u32 fill = cp.out & ZINDEX_BLOCK_MASK; //a block the checkpoint starts inside of is not cached
+	int ret = Z_OK;
+
+	while (ret != Z_STREAM_END)
+	{
+		buf.resize(ZINDEX_BLOCK_SIZE);
+		strm.next_out = &buf[fill];
+		strm.avail_out = ZINDEX_BLOCK_SIZE - fill;
+
+		while (strm.avail_out != 0)
+		{
+			if (strm.avail_in == 0)
+			{
+				strm.avail_in = (uInt)fread(&input[0], 1, std::min<u32>(ZINDEX_INPUT_SIZE, z->dataEnd - inPos), z->file);
+				inPos += strm.avail_in;
+				strm.next_in = &input[0];
+				if (strm.avail_in == 0)
+					break;
+			}
+			ret = inflate(&strm, Z_NO_FLUSH);
+			if (ret == Z_STREAM_END && z->windowBits > 0 && zindex_nextMember(z, &strm, &input[0], inPos))
+				ret = Z_OK;
+			if (ret != Z_OK)
+				break;
+		}
+		if (ret != Z_OK && ret != Z_STREAM_END)
+			break;
+
+		if (fill == 0)
+		{
+			buf.resize(ZINDEX_BLOCK_SIZE - strm.avail_out);
+			if (buf.empty())
+				break;
+			ZIndexCacheBlock *entry = zindex_cacheInsert(z, cur, buf);
+			if (cur == block)
+			{
+				found = entry;
+				break;
+			}
+		}
+		if (strm.avail_out != 0 && ret != Z_STREAM_END)
+			break; //ran out of input
+		cur++;
+		fill = 0;
+	}
+
+	inflateEnd(&strm);
+	return found;
+}
+
+static ZIndexCacheBlock * zindex_getBlock(ZIndexROMReaderData *z, u32 block)
+{
+	if (!z->cache.empty() && z->cache[z->mru].block == block)
+		return &z->cache[z->mru];
+
+	for (u32 i = 0; i < z->cache.size(); i++)
+	{
+		if (z->cache[i].block == block)
+		{
+			z->cache[i].lastUse = ++z->useCounter;
+			z->mru = i;
+			return &z->cache[i];
+		}
+	}
+
+	return zindex_decode(z, block);
+}
+
+void * ZIndexROMReaderInit(const char * filename)
+{
+	struct stat sb;
+	if (stat(filename, &sb) == -1 || (sb.st_mode & S_IFMT) != S_IFREG)
+		return NULL;
+
+	FILE *inf = fopen(filename, "rb");
+	if (!inf) return NULL;
+
+	ZIndexROMReaderData *z = new ZIndexROMReaderData();
+	z->file = inf;
+	z->deflated = true;
+	z->windowBits = 47;
+	z->dataOffset = 0;
+	z->dataEnd = (u32)sb.st_size;
+	z->size = 0;
+	z->pos = 0;
+	z->mru = 0;
+	z->useCounter = 0;
+
+	const size_t len = strlen(filename);
+	const bool isZip = (len >= 4 && !strcasecmp(".zip", filename + len - 4));
+	bool ok = isZip ? zindex_openZip(z, (u32)sb.st_size) : true;
+
+	if (ok && z->deflated)
+	{
+		const std::string indexPath = zindex_path(filename);
+		FILE *index = fopen(indexPath.c_str(), "rb");
+		const bool loaded = index && zindex_load(z, index, sb);
+		if (index) fclose(index);
+
+		if (!loaded)
+		{
+			ok = zindex_build(z);
+			//read-only rom directories just rebuild the index on every open
+			if (ok && (index = fopen(indexPath.c_str(), "wb")) != NULL)
+			{
+				zindex_save(z, index, sb);
+				fclose(index);
+			}
+		}
+	}
+
+	if (!ok)
+	{
+		fclose(inf);
+		delete z;
+		return NULL;
+	}
+
+	return (void*)z;
+}
+
+void ZIndexROMReaderDeInit(void * file)
+{
+	if (!file) return;
+	fclose(((ZIndexROMReaderData*)file)->file);
+	delete ((ZIndexROMReaderData*)file);
+}
+
+u32 ZIndexROMReaderSize(void * file)
+{
+	if (!file) return 0;
+	return ((ZIndexROMReaderData*)file)->size;
+}
+
+int ZIndexROMReaderSeek(void * file, int offset, int whence)
+{
+	if (!file) return 0;
+	ZIndexROMReaderData *z = (ZIndexROMReaderData*)file;
+	switch (whence)
+	{
+	case SEEK_SET: z->pos = offset; break;
+	case SEEK_CUR: z->pos += offset; break;
+	case SEEK_END: z->pos = z->size + offset; break;
+	}
+	return 1;
+}
+
+int ZIndexROMReaderRead(void * file, void * buffer, u32 size)
+{
+	if (!file) return 0;
+	ZIndexROMReaderData *z = (ZIndexROMReaderData*)file;
+
+	if (z->pos >= z->size)
+		return 0;
+	size = std::min(size, z->size - z->pos);
+
+	if (!z->deflated)
+	{
+		if (!zindex_readAt(z->file, z->dataOffset + z->pos, buffer, size))
+			return 0;
+		z->pos += size;
+		return size;
+	}
+
+	u8 *dst = (u8*)buffer;
+	u32 done = 0;
+	while (done < size)
+	{
+		ZIndexCacheBlock *entry = zindex_getBlock(z, z->pos >> ZINDEX_BLOCK_SHIFT);
+		if (!entry)
+			break;
+
+		const u32 ofs = z->pos & ZINDEX_BLOCK_MASK;
+		if (ofs >= entry->data.size())
+			break;
+		const u32 todo = std::min<u32>(size - done, (u32)entry->data.size() - ofs);
+		memcpy(dst + done, &entry->data[ofs], todo);
+		done += todo;
+		z->pos += todo;
+	}
+
+	return done;
+}
+
+int ZIndexROMReaderWrite(void *, void *, u32)
+{
+	//not supported, ever
+	return 0;
+}
+#endif
+
+#ifdef HAVE_MMAP_ROMREADER
+void * MMAPROMReaderInit(const char * filename);
+void MMAPROMReaderDeInit(void *);
+u32 MMAPROMReaderSize(void *);
+int MMAPROMReaderSeek(void *, int, int);
+int MMAPROMReaderRead(void *, void *, u32);
+int MMAPROMReaderWrite(void *, void *, u32);
+const u8 * MMAPROMReaderData(void *);
+
+ROMReader_struct MMAPROMReader =
+{
+	ROMREADER_MMAP,
+	"Mapped ROM Reader",
+	MMAPROMReaderInit,
+	MMAPROMReaderDeInit,
+	MMAPROMReaderSize,
+	MMAPROMReaderSeek,
+	MMAPROMReaderRead,
+	MMAPROMReaderWrite,
+	MMAPROMReaderData
+};
+
+struct MMAPROMReaderMapping
+{
+	u8* data;
+	u32 size;
+	u32 pos;
+};
+
+void * MMAPROMReaderInit(const char * filename)
+{
+	//this fails for anything that isn't a plain local file (or is too big to address), and the caller falls back to the standard reader
+	int fd = open(filename, O_RDONLY);
+	if (fd == -1) return NULL;
+
+	struct stat sb;
+	if (fstat(fd, &sb) == -1 || (sb.st_mode & S_IFMT) != S_IFREG || sb.st_size <= 0 || (u64)sb.st_size > 0xFFFFFFFFULL)
+	{
+		close(fd);
+		return NULL;
+	}
+
+	//MAP_SHARED so that the pages are the page cache's own, rather than a private copy per process
+	void* data = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) return NULL;
+
+	MMAPROMReaderMapping* ret = new MMAPROMReaderMapping();
+	ret->data = (u8*)data;
+	ret->size = (u32)sb.st_size;
+	ret->pos = 0;
+	return (void*)ret;
+}
+
+void MMAPROMReaderDeInit(void * file)
+{
+	if (!file) return;
+	munmap(((MMAPROMReaderMapping*)file)->data, ((MMAPROMReaderMapping*)file)->size);
+	delete ((MMAPROMReaderMapping*)file);
+}
+
+u32 MMAPROMReaderSize(void * file)
+{
+	if (!file) return 0;
+	return ((MMAPROMReaderMapping*)file)->size;
+}
+
+int MMAPROMReaderSeek(void * file, int offset, int whence)
+{
+	//same return convention as the standard reader
+	if (!file) return 0;
+	MMAPROMReaderMapping* rom = (MMAPROMReaderMapping*)file;
+	switch (whence)
+	{
+		case SEEK_SET: rom->pos = (u32)offset; break;
+		case SEEK_CUR: rom->pos += offset; break;
+		case SEEK_END: rom->pos = rom->size + offset; break;
+	}
+	return 1;
+}
+
+int MMAPROMReaderRead(void * file, void * buffer, u32 size)
+{
+	if (!file) return 0;
+	MMAPROMReaderMapping* rom = (MMAPROMReaderMapping*)file;
+	if (rom->pos >= rom->size) return 0;
+
+	u32 todo = rom->size - rom->pos;
+	if (size < todo)
+		todo = size;
+	memcpy(buffer, rom->data + rom->pos, todo);
+	rom->pos += todo;
+	return (int)todo;
+}
+
+int MMAPROMReaderWrite(void *, void *, u32)
+{
+	//the mapping is read-only
+	return 0;
+}
+
+const u8 * MMAPROMReaderData(void * file)
+{
+	if (!file) return NULL;
+	return ((MMAPROMReaderMapping*)file)->data;
+}
+#endif
+
 struct {
 	void* buf;
 	int len;
@@ -355,6 +1138,11 @@ int MemROMReaderWrite(void * file, void * buffer, u32 size)
 	return todo;
 }
 
+const u8 * MemROMReaderData(void *)
+{
+	return (const u8*)mem.buf;
+}
+
 static ROMReader_struct MemROMReader =
 {
 	ROMREADER_MEM,
@@ -365,6 +1153,7 @@ static ROMReader_struct MemROMReader =
 	MemROMReaderSeek,
 	MemROMReaderRead,
 	MemROMReaderWrite,
+	MemROMReaderData,
 };
 
 ROMReader_struct * MemROMReaderRead_TrueInit(void* buf, int length)
@@ -28,6 +28,14 @@
 #define ROMREADER_GZIP	1
 #define ROMREADER_ZIP	2
 #define ROMREADER_MEM	3
+#define ROMREADER_MMAP	4
+#define ROMREADER_ZINDEX	5
+
+//maps the rom file instead of reading it through stdio, so card reads come straight from the page cache
+//and every emulator process on the host shares the same pages
+#ifndef _WIN32
+#define HAVE_MMAP_ROMREADER
+#endif
 
 typedef struct
 {
@@ -39,15 +47,23 @@ typedef struct
 	int (*Seek)(void * file, int offset, int whence);
 	int (*Read)(void * file, void * buffer, u32 size);
 	int (*Write)(void * file, void * buffer, u32 size);
+	//the whole image, for readers which hold it in memory (NULL for streaming readers)
+	const u8 * (*Data)(void * file);
 } ROMReader_struct;
 
 extern ROMReader_struct STDROMReader;
 #ifdef HAVE_LIBZ
 extern ROMReader_struct GZIPROMReader;
+extern ROMReader_struct ZIndexROMReader;
 #endif
 #ifdef HAVE_LIBZZIP
 extern ROMReader_struct ZIPROMReader;
 #endif
+#ifdef HAVE_MMAP_ROMREADER
+extern ROMReader_struct MMAPROMReader;
+#endif
 
 ROMReader_struct * ROMReaderInit(char ** filename);
+//the streaming reader to try when reader->Init() refuses a file, or NULL
+ROMReader_struct * ROMReaderFallback(ROMReader_struct * reader, const char * filename);
 ROMReader_struct * MemROMReaderRead_TrueInit(void* buf, int length);
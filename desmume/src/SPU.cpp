@@ -43,6 +43,10 @@
 #include "matrix.h"
 #include "utils/bits.h"
 
+#ifdef ENABLE_SSE4_1
+#include <smmintrin.h>
+#endif
+
 static inline s16 read16(u32 addr) { return (s16)_MMU_read16<ARMCPU_ARM7,MMU_AT_DEBUG>(addr); }
 static inline u8 read08(u32 addr) { return _MMU_read08<ARMCPU_ARM7,MMU_AT_DEBUG>(addr); }
 static inline s8 read_s8(u32 addr) { return (s8)_MMU_read08<ARMCPU_ARM7,MMU_AT_DEBUG>(addr); }
@@ -331,10 +335,12 @@ SPU_struct::SPU_struct(int buffersize)
 	, buflength(0)
 	, sndbuf(0)
 	, outbuf(0)
+	, chanbuf(0)
 	, bufsize(buffersize)
 {
 	sndbuf = new s32[buffersize*2];
 	outbuf = new s16[buffersize*2];
+	chanbuf = new s32[buffersize];
 	reset();
 }
 
@@ -342,6 +348,7 @@ SPU_struct::~SPU_struct()
 {
 	if(sndbuf) delete[] sndbuf;
 	if(outbuf) delete[] outbuf;
+	if(chanbuf) delete[] chanbuf;
 }
 
 void SPU_DeInit(void)
@@ -1175,24 +1182,132 @@ static FORCEINLINE void FetchPSGData(channel_struct *chan, s32 *data)
 }
 
 //////////////////////////////////////////////////////////////////////////////
+// Block mixing. A channel's samples for the whole request are decoded into SPU->chanbuf first,
+// and then scaled, panned and accumulated into sndbuf here. The vector paths use the same integer
+// steps as the scalar tail, so the output does not depend on which one runs.
+
+#if defined(ENABLE_SSE2)
+// (val * multiplier) >> 7 on four lanes. Only the low 32 bits of each product are kept, same as the
+// scalar s32 multiplication.
+static FORCEINLINE v128s32 spumuldiv7_SSE2(const v128s32 &val, const s32 multiplier)
+{
+#if defined(ENABLE_SSE4_1)
+	return _mm_srai_epi32(_mm_mullo_epi32(val, _mm_set1_epi32(multiplier)), 7);
+#else
+	const v128u32 m = _mm_set1_epi32(multiplier);
+	const v128u32 even = _mm_mul_epu32(val, m);
+	const v128u32 odd = _mm_mul_epu32(_mm_srli_epi64(val, 32), m);
+	const v128s32 product = _mm_unpacklo_epi32(_mm_shuffle_epi32(even, 0x08), _mm_shuffle_epi32(odd, 0x08));
+	return _mm_srai_epi32(product, 7);
+#endif
+}
+#endif
 
-static FORCEINLINE void MixL(SPU_struct* SPU, channel_struct *chan, s32 data)
+#if defined(ENABLE_AVX2)
+static FORCEINLINE v256s32 spumuldiv7_AVX2(const v256s32 &val, const s32 multiplier)
 {
-	data = spumuldiv7(data, chan->vol) >> volume_shift[chan->volumeDiv];
-	SPU->sndbuf[SPU->bufpos<<1] += data;
+	return _mm256_srai_epi32(_mm256_mullo_epi32(val, _mm256_set1_epi32(multiplier)), 7);
 }
+#endif
 
-static FORCEINLINE void MixR(SPU_struct* SPU, channel_struct *chan, s32 data)
+template<int CHANNELS> static void SPU_MixBlock(SPU_struct* const SPU, const channel_struct* const chan, const u32 pos, const u32 count)
 {
-	data = spumuldiv7(data, chan->vol) >> volume_shift[chan->volumeDiv];
-	SPU->sndbuf[(SPU->bufpos<<1)+1] += data;
+	const s32 *data = SPU->chanbuf;
+	s32 *dst = SPU->sndbuf + (pos << 1);
+	const u8 vol = chan->vol;
+	const u8 shift = volume_shift[chan->volumeDiv];
+	const u8 panL = 127 - chan->pan;
+	const u8 panR = chan->pan;
+	u32 i = 0;
+
+#if defined(ENABLE_AVX2)
+	const v128s32 shift128 = _mm_cvtsi32_si128(shift);
+	for (; i + 8 <= count; i += 8)
+	{
+		v256s32 d = _mm256_loadu_si256((v256s32 *)(data + i));
+		if (vol != 127) d = spumuldiv7_AVX2(d, vol);
+		d = _mm256_sra_epi32(d, shift128);
+
+		v256s32 l, r;
+		switch (CHANNELS)
+		{
+			case 0: l = d; r = _mm256_setzero_si256(); break;
+			case 2: l = _mm256_setzero_si256(); r = d; break;
+			default: l = spumuldiv7_AVX2(d, panL); r = spumuldiv7_AVX2(d, panR); break;
+		}
+
+		// unpack works within 128-bit lanes, so put the halves back in sample order afterwards
+		const v256s32 lo = _mm256_unpacklo_epi32(l, r);
+		const v256s32 hi = _mm256_unpackhi_epi32(l, r);
+		v256s32 *out = (v256s32 *)(dst + (i << 1));
+		_mm256_storeu_si256(out + 0, _mm256_add_epi32(_mm256_loadu_si256(out + 0), _mm256_permute2x128_si256(lo, hi, 0x20)));
+		_mm256_storeu_si256(out + 1, _mm256_add_epi32(_mm256_loadu_si256(out + 1), _mm256_permute2x128_si256(lo, hi, 0x31)));
+	}
+#elif defined(ENABLE_SSE2)
+	const v128s32 shift128 = _mm_cvtsi32_si128(shift);
+	for (; i + 4 <= count; i += 4)
+	{
+		v128s32 d = _mm_loadu_si128((v128s32 *)(data + i));
+		if (vol != 127) d = spumuldiv7_SSE2(d, vol);
+		d = _mm_sra_epi32(d, shift128);
+
+		v128s32 l, r;
+		switch (CHANNELS)
+		{
+			case 0: l = d; r = _mm_setzero_si128(); break;
+			case 2: l = _mm_setzero_si128(); r = d; break;
+			default: l = spumuldiv7_SSE2(d, panL); r = spumuldiv7_SSE2(d, panR); break;
+		}
+
+		v128s32 *out = (v128s32 *)(dst + (i << 1));
+		_mm_storeu_si128(out + 0, _mm_add_epi32(_mm_loadu_si128(out + 0), _mm_unpacklo_epi32(l, r)));
+		_mm_storeu_si128(out + 1, _mm_add_epi32(_mm_loadu_si128(out + 1), _mm_unpackhi_epi32(l, r)));
+	}
+#endif
+
+	for (; i < count; i++)
+	{
+		const s32 d = spumuldiv7(data[i], vol) >> shift;
+		switch (CHANNELS)
+		{
+			case 0: dst[(i << 1) + 0] += d; break;
+			case 2: dst[(i << 1) + 1] += d; break;
+			default:
+				dst[(i << 1) + 0] += spumuldiv7(d, panL);
+				dst[(i << 1) + 1] += spumuldiv7(d, panR);
+				break;
+		}
+	}
 }
 
-static FORCEINLINE void MixLR(SPU_struct* SPU, channel_struct *chan, s32 data)
+// Master volume and the conversion to 16-bit output. The saturating pack clamps to the same range as MinMax.
+static void SPU_MixMasterVolume(SPU_struct* const SPU, const u8 vol, const u32 count)
 {
-	data = spumuldiv7(data, chan->vol) >> volume_shift[chan->volumeDiv];
-	SPU->sndbuf[SPU->bufpos<<1] += spumuldiv7(data, 127 - chan->pan);
-	SPU->sndbuf[(SPU->bufpos<<1)+1] += spumuldiv7(data, chan->pan);
+	s32 *src = SPU->sndbuf;
+	s16 *dst = SPU->outbuf;
+	u32 i = 0;
+
+#if defined(ENABLE_SSE2)
+	for (; i + 8 <= count; i += 8)
+	{
+		v128s32 a = _mm_loadu_si128((v128s32 *)(src + i + 0));
+		v128s32 b = _mm_loadu_si128((v128s32 *)(src + i + 4));
+		if (vol != 127)
+		{
+			a = spumuldiv7_SSE2(a, vol);
+			b = spumuldiv7_SSE2(b, vol);
+			_mm_storeu_si128((v128s32 *)(src + i + 0), a);
+			_mm_storeu_si128((v128s32 *)(src + i + 4), b);
+		}
+		_mm_storeu_si128((v128s16 *)(dst + i), _mm_packs_epi32(a, b));
+	}
+#endif
+
+	for (; i < count; i++)
+	{
+		src[i] = spumuldiv7(src[i], vol);
+		dst[i] = MinMax(src[i], -0x8000, 0x7FFF);
+	}
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -1261,21 +1376,15 @@ static FORCEINLINE void TestForLoop2(SPU_struct *SPU, channel_struct *chan)
 	}
 }
 
-template<int CHANNELS> FORCEINLINE static void SPU_Mix(SPU_struct* SPU, channel_struct *chan, s32 data)
-{
-	switch(CHANNELS)
-	{
-		case 0: MixL(SPU, chan, data); break;
-		case 1: MixLR(SPU, chan, data); break;
-		case 2: MixR(SPU, chan, data); break;
-	}
-	SPU->lastdata = data;
-}
-
 //WORK
 template<int FORMAT, SPUInterpolationMode INTERPOLATE_MODE, int CHANNELS> 
 	FORCEINLINE static void ____SPU_ChanUpdate(SPU_struct* const SPU, channel_struct* const chan)
 {
+	//decode first, then mix the decoded block in one go.
+	//the samples land in consecutive sndbuf slots from here, a key off just ends the block early.
+	const u32 mixpos = SPU->bufpos;
+	u32 mixcount = 0;
+
 	for (; SPU->bufpos < SPU->buflength; SPU->bufpos++)
 	{
 		if(CHANNELS != -1)
@@ -1288,7 +1397,7 @@ template<int FORMAT, SPUInterpolationMode INTERPOLATE_MODE, int CHANNELS>
 				case 2: FetchADPCMData<INTERPOLATE_MODE>(chan, &data); break;
 				case 3: FetchPSGData(chan, &data); break;
 			}
-			SPU_Mix<CHANNELS>(SPU, chan, data);
+			SPU->chanbuf[mixcount++] = data;
 		}
 
 		switch(FORMAT) {
@@ -1297,6 +1406,12 @@ template<int FORMAT, SPUInterpolationMode INTERPOLATE_MODE, int CHANNELS>
 			case 3: chan->sampcnt += chan->sampinc; break;
 		}
 	}
+
+	if(CHANNELS != -1 && mixcount > 0)
+	{
+		SPU_MixBlock<CHANNELS>(SPU, chan, mixpos, mixcount);
+		SPU->lastdata = SPU->chanbuf[mixcount - 1];
+	}
 }
 
 template<int FORMAT, SPUInterpolationMode INTERPOLATE_MODE> 
@@ -1639,13 +1754,7 @@ static void SPU_MixAudio(bool actuallyMix, SPU_struct *SPU, int length)
 
 	// convert from 32-bit->16-bit
 	if (actuallyMix && speakers)
-		for (int i = 0; i < length*2; i++)
-		{
-			// Apply Master Volume
-			SPU->sndbuf[i] = spumuldiv7(SPU->sndbuf[i], vol);
-			s16 outsample = MinMax(SPU->sndbuf[i],-0x8000,0x7FFF);
-			SPU->outbuf[i] = outsample;
-		}
+		SPU_MixMasterVolume(SPU, vol, length*2);
 
 
 }
@@ -1659,6 +1768,7 @@ static void SPU_MixAudio(bool actuallyMix, SPU_struct *SPU, int length)
 int spu_core_samples = 0;
 void SPU_Emulate_core()
 {
+	NDS_ProfileScope profileScope(NDS_PROFILE_SPU_EMULATE);
 	bool needToMix = true;
 	SoundInterface_struct *soundProcessor = SPU_SoundCore();
 	
@@ -151,6 +151,7 @@ public:
    s32 *sndbuf;
    s32 lastdata; //the last sample that a channel generated
    s16 *outbuf;
+   s32 *chanbuf; //one channel's decoded samples, waiting to be mixed into sndbuf
    u32 bufsize;
    channel_struct channels[16];
 
@@ -30,6 +30,11 @@
 #include <errno.h>
 #include <unistd.h>
 #include <stddef.h>
+#include <dlfcn.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <link.h>
+#endif
 #define HAVE_STATIC_CODE_BUFFER
 #endif
 
@@ -42,6 +47,13 @@
 #include "MMU_timing.h"
 #include "arm_jit.h"
 #include "bios.h"
+#include "emufile.h"
+#include "NDSSystem.h"
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
 
 #define LOG_JIT_LEVEL 0
 #define PROFILER_JIT_LEVEL 0
@@ -192,6 +204,85 @@ DS_ALIGN(4096) uintptr_t compiled_funcs[1<<26] = {0};
 
 static u8 recompile_counts[(1<<26)/16];
 
+//-----------------------------------------------------------------------------
+//   Code page tracking
+//-----------------------------------------------------------------------------
+// Every page with a bit in jit_code_pages keeps a list of the blocks whose
+// opcodes lie in it, as the range of slots they cover there. A write to such a
+// page drops only the blocks that overlap it, so new code copied next to old
+// code leaves the old blocks alone. A block spanning two pages is listed in
+// both; whichever copy a write finds first clears the block's entry point, and
+// the other is dropped the next time it is hit or replaced.
+
+struct JIT_PAGE_BLOCK
+{
+	u32 lo, hi;		// slots of the page the block's opcodes occupy
+	u32 head;		// slot of the block's entry point
+};
+
+u32 jit_code_pages[(JIT_CODE_PAGES + 31) / 32];
+static std::vector<JIT_PAGE_BLOCK> jit_page_blocks[JIT_CODE_PAGES];
+static JitCodeStats jit_code_stats;
+
+template<int PROCNUM>
+static void jit_track_block(u32 adr, u32 bytes)
+{
+	const u32 head = JIT_SLOT(&JIT_COMPILED_FUNC(adr, PROCNUM));
+	const u32 end = adr + bytes;
+	while(adr < end)
+	{
+		const u32 next = std::min((adr | 0xFFF) + 1, end);
+		if(!JIT_MAPPED(adr & 0x0FFFFFFF, PROCNUM))
+			break;
+		JIT_PAGE_BLOCK entry;
+		entry.lo = JIT_SLOT(&JIT_COMPILED_FUNC(adr, PROCNUM));
+		entry.hi = entry.lo + ((next - adr - 1) >> 1);
+		entry.head = head;
+
+		const u32 page = entry.lo >> JIT_CODE_PAGE_SHIFT;
+		std::vector<JIT_PAGE_BLOCK> &blocks = jit_page_blocks[page];
+		size_t i = 0;
+		while(i < blocks.size() && blocks[i].head != head)
+			i++;
+		if(i < blocks.size())
+			blocks[i] = entry;
+		else
+			blocks.push_back(entry);
+		jit_code_pages[page >> 5] |= 1 << (page & 31);
+		adr = next;
+	}
+}
+
+void FASTCALL arm_jit_invalidate(u32 slot, u32 count)
+{
+	const u32 page = slot >> JIT_CODE_PAGE_SHIFT;
+	const u32 last = slot + count - 1;
+	std::vector<JIT_PAGE_BLOCK> &blocks = jit_page_blocks[page];
+	jit_code_stats.code_writes++;
+	for(size_t i = 0; i < blocks.size(); )
+	{
+		if(blocks[i].lo <= last && blocks[i].hi >= slot)
+		{
+			JIT_SLOT_BASE[blocks[i].head] = 0;
+			jit_code_stats.blocks_invalidated++;
+			blocks[i] = blocks.back();
+			blocks.pop_back();
+		}
+		else
+			i++;
+	}
+	if(blocks.empty())
+		jit_code_pages[page >> 5] &= ~(1 << (page & 31));
+}
+
+static void jit_track_reset()
+{
+	for(u32 page = 0; page < JIT_CODE_PAGES; page++)
+		if(jit_code_pages[page >> 5] & (1 << (page & 31)))
+			jit_page_blocks[page].clear();
+	memset(jit_code_pages, 0, sizeof(jit_code_pages));
+}
+
 #ifdef HAVE_STATIC_CODE_BUFFER
 // On x86_64, allocate jitted code from a static buffer to ensure that it's within 2GB of .text
 // Allows call instructions to use pcrel offsets, as opposed to slower indirect calls.
@@ -201,11 +292,386 @@ static u8 recompile_counts[(1<<26)/16];
 DS_ALIGN(4096) static u8 scratchpad[1<<25];
 static u8 *scratchptr;
 
+// Where the host allows it, the scratchpad is backed by a memfd mapped twice:
+// read+exec at scratchpad itself, where blocks run, and read+write somewhere
+// else, where they are written. No page is ever writable and executable at
+// once. Everything else keeps dealing in scratchpad addresses (relocations,
+// links, regions); jit_rw() turns one into the address to write through.
+// Otherwise both views are the same read+write+exec scratchpad.
+static u8 *scratchpad_rw = scratchpad;
+
+template<typename T>
+static FORCEINLINE T* jit_rw(T *p)
+{
+	return (T*)((u8*)p + (scratchpad_rw - scratchpad));
+}
+
+//-----------------------------------------------------------------------------
+//   Block linking
+//-----------------------------------------------------------------------------
+// Every block in the scratchpad is preceded by a JIT_LINK naming up to two
+// statically known successors (branch target and fall-through). A link points
+// at the successor's JIT_COMPILED_FUNC slot rather than at its code, so a code
+// write, a region eviction or arm_jit_reset clearing that slot unlinks it for
+// free, and a successor compiled later is picked up without patching anything.
+// Blocks still return to armJitExec, which follows the link itself: it has to
+// check the cycle limit, the sequencer and the other cpu between blocks anyway,
+// and doing so there skips the compile check and JIT_COMPILED_FUNC lookup
+// without patching jumps into code that cannot check any of that.
+
+#define JIT_LINK_NONE		0xFFFFFFFF
+#define JIT_LINK_SIZE		((sizeof(JIT_LINK) + 15) & ~15)
+
+struct JIT_LINK
+{
+	uintptr_t *slot[2];
+	u32 adr[2];
+	u32 thumb;
+	// the block that follows, so a region can be walked when it is evicted
+	u32 start;
+	u32 proc;
+	u32 size;
+};
+
+// reserve a cleared link record in front of the next block and return where its code goes
+static u8* jit_alloc_link()
+{
+	scratchptr = (u8*)(((uintptr_t)scratchptr + 15) & ~(uintptr_t)15);
+	memset(jit_rw(scratchptr), 0, JIT_LINK_SIZE);
+	scratchptr += JIT_LINK_SIZE;
+	return scratchptr;
+}
+
+static JIT_LINK* jit_link_of(ArmOpCompiled f)
+{
+	if((u8*)f < scratchpad || (u8*)f >= scratchpad+sizeof(scratchpad))
+		return NULL;
+	return (JIT_LINK*)((u8*)f - JIT_LINK_SIZE);
+}
+
+//-----------------------------------------------------------------------------
+//   Code buffer regions
+//-----------------------------------------------------------------------------
+// The scratchpad is split into JIT_REGION_COUNT regions that are filled one
+// after the other. Once the last one is full, the oldest region is evicted and
+// filled again, so a full buffer costs one region's worth of recompiles rather
+// than every block of both cpus. Evicting a block clears its JIT_COMPILED_FUNC
+// slot unless a code write or a newer compile has already replaced it, and
+// takes back the recompile_counts tick it was compiled with, so blocks that
+// merely got old are never mistaken for self-modifying code.
+
+#define JIT_REGION_COUNT	8
+#define JIT_REGION_SIZE		(sizeof(scratchpad) / JIT_REGION_COUNT)
+
+static u8 *jit_region_end[JIT_REGION_COUNT];	// end of the last block in each region, NULL if empty
+static int jit_region = 0;						// region currently being filled
+static u8 jit_evicted[(1<<26)/64];				// one bit per recompile_counts entry that lost a block to eviction
+
+static void jit_region_evict(int region)
+{
+	u8 *p = scratchpad + region * JIT_REGION_SIZE;
+	u8 *end = jit_region_end[region];
+	if(!end)
+		return;
+
+	u32 blocks = 0;
+	while(p < end)
+	{
+		JIT_LINK *link = (JIT_LINK*)p;
+		u8 *code = p + JIT_LINK_SIZE;
+		const u32 adr = link->start;
+		const int proc = link->proc;
+		if(JIT_MAPPED(adr & 0x0FFFFFFF, proc) && JIT_COMPILED_FUNC(adr, proc) == (uintptr_t)code)
+		{
+			JIT_COMPILED_FUNC(adr, proc) = 0;
+
+			u32 mask_adr = (adr & 0x07FFFFFE) >> 4;
+			if((recompile_counts[mask_adr >> 1] >> 4*(mask_adr & 1)) & 0xF)
+				recompile_counts[mask_adr >> 1] -= 1 << 4*(mask_adr & 1);
+			jit_evicted[mask_adr >> 3] |= 1 << (mask_adr & 7);
+			blocks++;
+		}
+		p = (u8*)(((uintptr_t)code + link->size + 15) & ~(uintptr_t)15);
+	}
+
+	jit_region_end[region] = NULL;
+	jit_code_stats.evictions++;
+	jit_code_stats.blocks_evicted += blocks;
+}
+
+// make room for a block of the given size, moving on to the next region (and evicting it) if the current one is full
+static bool jit_region_reserve(uintptr_t size)
+{
+	const uintptr_t needed = size + JIT_LINK_SIZE + 15;
+	if(needed > JIT_REGION_SIZE)
+		return false;
+	if(needed <= (uintptr_t)(scratchpad + (jit_region+1) * JIT_REGION_SIZE - scratchptr))
+		return true;
+
+	jit_region_end[jit_region] = scratchptr;
+	jit_region = (jit_region + 1) % JIT_REGION_COUNT;
+	jit_region_evict(jit_region);
+	scratchptr = scratchpad + jit_region * JIT_REGION_SIZE;
+	return true;
+}
+
+static void jit_region_reset()
+{
+	scratchptr = scratchpad;
+	jit_region = 0;
+	memset(jit_region_end, 0, sizeof(jit_region_end));
+	memset(jit_evicted, 0, sizeof(jit_evicted));
+}
+
+//-----------------------------------------------------------------------------
+//   Persistent block cache
+//-----------------------------------------------------------------------------
+// Compiled blocks are saved per ROM along with AsmJit's relocation records, so
+// a warm start can copy them back into the scratchpad at any offset instead of
+// running the compiler. A block is only reused if the opcodes it was built from
+// still hash the same and it was compiled with the same settings. Every address
+// a block uses (calls, and pointers to emulator state, which the emitter loads
+// with imm_ptr() so the assembler records where they are) is saved relative to
+// the image it lies in, so the blocks survive this binary or a library being
+// loaded somewhere else, as ASLR does on every run. Blocks using any other
+// address (heap memory) are not saved. A cache file written by a build with a
+// different layout is rejected outright (see jit_cache_layout()).
+
+#define JIT_CACHE_MAGIC		0x434A5344 // "DSJC"
+#define JIT_CACHE_VERSION	4
+#define JIT_CACHE_LAYOUT	6
+#define JIT_CACHE_HASH_INIT	2166136261u
+
+// what a relocation's value is relative to
+#define JIT_CACHE_SYM_NONE	0xFFFFFFFF	// nothing: the value is used as it is
+#define JIT_CACHE_SYM_IMAGE	0xFFFFFFFE	// the start of this binary's image
+										// anything else indexes jit_cache_symbols
+
+struct JIT_CACHE_RELOC
+{
+	u32 type;
+	u32 size;
+	u32 offset;
+	u32 sym;
+	u64 value;		// target relative to sym, or displacement from block start for kRelocRelToAbs
+};
+
+struct JIT_CACHE_BLOCK
+{
+	JIT_CACHE_BLOCK() : count(0), opcode_hash(0), reserve(0) { next[0] = next[1] = JIT_LINK_NONE; }
+
+	u32 count;		// number of source opcodes
+	u32 opcode_hash;
+	u32 next[2];	// statically known successors, for the block's JIT_LINK
+	u32 reserve;	// scratchpad bytes needed, including possible trampolines
+	std::vector<u8> code;
+	std::vector<JIT_CACHE_RELOC> relocs;
+};
+
+static std::map<u64, JIT_CACHE_BLOCK> jit_cache;
+static std::string jit_cache_filename;
+static bool jit_cache_dirty = false;
+static JIT_CACHE_BLOCK *jit_cache_pending = NULL;
+static JitCacheStats jit_cache_stats;
+
+// dynamic symbols named by the relocations of the open cache, and where they are in this process (0 if missing)
+static std::vector<std::string> jit_cache_symbols;
+static std::vector<uintptr_t> jit_cache_symbol_adr;
+
+static uintptr_t jit_image_base()
+{
+	static uintptr_t base = 0;
+	Dl_info info;
+	if(!base && dladdr((void*)&NDS_ARM9, &info))
+		base = (uintptr_t)info.dli_fbase;
+	return base;
+}
+
+#if defined(__linux__) && defined(NT_GNU_BUILD_ID)
+struct JIT_BUILD_ID
+{
+	uintptr_t adr;	// any address within the image
+	std::vector<u8> id;
+};
+
+static int jit_image_build_id_note(struct dl_phdr_info *info, size_t, void *data)
+{
+	JIT_BUILD_ID *search = (JIT_BUILD_ID*)data;
+	bool mine = false;
+	for(int i = 0; i < info->dlpi_phnum && !mine; i++)
+	{
+		const ElfW(Phdr) &ph = info->dlpi_phdr[i];
+		mine = ph.p_type == PT_LOAD && search->adr - (info->dlpi_addr + ph.p_vaddr) < ph.p_memsz;
+	}
+	if(!mine)
+		return 0;
+
+	for(int i = 0; i < info->dlpi_phnum; i++)
+	{
+		const ElfW(Phdr) &ph = info->dlpi_phdr[i];
+		if(ph.p_type != PT_NOTE)
+			continue;
+		const u8 *p = (const u8*)(info->dlpi_addr + ph.p_vaddr);
+		const u8 *end = p + ph.p_memsz;
+		while(p + sizeof(ElfW(Nhdr)) <= end)
+		{
+			const ElfW(Nhdr) *note = (const ElfW(Nhdr)*)p;
+			const u8 *desc = p + sizeof(ElfW(Nhdr)) + ((note->n_namesz + 3) & ~3);
+			if(note->n_type == NT_GNU_BUILD_ID && note->n_namesz == 4 && !memcmp(note + 1, "GNU", 4) && desc + note->n_descsz <= end)
+			{
+				search->id.assign(desc, desc + note->n_descsz);
+				return 1;
+			}
+			p = desc + ((note->n_descsz + 3) & ~3);
+		}
+	}
+	return 1;
+}
+#endif
+
+// the linker's build id of this binary's image: it changes whenever the code or data the blocks point into may have
+// moved. empty if the image has none
+static std::vector<u8> jit_image_build_id()
+{
+#if defined(__linux__) && defined(NT_GNU_BUILD_ID)
+	JIT_BUILD_ID search;
+	search.adr = (uintptr_t)&NDS_ARM9;
+	dl_iterate_phdr(jit_image_build_id_note, &search);
+	return search.id;
+#else
+	return std::vector<u8>();
+#endif
+}
+
+// express adr relative to the image it lies in: this binary, or else the dynamic symbol nearest below it
+static bool jit_cache_rebase(uintptr_t adr, JIT_CACHE_RELOC *r)
+{
+	Dl_info info;
+	if(!dladdr((void*)adr, &info) || !info.dli_fbase)
+		return false;
+	if((uintptr_t)info.dli_fbase == jit_image_base())
+	{
+		r->sym = JIT_CACHE_SYM_IMAGE;
+		r->value = adr - jit_image_base();
+		return true;
+	}
+	if(!info.dli_sname || !info.dli_saddr)
+		return false;
+
+	const std::string name = info.dli_sname;
+	u32 sym = 0;
+	while(sym < jit_cache_symbols.size() && jit_cache_symbols[sym] != name)
+		sym++;
+	if(sym == jit_cache_symbols.size())
+	{
+		jit_cache_symbols.push_back(name);
+		jit_cache_symbol_adr.push_back((uintptr_t)info.dli_saddr);
+	}
+	r->sym = sym;
+	r->value = adr - (uintptr_t)info.dli_saddr;
+	return true;
+}
+
+// where a relocation points in this process
+static bool jit_cache_resolve(const JIT_CACHE_RELOC &r, uintptr_t *adr)
+{
+	if(r.sym == JIT_CACHE_SYM_NONE)
+		*adr = (uintptr_t)r.value;
+	else if(r.sym == JIT_CACHE_SYM_IMAGE)
+		*adr = jit_image_base() + (uintptr_t)r.value;
+	else if(r.sym < jit_cache_symbol_adr.size() && jit_cache_symbol_adr[r.sym])
+		*adr = jit_cache_symbol_adr[r.sym] + (uintptr_t)r.value;
+	else
+		return false;
+	return true;
+}
+
+// record the block being relocated for the cache, or leave its code empty if it cannot be saved
+static void jit_cache_capture(JIT_CACHE_BLOCK *block, Assembler *assembler)
+{
+	const PodVector<Assembler::RelocData> &relocs = assembler->getRelocData();
+	const PodVector<uint32_t> &ptrs = assembler->getPtrImmData();
+	const u8 *code = assembler->getCode();
+
+	block->reserve = (u32)assembler->getCodeSize();
+	block->code.assign(code, code + assembler->getOffset());
+	block->relocs.clear();
+	for(size_t i = 0; i < relocs.getLength(); i++)
+	{
+		const Assembler::RelocData &r = relocs[i];
+		JIT_CACHE_RELOC reloc;
+		reloc.type = r.type;
+		reloc.size = r.size;
+		reloc.offset = (u32)r.offset;
+		reloc.sym = JIT_CACHE_SYM_NONE;
+		if(r.type == kRelocRelToAbs)
+			reloc.value = (u64)r.destination;
+		else if(!jit_cache_rebase((uintptr_t)r.address, &reloc))
+		{
+			block->code.clear();
+			return;
+		}
+		block->relocs.push_back(reloc);
+	}
+	for(size_t i = 0; i < ptrs.getLength(); i++)
+	{
+		u64 value;
+		memcpy(&value, code + ptrs[i], 8);
+		value = LE_TO_LOCAL_64(value);
+
+		JIT_CACHE_RELOC reloc;
+		reloc.type = kRelocAbsToAbs;
+		reloc.size = 8;
+		reloc.offset = ptrs[i];
+		if(!jit_cache_rebase((uintptr_t)value, &reloc))
+		{
+			block->code.clear();
+			return;
+		}
+		block->relocs.push_back(reloc);
+	}
+}
+
+// map a memfd read+exec over the scratchpad (keeping it within reach of .text) and read+write at scratchpad_rw
+static bool jit_map_dual()
+{
+#if defined(__linux__) && defined(SYS_memfd_create)
+	if((uintptr_t)scratchpad & (sysconf(_SC_PAGESIZE) - 1))
+		return false;
+
+	int fd = (int)syscall(SYS_memfd_create, "desmume-jit", 0);
+	if(fd < 0)
+		return false;
+	bool ok = false;
+	if(ftruncate(fd, sizeof(scratchpad)) == 0)
+	{
+		void *rw = mmap(NULL, sizeof(scratchpad), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+		if(rw != MAP_FAILED)
+		{
+			if(mmap(scratchpad, sizeof(scratchpad), PROT_READ|PROT_EXEC, MAP_SHARED|MAP_FIXED, fd, 0) != MAP_FAILED)
+			{
+				scratchpad_rw = (u8*)rw;
+				ok = true;
+			}
+			else
+				munmap(rw, sizeof(scratchpad));
+		}
+	}
+	close(fd);
+	return ok;
+#else
+	return false;
+#endif
+}
+
 struct ASMJIT_API StaticCodeGenerator : public Context
 {
 	StaticCodeGenerator()
 	{
 		scratchptr = scratchpad;
+		if(jit_map_dual())
+			return;
+
 		int align = (uintptr_t)scratchpad & (sysconf(_SC_PAGESIZE) - 1);
 		int err = mprotect(scratchpad-align, sizeof(scratchpad)+align, PROT_READ|PROT_WRITE|PROT_EXEC);
 		if(err)
@@ -223,16 +689,17 @@ struct ASMJIT_API StaticCodeGenerator : public Context
 			*dest = NULL;
 			return kErrorNoFunction;
 		}
-		if(size > (uintptr_t)(scratchpad+sizeof(scratchpad)-scratchptr))
+		if(!jit_region_reserve(size))
 		{
-			fprintf(stderr, "Out of memory for asmjit. Clearing code cache.\n");
-			arm_jit_reset(1);
-			// If arm_jit_reset didn't involve recompiling op_cmp, we could keep the current function.
+			fprintf(stderr, "Block too large for a code buffer region (%u bytes).\n", (u32)size);
 			*dest = NULL;
-			return kErrorOk;
+			return kErrorNoHeapMemory;
 		}
-		void *p = scratchptr;
-		size = assembler->relocCode(p);
+		void *p = jit_alloc_link();
+		size = assembler->relocCode(jit_rw(p), (sysuint_t)p);
+		jit_rw(jit_link_of((ArmOpCompiled)p))->size = (u32)size;
+		if(jit_cache_pending)
+			jit_cache_capture(jit_cache_pending, assembler);
 		scratchptr += size;
 		*dest = p;
 		return kErrorOk;
@@ -2140,6 +2607,7 @@ static LDM_INLINE FASTCALL u32 OP_LDM_STM_other(u32 adr, u64 regs, int n)
 	cycles = n * MMU_memAccessCycles<PROCNUM,32,store?MMU_AD_WRITE:MMU_AD_READ>(adr);
 #endif
 	do {
+		MMU_syncShared(PROCNUM, MMU_AT_DATA, adr);
 		if(PROCNUM==ARMCPU_ARM9)
 			if(store) _MMU_ARM9_write32(adr, cpu->R[regs&0xF]);
 			else cpu->R[regs&0xF] = _MMU_ARM9_read32(adr);
@@ -2217,6 +2685,12 @@ static u32 FASTCALL OP_LDM_STM(u32 adr, u64 regs, int n)
 	{
 		ptr = MMU.MAIN_MEM + (adr & _MMU_MAIN_MEM_MASK32);
 		cycles = n * ((PROCNUM==ARMCPU_ARM9) ? 4 : 2);
+		if(store)
+		{
+			// the transfer stays within one 16KB page, but may still straddle a dirty tracking page
+			MMU_mainMemMarkDirty(adr);
+			MMU_mainMemMarkDirty(adr + (dir>0 ? (n-1)*4 : -(n-1)*4));
+		}
 	}
 	else if(PROCNUM==ARMCPU_ARM7 && !store && (adr & 0xFF800000) == 0x03800000)
 	{
@@ -2228,6 +2702,13 @@ static u32 FASTCALL OP_LDM_STM(u32 adr, u64 regs, int n)
 		ptr = MMU.SWIRAM + (adr & 0x7FFC);
 		cycles = n;
 	}
+	else if(!store && !(((adr & ~3) ^ ((adr & ~3) + (dir>0 ? (n-1)*4 : -(n-1)*4))) & ~MMU_PAGE_MASK)
+	        && (ptr = MMU_readPage(PROCNUM, MMU_AT_DATA, adr & ~3)) != NULL)
+	{
+		// any other plain memory the page tables know about, as long as the transfer stays within one page
+		ptr += adr & (MMU_PAGE_MASK & ~3);
+		cycles = n * MMU_memAccessCycles<PROCNUM,32,MMU_AD_READ>(adr & ~3);
+	}
 	else
 		return OP_LDM_STM_other<PROCNUM, store, dir>(adr, regs, n);
 
@@ -2568,7 +3049,7 @@ static int OP_MCR(const u32 i)
 	GpVar bb_cp15 = c.newGpVar(kX86VarTypeGpz);
 	GpVar data = c.newGpVar(kX86VarTypeGpd);
 	c.mov(data, reg_pos_ptr(12));
-	c.mov(bb_cp15, (uintptr_t)&cp15);
+	c.mov(bb_cp15, imm_ptr(&cp15));
 
 	bool bUnknown = false;
 	switch(CRn)
@@ -2580,7 +3061,7 @@ static int OP_MCR(const u32 i)
 				// On the NDS bit0,2,7,12..19 are R/W, Bit3..6 are always set, all other bits are always zero.
 				//MMU.ARM9_RW_MODE = BIT7(val);
 				GpVar bb_mmu = c.newGpVar(kX86VarTypeGpz);
-				c.mov(bb_mmu, (uintptr_t)&MMU);
+				c.mov(bb_mmu, imm_ptr(&MMU));
 				Mem rwmode = mmu_ptr_byte(ARM9_RW_MODE);
 				Mem ldtbit = cpu_ptr_byte(LDTBit, 0);
 				c.test(data, (1<<7));
@@ -2705,10 +3186,10 @@ static int OP_MCR(const u32 i)
 								{
 									//MMU.DTCMRegion = DTCMRegion = val & 0x0FFFF000;
 									c.and_(data, 0x0FFFF000);
-									GpVar bb_mmu = c.newGpVar(kX86VarTypeGpz);
-									c.mov(bb_mmu, (uintptr_t)&MMU);
-									c.mov(mmu_ptr(DTCMRegion), data);
 									c.mov(cp15_ptr(DTCMRegion), data);
+									X86CompilerFuncCall* ctx = c.call((void*)MMU_SetDTCMRegion);
+									ctx->setPrototype(kX86FuncConvDefault, FuncBuilder1<Void, u32>());
+									ctx->setArgument(0, data);
 								}
 								break;
 							case 1:
@@ -2716,7 +3197,7 @@ static int OP_MCR(const u32 i)
 									//ITCMRegion = val;
 									//ITCM base is not writeable!
 									GpVar bb_mmu = c.newGpVar(kX86VarTypeGpz);
-									c.mov(bb_mmu, (uintptr_t)&MMU);
+									c.mov(bb_mmu, imm_ptr(&MMU));
 									c.mov(mmu_ptr(ITCMRegion), 0);
 									c.mov(cp15_ptr(ITCMRegion), data);
 								}
@@ -2768,7 +3249,7 @@ static int OP_MRC(const u32 i)
 	GpVar bb_cp15 = c.newGpVar(kX86VarTypeGpz);
 	GpVar data = c.newGpVar(kX86VarTypeGpd);
 
-	c.mov(bb_cp15, (uintptr_t)&cp15);
+	c.mov(bb_cp15, imm_ptr(&cp15));
 	
 	bool bUnknown = false;
 	switch(CRn)
@@ -4068,89 +4549,1168 @@ static void _armlog(u8 proc, u32 addr, u32 opcode)
 #endif
 }
 
-template<int PROCNUM>
-static u32 compile_basicblock()
+// FNV-1a over the opcode's bytes, seeded with JIT_CACHE_HASH_INIT
+static u32 jit_cache_hash_opcode(u32 hash, u32 opcode, int size)
 {
-#if LOG_JIT
-	bool has_variable_cycles = FALSE;
-#endif
-	u32 interpreted_cycles = 0;
-	u32 start_adr = cpu->instruct_adr;
-	u32 opcode = 0;
-	
-	bb_thumb = cpu->CPSR.bits.T;
-	bb_opcodesize = bb_thumb ? 2 : 4;
+	for(int i = 0; i < size; i++)
+		hash = (hash ^ ((opcode >> (i*8)) & 0xFF)) * 16777619;
+	return hash;
+}
 
-	if (!JIT_MAPPED(start_adr & 0x0FFFFFFF, PROCNUM))
+// statically known successors of a block ending with opcode at bb_adr
+static void block_successors(u32 opcode, u32 prev_opcode, u32 *next)
+{
+	next[0] = next[1] = JIT_LINK_NONE;
+	if(!instr_is_branch(opcode))
 	{
-		printf("JIT: use unmapped memory address %08X\n", start_adr);
-		execute = false;
-		return 1;
+		next[0] = bb_next_instruction;
+		return;
 	}
 
-#if LOG_JIT
-	fprintf(stderr, "adr %08Xh %s%c\n", start_adr, ARMPROC.CPSR.bits.T ? "THUMB":"ARM", PROCNUM?'7':'9');
+	if(bb_thumb)
+	{
+		if((opcode & 0xF000) == 0xD000 && ((opcode>>8) & 0xF) < 0xE)
+		{
+			// B<cond>
+			next[0] = bb_r15 + ((s32)(s8)(opcode & 0xFF) << 1);
+			next[1] = bb_next_instruction;
+		}
+		else if((opcode & 0xF800) == 0xE000)
+			next[0] = bb_r15 + (((s32)(opcode << 21)) >> 20);	// B
+		else if((opcode & 0xF800) == 0xF800 && (prev_opcode & 0xF800) == 0xF000)
+			next[0] = bb_adr + 2 + (((s32)(prev_opcode << 21)) >> 9) + ((opcode & 0x7FF) << 1);	// BL pair
+	}
+	else if((opcode & 0x0E000000) == 0x0A000000 && CONDITION(opcode) != 0xF)
+	{
+		// B, BL (but not BLX, which switches to thumb)
+		next[0] = bb_r15 + (((s32)(opcode << 8)) >> 6);
+		if(CONDITION(opcode) != 0xE)
+			next[1] = bb_next_instruction;
+	}
+}
+
+#ifdef HAVE_STATIC_CODE_BUFFER
+template<int PROCNUM>
+static void jit_set_link(ArmOpCompiled f, u32 start, const u32 *next, bool thumb)
+{
+	JIT_LINK *link = jit_link_of(f);
+	if(!link)
+		return;
+
+	link = jit_rw(link);
+	link->start = start;
+	link->proc = PROCNUM;
+	link->thumb = thumb;
+	for(int i = 0; i < 2; i++)
+	{
+		link->adr[i] = next[i];
+		link->slot[i] = (next[i] != JIT_LINK_NONE && JIT_MAPPED(next[i] & 0x0FFFFFFF, PROCNUM))
+			? &JIT_COMPILED_FUNC(next[i], PROCNUM) : NULL;
+	}
+}
 #endif
 
-	c.clear();
-	c.newFunc(ASMJIT_CALL_CONV, FuncBuilder0<int>());
-	c.getFunc()->setHint(kFuncHintNaked, true);
-	c.getFunc()->setHint(kX86FuncHintPushPop, true);
-	
-	JIT_COMMENT("CPU ptr");
-	bb_cpu = c.newGpVar(kX86VarTypeGpz);
-	c.mov(bb_cpu, (uintptr_t)&ARMPROC);
+#ifdef HAVE_STATIC_CODE_BUFFER
+// the settings which change the code compiled for a block
+static u32 jit_cache_config()
+{
+	return (CommonSettings.jit_max_block_size & 0xFF)
+		| (CommonSettings.advanced_timing ? 0x100 : 0)
+		| (CommonSettings.rigorous_timing ? 0x200 : 0)
+		| (CommonSettings.jit_tier2_threshold ? 0x400 : 0);
+}
 
-	JIT_COMMENT("reset bb_total_cycles");
-	bb_total_cycles = c.newGpVar(kX86VarTypeGpz);
-	c.mov(bb_total_cycles, 0);
+static u64 jit_cache_key(int proc, bool thumb, u32 adr)
+{
+	return ((u64)jit_cache_config() << 34) | ((u64)proc << 33) | ((u64)thumb << 32) | adr;
+}
 
-#if (PROFILER_JIT_LEVEL > 0)
-	JIT_COMMENT("Profiler ptr");
-	bb_profiler = c.newGpVar(kX86VarTypeGpz);
-	c.mov(bb_profiler, (uintptr_t)&profiler_counter[PROCNUM]);
+// what the saved blocks depend on besides their settings: where a few things their relocations point at lie within
+// the image, the emitter's compiled-in options and the struct offsets it bakes into the code, and the image's build id
+// (the anchors alone would miss a rebuild that moves only what a block calls)
+static void jit_cache_layout(u64 *layout)
+{
+	static const u32 emitter[] = {
+		JIT_CACHE_VERSION, (u32)JIT_LINK_SIZE, PROFILER_JIT_LEVEL,
+#ifdef MAPPED_JIT_FUNCS
+		1,
+#else
+		0,
+#endif
+#ifdef ENABLE_ADVANCED_TIMING
+		1,
+#else
+		0,
+#endif
+		sizeof(armcpu_t), offsetof(armcpu_t, R), offsetof(armcpu_t, CPSR), offsetof(armcpu_t, SPSR),
+		offsetof(armcpu_t, instruct_adr), offsetof(armcpu_t, next_instruction), offsetof(armcpu_t, intVector),
+		offsetof(armcpu_t, LDTBit), offsetof(armcpu_t, freeze), offsetof(armcpu_t, cond_table),
+		sizeof(armcp15_t), offsetof(armcp15_t, ctrl), offsetof(armcp15_t, protectBaseSize),
+		sizeof(MMU_struct), offsetof(MMU_struct, ITCMRegion), offsetof(MMU_struct, ARM9_RW_MODE),
+	};
+
+	const uintptr_t base = jit_image_base();
+	layout[0] = (uintptr_t)&NDS_ARM9 - base;
+	layout[1] = (uintptr_t)&MMU - base;
+#ifdef MAPPED_JIT_FUNCS
+	layout[2] = (uintptr_t)&JIT - base;
+#else
+	layout[2] = (uintptr_t)compiled_funcs - base;
 #endif
+	layout[3] = (uintptr_t)arm_instructions_set[0][0] - base;
+	layout[4] = (uintptr_t)&NDS_Reschedule - base;
+	layout[5] = JIT_CACHE_HASH_INIT;
+	for(size_t i = 0; i < ARRAY_SIZE(emitter); i++)
+		layout[5] = jit_cache_hash_opcode((u32)layout[5], emitter[i], 4);
+	const std::vector<u8> build_id = jit_image_build_id();
+	for(size_t i = 0; i < build_id.size(); i++)
+		layout[5] = jit_cache_hash_opcode((u32)layout[5], build_id[i], 1);
+}
 
-	bb_constant_cycles = 0;
-	for(u32 i=0, bEndBlock = 0; bEndBlock == 0; i++)
+// copy a cached block into the scratchpad and apply its relocations, the same way relocCode() would
+static ArmOpCompiled jit_cache_map(const JIT_CACHE_BLOCK &block)
+{
+	if(block.code.empty() || !jit_region_reserve(block.reserve))
+		return NULL;
+
+	u8 *link = scratchptr;
+	u8 *dst = jit_alloc_link();
+	memcpy(jit_rw(dst), &block.code[0], block.code.size());
+	for(size_t i = 0; i < block.relocs.size(); i++)
 	{
-		bb_adr = start_adr + (i * bb_opcodesize);
-		if(bb_thumb)
-			opcode = _MMU_read16<PROCNUM, MMU_AT_CODE>(bb_adr);
-		else
-			opcode = _MMU_read32<PROCNUM, MMU_AT_CODE>(bb_adr);
+		const JIT_CACHE_RELOC &r = block.relocs[i];
+		sysint_t val;
+		uintptr_t target = 0;
+		if(r.type != kRelocRelToAbs && !jit_cache_resolve(r, &target))
+		{
+			scratchptr = link;
+			return NULL;
+		}
 
-#if LOG_JIT
-		char dasmbuf[1024] = {0};
-		if(bb_thumb)
-			des_thumb_instructions_set[opcode>>6](bb_adr, opcode, dasmbuf);
+		switch(r.type)
+		{
+			case kRelocAbsToAbs:
+				val = (sysint_t)target;
+				break;
+			case kRelocRelToAbs:
+				val = (sysint_t)((uintptr_t)dst + r.value);
+				break;
+			case kRelocAbsToRel:
+			case kRelocTrampoline:
+				val = (sysint_t)(target - ((uintptr_t)dst + r.offset + 4));
+				// blocks that needed a trampoline are not worth the trouble; just recompile them
+				if(!IntUtil::isInt32(val))
+				{
+					scratchptr = link;
+					return NULL;
+				}
+				break;
+			default:
+				scratchptr = link;
+				return NULL;
+		}
+
+		if(r.size == 4)
+			*(s32*)jit_rw(dst + r.offset) = (s32)val;
 		else
-			des_arm_instructions_set[INSTRUCTION_INDEX(opcode)](bb_adr, opcode, dasmbuf);
-		fprintf(stderr, "%08X\t%s\t\t; %s \n", bb_adr, dasmbuf, disassemble(opcode));
-#endif
+			*(s64*)jit_rw(dst + r.offset) = (s64)val;
+	}
 
-		u32 cycles = instr_cycles(opcode);
+	jit_rw(jit_link_of((ArmOpCompiled)dst))->size = (u32)block.code.size();
+	scratchptr += block.code.size();
+	return (ArmOpCompiled)dst;
+}
 
-		bEndBlock = instr_is_branch(opcode) || (i >= (CommonSettings.jit_max_block_size - 1));
-		
-#if LOG_JIT
-		if (instr_is_conditional(opcode) && (cycles > 1) || (cycles == 0))
-			has_variable_cycles = TRUE;
-#endif
-		bb_cycles = c.newGpVar(kX86VarTypeGpz);
+template<int PROCNUM>
+static ArmOpCompiled jit_cache_lookup(u32 adr)
+{
+	const bool thumb = cpu->CPSR.bits.T;
+	std::map<u64, JIT_CACHE_BLOCK>::iterator it = jit_cache.find(jit_cache_key(PROCNUM, thumb, adr));
+	if(it == jit_cache.end())
+	{
+		jit_cache_stats.misses++;
+		return NULL;
+	}
 
-		bb_constant_cycles += instr_is_conditional(opcode) ? 1 : cycles;
+	const JIT_CACHE_BLOCK &block = it->second;
+	const int size = thumb ? 2 : 4;
+	u32 hash = JIT_CACHE_HASH_INIT;
+	for(u32 i = 0; i < block.count; i++)
+	{
+		u32 opcode = thumb ? _MMU_read16<PROCNUM, MMU_AT_CODE>(adr + i*size) : _MMU_read32<PROCNUM, MMU_AT_CODE>(adr + i*size);
+		hash = jit_cache_hash_opcode(hash, opcode, size);
+	}
+	if(hash != block.opcode_hash)
+	{
+		jit_cache.erase(it);
+		jit_cache_dirty = true;
+		jit_cache_stats.stale++;
+		jit_cache_stats.misses++;
+		return NULL;
+	}
 
-		JIT_COMMENT("%s (PC:%08X)", disassemble(opcode), bb_adr);
+	ArmOpCompiled f = jit_cache_map(block);
+	if(f)
+	{
+		jit_set_link<PROCNUM>(f, adr, block.next, thumb);
+		jit_track_block<PROCNUM>(adr, block.count * size);
+		jit_cache_stats.hits++;
+	}
+	else
+		jit_cache_stats.misses++;
+	return f;
+}
 
-#if (PROFILER_JIT_LEVEL > 0)
-		JIT_COMMENT("*** profiler - counter");
-		if (bb_thumb)
+static void jit_cache_load()
+{
+	EMUFILE_FILE fp(jit_cache_filename, "rb");
+	if(!fp.is_open())
+		return;
+
+	u32 magic = 0, version = 0, romcrc = 0, count = 0;
+	u64 layout[JIT_CACHE_LAYOUT], file_layout[JIT_CACHE_LAYOUT];
+	jit_cache_layout(layout);
+
+	fp.read_32LE(magic);
+	fp.read_32LE(version);
+	fp.read_32LE(romcrc);
+	for(int i = 0; i < JIT_CACHE_LAYOUT; i++)
+		fp.read_64LE(file_layout[i]);
+	if(fp.fail() || magic != JIT_CACHE_MAGIC || version != JIT_CACHE_VERSION || romcrc != gameInfo.crc
+		|| memcmp(layout, file_layout, sizeof(layout)))
+	{
+		printf("JIT: ignoring stale block cache %s\n", jit_cache_filename.c_str());
+		jit_cache_dirty = true;
+		return;
+	}
+
+	u32 symbol_count = 0;
+	fp.read_32LE(symbol_count);
+	for(u32 i = 0; i < symbol_count && !fp.fail(); i++)
+	{
+		u32 len = 0;
+		fp.read_32LE(len);
+		if(len > 1024)
+			break;
+		std::string name(len, '\0');
+		if(len)
+			fp.fread(&name[0], len);
+		jit_cache_symbols.push_back(name);
+		jit_cache_symbol_adr.push_back((uintptr_t)dlsym(RTLD_DEFAULT, name.c_str()));
+	}
+	if(fp.fail() || jit_cache_symbols.size() != symbol_count)
+	{
+		jit_cache_symbols.clear();
+		jit_cache_symbol_adr.clear();
+		jit_cache_dirty = true;
+		return;
+	}
+
+	fp.read_32LE(count);
+	for(u32 n = 0; n < count && !fp.fail(); n++)
+	{
+		u64 key;
+		u32 code_size, reloc_count;
+		JIT_CACHE_BLOCK block;
+
+		fp.read_64LE(key);
+		fp.read_32LE(block.count);
+		fp.read_32LE(block.opcode_hash);
+		fp.read_32LE(block.next[0]);
+		fp.read_32LE(block.next[1]);
+		fp.read_32LE(block.reserve);
+		fp.read_32LE(code_size);
+		if(fp.fail() || code_size == 0 || code_size > block.reserve || block.reserve > sizeof(scratchpad))
+			break;
+		block.code.resize(code_size);
+		fp.fread(&block.code[0], code_size);
+		fp.read_32LE(reloc_count);
+		if(fp.fail() || reloc_count > code_size)
+			break;
+		bool corrupt = false;
+		block.relocs.resize(reloc_count);
+		for(u32 i = 0; i < reloc_count; i++)
+		{
+			JIT_CACHE_RELOC &r = block.relocs[i];
+			fp.read_32LE(r.type);
+			fp.read_32LE(r.size);
+			fp.read_32LE(r.offset);
+			fp.read_32LE(r.sym);
+			fp.read_64LE(r.value);
+			if(r.offset + r.size > code_size || (r.size != 4 && r.size != sizeof(sysint_t))
+				|| (r.sym < JIT_CACHE_SYM_IMAGE && r.sym >= symbol_count))
+				corrupt = true;
+		}
+		if(fp.fail() || corrupt)
+			break;
+		jit_cache[key] = block;
+	}
+
+	printf("JIT: loaded %u cached blocks from %s\n", (u32)jit_cache.size(), jit_cache_filename.c_str());
+}
+
+static void jit_cache_save()
+{
+	if(jit_cache_filename.empty() || !jit_cache_dirty)
+		return;
+
+	EMUFILE_FILE fp(jit_cache_filename, "wb");
+	if(!fp.is_open())
+	{
+		printf("JIT: could not write block cache %s\n", jit_cache_filename.c_str());
+		return;
+	}
+
+	u64 layout[JIT_CACHE_LAYOUT];
+	jit_cache_layout(layout);
+
+	fp.write_32LE((u32)JIT_CACHE_MAGIC);
+	fp.write_32LE((u32)JIT_CACHE_VERSION);
+	fp.write_32LE(gameInfo.crc);
+	for(int i = 0; i < JIT_CACHE_LAYOUT; i++)
+		fp.write_64LE(layout[i]);
+
+	fp.write_32LE((u32)jit_cache_symbols.size());
+	for(size_t i = 0; i < jit_cache_symbols.size(); i++)
+	{
+		fp.write_32LE((u32)jit_cache_symbols[i].size());
+		fp.fwrite(jit_cache_symbols[i].data(), jit_cache_symbols[i].size());
+	}
+
+	fp.write_32LE((u32)jit_cache.size());
+	for(std::map<u64, JIT_CACHE_BLOCK>::iterator it = jit_cache.begin(); it != jit_cache.end(); ++it)
+	{
+		const JIT_CACHE_BLOCK &block = it->second;
+		fp.write_64LE(it->first);
+		fp.write_32LE(block.count);
+		fp.write_32LE(block.opcode_hash);
+		fp.write_32LE(block.next[0]);
+		fp.write_32LE(block.next[1]);
+		fp.write_32LE(block.reserve);
+		fp.write_32LE((u32)block.code.size());
+		fp.fwrite(&block.code[0], block.code.size());
+		fp.write_32LE((u32)block.relocs.size());
+		for(size_t i = 0; i < block.relocs.size(); i++)
+		{
+			fp.write_32LE(block.relocs[i].type);
+			fp.write_32LE(block.relocs[i].size);
+			fp.write_32LE(block.relocs[i].offset);
+			fp.write_32LE(block.relocs[i].sym);
+			fp.write_64LE(block.relocs[i].value);
+		}
+	}
+
+	jit_cache_dirty = false;
+}
+
+// switch to the cache file for the current ROM, writing back the previous one.
+// calling this again with the same file (e.g. after a code buffer flush) keeps the loaded blocks.
+static void jit_cache_open(const std::string &filename)
+{
+	if(filename == jit_cache_filename)
+		return;
+
+	jit_cache_save();
+	jit_cache.clear();
+	jit_cache_symbols.clear();
+	jit_cache_symbol_adr.clear();
+	jit_cache_dirty = false;
+	memset(&jit_cache_stats, 0, sizeof(jit_cache_stats));
+
+	jit_cache_filename = filename;
+	if(!jit_cache_filename.empty())
+		jit_cache_load();
+}
+#endif
+
+//-----------------------------------------------------------------------------
+//   Tier 2
+//-----------------------------------------------------------------------------
+// With CommonSettings.jit_tier2_threshold set, every block compiled by the loop
+// below counts down a heat counter on entry and asks to be recompiled once it
+// runs out. The second tier keeps the guest registers touched by data processing
+// instructions in AsmJit variables for the whole block instead of going through
+// armcpu_t for each instruction, skips flag updates that are overwritten before
+// anything reads them, and folds registers holding known constants into
+// immediates. Everything else is still emitted by the first tier: loads and
+// stores only need the registers they read written back and the ones they write
+// reloaded, other instructions get all of them written back and reloaded.
+
+#define JIT_HEAT_BITS	12
+#define JIT_HEAT_SLOTS	(1 << JIT_HEAT_BITS)	// blocks whose addresses hash to the same counter share it, which only makes them hot sooner
+#define JIT_T2_MAX_OPS	128
+
+enum { T2_FALLBACK = 0, T2_MEM, T2_DATA };
+
+// flag bits, in the order of CPSR bits 31-28
+#define T2_N	8
+#define T2_Z	4
+#define T2_C	2
+#define T2_V	1
+
+struct JIT_T2_OP
+{
+	u8 kind;
+	u8 alu;				// ARM data processing opcode
+	u8 cond;
+	u8 imm;				// operand 2 is value, otherwise rm through the shifter
+	u8 rd, rn, rm;
+	u8 shift, amount;	// ARM immediate shift encoding: LSR/ASR #0 mean #32, ROR #0 is RRX
+	u8 value_carry;		// a rotated immediate sets C to its top bit
+	u8 flags_read, flags_written;
+	u8 live;			// flags that may be read after this instruction
+	u16 reads, writes;	// guest registers
+	u32 value;
+};
+
+static u32 jit_heat[JIT_HEAT_SLOTS];
+static std::set<u64> jit_tier2_pending;
+static JitTierStats jit_tier_stats;
+
+static bool bb_tier2;
+static JIT_T2_OP t2_ops[JIT_T2_MAX_OPS];
+static GpVar t2_reg[16];
+static u32 t2_valid, t2_dirty, t2_known;
+static u32 t2_value[16];
+
+static u64 jit_tier2_key(int proc, bool thumb, u32 adr)
+{
+	return ((u64)proc << 33) | ((u64)thumb << 32) | adr;
+}
+
+// The counters are keyed by the block's address rather than handed out as blocks
+// get compiled, so that a block recompiled after eviction or loaded from the block
+// cache picks up the same counter. arm_jit_reset() fills them all, and
+// jit_tier2_request() refills the one that ran out.
+static u32 jit_heat_slot(u32 adr)
+{
+	return ((adr ^ ((u32)PROCNUM << 31) ^ ((u32)bb_thumb << 30)) * 2654435761u) >> (32 - JIT_HEAT_BITS);
+}
+
+// called by a first tier block whose heat counter ran out
+static void FASTCALL jit_tier2_request(u32 adr, u32 info)
+{
+	const int proc = info & 1;
+	const u32 threshold = CommonSettings.jit_tier2_threshold;
+	jit_heat[info >> 2] = threshold ? threshold : 0xFFFFFFFF;
+	if(!threshold)
+		return;
+
+	jit_tier2_pending.insert(jit_tier2_key(proc, (info >> 1) & 1, adr));
+	JIT_COMPILED_FUNC(adr, proc) = 0;
+}
+
+static void emit_heat_counter(u32 start_adr)
+{
+	const u32 slot = jit_heat_slot(start_adr);
+
+	JIT_COMMENT("heat counter %u", slot);
+	GpVar heat = c.newGpVar(kX86VarTypeGpz);
+	Label warm = c.newLabel();
+	c.mov(heat, imm_ptr(&jit_heat[slot]));
+	c.sub(dword_ptr(heat), 1);
+	c.unuse(heat);
+	c.jnz(warm);
+	GpVar adr = c.newGpVar(kX86VarTypeGpd);
+	GpVar info = c.newGpVar(kX86VarTypeGpd);
+	c.mov(adr, start_adr);
+	c.mov(info, PROCNUM | (bb_thumb << 1) | (slot << 2));
+	X86CompilerFuncCall *ctx = c.call((void*)jit_tier2_request);
+	ctx->setPrototype(ASMJIT_CALL_CONV, FuncBuilder2<Void, u32, u32>());
+	ctx->setArgument(0, adr);
+	ctx->setArgument(1, info);
+	c.bind(warm);
+}
+
+static bool t2_alu_logical(u32 alu)
+{
+	return alu <= 1 || alu == 8 || alu == 9 || alu >= 12;
+}
+
+static void t2_set_data(JIT_T2_OP &op, u32 alu, bool s, u32 rd, u32 rn)
+{
+	op.kind = T2_DATA;
+	op.alu = alu;
+	op.rd = rd;
+	op.rn = rn;
+	if(alu != 13 && alu != 15)
+		op.reads |= 1 << rn;
+	if(!op.imm)
+		op.reads |= 1 << op.rm;
+	if(alu < 8 || alu > 11)
+		op.writes |= 1 << rd;
+
+	if(s)
+	{
+		if(!t2_alu_logical(alu))
+			op.flags_written = T2_N|T2_Z|T2_C|T2_V;
+		else if(op.imm ? op.value_carry : (op.shift != 0 || op.amount != 0))
+			op.flags_written = T2_N|T2_Z|T2_C;
+		else
+			op.flags_written = T2_N|T2_Z;
+	}
+	if(alu >= 5 && alu <= 7)
+		op.flags_read |= T2_C;
+	if(!op.imm && op.shift == 3 && op.amount == 0)
+		op.flags_read |= T2_C;
+}
+
+static void t2_set_mem(JIT_T2_OP &op, bool load, u32 rd, u32 reads, u32 writeback)
+{
+	op.kind = T2_MEM;
+	op.reads = (reads | (load ? 0 : 1 << rd)) & 0x7FFF;
+	op.writes = (writeback | (load ? 1 << rd : 0)) & 0x7FFF;
+}
+
+static void t2_decode_arm(u32 i, JIT_T2_OP &op)
+{
+	if(CONDITION(i) == 0xF)
+		return;
+
+	if((i & 0x0C000000) == 0 && ((i & 0x02000000) || !(i & 0x10)))
+	{
+		// data processing with an immediate or an immediate shifted register
+		const u32 alu = (i >> 21) & 0xF;
+		const bool s = BIT20(i);
+		if(alu >= 8 && alu <= 11 && !s)
+			return;
+		if(REG_POS(i,12) == 15 || REG_POS(i,16) == 15 || (!(i & 0x02000000) && REG_POS(i,0) == 15))
+			return;
+
+		op.cond = CONDITION(i);
+		op.imm = BIT25(i);
+		if(op.imm)
+		{
+			const u32 rot = ((i >> 8) & 0xF) * 2;
+			op.value = ROR(i & 0xFF, rot);
+			op.value_carry = rot != 0;
+		}
+		else
+		{
+			op.rm = REG_POS(i,0);
+			op.shift = (i >> 5) & 3;
+			op.amount = (i >> 7) & 0x1F;
+		}
+		t2_set_data(op, alu, s, REG_POS(i,12), REG_POS(i,16));
+		if(op.cond != 0xE)
+			op.flags_read = T2_N|T2_Z|T2_C|T2_V;
+		return;
+	}
+
+	if(CONDITION(i) != 0xE)
+		return;
+
+	const bool pre = BIT24(i), wb = BIT21(i), load = BIT20(i);
+	const u32 rd = REG_POS(i,12), rn = REG_POS(i,16), rm = REG_POS(i,0);
+	bool reg_offset;
+	if((i & 0x0C000000) == 0x04000000)
+	{
+		// LDR/STR/LDRB/STRB, but not the user mode forms
+		if((BIT25(i) && (i & 0x10)) || (!pre && wb))
+			return;
+		reg_offset = BIT25(i);
+	}
+	else if((i & 0x0E000090) == 0x00000090 && (i & 0x60))
+	{
+		// LDRH/STRH/LDRSB/LDRSH, but not LDRD/STRD
+		if((!load && ((i >> 5) & 3) != 1) || (!pre && wb))
+			return;
+		reg_offset = !BIT22(i);
+	}
+	else
+		return;
+
+	const bool writeback = !pre || wb;
+	if(rd == 15 || (reg_offset && rm == 15) || (rn == 15 && writeback))
+		return;
+	t2_set_mem(op, load, rd, (1 << rn) | (reg_offset ? 1 << rm : 0), writeback ? 1 << rn : 0);
+}
+
+static void t2_decode_thumb(u32 i, u32 adr, JIT_T2_OP &op)
+{
+	op.cond = 0xE;
+	op.imm = 1;
+
+	if(i < 0x1800)
+	{
+		// LSL/LSR/ASR rd, rs, #imm
+		op.imm = 0;
+		op.rm = _REG_NUM(i, 3);
+		op.shift = (i >> 11) & 3;
+		op.amount = (i >> 6) & 0x1F;
+		t2_set_data(op, 13, true, _REG_NUM(i, 0), 0);
+	}
+	else if(i < 0x2000)
+	{
+		// ADD/SUB rd, rs, rn / #imm3
+		op.imm = BIT10(i);
+		op.value = (i >> 6) & 7;
+		op.rm = (i >> 6) & 7;
+		t2_set_data(op, BIT9(i) ? 2 : 4, true, _REG_NUM(i, 0), _REG_NUM(i, 3));
+	}
+	else if(i < 0x4000)
+	{
+		// MOV/CMP/ADD/SUB rd, #imm8
+		static const u8 alu[4] = { 13, 10, 4, 2 };
+		op.value = i & 0xFF;
+		t2_set_data(op, alu[(i >> 11) & 3], true, _REG_NUM(i, 8), _REG_NUM(i, 8));
+	}
+	else if(i < 0x4400)
+	{
+		// ALU operations; register shifts and MUL are left to the first tier
+		static const s8 alu[16] = { 0, 1, -1, -1, -1, 5, 6, -1, 8, 3, 10, 11, 12, -1, 14, 15 };
+		const u32 rd = _REG_NUM(i, 0), rs = _REG_NUM(i, 3);
+		const s8 op_alu = alu[(i >> 6) & 0xF];
+		if(op_alu < 0)
+			return;
+		if(op_alu == 3)
+		{
+			// NEG is RSB rd, rs, #0
+			op.value = 0;
+			t2_set_data(op, 3, true, rd, rs);
+			return;
+		}
+		op.imm = 0;
+		op.rm = rs;
+		t2_set_data(op, op_alu, true, rd, rd);
+	}
+	else if(i < 0x4800)
+	{
+		// ADD/CMP/MOV with high registers, BX
+		const u32 rd = (i & 7) | ((i >> 4) & 8), rs = REG_POS(i, 3);
+		const u32 sub = (i >> 8) & 3;
+		if(sub == 3 || rd == 15 || rs == 15)
+			return;
+		static const u8 alu[3] = { 4, 10, 13 };
+		op.imm = 0;
+		op.rm = rs;
+		t2_set_data(op, alu[sub], sub == 1, rd, rd);
+	}
+	else if(i < 0x5000)
+		t2_set_mem(op, true, _REG_NUM(i, 8), 0, 0);
+	else if(i < 0x6000)
+		t2_set_mem(op, (i & 0x0E00) > 0x0400, _REG_NUM(i, 0), (1 << _REG_NUM(i, 3)) | (1 << _REG_NUM(i, 6)), 0);
+	else if(i < 0x9000)
+		t2_set_mem(op, BIT11(i), _REG_NUM(i, 0), 1 << _REG_NUM(i, 3), 0);
+	else if(i < 0xA000)
+		t2_set_mem(op, BIT11(i), _REG_NUM(i, 8), 1 << 13, 0);
+	else if(i < 0xA800)
+	{
+		// ADD rd, PC, #imm is a constant
+		op.value = ((adr + 4) & 0xFFFFFFFC) + ((i & 0xFF) << 2);
+		t2_set_data(op, 13, false, _REG_NUM(i, 8), 0);
+	}
+	else if(i < 0xB000)
+	{
+		op.value = (i & 0xFF) << 2;
+		t2_set_data(op, 4, false, _REG_NUM(i, 8), 13);
+	}
+	else if(i < 0xB100)
+	{
+		op.value = (i & 0x7F) << 2;
+		t2_set_data(op, BIT7(i) ? 2 : 4, false, 13, 13);
+	}
+}
+
+// decode the block at start_adr the way compile_basicblock will walk it and decide if it's worth a second tier
+template<int PROCNUM>
+static bool t2_prescan(u32 start_adr)
+{
+	u32 count = 0, data = 0;
+	for(u32 i = 0, bEndBlock = 0; bEndBlock == 0; i++)
+	{
+		if(i >= JIT_T2_MAX_OPS)
+			return false;
+
+		const u32 adr = start_adr + (i * bb_opcodesize);
+		const u32 opcode = bb_thumb ? _MMU_read16<PROCNUM, MMU_AT_CODE>(adr) : _MMU_read32<PROCNUM, MMU_AT_CODE>(adr);
+		bEndBlock = instr_is_branch(opcode) || (i >= (CommonSettings.jit_max_block_size - 1));
+
+		JIT_T2_OP &op = t2_ops[i];
+		memset(&op, 0, sizeof(op));
+		if(!instr_is_branch(opcode))
+		{
+			if(bb_thumb)
+				t2_decode_thumb(opcode, adr, op);
+			else
+				t2_decode_arm(opcode, op);
+		}
+		if(op.kind == T2_DATA && instr_cycles(opcode) != 1)
+			op.kind = T2_FALLBACK;
+		if(op.kind == T2_FALLBACK)
+		{
+			op.reads = op.writes = 0xFFFF;
+			op.flags_read = T2_N|T2_Z|T2_C|T2_V;
+		}
+		else if(op.kind == T2_DATA)
+			data++;
+		count++;
+	}
+
+	// flags are all live on the way out, and anything the first tier emits may look at them
+	u8 live = T2_N|T2_Z|T2_C|T2_V;
+	for(int i = count - 1; i >= 0; i--)
+	{
+		JIT_T2_OP &op = t2_ops[i];
+		op.live = live;
+		if(op.cond == 0xE)
+			live &= ~op.flags_written;
+		live |= op.flags_read;
+	}
+
+	return data >= 2;
+}
+
+static GpVar t2_get(u32 r)
+{
+	if(!(t2_valid & (1 << r)))
+	{
+		t2_reg[r] = c.newGpVar(kX86VarTypeGpd);
+		c.mov(t2_reg[r], reg_ptr(r));
+		t2_valid |= 1 << r;
+	}
+	return t2_reg[r];
+}
+
+static void t2_set(u32 r, const GpVar &var)
+{
+	if(t2_valid & (1 << r))
+		c.unuse(t2_reg[r]);
+	t2_reg[r] = var;
+	t2_valid |= 1 << r;
+	t2_dirty |= 1 << r;
+	t2_known &= ~(1 << r);
+}
+
+// write back the changed registers among mask
+static void t2_flush(u32 mask)
+{
+	for(u32 r = 0; r < 16; r++)
+		if(t2_dirty & mask & (1 << r))
+		{
+			JIT_COMMENT("t2: write back R%u", r);
+			c.mov(reg_ptr(r), t2_reg[r]);
+		}
+	t2_dirty &= ~mask;
+}
+
+// forget the registers among mask; armcpu_t is about to get their new values
+static void t2_drop(u32 mask)
+{
+	for(u32 r = 0; r < 16; r++)
+		if(t2_valid & mask & (1 << r))
+			c.unuse(t2_reg[r]);
+	t2_valid &= ~mask;
+	t2_dirty &= ~mask;
+	t2_known &= ~mask;
+}
+
+// operand 2 of a register that is known; *carry is -1 if C is left alone
+static u32 t2_shift_const(u32 shift, u32 amount, u32 v, int *carry)
+{
+	*carry = -1;
+	switch(shift)
+	{
+		case 0:
+			if(!amount) return v;
+			*carry = BIT_N(v, 32 - amount);
+			return v << amount;
+		case 1:
+			if(!amount) { *carry = BIT31(v); return 0; }
+			*carry = BIT_N(v, amount - 1);
+			return v >> amount;
+		case 2:
+			if(!amount) { *carry = BIT31(v); return (u32)((s32)v >> 31); }
+			*carry = BIT_N(v, amount - 1);
+			return (u32)((s32)v >> amount);
+		default:
+			*carry = BIT_N(v, amount - 1);
+			return ROR(v, amount);
+	}
+}
+
+// everything but ADC/SBC/RSC, which need C
+static u32 t2_alu_const(u32 alu, u32 a, u32 b, int carry, u32 *nzcv)
+{
+	u32 res = 0, cv = 0;
+	switch(alu)
+	{
+		case 0: case 8: res = a & b; break;
+		case 1: case 9: res = a ^ b; break;
+		case 12: res = a | b; break;
+		case 13: res = b; break;
+		case 14: res = a & ~b; break;
+		case 15: res = ~b; break;
+		case 3: { u32 t = a; a = b; b = t; } // fall through
+		case 2: case 10:
+			res = a - b;
+			cv = ((a >= b) << 1) | (BIT31((a ^ b) & (a ^ res)));
+			break;
+		case 4: case 11:
+			res = a + b;
+			cv = ((res < a) << 1) | (BIT31(~(a ^ b) & (a ^ res)));
+			break;
+	}
+	if(t2_alu_logical(alu))
+		cv = (carry > 0) ? T2_C : 0;
+	*nzcv = (BIT31(res) ? T2_N : 0) | (res == 0 ? T2_Z : 0) | cv;
+	return res;
+}
+
+static void t2_emit_data(const JIT_T2_OP &op)
+{
+	const bool writes_rd = op.alu < 8 || op.alu > 11;
+	const bool uses_rn = op.alu != 13 && op.alu != 15;
+	const bool logical = t2_alu_logical(op.alu);
+	const bool conditional = op.cond != 0xE;
+	const bool rrx = !op.imm && op.shift == 3 && op.amount == 0;
+	const u32 flags = op.flags_written & op.live;
+
+	if(op.flags_written & ~op.live)
+		jit_tier_stats.flags_skipped++;
+
+	// operand 2 as an immediate where possible
+	bool b_imm = op.imm != 0;
+	u32 b_val = op.value;
+	int b_carry = (op.imm && op.value_carry) ? (int)BIT31(op.value) : -1;
+	if(!op.imm && (t2_known & (1 << op.rm)) && !rrx)
+	{
+		b_val = t2_shift_const(op.shift, op.amount, t2_value[op.rm], &b_carry);
+		b_imm = true;
+	}
+	const bool a_imm = !uses_rn || (t2_known & (1 << op.rn));
+	const u32 a_val = uses_rn ? t2_value[op.rn] : 0;
+
+	if(!conditional && a_imm && b_imm && !(op.flags_read & T2_C))
+	{
+		JIT_COMMENT("t2: constant");
+		u32 nzcv;
+		const u32 res = t2_alu_const(op.alu, a_val, b_val, b_carry, &nzcv);
+		if(writes_rd)
+		{
+			GpVar x = c.newGpVar(kX86VarTypeGpd);
+			c.mov(x, res);
+			t2_set(op.rd, x);
+			t2_known |= 1 << op.rd;
+			t2_value[op.rd] = res;
+		}
+		if(flags)
+		{
+			c.and_(flags_ptr, ~(flags << 4) & 0xFF);
+			if(nzcv & flags)
+				c.or_(flags_ptr, (nzcv & flags) << 4);
+		}
+		return;
+	}
+
+	GpVar ok;
+	if(conditional)
+	{
+		static const u8 cond_bit[] = {0x40, 0x40, 0x20, 0x20, 0x80, 0x80, 0x10, 0x10};
+		ok = c.newGpVar(kX86VarTypeGpd);
+		if(op.cond < 8)
+		{
+			c.test(flags_ptr, cond_bit[op.cond]);
+			(op.cond & 1) ? c.setz(ok.r8Lo()) : c.setnz(ok.r8Lo());
+		}
+		else
+		{
+			GpVar x = c.newGpVar(kX86VarTypeGpz);
+			c.movzx(x, flags_ptr);
+			c.and_(x, 0xF0);
+#if defined(_M_X64) || defined(__x86_64__)
+			c.add(x, offsetof(armcpu_t,cond_table) + op.cond);
+			c.test(byte_ptr(bb_cpu, x), 1);
+#else
+			c.test(byte_ptr_abs((void*)(arm_cond_table + op.cond), x, kScaleNone), 1);
+#endif
+			c.unuse(x);
+			c.setnz(ok.r8Lo());
+		}
+	}
+
+	// operand 2 through the shifter
+	GpVar b, rcf;
+	bool rcf_var = false;
+	if(!b_imm)
+	{
+		GpVar rm = t2_get(op.rm);
+		const bool need_carry = logical && (flags & T2_C) && (op.shift != 0 || op.amount != 0);
+		if(op.shift == 0 && op.amount == 0)
+			b = rm;
+		else
+		{
+			b = c.newGpVar(kX86VarTypeGpd);
+			c.mov(b, rm);
+			if(need_carry)
+			{
+				const u32 bit = (op.shift == 0) ? 32 - op.amount : (op.amount ? op.amount - 1 : (rrx ? 0 : 31));
+				rcf = c.newGpVar(kX86VarTypeGpd);
+				c.bt(b, bit);
+				c.setc(rcf.r8Lo());
+				rcf_var = true;
+			}
+			switch(op.shift)
+			{
+				case 0: c.shl(b, op.amount); break;
+				case 1: if(op.amount) c.shr(b, op.amount); else c.xor_(b, b); break;
+				case 2: c.sar(b, op.amount ? op.amount : 31); break;
+				case 3:
+					if(op.amount)
+						c.ror(b, op.amount);
+					else
+					{
+						GpVar x = c.newGpVar(kX86VarTypeGpd);
+						c.movzx(x, flags_ptr);
+						c.bt(x, 5);
+						c.rcr(b, 1);
+						c.unuse(x);
+					}
+					break;
+			}
+		}
+	}
+
+	#define T2_A(inst, dst)	{ if(a_imm) c.inst(dst, a_val); else c.inst(dst, t2_get(op.rn)); }
+	#define T2_B(inst, dst)	{ if(b_imm) c.inst(dst, b_val); else c.inst(dst, b); }
+	#define T2_CARRY_IN(invert) { \
+		GpVar x = c.newGpVar(kX86VarTypeGpd); \
+		c.movzx(x, flags_ptr); \
+		c.bt(x, 5); \
+		if(invert) c.cmc(); \
+		c.unuse(x); \
+	}
+
+	JIT_COMMENT("t2: native");
+	GpVar t = c.newGpVar(kX86VarTypeGpd);
+	bool borrow = false;
+	switch(op.alu)
+	{
+		case 0: case 8: T2_A(mov, t); T2_B(and_, t); break;
+		case 1: case 9: T2_A(mov, t); T2_B(xor_, t); break;
+		case 12: T2_A(mov, t); T2_B(or_, t); break;
+		case 14:
+			T2_A(mov, t);
+			if(b_imm)
+				c.and_(t, ~b_val);
+			else
+			{
+				GpVar x = c.newGpVar(kX86VarTypeGpd);
+				c.mov(x, b);
+				c.not_(x);
+				c.and_(t, x);
+				c.unuse(x);
+			}
+			break;
+		case 13: case 15:
+			T2_B(mov, t);
+			if(op.alu == 15) c.not_(t);
+			if(flags & (T2_N|T2_Z)) c.test(t, t);
+			break;
+		case 2: case 10: T2_A(mov, t); T2_B(sub, t); borrow = true; break;
+		case 3: T2_B(mov, t); T2_A(sub, t); borrow = true; break;
+		case 4: case 11: T2_A(mov, t); T2_B(add, t); break;
+		case 5: T2_A(mov, t); T2_CARRY_IN(false); T2_B(adc, t); break;
+		case 6: T2_A(mov, t); T2_CARRY_IN(true); T2_B(sbb, t); borrow = true; break;
+		case 7: T2_B(mov, t); T2_CARRY_IN(true); T2_A(sbb, t); borrow = true; break;
+	}
+	#undef T2_A
+	#undef T2_B
+	#undef T2_CARRY_IN
+
+	// pick up the flags before anything else touches the host ones
+	GpVar f[4];
+	u32 f_const = 0;
+	int nf = 0;
+	u32 f_pos[4];
+	if(flags & T2_N) { f[nf] = c.newGpVar(kX86VarTypeGpd); c.sets(f[nf].r8Lo()); f_pos[nf++] = 7; }
+	if(flags & T2_Z) { f[nf] = c.newGpVar(kX86VarTypeGpd); c.setz(f[nf].r8Lo()); f_pos[nf++] = 6; }
+	if(flags & T2_C)
+	{
+		if(!logical)
+		{
+			f[nf] = c.newGpVar(kX86VarTypeGpd);
+			borrow ? c.setnc(f[nf].r8Lo()) : c.setc(f[nf].r8Lo());
+			f_pos[nf++] = 5;
+		}
+		else if(rcf_var)
+		{
+			f[nf] = rcf;
+			f_pos[nf++] = 5;
+		}
+		else if(b_carry > 0)
+			f_const |= 1 << 5;
+	}
+	if(flags & T2_V) { f[nf] = c.newGpVar(kX86VarTypeGpd); c.seto(f[nf].r8Lo()); f_pos[nf++] = 4; }
+
+	if(writes_rd)
+	{
+		if(!conditional)
+			t2_set(op.rd, t);
+		else
+		{
+			GpVar d = t2_get(op.rd);
+			c.test(ok, 1);
+			c.cmovnz(d, t);
+			c.unuse(t);
+			t2_dirty |= 1 << op.rd;
+			t2_known &= ~(1 << op.rd);
+		}
+	}
+	else
+		c.unuse(t);
+	if(!b_imm && !(op.shift == 0 && op.amount == 0))
+		c.unuse(b);
+
+	if(flags)
+	{
+		for(int n = 1; n < nf; n++)
+		{
+			c.shl(f[0], f_pos[0] - f_pos[n]);
+			c.or_(f[0], f[n]);
+			c.unuse(f[n]);
+			f_pos[0] = f_pos[n];
+		}
+		if(nf)
+			c.shl(f[0], f_pos[0]);
+
+		if(!conditional)
+		{
+			c.and_(flags_ptr, ~(flags << 4) & 0xFF);
+			if(nf) c.or_(flags_ptr, f[0].r8Lo());
+			if(f_const) c.or_(flags_ptr, f_const);
+		}
+		else
+		{
+			GpVar old = c.newGpVar(kX86VarTypeGpd);
+			GpVar x = c.newGpVar(kX86VarTypeGpd);
+			c.movzx(old, flags_ptr);
+			c.mov(x, old);
+			c.and_(x, ~(flags << 4) & 0xFF);
+			if(nf) c.or_(x, f[0]);
+			if(f_const) c.or_(x, f_const);
+			c.test(ok, 1);
+			c.cmovnz(old, x);
+			c.mov(flags_ptr, old.r8Lo());
+			c.unuse(old);
+			c.unuse(x);
+		}
+		if(nf)
+			c.unuse(f[0]);
+	}
+	if(conditional)
+		c.unuse(ok);
+
+	jit_tier_stats.native_ops++;
+}
+
+template<int PROCNUM>
+static u32 compile_basicblock(bool hot)
+{
+#if LOG_JIT
+	bool has_variable_cycles = FALSE;
+#endif
+	u32 interpreted_cycles = 0;
+	u32 start_adr = cpu->instruct_adr;
+	u32 opcode = 0;
+	u32 prev_opcode = 0;
+	u32 opcode_count = 0;
+	u32 opcode_hash = JIT_CACHE_HASH_INIT;
+	
+	bb_thumb = cpu->CPSR.bits.T;
+	bb_opcodesize = bb_thumb ? 2 : 4;
+
+	if (!JIT_MAPPED(start_adr & 0x0FFFFFFF, PROCNUM))
+	{
+		printf("JIT: use unmapped memory address %08X\n", start_adr);
+		execute = false;
+		return 1;
+	}
+
+	bb_tier2 = hot && t2_prescan<PROCNUM>(start_adr);
+	if(hot)
+		bb_tier2 ? jit_tier_stats.hot_blocks++ : jit_tier_stats.declined++;
+	t2_valid = t2_dirty = t2_known = 0;
+
+#if LOG_JIT
+	fprintf(stderr, "adr %08Xh %s%c\n", start_adr, ARMPROC.CPSR.bits.T ? "THUMB":"ARM", PROCNUM?'7':'9');
+#endif
+
+	c.clear();
+	c.newFunc(ASMJIT_CALL_CONV, FuncBuilder0<int>());
+	c.getFunc()->setHint(kFuncHintNaked, true);
+	c.getFunc()->setHint(kX86FuncHintPushPop, true);
+	
+	JIT_COMMENT("CPU ptr");
+	bb_cpu = c.newGpVar(kX86VarTypeGpz);
+	c.mov(bb_cpu, imm_ptr(&ARMPROC));
+
+	JIT_COMMENT("reset bb_total_cycles");
+	bb_total_cycles = c.newGpVar(kX86VarTypeGpz);
+	c.mov(bb_total_cycles, 0);
+
+	if(CommonSettings.jit_tier2_threshold && !hot)
+		emit_heat_counter(start_adr);
+
+#if (PROFILER_JIT_LEVEL > 0)
+	JIT_COMMENT("Profiler ptr");
+	bb_profiler = c.newGpVar(kX86VarTypeGpz);
+	c.mov(bb_profiler, imm_ptr(&profiler_counter[PROCNUM]));
+#endif
+
+	bb_constant_cycles = 0;
+	for(u32 i=0, bEndBlock = 0; bEndBlock == 0; i++)
+	{
+		bb_adr = start_adr + (i * bb_opcodesize);
+		prev_opcode = opcode;
+		if(bb_thumb)
+			opcode = _MMU_read16<PROCNUM, MMU_AT_CODE>(bb_adr);
+		else
+			opcode = _MMU_read32<PROCNUM, MMU_AT_CODE>(bb_adr);
+
+#if LOG_JIT
+		char dasmbuf[1024] = {0};
+		if(bb_thumb)
+			des_thumb_instructions_set[opcode>>6](bb_adr, opcode, dasmbuf);
+		else
+			des_arm_instructions_set[INSTRUCTION_INDEX(opcode)](bb_adr, opcode, dasmbuf);
+		fprintf(stderr, "%08X\t%s\t\t; %s \n", bb_adr, dasmbuf, disassemble(opcode));
+#endif
+
+		opcode_count++;
+		opcode_hash = jit_cache_hash_opcode(opcode_hash, opcode, bb_opcodesize);
+
+		u32 cycles = instr_cycles(opcode);
+
+		bEndBlock = instr_is_branch(opcode) || (i >= (CommonSettings.jit_max_block_size - 1));
+		
+#if LOG_JIT
+		if (instr_is_conditional(opcode) && (cycles > 1) || (cycles == 0))
+			has_variable_cycles = TRUE;
+#endif
+		bb_cycles = c.newGpVar(kX86VarTypeGpz);
+
+		bb_constant_cycles += instr_is_conditional(opcode) ? 1 : cycles;
+
+		JIT_COMMENT("%s (PC:%08X)", disassemble(opcode), bb_adr);
+
+#if (PROFILER_JIT_LEVEL > 0)
+		JIT_COMMENT("*** profiler - counter");
+		if (bb_thumb)
 			c.add(profiler_counter_thumb(opcode), 1);
 		else
 			c.add(profiler_counter_arm(opcode), 1);
 #endif
-		if(instr_is_conditional(opcode))
+		const bool native = bb_tier2 && t2_ops[i].kind == T2_DATA;
+		if(bb_tier2 && !native)
+			t2_flush(t2_ops[i].reads);
+
+		if(native)
+		{
+			sync_r15(opcode, bEndBlock, 0);
+			t2_emit_data(t2_ops[i]);
+		}
+		else if(instr_is_conditional(opcode))
 		{
 			// 25% of conditional instructions are immediately followed by
 			// another with the same condition, but merging them into a
@@ -4184,8 +5744,13 @@ static u32 compile_basicblock()
 				c.lea(bb_total_cycles, ptr(bb_total_cycles.r64(), bb_cycles.r64(), kScaleNone));
 			}
 		}
+		if(bb_tier2 && !native)
+			t2_drop(t2_ops[i].writes);
 		interpreted_cycles += op_decode[PROCNUM][bb_thumb]();
 	}
+
+	if(bb_tier2)
+		t2_flush(0xFFFF);
 	
 	if(!instr_does_prefetch(opcode))
 	{
@@ -4207,7 +5772,7 @@ static u32 compile_basicblock()
 	JIT_COMMENT("*** profiler - cycles");
 	u32 padr = ((start_adr & 0x07FFFFFE) >> 1);
 	bb_profiler_entry = c.newGpVar(kX86VarTypeGpz);
-	c.mov(bb_profiler_entry, (uintptr_t)&profiler_entry[PROCNUM][padr]);
+	c.mov(bb_profiler_entry, imm_ptr(&profiler_entry[PROCNUM][padr]));
 	c.add(dword_ptr(bb_profiler_entry, offsetof(PROFILER_ENTRY, cycles)), bb_total_cycles);
 	profiler_entry[PROCNUM][padr].addr = start_adr;
 #endif
@@ -4218,6 +5783,15 @@ static u32 compile_basicblock()
 #endif
 	c.endFunc();
 
+	u32 next[2];
+	block_successors(opcode, prev_opcode, next);
+
+#ifdef HAVE_STATIC_CODE_BUFFER
+	JIT_CACHE_BLOCK block;
+	if(!jit_cache_filename.empty())
+		jit_cache_pending = &block;
+#endif
+
 	ArmOpCompiled f = (ArmOpCompiled)c.make();
 	if(c.getError())
 	{
@@ -4226,12 +5800,28 @@ static u32 compile_basicblock()
 #endif
 		f = op_decode[PROCNUM][bb_thumb];
 	}
+#ifdef HAVE_STATIC_CODE_BUFFER
+	else if(f)
+		jit_set_link<PROCNUM>(f, start_adr, next, bb_thumb);
+
+	if(f && !c.getError() && jit_cache_pending && !block.code.empty())
+	{
+		block.count = opcode_count;
+		block.opcode_hash = opcode_hash;
+		block.next[0] = next[0];
+		block.next[1] = next[1];
+		jit_cache[jit_cache_key(PROCNUM, bb_thumb, start_adr)] = block;
+		jit_cache_dirty = true;
+	}
+	jit_cache_pending = NULL;
+#endif
 #if LOG_JIT
 	uintptr_t baddr = (uintptr_t)f;
 	fprintf(stderr, "Block address %08lX\n\n", baddr);
 	fflush(stderr);
 #endif
 	
+	jit_track_block<PROCNUM>(start_adr, opcode_count * bb_opcodesize);
 	JIT_COMPILED_FUNC(start_adr, PROCNUM) = (uintptr_t)f;
 	return interpreted_cycles;
 }
@@ -4243,6 +5833,8 @@ template<int PROCNUM> u32 arm_jit_compile()
 	// prevent endless recompilation of self-modifying code, which would be a memleak since we only free code all at once.
 	// also allows us to clear compiled_funcs[] while leaving it sparsely allocated, if the OS does memory overcommit.
 	u32 adr = cpu->instruct_adr;
+	// a block that used up its heat counter is being promoted rather than rewritten, so it doesn't count as a recompile
+	const bool hot = !jit_tier2_pending.empty() && jit_tier2_pending.erase(jit_tier2_key(PROCNUM, cpu->CPSR.bits.T, adr));
 	u32 mask_adr = (adr & 0x07FFFFFE) >> 4;
 	if(((recompile_counts[mask_adr >> 1] >> 4*(mask_adr & 1)) & 0xF) > 8)
 	{
@@ -4250,14 +5842,52 @@ template<int PROCNUM> u32 arm_jit_compile()
 		JIT_COMPILED_FUNC(adr, PROCNUM) = (uintptr_t)f;
 		return f();
 	}
-	recompile_counts[mask_adr >> 1] += 1 << 4*(mask_adr & 1);
+	if(!hot)
+		recompile_counts[mask_adr >> 1] += 1 << 4*(mask_adr & 1);
+
+#ifdef HAVE_STATIC_CODE_BUFFER
+	if(jit_evicted[mask_adr >> 3] & (1 << (mask_adr & 7)))
+	{
+		jit_evicted[mask_adr >> 3] &= ~(1 << (mask_adr & 7));
+		jit_code_stats.recompiles++;
+	}
+
+	if(!hot && !jit_cache_filename.empty() && JIT_MAPPED(adr & 0x0FFFFFFF, PROCNUM))
+	{
+		ArmOpCompiled f = jit_cache_lookup<PROCNUM>(adr);
+		if(f)
+		{
+			JIT_COMPILED_FUNC(adr, PROCNUM) = (uintptr_t)f;
+			return f();
+		}
+	}
+#endif
 
-	return compile_basicblock<PROCNUM>();
+	return compile_basicblock<PROCNUM>(hot);
 }
 
 template u32 arm_jit_compile<0>();
 template u32 arm_jit_compile<1>();
 
+template<int PROCNUM> ArmOpCompiled arm_jit_link(ArmOpCompiled prev)
+{
+#ifdef HAVE_STATIC_CODE_BUFFER
+	const JIT_LINK *link = jit_link_of(prev);
+	if(!link || link->thumb != ARMPROC.CPSR.bits.T)
+		return NULL;
+
+	const u32 adr = ARMPROC.instruct_adr;
+	if(link->slot[0] && link->adr[0] == adr)
+		return (ArmOpCompiled)*link->slot[0];
+	if(link->slot[1] && link->adr[1] == adr)
+		return (ArmOpCompiled)*link->slot[1];
+#endif
+	return NULL;
+}
+
+template ArmOpCompiled arm_jit_link<0>(ArmOpCompiled prev);
+template ArmOpCompiled arm_jit_link<1>(ArmOpCompiled prev);
+
 void arm_jit_reset(bool enable, bool suppress_msg)
 {
 #if LOG_JIT
@@ -4265,8 +5895,18 @@ void arm_jit_reset(bool enable, bool suppress_msg)
 	freopen("desmume_jit.log", "w", stderr);
 #endif
 #ifdef HAVE_STATIC_CODE_BUFFER
-	scratchptr = scratchpad;
+	jit_region_reset();
+	if (enable && !CommonSettings.jit_cache_path.empty())
+	{
+		char name[32];
+		sprintf(name, "/desmume_jit_%08X.cache", gameInfo.crc);
+		jit_cache_open(CommonSettings.jit_cache_path + name);
+	}
+	else
+		jit_cache_open("");
 #endif
+	jit_tier2_pending.clear();
+	std::fill(jit_heat, jit_heat + JIT_HEAT_SLOTS, CommonSettings.jit_tier2_threshold ? CommonSettings.jit_tier2_threshold : 0xFFFFFFFF);
 	if (!suppress_msg)
 		printf("CPU mode: %s\n", enable?"JIT":"Interpreter");
 	saveBlockSizeJIT = CommonSettings.jit_max_block_size;
@@ -4300,6 +5940,7 @@ void arm_jit_reset(bool enable, bool suppress_msg)
 				memset(compiled_funcs+128*i, 0, 128*sizeof(*compiled_funcs));
 			}
 #endif
+		jit_track_reset();
 	}
 
 	c.clear();
@@ -4331,8 +5972,44 @@ static int pcmp_entry(PROFILER_ENTRY *info1, PROFILER_ENTRY *info2)
 #endif
 #endif
 
+const JitCacheStats& arm_jit_cache_stats()
+{
+#ifdef HAVE_STATIC_CODE_BUFFER
+	jit_cache_stats.blocks = (u32)jit_cache.size();
+	return jit_cache_stats;
+#else
+	static const JitCacheStats none = {0};
+	return none;
+#endif
+}
+
+const JitCodeStats& arm_jit_code_stats()
+{
+#ifdef HAVE_STATIC_CODE_BUFFER
+	u32 live = 0;
+	for(int i = 0; i < JIT_REGION_COUNT; i++)
+		if(i != jit_region && jit_region_end[i])
+			live += (u32)(jit_region_end[i] - (scratchpad + i * JIT_REGION_SIZE));
+	live += (u32)(scratchptr - (scratchpad + jit_region * JIT_REGION_SIZE));
+	jit_code_stats.bytes_live = live;
+#endif
+	return jit_code_stats;
+}
+
+const JitTierStats& arm_jit_tier_stats()
+{
+	return jit_tier_stats;
+}
+
 void arm_jit_close()
 {
+#ifdef HAVE_STATIC_CODE_BUFFER
+	if (!jit_cache_filename.empty())
+	{
+		printf("JIT cache: %u hits, %u misses, %u stale\n", jit_cache_stats.hits, jit_cache_stats.misses, jit_cache_stats.stale);
+		jit_cache_open("");
+	}
+#endif
 #if (PROFILER_JIT_LEVEL > 0)
 	printf("Generating profile report...");
 
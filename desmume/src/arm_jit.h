@@ -30,6 +30,41 @@ void arm_jit_reset(bool enable, bool suppress_msg = false);
 void arm_jit_close();
 void arm_jit_sync();
 template<int PROCNUM> u32 arm_jit_compile();
+// the block that prev links to for the current PC, or NULL if the dispatcher has to look it up
+template<int PROCNUM> ArmOpCompiled arm_jit_link(ArmOpCompiled prev);
+
+// counters for the persistent block cache (see CommonSettings.jit_cache_path)
+struct JitCacheStats
+{
+	u32 hits;		// blocks mapped straight from the cache
+	u32 misses;		// blocks that had to be compiled
+	u32 stale;		// cached blocks rejected because their opcodes changed
+	u32 blocks;		// blocks currently held by the cache
+};
+const JitCacheStats& arm_jit_cache_stats();
+
+// counters for the code buffer, whose oldest region is evicted whenever it fills up
+struct JitCodeStats
+{
+	u32 evictions;		// regions evicted to make room
+	u32 blocks_evicted;	// blocks dropped along with them
+	u32 recompiles;		// blocks compiled again after being evicted
+	u32 bytes_live;		// code buffer bytes currently in use
+	u32 code_writes;	// guest writes that landed on a page holding compiled code
+	u32 blocks_invalidated;	// blocks dropped because such a write overlapped them
+};
+
+const JitCodeStats& arm_jit_code_stats();
+
+// counters for the second tier (see CommonSettings.jit_tier2_threshold)
+struct JitTierStats
+{
+	u32 hot_blocks;		// blocks recompiled on the second tier
+	u32 declined;		// hot blocks left on the first tier for having too little for it to do
+	u32 native_ops;		// instructions the second tier compiled itself
+	u32 flags_skipped;	// flag updates left out because nothing reads them
+};
+const JitTierStats& arm_jit_tier_stats();
 
 //#define MAPPED_JIT_FUNCS: to define or not to define?
 //* x86 windows seems faster with NON-DEFINED
@@ -67,6 +102,8 @@ extern CACHE_ALIGN JIT_struct JIT;
 #define JIT_COMPILED_FUNC_PREMASKED(adr, PROCNUM, ofs) JIT.JIT_MEM[PROCNUM][(adr)>>14][(((adr)&0x00003FFE)>>1)+ofs]
 #define JIT_COMPILED_FUNC_KNOWNBANK(adr, bank, mask, ofs) JIT.bank[(((adr)&(mask))>>1)+ofs]
 #define JIT_MAPPED(adr, PROCNUM) JIT.JIT_MEM[PROCNUM][(adr)>>14]
+#define JIT_SLOT_BASE ((uintptr_t*)&JIT)
+#define JIT_SLOT_COUNT (sizeof(JIT_struct)/sizeof(uintptr_t))
 #else
 // actually an array of function pointers, but they fit in 32bit address space, so might as well save memory
 extern uintptr_t compiled_funcs[];
@@ -75,8 +112,29 @@ extern uintptr_t compiled_funcs[];
 #define JIT_COMPILED_FUNC_PREMASKED(adr, PROCNUM, ofs) JIT_COMPILED_FUNC(adr+(ofs<<1), PROCNUM)
 #define JIT_COMPILED_FUNC_KNOWNBANK(adr, bank, mask, ofs) JIT_COMPILED_FUNC(adr+(ofs<<1), PROCNUM)
 #define JIT_MAPPED(adr, PROCNUM) true
+#define JIT_SLOT_BASE compiled_funcs
+#define JIT_SLOT_COUNT (1<<26)
 #endif
 
+// Writes invalidate compiled code through a bitmap with one bit per 4KB page of
+// JIT_COMPILED_FUNC slots (2048 halfwords) that some block was compiled from, so a
+// write to any other page costs a single bit test. Slots are counted from
+// JIT_SLOT_BASE, which makes mirrors of the same memory share their pages.
+#define JIT_CODE_PAGE_SHIFT 11
+#define JIT_CODE_PAGES ((JIT_SLOT_COUNT + (1<<JIT_CODE_PAGE_SHIFT) - 1) >> JIT_CODE_PAGE_SHIFT)
+extern u32 jit_code_pages[(JIT_CODE_PAGES + 31) / 32];
+// drops every block with an opcode in the count halfword slots starting at slot
+void FASTCALL arm_jit_invalidate(u32 slot, u32 count);
+
+#define JIT_SLOT(ptr) ((u32)((ptr) - JIT_SLOT_BASE))
+#define JIT_INVALIDATE_SLOT(slot, count) { \
+	const u32 jit_slot = (slot); \
+	if(jit_code_pages[jit_slot >> (JIT_CODE_PAGE_SHIFT+5)] & (1 << ((jit_slot >> JIT_CODE_PAGE_SHIFT) & 31))) \
+		arm_jit_invalidate(jit_slot, count); \
+}
+#define JIT_INVALIDATE(adr, PROCNUM, count) { if(JIT_MAPPED(adr, PROCNUM)) JIT_INVALIDATE_SLOT(JIT_SLOT(&JIT_COMPILED_FUNC_PREMASKED(adr, PROCNUM, 0)), count) }
+#define JIT_INVALIDATE_KNOWNBANK(adr, bank, mask, count) JIT_INVALIDATE_SLOT(JIT_SLOT(&JIT_COMPILED_FUNC_KNOWNBANK(adr, bank, mask, 0)), count)
+
 extern u32 saveBlockSizeJIT;
 
 #endif
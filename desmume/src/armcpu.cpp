@@ -20,9 +20,12 @@
 #include <stdio.h>
 #include <assert.h>
 #include <algorithm>
+#include <map>
+#include <vector>
 
 #include "armcpu.h"
 #include "instructions.h"
+#include "instruction_attributes.h"
 #include "cp15.h"
 #include "bios.h"
 #include "debug.h"
@@ -744,6 +747,668 @@ template u32 armcpu_exec<1,false>();
 template u32 armcpu_exec<1,true>();
 #endif
 
+//---------------------------------------------------------------------------
+//idle loops
+
+#define IDLELOOP_CACHE_SIZE 256
+#define IDLELOOP_NO_REG 0xFF
+#define IDLELOOP_FLAG_N (1<<16)
+#define IDLELOOP_FLAG_Z (1<<17)
+#define IDLELOOP_FLAG_C (1<<18)
+#define IDLELOOP_FLAG_V (1<<19)
+#define IDLELOOP_FLAGS (IDLELOOP_FLAG_N|IDLELOOP_FLAG_Z|IDLELOOP_FLAG_C|IDLELOOP_FLAG_V)
+
+//the address a load reads is rebuilt from the registers whenever the loop is about to be skipped
+struct IdleLoopLoad
+{
+	u8 rn; //IDLELOOP_NO_REG: imm is the absolute address (pc-relative loads)
+	u8 rnLoad; //the earlier load of the iteration rn comes from, or IDLELOOP_NO_REG for its value at the loop start
+	u8 rm; //IDLELOOP_NO_REG: imm is the offset
+	u8 shift, amount; //applied to rm (arm register offsets)
+	bool up;
+	bool word; //a word load whose value a later load uses as its base
+	u32 imm;
+};
+
+struct IdleLoopEntry
+{
+	u32 adr; //loop start, bit 0 set for thumb. 0xFFFFFFFF for an unused entry
+	bool idle;
+	u8 count, loadCount;
+	u32 code[ARMCPU_IDLELOOP_MAX_INSNS]; //compared again before each skip, in case the code was replaced
+	IdleLoopLoad loads[ARMCPU_IDLELOOP_MAX_INSNS];
+	armcpu_idleloop *stats;
+};
+
+static IdleLoopEntry idleloop_cache[2][IDLELOOP_CACHE_SIZE];
+static std::map<u32, armcpu_idleloop> idleloop_stats[2];
+
+//register and flag liveness over one iteration. a loop is idle when nothing it reads before writing it
+//is also written, since then every iteration starts from the same state as long as memory doesn't change.
+struct IdleLoopFlow
+{
+	u32 written, liveIn;
+	u8 wordLoad[16]; //1 + the load which last wrote the register, when that was a plain word load
+	void use(u32 mask) { liveIn |= mask & ~written; }
+	void useReg(u32 r) { if(r != 15) use(1<<r); }
+	void def(u32 mask)
+	{
+		written |= mask;
+		for(u32 r = 0; r < 16; r++)
+			if(mask & (1<<r)) wordLoad[r] = 0;
+	}
+};
+
+static bool idleloop_addLoad(IdleLoopEntry &e, IdleLoopFlow &flow, u32 rd, bool word, u32 rn, u32 rm, u32 shift, u32 amount, bool up, u32 imm)
+{
+	const u32 index = e.loadCount++;
+	IdleLoopLoad &load = e.loads[index];
+	load.rn = (u8)rn;
+	load.rnLoad = IDLELOOP_NO_REG;
+	load.rm = (u8)rm;
+	load.shift = (u8)shift;
+	load.amount = (u8)amount;
+	load.up = up;
+	load.word = false;
+	load.imm = imm;
+
+	bool ok = true;
+	if(rn != IDLELOOP_NO_REG)
+	{
+		flow.useReg(rn);
+		if(flow.written & (1<<rn))
+		{
+			//a base fetched earlier in the iteration (typically from a literal pool) is followed at skip time
+			if(flow.wordLoad[rn])
+			{
+				load.rnLoad = flow.wordLoad[rn] - 1;
+				e.loads[load.rnLoad].word = true;
+			}
+			else
+				ok = false;
+		}
+	}
+	if(rm != IDLELOOP_NO_REG)
+	{
+		flow.useReg(rm);
+		if(flow.written & (1<<rm))
+			ok = false;
+	}
+
+	flow.def(1<<rd);
+	if(word) flow.wordLoad[rd] = (u8)(index + 1);
+	//otherwise the address moves between iterations, which isn't polling the same location
+	return ok;
+}
+
+//returns 1 for the branch back to start, 0 for a body instruction, -1 for anything else
+static int idleloop_decodeARM(IdleLoopEntry &e, IdleLoopFlow &flow, u32 adr, u32 start, u32 i)
+{
+	const u32 cond = CONDITION(i);
+	if(cond == 0xF) return -1;
+	if((i & 0x0F000000) == 0x0A000000)
+	{
+		if(adr + 8 + ((s32)(i << 8) >> 6) != start) return -1;
+		if(cond != 0xE) flow.use(IDLELOOP_FLAGS);
+		return 1;
+	}
+	//conditional writes would make the liveness depend on the flags
+	if(cond != 0xE) return -1;
+
+	const u32 rd = REG_POS(i,12);
+	const u32 rn = REG_POS(i,16);
+	if((i & 0x0E000090) == 0x00000090)
+	{
+		//ldrh/ldrsb/ldrsh, pre-indexed without writeback
+		if(!(i & (1<<20)) || ((i >> 5) & 3) == 0 || !(i & (1<<24)) || (i & (1<<21)) || rd == 15) return -1;
+		const bool up = !!(i & (1<<23));
+		bool ok;
+		if(i & (1<<22))
+		{
+			const u32 imm = ((i >> 4) & 0xF0) | (i & 0xF);
+			ok = (rn == 15)
+				? idleloop_addLoad(e, flow, rd, false, IDLELOOP_NO_REG, IDLELOOP_NO_REG, 0, 0, true, up ? adr + 8 + imm : adr + 8 - imm)
+				: idleloop_addLoad(e, flow, rd, false, rn, IDLELOOP_NO_REG, 0, 0, up, imm);
+		}
+		else
+		{
+			if(rn == 15 || REG_POS(i,0) == 15) return -1;
+			ok = idleloop_addLoad(e, flow, rd, false, rn, REG_POS(i,0), 0, 0, up, 0);
+		}
+		return ok ? 0 : -1;
+	}
+	if((i & 0x0C000000) == 0x04000000)
+	{
+		//ldr/ldrb, pre-indexed without writeback
+		if(!(i & (1<<20)) || !(i & (1<<24)) || (i & (1<<21)) || rd == 15) return -1;
+		const bool up = !!(i & (1<<23));
+		const bool word = !(i & (1<<22));
+		bool ok;
+		if(i & (1<<25))
+		{
+			const u32 shift = (i >> 5) & 3, amount = (i >> 7) & 0x1F;
+			if((i & 0x10) || rn == 15 || REG_POS(i,0) == 15 || (shift == 3 && amount == 0)) return -1;
+			ok = idleloop_addLoad(e, flow, rd, word, rn, REG_POS(i,0), shift, amount, up, 0);
+		}
+		else
+		{
+			const u32 imm = i & 0xFFF;
+			ok = (rn == 15)
+				? idleloop_addLoad(e, flow, rd, word, IDLELOOP_NO_REG, IDLELOOP_NO_REG, 0, 0, true, up ? adr + 8 + imm : adr + 8 - imm)
+				: idleloop_addLoad(e, flow, rd, word, rn, IDLELOOP_NO_REG, 0, 0, up, imm);
+		}
+		return ok ? 0 : -1;
+	}
+	if((i & 0x0C000000) == 0x00000000)
+	{
+		//alu ops with an immediate or an immediate-shifted register
+		const u32 op = OPCODE(i);
+		const bool s = !!(i & (1<<20));
+		const bool compare = (op >= 8 && op <= 11);
+		if(compare && !s) return -1; //mrs/msr/bx live here
+		if(!compare && rd == 15) return -1;
+
+		bool carryOut;
+		if(i & (1<<25))
+			carryOut = ((i >> 8) & 0xF) != 0;
+		else
+		{
+			if(i & 0x10) return -1;
+			const u32 shift = (i >> 5) & 3, amount = (i >> 7) & 0x1F;
+			flow.useReg(REG_POS(i,0));
+			if(shift == 3 && amount == 0) flow.use(IDLELOOP_FLAG_C); //rrx
+			carryOut = (shift != 0 || amount != 0);
+		}
+		if(op != 13 && op != 15) flow.useReg(rn);
+		if(op == 5 || op == 6 || op == 7) flow.use(IDLELOOP_FLAG_C);
+
+		const bool logical = (op == 0 || op == 1 || op == 8 || op == 9 || op >= 12);
+		if(s) flow.def(logical ? (IDLELOOP_FLAG_N|IDLELOOP_FLAG_Z|(carryOut ? IDLELOOP_FLAG_C : 0)) : IDLELOOP_FLAGS);
+		if(!compare) flow.def(1<<rd);
+		return 0;
+	}
+	return -1;
+}
+
+static int idleloop_decodeThumb(IdleLoopEntry &e, IdleLoopFlow &flow, u32 adr, u32 start, u32 i)
+{
+	const u32 rd = i & 7;
+	const u32 rs = (i >> 3) & 7;
+	const u32 nz = IDLELOOP_FLAG_N|IDLELOOP_FLAG_Z;
+
+	if((i & 0xF000) == 0xD000)
+	{
+		const u32 cond = (i >> 8) & 0xF;
+		if(cond >= 0xE || adr + 4 + ((s32)(s8)(i & 0xFF) << 1) != start) return -1;
+		flow.use(IDLELOOP_FLAGS);
+		return 1;
+	}
+	if((i & 0xF800) == 0xE000)
+		return (adr + 4 + ((s32)(i << 21) >> 20) == start) ? 1 : -1;
+
+	if((i & 0xF800) == 0x1800)
+	{
+		//add/sub register or imm3
+		flow.useReg(rs);
+		if(!(i & 0x0400)) flow.useReg((i >> 6) & 7);
+		flow.def(IDLELOOP_FLAGS | (1<<rd));
+		return 0;
+	}
+	if((i & 0xE000) == 0x0000)
+	{
+		//lsl/lsr/asr imm5
+		flow.useReg(rs);
+		flow.def(nz | (((i & 0x1800) || (i & 0x07C0)) ? IDLELOOP_FLAG_C : 0) | (1<<rd));
+		return 0;
+	}
+	if((i & 0xE000) == 0x2000)
+	{
+		//mov/cmp/add/sub imm8
+		const u32 op = (i >> 11) & 3;
+		const u32 r = (i >> 8) & 7;
+		if(op != 0) flow.useReg(r);
+		flow.def((op == 0 ? nz : IDLELOOP_FLAGS) | (op != 1 ? (1<<r) : 0));
+		return 0;
+	}
+	if((i & 0xFC00) == 0x4000)
+	{
+		const u32 op = (i >> 6) & 0xF;
+		if(op == 13) return -1; //mul
+		if(op != 9 && op != 15) flow.useReg(rd); //neg, mvn
+		flow.useReg(rs);
+		if(op == 5 || op == 6) flow.use(IDLELOOP_FLAG_C); //adc, sbc
+		//register shifts by zero keep the carry, so it is both read and written
+		if(op == 2 || op == 3 || op == 4 || op == 7) flow.use(IDLELOOP_FLAG_C);
+		const bool arith = (op == 5 || op == 6 || op == 9 || op == 10 || op == 11);
+		const bool carry = arith || op == 2 || op == 3 || op == 4 || op == 7;
+		flow.def(nz | (carry ? IDLELOOP_FLAG_C : 0) | (arith ? IDLELOOP_FLAG_V : 0));
+		if(op != 8 && op != 10 && op != 11) flow.def(1<<rd); //tst, cmp, cmn
+		return 0;
+	}
+	if((i & 0xFC00) == 0x4400)
+	{
+		//hi register add/cmp/mov
+		const u32 op = (i >> 8) & 3;
+		const u32 hd = rd | ((i >> 4) & 8);
+		const u32 hs = (i >> 3) & 0xF;
+		if(op == 3 || (op != 1 && hd == 15)) return -1;
+		flow.useReg(hs);
+		if(op != 2) flow.useReg(hd);
+		flow.def(op == 1 ? IDLELOOP_FLAGS : (1<<hd));
+		return 0;
+	}
+
+	if((i & 0xF800) == 0x4800)
+	{
+		//ldr pc-relative
+		const u32 r = (i >> 8) & 7;
+		return idleloop_addLoad(e, flow, r, true, IDLELOOP_NO_REG, IDLELOOP_NO_REG, 0, 0, true, ((adr + 4) & ~3) + ((i & 0xFF) << 2)) ? 0 : -1;
+	}
+	if((i & 0xF000) == 0x5000)
+	{
+		//register offset: ldr/ldrb, ldrh/ldsb/ldsh
+		if((i & 0x0200) ? ((i & 0x0C00) == 0) : !(i & 0x0800)) return -1;
+		return idleloop_addLoad(e, flow, rd, (i & 0x0E00) == 0x0800, rs, (i >> 6) & 7, 0, 0, true, 0) ? 0 : -1;
+	}
+	if((i & 0xE000) == 0x6000)
+	{
+		//ldr/ldrb imm5
+		if(!(i & 0x0800)) return -1;
+		const u32 imm = (i >> 6) & 0x1F;
+		const bool word = !(i & 0x1000);
+		return idleloop_addLoad(e, flow, rd, word, rs, IDLELOOP_NO_REG, 0, 0, true, word ? (imm << 2) : imm) ? 0 : -1;
+	}
+	if((i & 0xF800) == 0x8800)
+	{
+		//ldrh imm5
+		return idleloop_addLoad(e, flow, rd, false, rs, IDLELOOP_NO_REG, 0, 0, true, ((i >> 6) & 0x1F) << 1) ? 0 : -1;
+	}
+	if((i & 0xF800) == 0x9800)
+	{
+		//ldr sp-relative
+		const u32 r = (i >> 8) & 7;
+		return idleloop_addLoad(e, flow, r, true, 13, IDLELOOP_NO_REG, 0, 0, true, (i & 0xFF) << 2) ? 0 : -1;
+	}
+	return -1;
+}
+
+template<int PROCNUM>
+static void idleloop_analyze(IdleLoopEntry &e, u32 key)
+{
+	const bool thumb = (key & 1);
+	const u32 start = key & ~1;
+	IdleLoopFlow flow;
+	memset(&flow, 0, sizeof(flow));
+
+	e.adr = key;
+	e.idle = false;
+	e.count = e.loadCount = 0;
+	e.stats = NULL;
+
+	for(u32 n = 0; n < ARMCPU_IDLELOOP_MAX_INSNS; n++)
+	{
+		const u32 adr = start + (thumb ? n*2 : n*4);
+		const u32 i = thumb ? _MMU_read16<PROCNUM, MMU_AT_CODE>(adr) : _MMU_read32<PROCNUM, MMU_AT_CODE>(adr);
+		e.code[e.count++] = i;
+
+		const int ret = thumb ? idleloop_decodeThumb(e, flow, adr, start, i) : idleloop_decodeARM(e, flow, adr, start, i);
+		if(ret < 0)
+			return;
+		if(ret > 0)
+		{
+			e.idle = !(flow.liveIn & flow.written);
+			return;
+		}
+	}
+}
+
+//reads which pop a fifo (ipc, gamecard data), follow the clock without any event (timer counters)
+//or reach devices with state of their own (wifi, slot 2) make a loop more than a poll
+template<int PROCNUM>
+static bool idleloop_quietAddress(u32 adr)
+{
+	if(PROCNUM == ARMCPU_ARM9 && (adr & ~0x3FFF) == MMU.DTCMRegion)
+		return true;
+	if(adr >= 0x08000000)
+		return false;
+	if(adr >= 0x04000100 && adr < 0x04000110)
+		return false;
+	if(adr >= 0x04100000 && adr < 0x05000000)
+		return false;
+	return true;
+}
+
+template<int PROCNUM>
+armcpu_idleloop* armcpu_idleloop_check(u32 adr)
+{
+	const u32 key = adr | ARMPROC.CPSR.bits.T;
+	IdleLoopEntry &e = idleloop_cache[PROCNUM][(adr >> 1) & (IDLELOOP_CACHE_SIZE-1)];
+	if(e.adr != key)
+		idleloop_analyze<PROCNUM>(e, key);
+	if(!e.idle)
+		return NULL;
+
+	for(u32 n = 0; n < e.count; n++)
+	{
+		const u32 i = (key & 1) ? _MMU_read16<PROCNUM, MMU_AT_CODE>(adr + n*2) : _MMU_read32<PROCNUM, MMU_AT_CODE>(adr + n*4);
+		if(i != e.code[n])
+		{
+			idleloop_analyze<PROCNUM>(e, key);
+			if(!e.idle) return NULL;
+			break;
+		}
+	}
+
+	u32 values[ARMCPU_IDLELOOP_MAX_INSNS];
+	for(u32 n = 0; n < e.loadCount; n++)
+	{
+		const IdleLoopLoad &load = e.loads[n];
+		u32 offset = load.imm;
+		if(load.rm != IDLELOOP_NO_REG)
+		{
+			const u32 v = ARMPROC.R[load.rm];
+			switch(load.shift)
+			{
+				case 0: offset = v << load.amount; break;
+				case 1: offset = load.amount ? (v >> load.amount) : 0; break;
+				case 2: offset = (u32)((s32)v >> (load.amount ? load.amount : 31)); break;
+				default: offset = ROR(v, load.amount); break;
+			}
+		}
+		u32 base = 0;
+		if(load.rnLoad != IDLELOOP_NO_REG) base = values[load.rnLoad];
+		else if(load.rn != IDLELOOP_NO_REG) base = ARMPROC.R[load.rn];
+
+		const u32 address = load.up ? base + offset : base - offset;
+		if(!idleloop_quietAddress<PROCNUM>(address))
+			return NULL;
+		if(load.word)
+		{
+			if(address & 3) return NULL;
+			values[n] = _MMU_read32<PROCNUM, MMU_AT_DATA>(address);
+		}
+	}
+
+	if(!e.stats)
+	{
+		e.stats = &idleloop_stats[PROCNUM][key];
+		e.stats->adr = key;
+	}
+	return e.stats;
+}
+
+template armcpu_idleloop* armcpu_idleloop_check<0>(u32 adr);
+template armcpu_idleloop* armcpu_idleloop_check<1>(u32 adr);
+
+void armcpu_idleloop_reset()
+{
+	for(int proc = 0; proc < 2; proc++)
+	{
+		for(u32 n = 0; n < IDLELOOP_CACHE_SIZE; n++)
+			idleloop_cache[proc][n].adr = 0xFFFFFFFF;
+		idleloop_stats[proc].clear();
+	}
+}
+
+static bool idleloop_moreCycles(const armcpu_idleloop &a, const armcpu_idleloop &b)
+{
+	return a.cycles > b.cycles;
+}
+
+std::vector<armcpu_idleloop> armcpu_idleloop_stats(int procnum)
+{
+	std::vector<armcpu_idleloop> ret;
+	for(std::map<u32, armcpu_idleloop>::const_iterator it = idleloop_stats[procnum].begin(); it != idleloop_stats[procnum].end(); ++it)
+		ret.push_back(it->second);
+	std::sort(ret.begin(), ret.end(), idleloop_moreCycles);
+	return ret;
+}
+
+//---------------------------------------------------------------------------
+//predecoded blocks (CommonSettings.interp_predecode)
+
+#define PREDECODE_MAX_OPS 32
+#define PREDECODE_CACHE_SIZE 0x10000
+#define PREDECODE_POOL_BLOCKS 0x8000
+#define PREDECODE_POOL_OPS 0x40000
+
+enum PredecodeKind
+{
+	PREDECODE_ARM,      //unconditional
+	PREDECODE_ARM_COND,
+	PREDECODE_THUMB,
+};
+
+struct PredecodedOp
+{
+	OpFunc handler;
+	u32 opcode;
+	u32 kind;
+};
+
+struct PredecodedBlock
+{
+	u32 adr; //bit 0 set for thumb
+	u32 count;
+	bool valid; //cleared when the code under the block is written
+	const u8 *host; //where the code was read from
+	PredecodedOp *ops;
+};
+
+//the blocks with code in one 4KB page of MMU, with the byte range each covers
+struct PredecodePageEntry
+{
+	u32 lo, hi;
+	PredecodedBlock *block;
+};
+
+u32 armcpu_predecode_pages[(MMU_CODE_PAGES + 31) / 32];
+static std::vector<PredecodePageEntry> predecode_page_blocks[MMU_CODE_PAGES];
+static PredecodedBlock *predecode_cache[2][PREDECODE_CACHE_SIZE];
+static PredecodedBlock predecode_blocks[PREDECODE_POOL_BLOCKS];
+static PredecodedOp predecode_ops[PREDECODE_POOL_OPS];
+static u32 predecode_blockCount = 0, predecode_opCount = 0;
+
+void armcpu_predecode_reset()
+{
+	if(predecode_blockCount == 0)
+		return;
+	memset(predecode_cache, 0, sizeof(predecode_cache));
+	for(u32 n = 0; n < MMU_CODE_PAGES; n++)
+		predecode_page_blocks[n].clear();
+	memset(armcpu_predecode_pages, 0, sizeof(armcpu_predecode_pages));
+	predecode_blockCount = predecode_opCount = 0;
+}
+
+void armcpu_predecode_invalidate(u32 ofs, u32 bytes)
+{
+	const u32 page = ofs >> MMU_PAGE_SHIFT;
+	std::vector<PredecodePageEntry> &list = predecode_page_blocks[page];
+	for(size_t n = 0; n < list.size(); )
+	{
+		if(list[n].lo < ofs + bytes && ofs < list[n].hi)
+		{
+			list[n].block->valid = false;
+			list[n] = list.back();
+			list.pop_back();
+		}
+		else n++;
+	}
+	if(list.empty())
+		armcpu_predecode_pages[page >> 5] &= ~(1 << (page & 31));
+}
+
+//same rule as the jit uses to end its blocks: anything which may write r15 or leave for an exception
+static bool predecode_endsBlock(u32 opcode, bool thumb)
+{
+	if(thumb)
+	{
+		const u32 x = thumb_attributes[opcode>>6];
+		if(x & MERGE_NEXT) return false; //bl prefix
+		return (x & BRANCH_ALWAYS)
+			|| ((x & BRANCH_POS0) && ((opcode&7) | ((opcode>>4)&8)) == 15)
+			|| (x & BRANCH_SWI)
+			|| (x & JIT_BYPASS);
+	}
+	const u32 x = instruction_attributes[INSTRUCTION_INDEX(opcode)];
+	return (x & BRANCH_ALWAYS)
+		|| ((x & BRANCH_POS12) && REG_POS(opcode,12) == 15)
+		|| ((x & BRANCH_LDM) && BIT15(opcode))
+		|| (x & BRANCH_SWI)
+		|| (x & JIT_BYPASS);
+}
+
+//decodes the instructions from key's address up to the first branch or the end of its page
+template<int PROCNUM>
+static PredecodedBlock* predecode_build(const u32 key, const u8 *host)
+{
+	const size_t ofs = host - (const u8*)&MMU;
+	if(ofs >= sizeof(MMU_struct))
+		return NULL;
+
+	if(predecode_blockCount == PREDECODE_POOL_BLOCKS || predecode_opCount + PREDECODE_MAX_OPS > PREDECODE_POOL_OPS)
+		armcpu_predecode_reset();
+
+	const bool thumb = (key & 1);
+	const u32 size = thumb ? 2 : 4;
+	PredecodedBlock *block = &predecode_blocks[predecode_blockCount++];
+	block->adr = key;
+	block->host = host;
+	block->valid = true;
+	block->ops = &predecode_ops[predecode_opCount];
+	block->count = 0;
+
+	u32 pos = (u32)(key & ~1) & MMU_PAGE_MASK;
+	do
+	{
+		PredecodedOp &op = block->ops[block->count++];
+		if(thumb)
+		{
+			op.opcode = LE_TO_LOCAL_16(*(const u16 *)(host + block->count*2 - 2));
+			op.handler = thumb_instructions_set[PROCNUM][op.opcode>>6];
+			op.kind = PREDECODE_THUMB;
+		}
+		else
+		{
+			op.opcode = LE_TO_LOCAL_32(*(const u32 *)(host + block->count*4 - 4));
+			op.handler = arm_instructions_set[PROCNUM][INSTRUCTION_INDEX(op.opcode)];
+			op.kind = (CONDITION(op.opcode) == 0x0E) ? PREDECODE_ARM : PREDECODE_ARM_COND;
+		}
+		pos += size;
+		if(predecode_endsBlock(op.opcode, thumb))
+			break;
+	} while(block->count < PREDECODE_MAX_OPS && pos < MMU_PAGE_SIZE);
+	predecode_opCount += block->count;
+
+	//the block stays within one guest page, but MMU's members don't start on host page boundaries, so the code
+	//it was read from can still straddle two of the host pages that writes are tracked by
+	const PredecodePageEntry entry = { (u32)ofs, (u32)ofs + block->count*size, block };
+	for(u32 page = entry.lo >> MMU_PAGE_SHIFT; page <= (entry.hi - 1) >> MMU_PAGE_SHIFT; page++)
+	{
+		predecode_page_blocks[page].push_back(entry);
+		armcpu_predecode_pages[page >> 5] |= (1 << (page & 31));
+	}
+
+	predecode_cache[PROCNUM][(key >> 1) & (PREDECODE_CACHE_SIZE-1)] = block;
+	return block;
+}
+
+//runs the block at the cpu's next instruction. each instruction retires exactly as in armcpu_exec: the handler, then the
+//fetch of the next one, which comes from the block for as long as the code runs on sequentially, and from memory
+//(armcpu_prefetch) once it leaves.
+template<int PROCNUM>
+u32 armcpu_exec_predecoded()
+{
+#ifdef HAVE_LUA
+	//lua exec hooks see every instruction through armcpu_exec
+	if(AnyLuaActive())
+		return armcpu_exec<PROCNUM>();
+#endif
+
+	const u32 key = ARMPROC.instruct_adr | ARMPROC.CPSR.bits.T;
+	const u8 *page = MMU_readPage(PROCNUM, MMU_AT_CODE, ARMPROC.instruct_adr);
+	if(!page)
+		return armcpu_exec<PROCNUM>();
+	const u8 *host = page + (ARMPROC.instruct_adr & MMU_PAGE_MASK);
+
+	PredecodedBlock *block = predecode_cache[PROCNUM][(key >> 1) & (PREDECODE_CACHE_SIZE-1)];
+	if(!block || block->adr != key || block->host != host || !block->valid)
+	{
+		block = predecode_build<PROCNUM>(key, host);
+		if(!block)
+			return armcpu_exec<PROCNUM>();
+	}
+
+	const PredecodedOp *op = block->ops;
+	const PredecodedOp *const end = op + block->count;
+	u32 cycles = 0;
+	u32 cExecute;
+
+	//every instruction but the last of the block is followed by the next record, if the code is still sequential
+	#define PREDECODE_RETIRE(size, fetchbits) \
+		if(++op == end || ARMPROC.next_instruction != ARMPROC.instruct_adr + size || !block->valid \
+			|| ARMPROC.freeze || nds.freezeBus) \
+			goto leave; \
+		ARMPROC.instruct_adr = ARMPROC.next_instruction; \
+		ARMPROC.next_instruction += size; \
+		ARMPROC.R[15] = ARMPROC.next_instruction + size; \
+		ARMPROC.instruction = op->opcode; \
+		cycles += MMU_fetchExecuteCycles<PROCNUM>(cExecute, MMU_codeFetchCycles<PROCNUM,fetchbits>(ARMPROC.instruct_adr));
+
+#ifdef __GNUC__
+	//computed goto: every handler jumps straight to the one for the next record
+	static const void *const dispatch[] = { &&op_arm, &&op_arm_cond, &&op_thumb };
+	#define PREDECODE_NEXT() goto *dispatch[op->kind]
+
+	PREDECODE_NEXT();
+
+op_arm:
+	cExecute = op->handler(op->opcode);
+	PREDECODE_RETIRE(4, 32);
+	PREDECODE_NEXT();
+
+op_arm_cond:
+	cExecute = TEST_COND(CONDITION(op->opcode), CODE(op->opcode), ARMPROC.CPSR) ? op->handler(op->opcode) : 1;
+	PREDECODE_RETIRE(4, 32);
+	PREDECODE_NEXT();
+
+op_thumb:
+	cExecute = op->handler(op->opcode);
+	PREDECODE_RETIRE(2, (PROCNUM == 0 ? 32 : 16));
+	PREDECODE_NEXT();
+
+	#undef PREDECODE_NEXT
+#else
+	for(;;)
+	{
+		switch(op->kind)
+		{
+			case PREDECODE_ARM:
+				cExecute = op->handler(op->opcode);
+				PREDECODE_RETIRE(4, 32);
+				break;
+			case PREDECODE_ARM_COND:
+				cExecute = TEST_COND(CONDITION(op->opcode), CODE(op->opcode), ARMPROC.CPSR) ? op->handler(op->opcode) : 1;
+				PREDECODE_RETIRE(4, 32);
+				break;
+			default:
+				cExecute = op->handler(op->opcode);
+				PREDECODE_RETIRE(2, (PROCNUM == 0 ? 32 : 16));
+				break;
+		}
+	}
+#endif
+
+	#undef PREDECODE_RETIRE
+
+leave:
+	cycles += MMU_fetchExecuteCycles<PROCNUM>(cExecute, armcpu_prefetch<PROCNUM>());
+	return cycles;
+}
+
+template u32 armcpu_exec_predecoded<0>();
+template u32 armcpu_exec_predecoded<1>();
+
 void setIF(int PROCNUM, u32 flag)
 {
 	//don't set generated bits!!!
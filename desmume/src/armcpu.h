@@ -356,6 +356,31 @@ template<int PROCNUM> u32 armcpu_exec();
 template<int PROCNUM, bool jit> u32 armcpu_exec();
 #endif
 
+//idle loop skipping (CommonSettings.idle_loop_skip). a short loop of loads and alu ops which ends in a branch back to
+//its start, and carries no register or flag from one iteration into the next, spins until something outside the cpu
+//changes what it reads. the cpu loop may then move the cpu's clock straight to the next point where that can happen.
+#define ARMCPU_IDLELOOP_MAX_INSNS 8
+#define ARMCPU_IDLELOOP_MAX_BYTES (ARMCPU_IDLELOOP_MAX_INSNS*4)
+
+struct armcpu_idleloop
+{
+	u32 adr; //loop start, bit 0 set for thumb
+	u32 skips;
+	u64 cycles; //cycles skipped
+};
+
+//the loop starting at adr (the cpu's next instruction) if it is idle with the registers as they are now, else NULL
+template<int PROCNUM> armcpu_idleloop* armcpu_idleloop_check(u32 adr);
+void armcpu_idleloop_reset();
+//every loop skipped since the last reset, most cycles skipped first
+std::vector<armcpu_idleloop> armcpu_idleloop_stats(int procnum);
+
+//interprets the basic block at the cpu's next instruction from records decoded when it first ran (CommonSettings.interp_predecode),
+//up to its branch or until the code stops running sequentially. returns the cycles taken, like armcpu_exec
+template<int PROCNUM> u32 armcpu_exec_predecoded();
+//drops every predecoded block
+void armcpu_predecode_reset();
+
 void setIF(int PROCNUM, u32 flag);
 
 static INLINE void NDS_makeIrq(int PROCNUM, u32 num)
@@ -55,9 +55,15 @@ CommandLine::CommandLine()
 , _num_cores(-1)
 , _rigorous_timing(0)
 , _advanced_timing(-1)
+, _threaded_arm7(0)
+, _threaded_arm7_skew(-1)
+, _idle_loop_skip(0)
+, _interp_predecode(0)
 , _gamehacks(-1)
 , _texture_deposterize(-1)
 , _texture_smooth(-1)
+, _3d_pipelined(0)
+, _2d_parallel(0)
 , _slot1(NULL)
 , _slot1_fat_dir(NULL)
 , _slot1_fat_dir_type(false)
@@ -65,6 +71,8 @@ CommandLine::CommandLine()
 #ifdef HAVE_JIT
 , _cpu_mode(-1)
 , _jit_size(-1)
+, _jit_cache(NULL)
+, _jit_tier2(-1)
 #endif
 , _console_type(NULL)
 , _advanscene_import(NULL)
@@ -114,6 +122,10 @@ static const char* help_string = \
 "                            4:4x upscaling" ENDL
 " --3d-texture-smoothing-enable" ENDL
 "                            Enables smooth texture sampling while rendering." ENDL
+" --3d-pipelined             Render 3D on a worker while the CPUs run ahead" ENDL
+"                            (SoftRasterizer); default OFF" ENDL
+" --2d-parallel              Render the sub 2D engine on a worker alongside the" ENDL
+"                            main engine; default OFF" ENDL
 #ifdef HOST_WINDOWS
 " --gpu-resolution-multiplier N" ENDL
 "                            Increases the resolution of GPU rendering by this" ENDL
@@ -133,9 +145,15 @@ ENDL
 #ifdef HAVE_JIT
 " --jit-enable               Formerly --cpu-mode; default OFF" ENDL
 " --jit-size N               JIT block size 1-100; 1:accurate 100:fast (default)" ENDL
+" --jit-cache DIR            Keep compiled JIT blocks in DIR across runs" ENDL
+" --jit-tier2 N              Recompile JIT blocks run N times with registers kept in host registers; default 0 (off)" ENDL
 #endif
 " --advanced-timing          Use advanced bus-level timing; default ON" ENDL
 " --rigorous-timing          Use more realistic component timings; default OFF" ENDL
+" --threaded-arm7            Run the ARM7 on its own thread; default OFF" ENDL
+" --threaded-arm7-skew N     Cycles the threaded ARM7 may drift from the ARM9" ENDL
+" --idle-loop-skip           Skip ahead when a CPU spins in a polling loop; default OFF" ENDL
+" --interp-predecode         Run interpreted code from a predecoded block cache; default OFF" ENDL
 " --gamehacks                Use game-specific hacks; default ON" ENDL
 " --spu-advanced             Enable advanced SPU capture functions (reverb)" ENDL
 " --backupmem-db             Use DB for autodetecting backup memory type" ENDL
@@ -196,6 +214,9 @@ ENDL
 #define OPT_3D_TEXTURE_UPSCALE 81
 #define OPT_GPU_RESOLUTION_MULTIPLIER 82
 #define OPT_JIT_SIZE 100
+#define OPT_JIT_CACHE 101
+#define OPT_THREADED_ARM7_SKEW 102
+#define OPT_JIT_TIER2 103
 
 #define OPT_CONSOLE_TYPE 200
 #define OPT_ARM9 201
@@ -250,6 +271,8 @@ bool CommandLine::parse(int argc,char **argv)
 			{ "3d-texture-deposterize-enable", no_argument, &_texture_deposterize, 1 },
 			{ "3d-texture-upscale", required_argument, NULL, OPT_3D_TEXTURE_UPSCALE },
 			{ "3d-texture-smoothing-enable", no_argument, &_texture_smooth, 1 },
+			{ "3d-pipelined", no_argument, &_3d_pipelined, 1 },
+			{ "2d-parallel", no_argument, &_2d_parallel, 1 },
 			#ifdef HOST_WINDOWS
 				{ "gpu-resolution-multiplier", required_argument, NULL, OPT_GPU_RESOLUTION_MULTIPLIER },
 				{ "windowed-fullscreen", no_argument, &windowed_fullscreen, 1 },
@@ -265,9 +288,15 @@ bool CommandLine::parse(int argc,char **argv)
 			#ifdef HAVE_JIT
 				{ "jit-enable", no_argument, &_cpu_mode, 1},
 				{ "jit-size", required_argument, NULL, OPT_JIT_SIZE },
+				{ "jit-cache", required_argument, NULL, OPT_JIT_CACHE },
+				{ "jit-tier2", required_argument, NULL, OPT_JIT_TIER2 },
 			#endif
 			{ "rigorous-timing", no_argument, &_rigorous_timing, 1},
 			{ "advanced-timing", no_argument, &_advanced_timing, 1},
+			{ "threaded-arm7", no_argument, &_threaded_arm7, 1},
+			{ "threaded-arm7-skew", required_argument, NULL, OPT_THREADED_ARM7_SKEW },
+			{ "idle-loop-skip", no_argument, &_idle_loop_skip, 1},
+			{ "interp-predecode", no_argument, &_interp_predecode, 1},
 			{ "gamehacks", no_argument, &_gamehacks, 1},
 			{ "spu-advanced", no_argument, &_spu_advanced, 1},
 			{ "backupmem-db", no_argument, &autodetect_method, 1},
@@ -340,7 +369,10 @@ bool CommandLine::parse(int argc,char **argv)
 		//sync settings
 		#ifdef HAVE_JIT
 		case OPT_JIT_SIZE: _jit_size = atoi(optarg); break;
+		case OPT_JIT_CACHE: _jit_cache = optarg; break;
+		case OPT_JIT_TIER2: _jit_tier2 = atoi(optarg); break;
 		#endif
+		case OPT_THREADED_ARM7_SKEW: _threaded_arm7_skew = atoi(optarg); break;
 
 		//system equipment
 		case OPT_CONSOLE_TYPE: console_type = optarg; break;
@@ -389,6 +421,10 @@ bool CommandLine::parse(int argc,char **argv)
 	if(_num_cores != -1) CommonSettings.num_cores = _num_cores;
 	if(_rigorous_timing) CommonSettings.rigorous_timing = true;
 	if(_advanced_timing != -1) CommonSettings.advanced_timing = _advanced_timing==1;
+	if(_threaded_arm7) CommonSettings.threaded_arm7 = true;
+	if(_threaded_arm7_skew >= 0) CommonSettings.threaded_arm7_skew = _threaded_arm7_skew;
+	if(_idle_loop_skip) CommonSettings.idle_loop_skip = true;
+	if(_interp_predecode) CommonSettings.interp_predecode = true;
 	if(_gamehacks != -1) CommonSettings.gamehacks.en = _gamehacks==1;
 
 #ifdef HAVE_JIT
@@ -400,6 +436,8 @@ bool CommandLine::parse(int argc,char **argv)
 		else
 			CommonSettings.jit_max_block_size = _jit_size;
 	}
+	if(_jit_cache) CommonSettings.jit_cache_path = _jit_cache;
+	if(_jit_tier2 >= 0) CommonSettings.jit_tier2_threshold = _jit_tier2;
 #endif
 
 	//process console type
@@ -427,6 +465,8 @@ bool CommandLine::parse(int argc,char **argv)
 
 	if (_texture_deposterize != -1) CommonSettings.GFX3D_Renderer_TextureDeposterize = (_texture_deposterize == 1);
 	if (_texture_smooth != -1) CommonSettings.GFX3D_Renderer_TextureSmoothing = (_texture_smooth == 1);
+	if (_3d_pipelined) CommonSettings.GFX3D_Renderer_Pipelined = true;
+	if (_2d_parallel) CommonSettings.GPU2D_ParallelSubEngine = true;
 
 	if (autodetect_method != -1)
 		CommonSettings.autodetectBackupMethod = autodetect_method;
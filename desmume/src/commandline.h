@@ -100,12 +100,20 @@ private:
 	int _num_cores;
 	int _rigorous_timing;
 	int _advanced_timing;
+	int _threaded_arm7;
+	int _threaded_arm7_skew;
+	int _idle_loop_skip;
+	int _interp_predecode;
 	int _gamehacks;
 	int _texture_deposterize;
 	int _texture_smooth;
+	int _3d_pipelined;
+	int _2d_parallel;
 #ifdef HAVE_JIT
 	int _cpu_mode;
 	int _jit_size;
+	char* _jit_cache;
+	int _jit_tier2;
 #endif
 	char* _slot1;
 	char *_slot1_fat_dir;
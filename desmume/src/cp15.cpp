@@ -436,7 +436,8 @@ BOOL armcp15_t::moveARM2CP(u32 val, u8 CRn, u8 CRm, u8 opcode1, u8 opcode2)
 				switch(opcode2)
 				{
 				case 0:
-					MMU.DTCMRegion = DTCMRegion = val & 0x0FFFF000;
+					DTCMRegion = val & 0x0FFFF000;
+					MMU_SetDTCMRegion(DTCMRegion);
 					return TRUE;
 				case 1:
 					ITCMRegion = val;
@@ -755,6 +755,13 @@ static void check_variables(bool first_boot)
           CommonSettings.jit_max_block_size = var.value ? strtol(var.value, 0, 10) : 100;
       else
           CommonSettings.jit_max_block_size = 100;
+
+      var.key = "desmume_jit_tier2";
+
+      if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value && strcmp(var.value, "disabled"))
+          CommonSettings.jit_tier2_threshold = strtol(var.value, 0, 10);
+      else
+          CommonSettings.jit_tier2_threshold = 0;
 #endif
 
       var.key = "desmume_use_external_bios";
@@ -1243,6 +1250,66 @@ static void check_variables(bool first_boot)
    else
       CommonSettings.advanced_timing = true;
 
+   var.key = "desmume_threaded_arm7";
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+   {
+      if (!strcmp(var.value, "enabled"))
+         CommonSettings.threaded_arm7 = true;
+      else if (!strcmp(var.value, "disabled"))
+         CommonSettings.threaded_arm7 = false;
+   }
+   else
+      CommonSettings.threaded_arm7 = false;
+
+   var.key = "desmume_idle_loop_skip";
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+   {
+      if (!strcmp(var.value, "enabled"))
+         CommonSettings.idle_loop_skip = true;
+      else if (!strcmp(var.value, "disabled"))
+         CommonSettings.idle_loop_skip = false;
+   }
+   else
+      CommonSettings.idle_loop_skip = false;
+
+   var.key = "desmume_interp_predecode";
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+   {
+      if (!strcmp(var.value, "enabled"))
+         CommonSettings.interp_predecode = true;
+      else if (!strcmp(var.value, "disabled"))
+         CommonSettings.interp_predecode = false;
+   }
+   else
+      CommonSettings.interp_predecode = false;
+
+   var.key = "desmume_pipelined_3d";
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+   {
+      if (!strcmp(var.value, "enabled"))
+         CommonSettings.GFX3D_Renderer_Pipelined = true;
+      else if (!strcmp(var.value, "disabled"))
+         CommonSettings.GFX3D_Renderer_Pipelined = false;
+   }
+   else
+      CommonSettings.GFX3D_Renderer_Pipelined = false;
+
+   var.key = "desmume_parallel_2d";
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+   {
+      if (!strcmp(var.value, "enabled"))
+         CommonSettings.GPU2D_ParallelSubEngine = true;
+      else if (!strcmp(var.value, "disabled"))
+         CommonSettings.GPU2D_ParallelSubEngine = false;
+   }
+   else
+      CommonSettings.GPU2D_ParallelSubEngine = false;
+
    var.key = "desmume_screens_gap";
 
    if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
@@ -1744,6 +1811,51 @@ static void check_variables_run()
 			CommonSettings.advanced_timing = false;
 	}
 
+	var.key = "desmume_threaded_arm7";
+	if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+	{
+		if (!strcmp(var.value, "enabled"))
+			CommonSettings.threaded_arm7 = true;
+		else if (!strcmp(var.value, "disabled"))
+			CommonSettings.threaded_arm7 = false;
+	}
+
+	var.key = "desmume_idle_loop_skip";
+	if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+	{
+		if (!strcmp(var.value, "enabled"))
+			CommonSettings.idle_loop_skip = true;
+		else if (!strcmp(var.value, "disabled"))
+			CommonSettings.idle_loop_skip = false;
+	}
+
+	var.key = "desmume_interp_predecode";
+	if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+	{
+		if (!strcmp(var.value, "enabled"))
+			CommonSettings.interp_predecode = true;
+		else if (!strcmp(var.value, "disabled"))
+			CommonSettings.interp_predecode = false;
+	}
+
+	var.key = "desmume_pipelined_3d";
+	if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+	{
+		if (!strcmp(var.value, "enabled"))
+			CommonSettings.GFX3D_Renderer_Pipelined = true;
+		else if (!strcmp(var.value, "disabled"))
+			CommonSettings.GFX3D_Renderer_Pipelined = false;
+	}
+
+	var.key = "desmume_parallel_2d";
+	if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+	{
+		if (!strcmp(var.value, "enabled"))
+			CommonSettings.GPU2D_ParallelSubEngine = true;
+		else if (!strcmp(var.value, "disabled"))
+			CommonSettings.GPU2D_ParallelSubEngine = false;
+	}
+
 	var.key = "desmume_screens_gap";
 	if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
 	{
@@ -1962,10 +2074,16 @@ void retro_set_environment(retro_environment_t cb)
       { "desmume_cpu_mode", "CPU Mode (restart); jit|interpreter" },
 #endif
       { "desmume_jit_block_size", "JIT Block Size; 12|13|14|15|16|17|18|19|20|21|22|23|24|25|26|27|28|29|30|31|32|33|34|35|36|37|38|39|40|41|42|43|44|45|46|47|48|49|50|51|52|53|54|55|56|57|58|59|60|61|62|63|64|65|66|67|68|69|70|71|72|73|74|75|76|77|78|79|80|81|82|83|84|85|86|87|88|89|90|91|92|93|94|95|96|97|98|99|100|0|1|2|3|4|5|6|7|8|9|10|11" },
+      { "desmume_jit_tier2", "JIT Recompile Hot Blocks After; disabled|1000|10000|100" },
 #else
       { "desmume_cpu_mode", "CPU Mode; interpreter" },
 #endif
       { "desmume_advanced_timing", "Enable Advanced Bus-Level Timing; enabled|disabled" },
+      { "desmume_threaded_arm7", "Run ARM7 On Separate Thread (experimental); disabled|enabled" },
+      { "desmume_idle_loop_skip", "Skip CPU Idle Loops; disabled|enabled" },
+      { "desmume_interp_predecode", "Predecode Interpreted Code; disabled|enabled" },
+      { "desmume_pipelined_3d", "Pipeline 3D Rendering With CPU Emulation (SoftRasterizer); disabled|enabled" },
+      { "desmume_parallel_2d", "Render Sub 2D Engine On Separate Thread; disabled|enabled" },
       { "desmume_frameskip", "Frameskip; 0|1|2|3|4|5|6|7|8|9" },
       { "desmume_internal_resolution", "Internal Resolution; 256x192|512x384|768x576|1024x768|1280x960|1536x1152|1792x1344|2048x1536|2304x1728|2560x1920" },
 #ifdef HAVE_OPENGL
@@ -0,0 +1,430 @@
+/* main.cpp - this file is part of DeSmuME
+ *
+ * Copyright (C) 2006-2019 DeSmuME Team
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+//desmume-bench: runs a ROM (optionally driven by a DSM replay) for a fixed number of frames
+//with no audio or video output, and reports the frame rate and the host time spent in the
+//major emulation sections as JSON. intended for comparing builds and settings on the same input.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#ifdef GDB_STUB
+#include <pthread.h>
+#endif
+
+#include "../NDSSystem.h"
+#include "../armcpu.h"
+#include "../driver.h"
+#include "../GPU.h"
+#include "../SPU.h"
+#include "../render3D.h"
+#include "../rasterize.h"
+#include "../movie.h"
+#include "../saves.h"
+#include "../commandline.h"
+#include "../slot2.h"
+#include "../texcache.h"
+#include "../MMU.h"
+
+#define BENCH_DEFAULT_FRAMES 600
+//idle loops listed per cpu, by cycles skipped
+#define BENCH_IDLE_LOOPS 16
+//the texture unpack benchmark unpacks a 256x256 texture this many times per format
+#define BENCH_UNPACK_SIZE 256
+#define BENCH_UNPACK_PASSES 500
+
+volatile bool execute = false;
+
+SoundInterface_struct *SNDCoreList[] = {
+	&SNDDummy,
+	NULL
+};
+
+GPU3DInterface *core3DList[] = {
+	&gpu3DNull,
+	&gpu3DRasterize,
+	NULL
+};
+
+class BenchCommandLine : public CommandLine
+{
+public:
+	int frames;
+	std::string json_file;
+	bool unpack_bench;
+
+	BenchCommandLine()
+		: frames(BENCH_DEFAULT_FRAMES)
+		, unpack_bench(false)
+	{}
+
+	//pulls the bench-only options out of argv so the rest can go through the shared parser
+	bool parseBench(int &argc, char **argv)
+	{
+		int out = 1;
+		for (int i = 1; i < argc; i++)
+		{
+			if (!strcmp(argv[i], "--frames") && i + 1 < argc)
+			{
+				frames = atoi(argv[++i]);
+				if (frames <= 0)
+				{
+					fprintf(stderr, "--frames must be > 0\n");
+					return false;
+				}
+			}
+			else if (!strcmp(argv[i], "--json-file") && i + 1 < argc)
+				json_file = argv[++i];
+			else if (!strcmp(argv[i], "--unpack-bench"))
+				unpack_bench = true;
+			else
+				argv[out++] = argv[i];
+		}
+		argc = out;
+		argv[argc] = NULL;
+		return true;
+	}
+};
+
+/*
+ * The thread handling functions needed by the GDB stub code.
+ */
+#ifdef GDB_STUB
+struct bench_gdb_thread
+{
+	void (*func)(void *data);
+	void *data;
+	pthread_t thread;
+};
+
+static void* bench_gdb_thread_proc(void *arg)
+{
+	bench_gdb_thread *t = (bench_gdb_thread *)arg;
+	t->func(t->data);
+	return NULL;
+}
+
+void* createThread_gdb(void (*thread_function)(void *data), void *thread_data)
+{
+	bench_gdb_thread *t = new bench_gdb_thread;
+	t->func = thread_function;
+	t->data = thread_data;
+	if (pthread_create(&t->thread, NULL, &bench_gdb_thread_proc, t) != 0)
+	{
+		delete t;
+		return NULL;
+	}
+	return t;
+}
+
+void joinThread_gdb(void *thread_handle)
+{
+	bench_gdb_thread *t = (bench_gdb_thread *)thread_handle;
+	pthread_join(t->thread, NULL);
+	delete t;
+}
+#endif
+
+static std::string bench_json_escape(const std::string &str)
+{
+	std::string ret;
+	for (size_t i = 0; i < str.size(); i++)
+	{
+		const unsigned char c = (unsigned char)str[i];
+		if (c == '"' || c == '\\')
+		{
+			ret += '\\';
+			ret += (char)c;
+		}
+		else if (c < 0x20)
+		{
+			char buf[8];
+			snprintf(buf, sizeof(buf), "\\u%04x", c);
+			ret += buf;
+		}
+		else
+			ret += (char)c;
+	}
+	return ret;
+}
+
+static void bench_write_json(FILE *fp, const BenchCommandLine &config, int frames, double seconds)
+{
+	fprintf(fp, "{\n");
+	fprintf(fp, "  \"rom\": \"%s\",\n", bench_json_escape(config.nds_file).c_str());
+	fprintf(fp, "  \"movie\": \"%s\",\n", bench_json_escape(config.play_movie_file).c_str());
+	fprintf(fp, "  \"frames\": %d,\n", frames);
+	fprintf(fp, "  \"seconds\": %.6f,\n", seconds);
+	fprintf(fp, "  \"fps\": %.3f,\n", (seconds > 0.0) ? (double)frames / seconds : 0.0);
+#ifdef HAVE_JIT
+	fprintf(fp, "  \"jit\": %s,\n", CommonSettings.use_jit ? "true" : "false");
+	const JitCodeStats &jitCode = arm_jit_code_stats();
+	fprintf(fp, "  \"jit_code\": { \"evictions\": %u, \"blocks_evicted\": %u, \"recompiles\": %u, \"bytes_live\": %u, \"code_writes\": %u, \"blocks_invalidated\": %u },\n",
+	        jitCode.evictions, jitCode.blocks_evicted, jitCode.recompiles, jitCode.bytes_live, jitCode.code_writes, jitCode.blocks_invalidated);
+	const JitTierStats &jitTier = arm_jit_tier_stats();
+	fprintf(fp, "  \"jit_tier2\": { \"threshold\": %u, \"hot_blocks\": %u, \"declined\": %u, \"native_ops\": %u, \"flags_skipped\": %u },\n",
+	        CommonSettings.jit_tier2_threshold, jitTier.hot_blocks, jitTier.declined, jitTier.native_ops, jitTier.flags_skipped);
+#endif
+	fprintf(fp, "  \"threaded_arm7\": %s,\n", CommonSettings.threaded_arm7 ? "true" : "false");
+	fprintf(fp, "  \"idle_loop_skip\": %s,\n", CommonSettings.idle_loop_skip ? "true" : "false");
+	fprintf(fp, "  \"interp_predecode\": %s,\n", CommonSettings.interp_predecode ? "true" : "false");
+	fprintf(fp, "  \"sections\": {\n");
+	for (int i = 0; i < NDS_PROFILE_SECTION_COUNT; i++)
+	{
+		const double sectionSeconds = (double)nds_profile.nanoseconds[i] / 1000000000.0;
+		fprintf(fp, "    \"%s\": { \"seconds\": %.6f, \"calls\": %llu, \"percent\": %.2f }%s\n",
+		        NDS_ProfileSectionName((NDS_PROFILE_SECTION)i),
+		        sectionSeconds,
+		        (unsigned long long)nds_profile.calls[i],
+		        (seconds > 0.0) ? sectionSeconds * 100.0 / seconds : 0.0,
+		        (i + 1 < NDS_PROFILE_SECTION_COUNT) ? "," : "");
+	}
+	fprintf(fp, "  },\n");
+	fprintf(fp, "  \"events\": {\n");
+	for (int i = 0; i < NDS_EVENT_COUNT; i++)
+	{
+		fprintf(fp, "    \"%s\": %llu%s\n",
+		        NDS_EventName((NDS_EVENT)i),
+		        (unsigned long long)nds_profile.events[i],
+		        (i + 1 < NDS_EVENT_COUNT) ? "," : "");
+	}
+	fprintf(fp, "  },\n");
+	fprintf(fp, "  \"idle_loops\": {\n");
+	for (int proc = 0; proc < 2; proc++)
+	{
+		const std::vector<armcpu_idleloop> loops = armcpu_idleloop_stats(proc);
+		const size_t count = std::min<size_t>(loops.size(), BENCH_IDLE_LOOPS);
+		fprintf(fp, "    \"%s\": [", proc == ARMCPU_ARM9 ? "arm9" : "arm7");
+		for (size_t i = 0; i < count; i++)
+		{
+			fprintf(fp, "%s\n      { \"address\": \"0x%08X\", \"thumb\": %s, \"skips\": %u, \"cycles\": %llu }",
+			        i ? "," : "",
+			        loops[i].adr & ~1,
+			        (loops[i].adr & 1) ? "true" : "false",
+			        loops[i].skips,
+			        (unsigned long long)loops[i].cycles);
+		}
+		fprintf(fp, "%s]%s\n", count ? "\n    " : "", proc == 0 ? "," : "");
+	}
+	fprintf(fp, "  }\n");
+	fprintf(fp, "}\n");
+}
+
+//--unpack-bench: times every texture unpacker on random texels, once through the scalar code
+//and once through the vectorized kernels texcache picked for this cpu. needs no ROM.
+static CACHE_ALIGN u8 bench_unpack_src[BENCH_UNPACK_SIZE * BENCH_UNPACK_SIZE * 2];
+static CACHE_ALIGN u16 bench_unpack_index[BENCH_UNPACK_SIZE * BENCH_UNPACK_SIZE / 8];
+static CACHE_ALIGN u16 bench_unpack_pal[256];
+static CACHE_ALIGN u8 bench_unpack_palslot[0x4000];
+static CACHE_ALIGN u32 bench_unpack_dst[BENCH_UNPACK_SIZE * BENCH_UNPACK_SIZE];
+
+template <TextureStoreUnpackFormat TEXCACHEFORMAT>
+static void bench_unpack_texture(const NDSTextureFormat packFormat)
+{
+	const size_t texels = BENCH_UNPACK_SIZE * BENCH_UNPACK_SIZE;
+
+	switch (packFormat)
+	{
+		case TEXMODE_I2: NDSTextureUnpackI2<TEXCACHEFORMAT>(texels / 4, bench_unpack_src, bench_unpack_pal, true, bench_unpack_dst); break;
+		case TEXMODE_I4: NDSTextureUnpackI4<TEXCACHEFORMAT>(texels / 2, bench_unpack_src, bench_unpack_pal, true, bench_unpack_dst); break;
+		case TEXMODE_I8: NDSTextureUnpackI8<TEXCACHEFORMAT>(texels, bench_unpack_src, bench_unpack_pal, true, bench_unpack_dst); break;
+		case TEXMODE_A3I5: NDSTextureUnpackA3I5<TEXCACHEFORMAT>(texels, bench_unpack_src, bench_unpack_pal, bench_unpack_dst); break;
+		case TEXMODE_A5I3: NDSTextureUnpackA5I3<TEXCACHEFORMAT>(texels, bench_unpack_src, bench_unpack_pal, bench_unpack_dst); break;
+		case TEXMODE_4X4: NDSTextureUnpack4x4<TEXCACHEFORMAT>(texels / 4, (u32 *)bench_unpack_src, bench_unpack_index, 0, BENCH_UNPACK_SIZE, BENCH_UNPACK_SIZE, bench_unpack_dst); break;
+		case TEXMODE_16BPP: NDSTextureUnpackDirect16Bit<TEXCACHEFORMAT>(texels * 2, (u16 *)bench_unpack_src, bench_unpack_dst); break;
+		default: break;
+	}
+}
+
+template <TextureStoreUnpackFormat TEXCACHEFORMAT>
+static double bench_unpack_rate(const NDSTextureFormat packFormat, const bool vectorized)
+{
+	NDSTextureUnpackSetVectorized(vectorized);
+
+	const std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+	for (int pass = 0; pass < BENCH_UNPACK_PASSES; pass++)
+		bench_unpack_texture<TEXCACHEFORMAT>(packFormat);
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+	return (seconds > 0.0) ? (double)BENCH_UNPACK_SIZE * BENCH_UNPACK_SIZE * BENCH_UNPACK_PASSES / seconds / 1000000.0 : 0.0;
+}
+
+static void bench_write_unpack_json(FILE *fp)
+{
+	static const struct { NDSTextureFormat format; const char *name; } formats[] = {
+		{ TEXMODE_I2, "i2" }, { TEXMODE_I4, "i4" }, { TEXMODE_I8, "i8" }, { TEXMODE_A3I5, "a3i5" },
+		{ TEXMODE_A5I3, "a5i3" }, { TEXMODE_4X4, "4x4" }, { TEXMODE_16BPP, "direct16" }
+	};
+	const size_t formatCount = sizeof(formats) / sizeof(formats[0]);
+
+	srand(1);
+	for (size_t i = 0; i < sizeof(bench_unpack_src); i++)
+		bench_unpack_src[i] = (u8)rand();
+	for (size_t i = 0; i < sizeof(bench_unpack_index) / sizeof(u16); i++)
+		bench_unpack_index[i] = (u16)rand();
+	for (size_t i = 0; i < 256; i++)
+		bench_unpack_pal[i] = (u16)rand();
+	for (size_t i = 0; i < sizeof(bench_unpack_palslot); i++)
+		bench_unpack_palslot[i] = (u8)rand();
+
+	//4x4 textures read their palette through the slot table; point all of it at the random palette
+	for (size_t i = 0; i < ARRAY_SIZE(MMU.texInfo.texPalSlot); i++)
+		MMU.texInfo.texPalSlot[i] = bench_unpack_palslot;
+
+	NDSTextureUnpackSetVectorized(true);
+	fprintf(fp, "{\n");
+	fprintf(fp, "  \"vectorized\": \"%s\",\n", NDSTextureUnpackKernelName());
+	fprintf(fp, "  \"texels\": %d,\n", BENCH_UNPACK_SIZE * BENCH_UNPACK_SIZE * BENCH_UNPACK_PASSES);
+	fprintf(fp, "  \"unpack\": {\n");
+	for (size_t i = 0; i < formatCount; i++)
+	{
+		for (int bpp = 0; bpp < 2; bpp++)
+		{
+			const double scalar = (bpp == 0) ? bench_unpack_rate<TexFormat_15bpp>(formats[i].format, false) : bench_unpack_rate<TexFormat_32bpp>(formats[i].format, false);
+			const double vectorized = (bpp == 0) ? bench_unpack_rate<TexFormat_15bpp>(formats[i].format, true) : bench_unpack_rate<TexFormat_32bpp>(formats[i].format, true);
+			fprintf(fp, "    \"%s_%s\": { \"scalar_mtexels\": %.1f, \"vectorized_mtexels\": %.1f, \"speedup\": %.2f }%s\n",
+			        formats[i].name,
+			        (bpp == 0) ? "15bpp" : "32bpp",
+			        scalar,
+			        vectorized,
+			        (scalar > 0.0) ? vectorized / scalar : 0.0,
+			        (i + 1 < formatCount || bpp == 0) ? "," : "");
+		}
+	}
+	fprintf(fp, "  }\n");
+	fprintf(fp, "}\n");
+
+	NDSTextureUnpackSetVectorized(true);
+}
+
+static FILE* bench_open_json(const BenchCommandLine &config)
+{
+	FILE *fp = stdout;
+	if (config.json_file != "")
+	{
+		fp = fopen(config.json_file.c_str(), "w");
+		if (fp == NULL)
+		{
+			fprintf(stderr, "could not open %s for writing\n", config.json_file.c_str());
+			fp = stdout;
+		}
+	}
+	return fp;
+}
+
+int main(int argc, char ** argv)
+{
+	BenchCommandLine config;
+
+	NDS_Init();
+
+	if (!config.parseBench(argc, argv) || !config.parse(argc, argv) || !config.validate())
+	{
+		fprintf(stderr, "usage: %s [--frames N] [--json-file FILE] [desmume options] ROM\n"
+		                "       %s --unpack-bench [--json-file FILE]\n", argv[0], argv[0]);
+		config.errorHelp(argv[0]);
+		return 1;
+	}
+
+	if (config.unpack_bench)
+	{
+		FILE *fp = bench_open_json(config);
+		bench_write_unpack_json(fp);
+		if (fp != stdout)
+			fclose(fp);
+
+		NDS_DeInit();
+		return 0;
+	}
+
+	if (config.nds_file == "")
+	{
+		fprintf(stderr, "Need to specify file to load.\n");
+		return 1;
+	}
+
+	if (config.language != -1)
+		CommonSettings.fwConfig.language = config.language;
+
+	config.process_addonCommands();
+	slot2_Init();
+	slot2_Change(config.is_cflash_configured ? NDS_SLOT2_CFLASH : NDS_SLOT2_AUTO);
+
+	driver = new BaseDriver();
+
+	//the dummy core still runs the SPU, it only discards the mixed samples
+	SPU_ChangeSoundCore(SNDCORE_DUMMY, 735 * 4);
+
+	GPU->Change3DRendererByID((config.render3d == COMMANDLINE_RENDER3D_NONE) ? RENDERID_NULL : RENDERID_SOFTRASTERIZER);
+
+	if (NDS_LoadROM(config.nds_file.c_str()) < 0)
+	{
+		fprintf(stderr, "error while loading %s\n", config.nds_file.c_str());
+		return 1;
+	}
+
+	if (config.load_slot != -1)
+		loadstate_slot(config.load_slot);
+
+	config.process_movieCommands();
+	if (config.play_movie_file != "" && movieMode != MOVIEMODE_PLAY)
+	{
+		fprintf(stderr, "error while loading movie %s\n", config.play_movie_file.c_str());
+		return 1;
+	}
+
+	execute = true;
+
+	NDS_ProfileReset();
+	NDS_ProfileEnable(true);
+
+	const std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+
+	int frame;
+	for (frame = 0; frame < config.frames && execute; frame++)
+	{
+		NDS_beginProcessingInput();
+		FCEUMOV_HandlePlayback();
+		NDS_endProcessingInput();
+
+		NDS_exec<false>();
+		SPU_Emulate_user(false);
+	}
+
+	const std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - begin;
+	NDS_ProfileEnable(false);
+
+	const double seconds = std::chrono::duration<double>(elapsed).count();
+
+	FILE *fp = bench_open_json(config);
+	bench_write_json(fp, config, frame, seconds);
+
+	if (fp != stdout)
+		fclose(fp);
+
+	NDS_DeInit();
+
+	return 0;
+}
@@ -24,6 +24,7 @@
 #include "SPU.h"
 #include "sndsdl.h"
 #include "debug.h"
+#include "metaspu/metaspu.h"
 
 #ifdef _XBOX
 #include <xtl.h>
@@ -51,11 +52,13 @@ SNDSDLUnMuteAudio,
 SNDSDLSetVolume
 };
 
-static u16 *stereodata16;
-static u32 soundoffset;
-static volatile u32 soundpos;
+//the emulator produces into this from its own thread and the SDL callback consumes from it,
+//so neither side has to take the audio lock
+static SPSCSampleRing *soundring;
+static s16 *mixbuf;
+static u32 mixbufsize;
 static u32 soundlen;
-static u32 soundbufsize;
+static u32 soundbufframes;
 static SDL_AudioSpec audiofmt;
 int audio_volume;
 
@@ -80,20 +83,16 @@ DWORD WINAPI SNDXBOXThread( LPVOID )
 
 
 static void MixAudio(void *userdata, Uint8 *stream, int len) {
-   int i;
-   Uint8 *soundbuf=(Uint8 *)stereodata16;
+   if ((u32)len > mixbufsize)
+      len = mixbufsize;
 
-   Uint8 *stream_tmp=(Uint8 *)malloc(len);
-   for (i = 0; i < len; i++)
-   {
-      if (soundpos >= soundbufsize)
-         soundpos = 0;
+   const u32 frames = len / (sizeof(s16) * 2);
+   const u32 got = soundring->read(mixbuf, frames);
 
-      stream_tmp[i] = soundbuf[soundpos];
-      soundpos++;
-   }
-   SDL_MixAudio(stream, stream_tmp, len, audio_volume);
-   free(stream_tmp);
+   //pad with silence when the emulator falls behind
+   memset(mixbuf + got * 2, 0, (frames - got) * sizeof(s16) * 2);
+
+   SDL_MixAudio(stream, (Uint8 *)mixbuf, len, audio_volume);
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -119,20 +118,21 @@ int SNDSDLInit(int buffersize)
    audiofmt.samples = normSamples;
    
    soundlen = audiofmt.freq / 60; // 60 for NTSC
-   soundbufsize = buffersize * sizeof(s16) * 2;
+   soundbufframes = buffersize;
+
+   //the callback may be asked for the whole hardware buffer at once; size its scratch space up front
+   //so it never has to allocate
+   mixbufsize = audiofmt.samples * sizeof(s16) * 2;
+   if ((mixbuf = (s16 *)malloc(mixbufsize)) == NULL)
+      return -1;
+
+   soundring = new SPSCSampleRing(soundbufframes);
 
    if (SDL_OpenAudio(&audiofmt, NULL) != 0)
    {
       return -1;
    }
 
-   if ((stereodata16 = (u16 *)malloc(soundbufsize)) == NULL)
-      return -1;
-
-   memset(stereodata16, 0, soundbufsize);
-
-   soundpos = 0;
-
    SDL_PauseAudio(0);
 
 #ifdef _XBOX
@@ -156,53 +156,27 @@ void SNDSDLDeInit()
 #endif
    SDL_CloseAudio();
 
-   if (stereodata16)
-      free(stereodata16);
+   delete soundring;
+   soundring = NULL;
+
+   free(mixbuf);
+   mixbuf = NULL;
 }
 
 //////////////////////////////////////////////////////////////////////////////
 
 void SNDSDLUpdateAudio(s16 *buffer, u32 num_samples)
 {
-   u32 copy1size=0, copy2size=0;
-   SDL_LockAudio();
-
-   if ((soundbufsize - soundoffset) < (num_samples * sizeof(s16) * 2))
-   {
-      copy1size = (soundbufsize - soundoffset);
-      copy2size = (num_samples * sizeof(s16) * 2) - copy1size;
-   }
-   else
-   {
-      copy1size = (num_samples * sizeof(s16) * 2);
-      copy2size = 0;
-   }
-
-   memcpy((((u8 *)stereodata16)+soundoffset), buffer, copy1size);
-//   ScspConvert32uto16s((s32 *)leftchanbuffer, (s32 *)rightchanbuffer, (s16 *)(((u8 *)stereodata16)+soundoffset), copy1size / sizeof(s16) / 2);
-
-   if (copy2size)
-      memcpy(stereodata16, ((u8 *)buffer)+copy1size, copy2size);
-//      ScspConvert32uto16s((s32 *)leftchanbuffer, (s32 *)rightchanbuffer, (s16 *)stereodata16, copy2size / sizeof(s16) / 2);
-
-   soundoffset += copy1size + copy2size;
-   soundoffset %= soundbufsize;
-
-   SDL_UnlockAudio();
+   //whatever does not fit is dropped; GetAudioSpace keeps the SPU from producing that much
+   soundring->write(buffer, num_samples);
 }
 
 //////////////////////////////////////////////////////////////////////////////
 
 u32 SNDSDLGetAudioSpace()
 {
-   u32 freespace=0;
-
-   if (soundoffset > soundpos)
-      freespace = soundbufsize - soundoffset + soundpos;
-   else
-      freespace = soundpos - soundoffset;
-
-   return (freespace / sizeof(s16) / 2);
+   const u32 queued = soundring->size();
+   return (queued < soundbufframes) ? (soundbufframes - queued) : 0;
 }
 
 //////////////////////////////////////////////////////////////////////////////
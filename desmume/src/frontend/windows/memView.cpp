@@ -681,6 +681,7 @@ INT_PTR CALLBACK MemView_DlgProc(HWND hDlg, UINT uMsg, WPARAM wParam, LPARAM lPa
 			char str[16];
 			GetDlgItemText(hDlg, IDC_MEMBPTARG, str, 16);
 			memReadBreakPoints.push_back(strtol(str, NULL, 16));
+			MMU_RebuildPageTables();
 			wnd->Refresh();
 			wnd->SetFocus();
 			InvalidateRect(hDlg, NULL, FALSE);
@@ -691,6 +692,7 @@ INT_PTR CALLBACK MemView_DlgProc(HWND hDlg, UINT uMsg, WPARAM wParam, LPARAM lPa
 			char str[16];
 			GetDlgItemText(hDlg, IDC_MEMBPTARG, str, 16);
 			memWriteBreakPoints.push_back(strtol(str, NULL, 16));
+			MMU_RebuildPageTables();
 			wnd->Refresh();
 			wnd->SetFocus();
 			InvalidateRect(hDlg, NULL, FALSE);
@@ -699,6 +701,7 @@ INT_PTR CALLBACK MemView_DlgProc(HWND hDlg, UINT uMsg, WPARAM wParam, LPARAM lPa
 		case IDC_DELREADBP: {
 			if (RBPOffs < memReadBreakPoints.size()) {
 				memReadBreakPoints.erase(memReadBreakPoints.begin() + RBPOffs);
+				MMU_RebuildPageTables();
 			}
 			wnd->Refresh();
 			wnd->SetFocus();
@@ -708,6 +711,7 @@ INT_PTR CALLBACK MemView_DlgProc(HWND hDlg, UINT uMsg, WPARAM wParam, LPARAM lPa
 		case IDC_DELWRITEBP: {
 			if (WBPOffs < memWriteBreakPoints.size()) {
 				memWriteBreakPoints.erase(memWriteBreakPoints.begin() + WBPOffs);
+				MMU_RebuildPageTables();
 			}
 			wnd->Refresh();
 			wnd->SetFocus();
@@ -33,6 +33,14 @@
 //from MatrixStackSetStackPosition: "once upon a time, we tried clamping to the size. this utterly broke sims 2 apartment pets. changing to wrap around made it work perfectly"
 //Water Horse Legend Of The Deep does seem to exercise the texture matrix stack, which does probably need to exist *but I'm not 100% sure)
 
+#include "types.h"
+
+//the vertex batch transforms call the real SSE4.1 and AVX2 intrinsics, so they need to be declared before
+//GPU.h can put its SSE2 stand-ins in their place
+#ifdef ENABLE_SSE2
+#include <immintrin.h>
+#endif
+
 #include "gfx3d.h"
 
 #include <assert.h>
@@ -58,6 +66,11 @@
 #include "utils/bits.h"
 #include "movie.h" //only for currframecounter which really ought to be moved into the core emu....
 
+#ifdef ENABLE_SSE2
+#include <features/features_cpu.h>
+#undef _mm_blendv_epi8
+#endif
+
 //#define _SHOW_VTX_COUNTERS	// show polygon/vertex counters on screen
 #ifdef _SHOW_VTX_COUNTERS
 u32 max_polys, max_verts;
@@ -81,6 +94,7 @@ resolved since then by deferring actual rendering to the next vcount=0 (giving t
 But since we're not sure how we'll eventually want this, I am leaving it sort of reconfigurable, doing all the work
 in this function: */
 static void gfx3d_doFlush();
+static void GEM_ClearVertexBatch();
 
 #define GFX_NOARG_COMMAND 0x00
 #define GFX_INVALID_COMMAND 0xFF
@@ -625,6 +639,7 @@ void gfx3d_reset()
 	memset(gxPIPE.param, 0, sizeof(gxPIPE.param));
 	memset(colorRGB, 0, sizeof(colorRGB));
 	memset(&tempVertInfo, 0, sizeof(tempVertInfo));
+	GEM_ClearVertexBatch();
 	memset(_gfx3d_savestateBuffer, 0, GPU_FRAMEBUFFER_NATIVE_WIDTH * GPU_FRAMEBUFFER_NATIVE_HEIGHT * sizeof(u32));
 
 	MatrixInit(mtxCurrent[MATRIXMODE_PROJECTION]);
@@ -733,6 +748,214 @@ static void GEM_TransformVertex(const s32 (&__restrict mtx)[16], s32 (&__restric
 	vec[2] = GEM_SaturateAndShiftdown36To32( GEM_Mul32x32To64(x,mtx[2]) + GEM_Mul32x32To64(y,mtx[6]) + GEM_Mul32x32To64(z,mtx[10]) + GEM_Mul32x32To64(w,mtx[14]) );
 	vec[3] = GEM_SaturateAndShiftdown36To32( GEM_Mul32x32To64(x,mtx[3]) + GEM_Mul32x32To64(y,mtx[7]) + GEM_Mul32x32To64(z,mtx[11]) + GEM_Mul32x32To64(w,mtx[15]) );
 }
+
+//vertices submitted between matrix changes all go through the same modelview and projection matrices,
+//so they are queued up and transformed several at a time. coord is laid out as x,y,z,w lanes.
+#define GEM_VERTEX_BATCH_SIZE 8
+
+// The batch transforms are built for the instruction sets that they use, regardless of what the rest of
+// the build targets, and the fastest set that the host cpu supports is picked once at startup.
+#if defined(ENABLE_SSE2) && defined(__GNUC__)
+	#define GEM_TARGET(isa) __attribute__((target(isa)))
+#else
+	#define GEM_TARGET(isa)
+#endif
+
+enum GEM_TransformKernel
+{
+	GEM_TransformKernel_Scalar	= 0,
+	GEM_TransformKernel_SSE4_1	= 1,
+	GEM_TransformKernel_AVX2	= 2
+};
+
+static GEM_TransformKernel GEM_DetectTransformKernel()
+{
+#ifdef ENABLE_SSE2
+	const u64 features = cpu_features_get();
+	
+	if (features & RETRO_SIMD_AVX2)
+	{
+		return GEM_TransformKernel_AVX2;
+	}
+	
+	if (features & RETRO_SIMD_SSE4)
+	{
+		return GEM_TransformKernel_SSE4_1;
+	}
+#endif
+	
+	return GEM_TransformKernel_Scalar;
+}
+
+static const GEM_TransformKernel _gemTransformKernel = GEM_DetectTransformKernel();
+
+#ifdef ENABLE_SSE2
+
+static FORCEINLINE GEM_TARGET("avx2") __m256i GEM_SaturateAndShiftdown36To32_AVX2(const __m256i val)
+{
+	//a 64-bit lane is in range when bits 63..43 all match its sign, which can be checked on the high dword alone
+	const __m256i sign = _mm256_shuffle_epi32(_mm256_srai_epi32(val, 31), 0xF5);
+	const __m256i inRange = _mm256_shuffle_epi32(_mm256_cmpeq_epi32(_mm256_srai_epi32(val, 11), _mm256_srai_epi32(val, 31)), 0xF5);
+	const __m256i saturated = _mm256_xor_si256(sign, _mm256_set1_epi64x(0x7FFFFFFF));
+	return _mm256_blendv_epi8(saturated, _mm256_srli_epi64(val, 12), inRange);
+}
+
+static GEM_TARGET("avx2") void GEM_TransformVertexBatch_AVX2(const s32 (&__restrict mtx)[16], s32 (&__restrict coord)[4][GEM_VERTEX_BATCH_SIZE], const size_t count)
+{
+	const __m256i packLanes = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+	
+	for (size_t i = 0; i < count; i += 4)
+	{
+		const __m256i x = _mm256_cvtepi32_epi64(_mm_load_si128((__m128i *)&coord[0][i]));
+		const __m256i y = _mm256_cvtepi32_epi64(_mm_load_si128((__m128i *)&coord[1][i]));
+		const __m256i z = _mm256_cvtepi32_epi64(_mm_load_si128((__m128i *)&coord[2][i]));
+		const __m256i w = _mm256_cvtepi32_epi64(_mm_load_si128((__m128i *)&coord[3][i]));
+		
+		for (size_t r = 0; r < 4; r++)
+		{
+			__m256i acc = _mm256_add_epi64( _mm256_add_epi64(_mm256_mul_epi32(x, _mm256_set1_epi32(mtx[r])), _mm256_mul_epi32(y, _mm256_set1_epi32(mtx[r+4]))),
+			                                _mm256_add_epi64(_mm256_mul_epi32(z, _mm256_set1_epi32(mtx[r+8])), _mm256_mul_epi32(w, _mm256_set1_epi32(mtx[r+12]))) );
+			acc = _mm256_permutevar8x32_epi32(GEM_SaturateAndShiftdown36To32_AVX2(acc), packLanes);
+			_mm_store_si128((__m128i *)&coord[r][i], _mm256_castsi256_si128(acc));
+		}
+	}
+}
+
+static FORCEINLINE GEM_TARGET("sse4.1") __m128i GEM_SaturateAndShiftdown36To32_SSE41(const __m128i val)
+{
+	//a 64-bit lane is in range when bits 63..43 all match its sign, which can be checked on the high dword alone
+	const __m128i sign = _mm_shuffle_epi32(_mm_srai_epi32(val, 31), 0xF5);
+	const __m128i inRange = _mm_shuffle_epi32(_mm_cmpeq_epi32(_mm_srai_epi32(val, 11), _mm_srai_epi32(val, 31)), 0xF5);
+	const __m128i saturated = _mm_xor_si128(sign, _mm_set1_epi64x(0x7FFFFFFF));
+	return _mm_blendv_epi8(saturated, _mm_srli_epi64(val, 12), inRange);
+}
+
+static GEM_TARGET("sse4.1") void GEM_TransformVertexBatch_SSE41(const s32 (&__restrict mtx)[16], s32 (&__restrict coord)[4][GEM_VERTEX_BATCH_SIZE], const size_t count)
+{
+	for (size_t i = 0; i < count; i += 2)
+	{
+		const __m128i x = _mm_cvtepi32_epi64(_mm_loadl_epi64((__m128i *)&coord[0][i]));
+		const __m128i y = _mm_cvtepi32_epi64(_mm_loadl_epi64((__m128i *)&coord[1][i]));
+		const __m128i z = _mm_cvtepi32_epi64(_mm_loadl_epi64((__m128i *)&coord[2][i]));
+		const __m128i w = _mm_cvtepi32_epi64(_mm_loadl_epi64((__m128i *)&coord[3][i]));
+		
+		for (size_t r = 0; r < 4; r++)
+		{
+			__m128i acc = _mm_add_epi64( _mm_add_epi64(_mm_mul_epi32(x, _mm_set1_epi32(mtx[r])), _mm_mul_epi32(y, _mm_set1_epi32(mtx[r+4]))),
+			                             _mm_add_epi64(_mm_mul_epi32(z, _mm_set1_epi32(mtx[r+8])), _mm_mul_epi32(w, _mm_set1_epi32(mtx[r+12]))) );
+			acc = _mm_shuffle_epi32(GEM_SaturateAndShiftdown36To32_SSE41(acc), 0xD8);
+			_mm_storel_epi64((__m128i *)&coord[r][i], acc);
+		}
+	}
+}
+
+#endif // ENABLE_SSE2
+
+static void GEM_TransformVertexBatch(const s32 (&__restrict mtx)[16], s32 (&__restrict coord)[4][GEM_VERTEX_BATCH_SIZE], const size_t count)
+{
+#ifdef ENABLE_SSE2
+	if (_gemTransformKernel == GEM_TransformKernel_AVX2)
+	{
+		GEM_TransformVertexBatch_AVX2(mtx, coord, count);
+		return;
+	}
+	
+	if (_gemTransformKernel == GEM_TransformKernel_SSE4_1)
+	{
+		GEM_TransformVertexBatch_SSE41(mtx, coord, count);
+		return;
+	}
+#endif
+	
+	for (size_t i = 0; i < count; i++)
+	{
+		s32 vec[4] = { coord[0][i], coord[1][i], coord[2][i], coord[3][i] };
+		GEM_TransformVertex(mtx, vec);
+		coord[0][i] = vec[0];
+		coord[1][i] = vec[1];
+		coord[2][i] = vec[2];
+		coord[3][i] = vec[3];
+	}
+}
+
+struct GEM_VertexBatch
+{
+	DS_ALIGN(32) s32 coord[4][GEM_VERTEX_BATCH_SIZE];
+	VERT *vert[GEM_VERTEX_BATCH_SIZE];
+	size_t count;
+	
+	//untextured polygons completed while some of their vertices were still queued.
+	//the line segment test needs their final coords, so it runs when the batch is flushed.
+	POLY *lineTest[GEM_VERTEX_BATCH_SIZE];
+	size_t lineTestCount;
+};
+
+static GEM_VertexBatch vertexBatch;
+
+static void gfx3d_DetectLineSegment(POLY &poly)
+{
+	// Line segment detect
+	// Tested" Castlevania POR - warp stone, trajectory of ricochet, "Eye of Decay"
+	bool duplicated = false;
+	const VERT &vert0 = vertList[poly.vertIndexes[0]];
+	const VERT &vert1 = vertList[poly.vertIndexes[1]];
+	const VERT &vert2 = vertList[poly.vertIndexes[2]];
+	if ( (vert0.x == vert1.x) && (vert0.y == vert1.y) ) duplicated = true;
+	else
+		if ( (vert1.x == vert2.x) && (vert1.y == vert2.y) ) duplicated = true;
+		else
+			if ( (vert0.y == vert1.y) && (vert1.y == vert2.y) ) duplicated = true;
+			else
+				if ( (vert0.x == vert1.x) && (vert1.x == vert2.x) ) duplicated = true;
+	if (duplicated)
+	{
+		//printf("Line Segmet detected (poly type %i, mode %i, texparam %08X)\n", poly.type, poly.vtxFormat, textureFormat);
+		poly.vtxFormat = (PolygonPrimitiveType)(poly.vtxFormat + 4);
+	}
+}
+
+//transforms every queued vertex. this must happen before the matrices change, and before anything reads the vertex list.
+static void GEM_FlushVertexBatch()
+{
+	if (vertexBatch.count == 0)
+		return;
+	
+	GEM_TransformVertexBatch(mtxCurrent[MATRIXMODE_POSITION], vertexBatch.coord, vertexBatch.count); //modelview
+	GEM_TransformVertexBatch(mtxCurrent[MATRIXMODE_PROJECTION], vertexBatch.coord, vertexBatch.count); //projection
+	
+	for (size_t i = 0; i < vertexBatch.count; i++)
+	{
+		VERT &vert = *vertexBatch.vert[i];
+		vert.coord[0] = vertexBatch.coord[0][i]/4096.0f;
+		vert.coord[1] = vertexBatch.coord[1][i]/4096.0f;
+		vert.coord[2] = vertexBatch.coord[2][i]/4096.0f;
+		vert.coord[3] = vertexBatch.coord[3][i]/4096.0f;
+	}
+	vertexBatch.count = 0;
+	
+	for (size_t i = 0; i < vertexBatch.lineTestCount; i++)
+		gfx3d_DetectLineSegment(*vertexBatch.lineTest[i]);
+	vertexBatch.lineTestCount = 0;
+}
+
+static void GEM_ClearVertexBatch()
+{
+	vertexBatch.count = 0;
+	vertexBatch.lineTestCount = 0;
+}
+
+static void GEM_QueueVertex(VERT &vert, const s32 (&coord)[4])
+{
+	const size_t i = vertexBatch.count++;
+	vertexBatch.coord[0][i] = coord[0];
+	vertexBatch.coord[1][i] = coord[1];
+	vertexBatch.coord[2][i] = coord[2];
+	vertexBatch.coord[3][i] = coord[3];
+	vertexBatch.vert[i] = &vert;
+	
+	if (vertexBatch.count == GEM_VERTEX_BATCH_SIZE)
+		GEM_FlushVertexBatch();
+}
 //---------------
 
 
@@ -763,28 +986,6 @@ static void SetVertex()
 	if(polylist->count >= POLYLIST_SIZE) 
 			return;
 
-	if(freelookMode == 2)
-	{
-		//adjust projection
-		s32 tmp[16];
-		MatrixCopy(tmp,mtxCurrent[MATRIXMODE_PROJECTION]);
-		MatrixMultiply(tmp, freelookMatrix);
-		GEM_TransformVertex(mtxCurrent[MATRIXMODE_POSITION], coordTransformed); //modelview
-		GEM_TransformVertex(tmp, coordTransformed); //projection
-	}
-	else if(freelookMode == 3)
-	{
-		//use provided projection
-		GEM_TransformVertex(mtxCurrent[MATRIXMODE_POSITION], coordTransformed); //modelview
-		GEM_TransformVertex(freelookMatrix, coordTransformed); //projection
-	}
-	else
-	{
-		//no freelook
-		GEM_TransformVertex(mtxCurrent[MATRIXMODE_POSITION], coordTransformed); //modelview
-		GEM_TransformVertex(mtxCurrent[MATRIXMODE_PROJECTION], coordTransformed); //projection
-	}
-
 	//TODO - culling should be done here.
 	//TODO - viewport transform?
 
@@ -816,12 +1017,40 @@ static void SetVertex()
 	//	//MatrixPrint(mtxCurrent[1]);
 	//}
 
+	if(freelookMode == 2 || freelookMode == 3)
+	{
+		//keep the vertex list in submission order; a queued vertex may be headed for this same slot
+		GEM_FlushVertexBatch();
+
+		if(freelookMode == 2)
+		{
+			//adjust projection
+			s32 tmp[16];
+			MatrixCopy(tmp,mtxCurrent[MATRIXMODE_PROJECTION]);
+			MatrixMultiply(tmp, freelookMatrix);
+			GEM_TransformVertex(mtxCurrent[MATRIXMODE_POSITION], coordTransformed); //modelview
+			GEM_TransformVertex(tmp, coordTransformed); //projection
+		}
+		else
+		{
+			//use provided projection
+			GEM_TransformVertex(mtxCurrent[MATRIXMODE_POSITION], coordTransformed); //modelview
+			GEM_TransformVertex(freelookMatrix, coordTransformed); //projection
+		}
+
+		vert.coord[0] = coordTransformed[0]/4096.0f;
+		vert.coord[1] = coordTransformed[1]/4096.0f;
+		vert.coord[2] = coordTransformed[2]/4096.0f;
+		vert.coord[3] = coordTransformed[3]/4096.0f;
+	}
+	else
+	{
+		//no freelook
+		GEM_QueueVertex(vert, coordTransformed);
+	}
+
 	vert.texcoord[0] = last_s/16.0f;
 	vert.texcoord[1] = last_t/16.0f;
-	vert.coord[0] = coordTransformed[0]/4096.0f;
-	vert.coord[1] = coordTransformed[1]/4096.0f;
-	vert.coord[2] = coordTransformed[2]/4096.0f;
-	vert.coord[3] = coordTransformed[3]/4096.0f;
 	vert.color[0] = GFX3D_5TO6_LOOKUP(colorRGB[0]);
 	vert.color[1] = GFX3D_5TO6_LOOKUP(colorRGB[1]);
 	vert.color[2] = GFX3D_5TO6_LOOKUP(colorRGB[2]);
@@ -912,26 +1141,12 @@ static void SetVertex()
 			
 			poly.vtxFormat = vtxFormat;
 
-			// Line segment detect
-			// Tested" Castlevania POR - warp stone, trajectory of ricochet, "Eye of Decay"
 			if (currentPolyTexParam.PackedFormat == TEXMODE_NONE)
 			{
-				bool duplicated = false;
-				const VERT &vert0 = vertList[poly.vertIndexes[0]];
-				const VERT &vert1 = vertList[poly.vertIndexes[1]];
-				const VERT &vert2 = vertList[poly.vertIndexes[2]];
-				if ( (vert0.x == vert1.x) && (vert0.y == vert1.y) ) duplicated = true;
+				if (vertexBatch.count != 0)
+					vertexBatch.lineTest[vertexBatch.lineTestCount++] = &poly;
 				else
-					if ( (vert1.x == vert2.x) && (vert1.y == vert2.y) ) duplicated = true;
-					else
-						if ( (vert0.y == vert1.y) && (vert1.y == vert2.y) ) duplicated = true;
-						else
-							if ( (vert0.x == vert1.x) && (vert1.x == vert2.x) ) duplicated = true;
-				if (duplicated)
-				{
-					//printf("Line Segmet detected (poly type %i, mode %i, texparam %08X)\n", poly.type, poly.vtxFormat, textureFormat);
-					poly.vtxFormat = (PolygonPrimitiveType)(vtxFormat + 4);
-				}
+					gfx3d_DetectLineSegment(poly);
 			}
 
 			poly.attribute = polyAttrInProcess;
@@ -2113,6 +2328,11 @@ static void gfx3d_execute(u8 cmd, u32 param)
 	log3D(cmd, param);
 #endif
 
+	//vertex, per-vertex material, lighting and begin/end commands leave the modelview and projection
+	//matrices alone, so queued vertices can wait. everything else gets to see them transformed.
+	if (cmd < 0x20 || cmd > 0x41)
+		GEM_FlushVertexBatch();
+
 	switch (cmd)
 	{
 		case 0x10:		// MTX_MODE - Set Matrix Mode (W)
@@ -2234,6 +2454,8 @@ static void gfx3d_execute(u8 cmd, u32 param)
 
 void gfx3d_execute3D()
 {
+	NDS_ProfileScope profileScope(NDS_PROFILE_GFX3D_EXECUTE);
+	
 	u8	cmd = 0;
 	u32	param = 0;
 
@@ -2455,6 +2677,8 @@ void gfx3d_GenerateRenderLists(const ClipperMode clippingMode)
 
 static void gfx3d_doFlush()
 {
+	GEM_FlushVertexBatch();
+
 	gfx3d.render3DFrameCount++;
 
 	//the renderer will get the lists we just built
@@ -2499,6 +2723,15 @@ void gfx3d_VBlankSignal()
 {
 	if (isSwapBuffers)
 	{
+		//the renderer reads the render state and the display lists which the flush is about to replace.
+		//usually it was already joined by the 2d engine, but not when the 3d layer wasn't displayed.
+		if (CurrentRenderer->GetRenderNeedsFinish())
+		{
+			GPU->ForceRender3DFinishAndFlush(false);
+			CurrentRenderer->SetRenderNeedsFinish(false);
+			GPU->GetEventHandler()->DidRender3DEnd();
+		}
+		
 		gfx3d_doFlush();
 		GFX_DELAY(392);
 		isSwapBuffers = FALSE;
@@ -2577,6 +2810,8 @@ void gfx3d_VBlankEndSignal(bool skipFrame)
 	if (GPU->GetEngineMain()->GetEnableStateApplied() && nds.power_render)
 	{
 		CurrentRenderer->SetTextureProcessingProperties();
+		
+		NDS_ProfileScope profileScope(NDS_PROFILE_3D_RENDER);
 		CurrentRenderer->Render(gfx3d);
 	}
 	else
@@ -2859,6 +3094,9 @@ void gfx3d_savestate(EMUFILE &os)
 	//version
 	os.write_32LE(4);
 
+	//the vertex list is written out as-is, so queued vertices need their coords first
+	GEM_FlushVertexBatch();
+
 	//dump the render lists
 	os.write_32LE((u32)vertListCount[listTwiddle]);
 	for (size_t i = 0; i < vertListCount[listTwiddle]; i++)
@@ -2930,6 +3168,8 @@ bool gfx3d_loadstate(EMUFILE &is, int size)
 		GPU->ForceRender3DFinishAndFlush(false);
 	}
 
+	GEM_ClearVertexBatch();
+
 	gfx3d_glPolygonAttrib_cache();
 	gfx3d_glTexImage_cache();
 	gfx3d_glLightDirection_cache(0);
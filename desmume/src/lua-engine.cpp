@@ -1886,6 +1886,7 @@ DEFINE_LUA_FUNCTION(vram_writeword, "address,value")
 	int address = luaL_checkinteger(L,1);
 	u16 value = (u16)(luaL_checkinteger(L,2) & 0xFFFF);
 	T1WriteWord(MMU.ARM9_LCD,address,value);
+	MMU_VRAMmarkWritten(MMU.ARM9_LCD + address, sizeof(u16));
 	return 0;
 }
 DEFINE_LUA_FUNCTION(memory_writedword, "address,value")
@@ -5759,6 +5760,7 @@ static void CalculateMemHookRegions(LuaMemHookType hookType)
 		++iter;
 	}
 	hookedRegions[hookType].Calculate(hookedBytes);
+	MMU_RebuildPageTables();
 }
 
 
@@ -20,7 +20,7 @@
 #include "metaspu.h"
 
 #include <queue>
-#include <vector>
+#include <string.h>
 #include <assert.h>
 
 //for pcsx2 method
@@ -29,6 +29,73 @@
 #endif
 
 
+//every synchronizer queues up to this many frames (about 1.5 seconds) between the emulator and the output
+static const size_t kSynchronizerFrames = 65536;
+
+SPSCSampleRing::SPSCSampleRing(size_t minFrames)
+	: _head(0)
+	, _tail(0)
+{
+	size_t frames = 1;
+	while(frames < minFrames)
+		frames <<= 1;
+	_mask = frames - 1;
+	_buffer = new s16[frames*2]();
+}
+
+SPSCSampleRing::~SPSCSampleRing()
+{
+	delete[] _buffer;
+}
+
+size_t SPSCSampleRing::space() const
+{
+	return capacity() - (_head.load(std::memory_order_relaxed) - _tail.load(std::memory_order_acquire));
+}
+
+size_t SPSCSampleRing::write(const s16 *buf, size_t frames)
+{
+	const size_t head = _head.load(std::memory_order_relaxed);
+	frames = std::min(frames, capacity() - (head - _tail.load(std::memory_order_acquire)));
+
+	const size_t pos = head & _mask;
+	const size_t first = std::min(frames, capacity() - pos);
+	memcpy(_buffer + pos*2, buf, first*2*sizeof(s16));
+	memcpy(_buffer, buf + first*2, (frames-first)*2*sizeof(s16));
+
+	//publish the frames only after they are in place
+	_head.store(head + frames, std::memory_order_release);
+	return frames;
+}
+
+size_t SPSCSampleRing::size() const
+{
+	return _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_acquire);
+}
+
+size_t SPSCSampleRing::read(s16 *buf, size_t frames)
+{
+	const size_t tail = _tail.load(std::memory_order_relaxed);
+	frames = std::min(frames, _head.load(std::memory_order_acquire) - tail);
+
+	const size_t pos = tail & _mask;
+	const size_t first = std::min(frames, capacity() - pos);
+	memcpy(buf, _buffer + pos*2, first*2*sizeof(s16));
+	memcpy(buf + first*2, _buffer, (frames-first)*2*sizeof(s16));
+
+	//and hand the space back only after they are copied out
+	_tail.store(tail + frames, std::memory_order_release);
+	return frames;
+}
+
+void SPSCSampleRing::discard(size_t frames)
+{
+	const size_t tail = _tail.load(std::memory_order_relaxed);
+	frames = std::min(frames, _head.load(std::memory_order_acquire) - tail);
+	_tail.store(tail + frames, std::memory_order_release);
+}
+
+
 template<typename T> inline T _abs(T val)
 {
 	if(val<0) return -val;
@@ -67,11 +134,7 @@ public:
 
 	virtual void enqueue_samples(s16* buf, int samples_provided)
 	{
-		for(int i=0;i<samples_provided;i++) {
-			s16 left = *buf++;
-			s16 right = *buf++;
-			adjustobuf.enqueue(left,right);
-		}
+		adjustobuf.enqueue(buf,samples_provided);
 	}
 
 	//returns the number of samples actually supplied, which may not match the number requested
@@ -79,13 +142,13 @@ public:
 	{
 		int done = 0;
 		if(!mixqueue_go) {
-			if(adjustobuf.size > 200)
+			if(adjustobuf.size() > 200)
 				mixqueue_go = true;
 		}
 		else
 		{
 			for(int i=0;i<samples_requested;i++) {
-				if(adjustobuf.size==0) {
+				if(adjustobuf.size()==0) {
 					mixqueue_go = false;
 					break;
 				}
@@ -105,9 +168,9 @@ private:
 	{
 	public:
 		Adjustobuf(int _minLatency, int _maxLatency)
-			: size(0)
-			, minLatency(_minLatency)
+			: minLatency(_minLatency)
 			, maxLatency(_maxLatency)
+			, buffer(kSynchronizerFrames)
 		{
 			rollingTotalSize = 0;
 			targetLatency = (maxLatency + minLatency)/2;
@@ -119,17 +182,16 @@ private:
 
 		float rate, cursor;
 		int minLatency, targetLatency, maxLatency;
-		std::queue<s16> buffer;
-		int size;
+		SPSCSampleRing buffer;
 		s16 curr[2];
 
 		std::queue<int> statsHistory;
 
-		void enqueue(s16 left, s16 right) 
+		int size() const { return (int)buffer.size(); }
+
+		void enqueue(const s16 *buf, int samples)
 		{
-			buffer.push(left);
-			buffer.push(right);
-			size++;
+			buffer.write(buf, samples);
 		}
 
 		s64 rollingTotalSize;
@@ -138,8 +200,9 @@ private:
 
 		void addStatistic()
 		{
-			statsHistory.push(size);
-			rollingTotalSize += size;
+			const int queued = size();
+			statsHistory.push(queued);
+			rollingTotalSize += queued;
 			if(statsHistory.size()>kAverageSize)
 			{
 				rollingTotalSize -= statsHistory.front();
@@ -170,15 +233,11 @@ private:
 		{
 			left = right = 0; 
 			addStatistic();
-			if(size==0) { return; }
+			if(size()==0) { return; }
 			cursor += rate;
 			while(cursor>1.0f) {
 				cursor -= 1.0f;
-				if(size>0) {
-					curr[0] = buffer.front(); buffer.pop();
-					curr[1] = buffer.front(); buffer.pop();
-					size--;
-				}
+				buffer.read(curr,1);
 			}
 			left = curr[0]; 
 			right = curr[1];
@@ -196,7 +255,14 @@ private:
 		ssamp(s16 ll, s16 rr) : l(ll), r(rr) {}
 	};
 
-	std::vector<ssamp> sampleQueue;
+	SPSCSampleRing sampleQueue;
+
+	FORCEINLINE ssamp queuedSample(int index) const
+	{
+		ssamp sample;
+		sampleQueue.peek(index, sample.l, sample.r);
+		return sample;
+	}
 
 	// returns values going between 0 and y-1 in a saw wave pattern, based on x
 	static FORCEINLINE int pingpong(int x, int y)
@@ -240,23 +306,14 @@ private:
 		*outbuf++ = sample.r;
 	}
 
-	static FORCEINLINE void emit_samples(s16*& outbuf, const ssamp* samplebuf, int samples)
-	{
-		for(int i=0;i<samples;i++)
-			emit_sample(outbuf,samplebuf[i]);
-	}
-
 public:
 	NitsujaSynchronizer()
+		: sampleQueue(kSynchronizerFrames)
 	{}
 
 	virtual void enqueue_samples(s16* buf, int samples_provided)
 	{
-		for(int i=0;i<samples_provided;i++)
-		{
-			sampleQueue.push_back(ssamp(buf[0],buf[1]));
-			buf += 2;
-		}
+		sampleQueue.write(buf, samples_provided);
 	}
 
 	virtual int output_samples(s16* buf, int samples_requested)
@@ -282,7 +339,7 @@ public:
 					for(int i = 0; i < audiosize; i++)
 					{
 						int j = i + queued - audiosize;
-						ssamp outsamp = crossfade(sampleQueue[i],sampleQueue[j], i,0,audiosize);
+						ssamp outsamp = crossfade(queuedSample(i),queuedSample(j), i,0,audiosize);
 						emit_sample(buf,outsamp);
 					}
 				}
@@ -324,7 +381,8 @@ public:
 						int bestenddiff = worstdiff;
 						for(int i = 0; i < 128; i+=2)
 						{
-							int diff = abs(sampleQueue[i].l - sampleQueue[i+1].l) + abs(sampleQueue[i].r - sampleQueue[i+1].r);
+							const ssamp a = queuedSample(i), b = queuedSample(i+1);
+							int diff = abs(a.l - b.l) + abs(a.r - b.r);
 							if(diff < beststartdiff)
 							{
 								beststartdiff = diff;
@@ -333,7 +391,8 @@ public:
 						}
 						for(int i = queued-3; i > queued-3-128; i-=2)
 						{
-							int diff = abs(sampleQueue[i].l - sampleQueue[i+1].l) + abs(sampleQueue[i].r - sampleQueue[i+1].r);
+							const ssamp a = queuedSample(i), b = queuedSample(i+1);
+							int diff = abs(a.l - b.l) + abs(a.r - b.r);
 							if(diff < bestenddiff)
 							{
 								bestenddiff = diff;
@@ -351,9 +410,9 @@ public:
 
 						for(int x = 0; x < beststart; x++)
 						{
-							emit_sample(buf,sampleQueue[x]);
+							emit_sample(buf,queuedSample(x));
 						}
-						sampleQueue.erase(sampleQueue.begin(), sampleQueue.begin() + beststart);
+						sampleQueue.discard(beststart);
 					}
 
 
@@ -395,7 +454,7 @@ public:
 					for(int x = 0; x < leftMidpointX; x++)
 					{
 						int i = pingpong(x, queued);
-						emit_sample(buf,sampleQueue[i]);
+						emit_sample(buf,queuedSample(i));
 					}
 
 					// output the middle stretch (section "B")
@@ -403,27 +462,27 @@ public:
 					int dyMidLeft  = (leftMidpointY  < midpointY) ? 1 : -1;
 					int dyMidRight = (rightMidpointY > midpointY) ? 1 : -1;
 					for(int x = leftMidpointX; x < midpointX; x++, y+=dyMidLeft)
-						emit_sample(buf,sampleQueue[y]);
+						emit_sample(buf,queuedSample(y));
 					for(int x = midpointX; x < rightMidpointX; x++, y+=dyMidRight)
-						emit_sample(buf,sampleQueue[y]);
+						emit_sample(buf,queuedSample(y));
 
 					// output the end of the queued sound (section "C")
 					for(int x = rightMidpointX; x < audiosize; x++)
 					{
 						int i = (queued-1) - pingpong((int)audiosize-1 - x + queued*2, queued);
-						emit_sample(buf,sampleQueue[i]);
+						emit_sample(buf,queuedSample(i));
 					}
 
 					for(int x = 0; x < extraAtEnd; x++)
 					{
 						int i = queued + x;
-						emit_sample(buf,sampleQueue[i]);
+						emit_sample(buf,queuedSample(i));
 					}
 					queued += extraAtEnd;
 					audiosize += beststart + extraAtEnd;
 				} //end else
 
-				sampleQueue.erase(sampleQueue.begin(), sampleQueue.begin() + queued);
+				sampleQueue.discard(queued);
 				return audiosize;
 			}
 			else
@@ -439,14 +498,12 @@ public:
 
 				if(audiosize >= queued)
 				{
-					emit_samples(buf,&sampleQueue[0],queued);
-					sampleQueue.erase(sampleQueue.begin(), sampleQueue.begin() + queued);
+					sampleQueue.read(buf,queued);
 					return queued;
 				}
 				else
 				{
-					emit_samples(buf,&sampleQueue[0],audiosize);
-					sampleQueue.erase(sampleQueue.begin(), sampleQueue.begin()+audiosize);
+					sampleQueue.read(buf,audiosize);
 					return audiosize;
 				}
 
@@ -469,36 +526,46 @@ private:
 class PCSX2Synchronizer : public ISynchronizingAudioBuffer
 {
 public:
-	std::queue<s16> readySamples;
+	//SndBuffer isnt thread safe, so the emulator only queues frames here
+	//and everything that touches SndBuffer happens on the output side
+	SPSCSampleRing incoming;
+	StereoOut16 readySamples[SndOutPacketSize*2];
+	int readyPos, readyCount;
+
 	PCSX2Synchronizer()
+		: incoming(kSynchronizerFrames)
+		, readyPos(0)
+		, readyCount(0)
 	{
 		SndBuffer::Init();
 	}
 	virtual void enqueue_samples(s16* buf, int samples_provided)
 	{
-		for(int i=0;i<samples_provided;i++)
-		{
-			StereoOut32 so32(buf[0],buf[1]);
-			SndBuffer::Write(so32);
-			buf++;
-			buf++;
-		}
+		incoming.write(buf, samples_provided);
 	}
 
 	virtual int output_samples(s16* buf, int samples_requested)
 	{
+		s16 block[256*2];
+		while(size_t frames = incoming.read(block, 256))
+		{
+			for(size_t i=0;i<frames;i++)
+			{
+				StereoOut32 so32(block[i*2],block[i*2+1]);
+				SndBuffer::Write(so32);
+			}
+		}
+
 		for(int i=0;i<samples_requested;i++) {
-			if(readySamples.size()==0) {
+			if(readyPos==readyCount) {
 				//SndOutPacketSize
-				StereoOut16 temp[SndOutPacketSize*2];
-				SndBuffer::ReadSamples( temp );
-				for(int i=0;i<SndOutPacketSize;i++) {
-					readySamples.push(temp[i].Left);
-					readySamples.push(temp[i].Right);
-				}
+				SndBuffer::ReadSamples( readySamples );
+				readyPos = 0;
+				readyCount = SndOutPacketSize;
 			}
-			*buf++ = readySamples.front(); readySamples.pop();
-			*buf++ = readySamples.front(); readySamples.pop();
+			*buf++ = readySamples[readyPos].Left;
+			*buf++ = readySamples[readyPos].Right;
+			readyPos++;
 		}
 		return samples_requested;
 	}
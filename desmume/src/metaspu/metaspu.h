@@ -25,6 +25,7 @@
 #define _METASPU_H_
 
 #include <algorithm>
+#include <atomic>
 
 #include "types.h"
 
@@ -40,6 +41,39 @@ static FORCEINLINE T GetClamped( T src, T min, T max )
 	return std::min( std::max( src, min ), max );
 }
 
+//a ring of stereo frames with exactly one producer thread and one consumer thread.
+//the storage is allocated once, and each side only ever stores its own index, so neither side takes a lock
+//and a whole block of samples goes in or out with at most two copies.
+class SPSCSampleRing
+{
+public:
+	SPSCSampleRing(size_t minFrames);
+	~SPSCSampleRing();
+
+	size_t capacity() const { return _mask + 1; }
+
+	//producer side. write() takes as many whole frames as fit and returns how many that was
+	size_t space() const;
+	size_t write(const s16 *buf, size_t frames);
+
+	//consumer side. frames are indexed from the oldest one still queued
+	size_t size() const;
+	size_t read(s16 *buf, size_t frames);
+	void discard(size_t frames);
+	FORCEINLINE void peek(size_t index, s16 &left, s16 &right) const
+	{
+		const size_t pos = ((_tail.load(std::memory_order_relaxed) + index) & _mask) * 2;
+		left = _buffer[pos];
+		right = _buffer[pos+1];
+	}
+
+private:
+	s16 *_buffer;
+	size_t _mask;
+	std::atomic<size_t> _head; //total frames written; only the producer stores it
+	std::atomic<size_t> _tail; //total frames read; only the consumer stores it
+};
+
 class ISynchronizingAudioBuffer
 {
 public:
@@ -38,6 +38,7 @@
 #include "rasterize.h"
 
 #include <algorithm>
+#include <functional>
 #include <assert.h>
 #include <math.h>
 #include <string.h>
@@ -1258,6 +1259,83 @@ void RasterizerUnit<RENDERER>::SetRenderer(SoftRasterizerRenderer *theRenderer)
 	this->_softRender = theRenderer;
 }
 
+template<bool RENDERER> template <bool SLI, bool USELINEHACK>
+FORCEINLINE void RasterizerUnit<RENDERER>::_renderPolygon(const size_t polyIndex, TEXIMAGE_PARAM &lastTexParams, u32 &lastTexPalette, FragmentColor *dstColor, const size_t dstWidth, const size_t dstHeight)
+{
+	this->_polynum = polyIndex;
+	
+	const CPoly &clippedPoly = this->_softRender->GetClippedPolyByIndex(polyIndex);
+	const POLY &thePoly = *clippedPoly.poly;
+	const int vertCount = clippedPoly.type;
+	const bool useLineHack = USELINEHACK && (thePoly.vtxFormat & 4);
+	
+	const POLYGON_ATTR polyAttr = thePoly.attribute;
+	const bool isTranslucent = thePoly.isTranslucent();
+	
+	if (lastTexParams.value != thePoly.texParam.value || lastTexPalette != thePoly.texPalette)
+	{
+		lastTexParams = thePoly.texParam;
+		lastTexPalette = thePoly.texPalette;
+		this->_SetupTexture(thePoly, polyIndex);
+	}
+	
+	for (size_t j = 0; j < vertCount; j++)
+		this->_verts[j] = &clippedPoly.clipVerts[j];
+	for (size_t j = vertCount; j < MAX_CLIPPED_VERTS; j++)
+		this->_verts[j] = NULL;
+	
+	if (!this->_softRender->isPolyBackFacing[polyIndex])
+	{
+		if (polyAttr.Mode == POLYGON_MODE_SHADOW)
+		{
+			if (useLineHack)
+			{
+				this->_shape_engine<SLI, true, true, true>(polyAttr, isTranslucent, dstColor, dstWidth, dstHeight, vertCount);
+			}
+			else
+			{
+				this->_shape_engine<SLI, true, true, false>(polyAttr, isTranslucent, dstColor, dstWidth, dstHeight, vertCount);
+			}
+		}
+		else
+		{
+			if (useLineHack)
+			{
+				this->_shape_engine<SLI, true, false, true>(polyAttr, isTranslucent, dstColor, dstWidth, dstHeight, vertCount);
+			}
+			else
+			{
+				this->_shape_engine<SLI, true, false, false>(polyAttr, isTranslucent, dstColor, dstWidth, dstHeight, vertCount);
+			}
+		}
+	}
+	else
+	{
+		if (polyAttr.Mode == POLYGON_MODE_SHADOW)
+		{
+			if (useLineHack)
+			{
+				this->_shape_engine<SLI, false, true, true>(polyAttr, isTranslucent, dstColor, dstWidth, dstHeight, vertCount);
+			}
+			else
+			{
+				this->_shape_engine<SLI, false, true, false>(polyAttr, isTranslucent, dstColor, dstWidth, dstHeight, vertCount);
+			}
+		}
+		else
+		{
+			if (useLineHack)
+			{
+				this->_shape_engine<SLI, false, false, true>(polyAttr, isTranslucent, dstColor, dstWidth, dstHeight, vertCount);
+			}
+			else
+			{
+				this->_shape_engine<SLI, false, false, false>(polyAttr, isTranslucent, dstColor, dstWidth, dstHeight, vertCount);
+			}
+		}
+	}
+}
+
 template<bool RENDERER> template <bool SLI, bool USELINEHACK>
 FORCEINLINE void RasterizerUnit<RENDERER>::Render()
 {
@@ -1273,7 +1351,6 @@ FORCEINLINE void RasterizerUnit<RENDERER>::Render()
 	
 	const CPoly &firstClippedPoly = this->_softRender->GetClippedPolyByIndex(0);
 	const POLY &firstPoly = *firstClippedPoly.poly;
-	POLYGON_ATTR polyAttr = firstPoly.attribute;
 	TEXIMAGE_PARAM lastTexParams = firstPoly.texParam;
 	u32 lastTexPalette = firstPoly.texPalette;
 	
@@ -1284,77 +1361,34 @@ FORCEINLINE void RasterizerUnit<RENDERER>::Render()
 	{
 		if (!RENDERER) _debug_thisPoly = (i == this->_softRender->_debug_drawClippedUserPoly);
 		if (!this->_softRender->isPolyVisible[i]) continue;
-		this->_polynum = i;
-
-		const CPoly &clippedPoly = this->_softRender->GetClippedPolyByIndex(i);
-		const POLY &thePoly = *clippedPoly.poly;
-		const int vertCount = clippedPoly.type;
-		const bool useLineHack = USELINEHACK && (thePoly.vtxFormat & 4);
-		
-		polyAttr = thePoly.attribute;
-		const bool isTranslucent = thePoly.isTranslucent();
 		
-		if (lastTexParams.value != thePoly.texParam.value || lastTexPalette != thePoly.texPalette)
-		{
-			lastTexParams = thePoly.texParam;
-			lastTexPalette = thePoly.texPalette;
-			this->_SetupTexture(thePoly, i);
-		}
+		this->_renderPolygon<SLI, USELINEHACK>(i, lastTexParams, lastTexPalette, dstColor, dstWidth, dstHeight);
+	}
+}
+
+template<bool RENDERER> template <bool USELINEHACK>
+void RasterizerUnit<RENDERER>::RenderBins()
+{
+	FragmentColor *dstColor = this->_softRender->GetFramebuffer();
+	const size_t dstWidth = this->_softRender->GetFramebufferWidth();
+	const size_t dstHeight = this->_softRender->GetFramebufferHeight();
+	
+	// Keep taking bins until there are none left. Bins own disjoint lines, and each one lists
+	// its polygons in render order, so the result is the same as rendering the whole list.
+	const u32 *polyIndex;
+	size_t polyCount;
+	
+	while (this->_softRender->GetNextBin(this->_SLI_startLine, this->_SLI_endLine, polyIndex, polyCount))
+	{
+		const POLY &firstPoly = *this->_softRender->GetClippedPolyByIndex(polyIndex[0]).poly;
+		TEXIMAGE_PARAM lastTexParams = firstPoly.texParam;
+		u32 lastTexPalette = firstPoly.texPalette;
 		
-		for (size_t j = 0; j < vertCount; j++)
-			this->_verts[j] = &clippedPoly.clipVerts[j];
-		for (size_t j = vertCount; j < MAX_CLIPPED_VERTS; j++)
-			this->_verts[j] = NULL;
+		this->_SetupTexture(firstPoly, polyIndex[0]);
 		
-		if (!this->_softRender->isPolyBackFacing[i])
-		{
-			if (polyAttr.Mode == POLYGON_MODE_SHADOW)
-			{
-				if (useLineHack)
-				{
-					this->_shape_engine<SLI, true, true, true>(polyAttr, isTranslucent, dstColor, dstWidth, dstHeight, vertCount);
-				}
-				else
-				{
-					this->_shape_engine<SLI, true, true, false>(polyAttr, isTranslucent, dstColor, dstWidth, dstHeight, vertCount);
-				}
-			}
-			else
-			{
-				if (useLineHack)
-				{
-					this->_shape_engine<SLI, true, false, true>(polyAttr, isTranslucent, dstColor, dstWidth, dstHeight, vertCount);
-				}
-				else
-				{
-					this->_shape_engine<SLI, true, false, false>(polyAttr, isTranslucent, dstColor, dstWidth, dstHeight, vertCount);
-				}
-			}
-		}
-		else
+		for (size_t i = 0; i < polyCount; i++)
 		{
-			if (polyAttr.Mode == POLYGON_MODE_SHADOW)
-			{
-				if (useLineHack)
-				{
-					this->_shape_engine<SLI, false, true, true>(polyAttr, isTranslucent, dstColor, dstWidth, dstHeight, vertCount);
-				}
-				else
-				{
-					this->_shape_engine<SLI, false, true, false>(polyAttr, isTranslucent, dstColor, dstWidth, dstHeight, vertCount);
-				}
-			}
-			else
-			{
-				if (useLineHack)
-				{
-					this->_shape_engine<SLI, false, false, true>(polyAttr, isTranslucent, dstColor, dstWidth, dstHeight, vertCount);
-				}
-				else
-				{
-					this->_shape_engine<SLI, false, false, false>(polyAttr, isTranslucent, dstColor, dstWidth, dstHeight, vertCount);
-				}
-			}
+			this->_renderPolygon<true, USELINEHACK>(polyIndex[i], lastTexParams, lastTexPalette, dstColor, dstWidth, dstHeight);
 		}
 	}
 }
@@ -1377,6 +1411,15 @@ void* SoftRasterizer_RunRasterizerUnit(void *arg)
 	return 0;
 }
 
+template <bool USELINEHACK>
+void* SoftRasterizer_RunRasterizerBins(void *arg)
+{
+	RasterizerUnit<true> *unit = (RasterizerUnit<true> *)arg;
+	unit->RenderBins<USELINEHACK>();
+	
+	return 0;
+}
+
 static void* SoftRasterizer_RunProcessAllVertices(void *arg)
 {
 	SoftRasterizerRenderer *softRender = (SoftRasterizerRenderer *)arg;
@@ -1417,6 +1460,14 @@ static void* SoftRasterizer_RunClearUsingValues(void *arg)
 	return NULL;
 }
 
+static void* SoftRasterizer_RunPipelinedRender(void *arg)
+{
+	SoftRasterizerRenderer *softRender = (SoftRasterizerRenderer *)arg;
+	softRender->RenderPipelined();
+	
+	return NULL;
+}
+
 static Render3D* SoftRasterizerRendererCreate()
 {
 #if defined(ENABLE_AVX)
@@ -1733,6 +1784,13 @@ SoftRasterizerRenderer::SoftRasterizerRenderer()
 	_renderGeometryNeedsFinish = false;
 	_framebufferAttributes = NULL;
 	
+	_pipelineTask = NULL;
+	_enablePipelinedRender = CommonSettings.GFX3D_Renderer_Pipelined;
+	_renderPipelineNeedsFinish = false;
+	
+	_binCount = 0;
+	_binNext = 0;
+	
 	_enableHighPrecisionColorInterpolation = CommonSettings.GFX3D_HighResolutionInterpolateColor;
 	_enableLineHack = CommonSettings.GFX3D_LineHack;
 	_enableFragmentSamplingHack = CommonSettings.GFX3D_TXTHack;
@@ -1823,6 +1881,14 @@ SoftRasterizerRenderer::SoftRasterizerRenderer()
 
 SoftRasterizerRenderer::~SoftRasterizerRenderer()
 {
+	if (this->_pipelineTask != NULL)
+	{
+		this->_RenderPipelineFinish();
+		this->_pipelineTask->shutdown();
+		delete this->_pipelineTask;
+		this->_pipelineTask = NULL;
+	}
+	
 	for (size_t i = 0; i < this->_threadCount; i++)
 	{
 		this->_task[i].finish();
@@ -1974,6 +2040,120 @@ void SoftRasterizerRenderer::_GetPolygonStates()
 	}
 }
 
+// Returns the framebuffer lines a polygon can touch. Vertex y is in 28.4 fixed point at this
+// point, and the shape engine draws from ceil(top) up to ceil(bottom), inclusive for the line hack.
+static FORCEINLINE bool SoftRasterizer_GetPolygonLines(const CPoly &clippedPoly, const size_t framebufferHeight, size_t &firstLine, size_t &lastLine)
+{
+	float minY = clippedPoly.clipVerts[0].y;
+	float maxY = minY;
+	
+	for (size_t j = 1; j < clippedPoly.type; j++)
+	{
+		minY = std::min<float>(minY, clippedPoly.clipVerts[j].y);
+		maxY = std::max<float>(maxY, clippedPoly.clipVerts[j].y);
+	}
+	
+	minY = floorf(minY / 16.0f);
+	maxY = ceilf(maxY / 16.0f);
+	
+	// Be conservative with nutty polygons; the shape engine does the real clipping.
+	if (!(minY <= maxY))
+	{
+		firstLine = 0;
+		lastLine = framebufferHeight - 1;
+		return true;
+	}
+	
+	if ( (maxY < 0.0f) || (minY > (float)(framebufferHeight - 1)) )
+	{
+		return false;
+	}
+	
+	firstLine = (minY > 0.0f) ? (size_t)minY : 0;
+	lastLine = (maxY < (float)(framebufferHeight - 1)) ? (size_t)maxY : framebufferHeight - 1;
+	
+	return true;
+}
+
+void SoftRasterizerRenderer::_BinPolygons()
+{
+	const size_t h = this->_framebufferHeight;
+	this->_binCount = (h + SOFTRASTERIZER_BIN_LINES - 1) / SOFTRASTERIZER_BIN_LINES;
+	this->_binStart.assign(this->_binCount + 1, 0);
+	
+	// First pass: count the polygons in each bin.
+	size_t totalCount = 0;
+	for (size_t i = 0; i < this->_clippedPolyCount; i++)
+	{
+		size_t firstLine, lastLine;
+		if (!this->isPolyVisible[i] || !SoftRasterizer_GetPolygonLines(this->_clippedPolyList[i], h, firstLine, lastLine))
+		{
+			continue;
+		}
+		
+		for (size_t b = firstLine / SOFTRASTERIZER_BIN_LINES; b <= lastLine / SOFTRASTERIZER_BIN_LINES; b++)
+		{
+			this->_binStart[b + 1]++;
+			totalCount++;
+		}
+	}
+	
+	for (size_t b = 0; b < this->_binCount; b++)
+	{
+		this->_binStart[b + 1] += this->_binStart[b];
+	}
+	
+	// Second pass: fill the bins. Polygons are visited in list order, so each bin keeps the
+	// DS rendering order, including the translucent polygon sort done by gfx3d.
+	this->_binPolyIndex.resize(std::max<size_t>(totalCount, 1));
+	std::vector<u32> binFill(this->_binStart.begin(), this->_binStart.end() - 1);
+	
+	for (size_t i = 0; i < this->_clippedPolyCount; i++)
+	{
+		size_t firstLine, lastLine;
+		if (!this->isPolyVisible[i] || !SoftRasterizer_GetPolygonLines(this->_clippedPolyList[i], h, firstLine, lastLine))
+		{
+			continue;
+		}
+		
+		for (size_t b = firstLine / SOFTRASTERIZER_BIN_LINES; b <= lastLine / SOFTRASTERIZER_BIN_LINES; b++)
+		{
+			this->_binPolyIndex[binFill[b]++] = (u32)i;
+		}
+	}
+	
+	// Hand out the busiest bins first so that the threads finish close together.
+	this->_binOrder.clear();
+	for (size_t b = 0; b < this->_binCount; b++)
+	{
+		const u32 count = this->_binStart[b + 1] - this->_binStart[b];
+		if (count > 0)
+		{
+			this->_binOrder.push_back(((u64)count << 32) | (u64)b);
+		}
+	}
+	
+	std::sort(this->_binOrder.begin(), this->_binOrder.end(), std::greater<u64>());
+	this->_binNext = 0;
+}
+
+bool SoftRasterizerRenderer::GetNextBin(u32 &startLine, u32 &endLine, const u32 *&polyIndex, size_t &polyCount)
+{
+	const s32 next = atomic_inc_barrier32(&this->_binNext) - 1;
+	if (next >= (s32)this->_binOrder.size())
+	{
+		return false;
+	}
+	
+	const u32 bin = (u32)(this->_binOrder[next] & 0xFFFFFFFF);
+	startLine = bin * SOFTRASTERIZER_BIN_LINES;
+	endLine = std::min<u32>(startLine + SOFTRASTERIZER_BIN_LINES, (u32)this->_framebufferHeight);
+	polyIndex = &this->_binPolyIndex[this->_binStart[bin]];
+	polyCount = this->_binStart[bin + 1] - this->_binStart[bin];
+	
+	return true;
+}
+
 void SoftRasterizerRenderer::GetAndLoadAllTextures()
 {
 	for (size_t i = 0; i < this->_clippedPolyCount; i++)
@@ -2000,10 +2180,61 @@ Render3DError SoftRasterizerRenderer::ApplyRenderingSettings(const GFX3D_State &
 	this->_enableHighPrecisionColorInterpolation = CommonSettings.GFX3D_HighResolutionInterpolateColor;
 	this->_enableLineHack = CommonSettings.GFX3D_LineHack;
 	this->_enableFragmentSamplingHack = CommonSettings.GFX3D_TXTHack;
+	this->_enablePipelinedRender = CommonSettings.GFX3D_Renderer_Pipelined;
 	
 	return Render3D::ApplyRenderingSettings(renderState);
 }
 
+Render3DError SoftRasterizerRenderer::Render(const GFX3D &engine)
+{
+	if (!this->_enablePipelinedRender)
+	{
+		return Render3D::Render(engine);
+	}
+	
+	if (this->_pipelineTask == NULL)
+	{
+		this->_pipelineTask = new Task;
+#ifdef DESMUME_COCOA
+		this->_pipelineTask->start(false, 43);
+#else
+		this->_pipelineTask->start(false);
+#endif
+	}
+	
+	// Everything that reads VRAM or the texture cache (texture loading and the rear-plane clear image)
+	// is done here, before the CPUs get to write VRAM again. The worker only rasterizes and post-processes,
+	// which reads the polygon list copied by BeginRender(), the loaded textures and the render state.
+	// The render state stays untouched until the next flush, and gfx3d joins the render before that.
+	// Errors from the worker are not reported back, same as for the geometry threads.
+	this->_RenderPipelineFinish();
+	
+	Render3DError error = this->_RenderSetup(engine);
+	if (error != RENDER3DERROR_NOERR)
+	{
+		return error;
+	}
+	
+	this->_renderPipelineNeedsFinish = true;
+	this->_pipelineTask->execute(&SoftRasterizer_RunPipelinedRender, this);
+	
+	return RENDER3DERROR_NOERR;
+}
+
+Render3DError SoftRasterizerRenderer::RenderPipelined()
+{
+	return this->_RenderDraw();
+}
+
+void SoftRasterizerRenderer::_RenderPipelineFinish()
+{
+	if (this->_renderPipelineNeedsFinish)
+	{
+		this->_pipelineTask->finish();
+		this->_renderPipelineNeedsFinish = false;
+	}
+}
+
 Render3DError SoftRasterizerRenderer::BeginRender(const GFX3D &engine)
 {
 	// Force all threads to finish before rendering with new data
@@ -2058,18 +2289,23 @@ Render3DError SoftRasterizerRenderer::RenderGeometry()
 	// Render the geometry
 	if (this->_threadCount > 0)
 	{
+		// Sort the polygons into bins of lines, then let every thread pull bins until they run out.
+		// Unlike fixed strips per thread, this keeps all threads busy when the geometry is bunched
+		// up in one part of the screen.
+		this->_BinPolygons();
+		
 		if (this->_enableLineHack)
 		{
 			for (size_t i = 0; i < this->_threadCount; i++)
 			{
-				this->_task[i].execute(&SoftRasterizer_RunRasterizerUnit<true>, &this->_rasterizerUnit[i]);
+				this->_task[i].execute(&SoftRasterizer_RunRasterizerBins<true>, &this->_rasterizerUnit[i]);
 			}
 		}
 		else
 		{
 			for (size_t i = 0; i < this->_threadCount; i++)
 			{
-				this->_task[i].execute(&SoftRasterizer_RunRasterizerUnit<false>, &this->_rasterizerUnit[i]);
+				this->_task[i].execute(&SoftRasterizer_RunRasterizerBins<false>, &this->_rasterizerUnit[i]);
 			}
 		}
 		
@@ -2087,7 +2323,13 @@ Render3DError SoftRasterizerRenderer::RenderGeometry()
 		}
 		
 		this->_renderGeometryNeedsFinish = false;
-		texCache.Evict(); // Since we're finishing geometry rendering here and now, also check the texture cache now.
+		
+		// Since we're finishing geometry rendering here and now, also check the texture cache now.
+		// A pipelined render is running on its worker, so RenderFinish() does this on the emulation thread.
+		if (!this->_renderPipelineNeedsFinish)
+		{
+			texCache.Evict();
+		}
 	}
 	
 	//	printf("rendered %d of %d polys after backface culling\n",gfx3d.polylist->count-culled,gfx3d.polylist->count);
@@ -2352,6 +2594,8 @@ Render3DError SoftRasterizerRenderer::ClearUsingValues(const FragmentColor &clea
 
 Render3DError SoftRasterizerRenderer::Reset()
 {
+	this->_RenderPipelineFinish();
+	
 	if (this->_threadCount > 0)
 	{
 		for (size_t i = 0; i < this->_threadCount; i++)
@@ -2388,12 +2632,24 @@ Render3DError SoftRasterizerRenderer::EndRender()
 
 Render3DError SoftRasterizerRenderer::RenderFinish()
 {
+	// Wait for a pipelined Render() to hand off its geometry work before joining that.
+	const bool wasPipelined = this->_renderPipelineNeedsFinish;
+	this->_RenderPipelineFinish();
+	
 	if (!this->_renderNeedsFinish)
 	{
 		return RENDER3DERROR_NOERR;
 	}
 	
-	if (this->_renderGeometryNeedsFinish)
+	if (!this->_renderGeometryNeedsFinish)
+	{
+		// The worker rendered the geometry by itself and left the texture cache alone.
+		if (wasPipelined)
+		{
+			texCache.Evict();
+		}
+	}
+	else
 	{
 		// Allow for the geometry rendering to finish.
 		this->_renderGeometryNeedsFinish = false;
@@ -2446,8 +2702,17 @@ Render3DError SoftRasterizerRenderer::RenderFlush(bool willFlushBuffer32, bool w
 	return RENDER3DERROR_NOERR;
 }
 
+Render3DError SoftRasterizerRenderer::VramReconfigureSignal()
+{
+	// Join a pipelined render first, so the texture cache never changes while a frame is still drawn from it.
+	this->_RenderPipelineFinish();
+	return Render3D::VramReconfigureSignal();
+}
+
 Render3DError SoftRasterizerRenderer::SetFramebufferSize(size_t w, size_t h)
 {
+	this->_RenderPipelineFinish();
+	
 	Render3DError error = Render3D::SetFramebufferSize(w, h);
 	if (error != RENDER3DERROR_NOERR)
 	{
@@ -18,6 +18,8 @@
 #ifndef _RASTERIZE_H_
 #define _RASTERIZE_H_
 
+#include <vector>
+
 #include "render3D.h"
 #include "gfx3d.h"
 
@@ -26,6 +28,7 @@
 #endif
 
 #define SOFTRASTERIZER_MAX_THREADS 32
+#define SOFTRASTERIZER_BIN_LINES 16 // Height of a polygon bin, in framebuffer lines
 
 extern GPU3DInterface gpu3DRasterize;
 
@@ -127,11 +130,13 @@ protected:
 	template<int TYPE> FORCEINLINE void _rot_verts();
 	template<bool ISFRONTFACING, int TYPE> void _sort_verts();
 	template<bool SLI, bool ISFRONTFACING, bool ISSHADOWPOLYGON, bool USELINEHACK> void _shape_engine(const POLYGON_ATTR polyAttr, const bool isTranslucent, FragmentColor *dstColor, const size_t framebufferWidth, const size_t framebufferHeight, int type);
+	template<bool SLI, bool USELINEHACK> FORCEINLINE void _renderPolygon(const size_t polyIndex, TEXIMAGE_PARAM &lastTexParams, u32 &lastTexPalette, FragmentColor *dstColor, const size_t dstWidth, const size_t dstHeight);
 	
 public:
 	void SetSLI(u32 startLine, u32 endLine, bool debug);
 	void SetRenderer(SoftRasterizerRenderer *theRenderer);
 	template<bool SLI, bool USELINEHACK> FORCEINLINE void Render();
+	template<bool USELINEHACK> void RenderBins();
 };
 
 #if defined(ENABLE_AVX)
@@ -167,6 +172,24 @@ protected:
 	
 	bool _renderGeometryNeedsFinish;
 	
+	// Pipelined rendering. When enabled, Render() sets up the render state, loads the textures and
+	// clears the framebuffer on the emulation thread as usual, then leaves the rasterization and
+	// post-processing to _pipelineTask so that CPU emulation can continue until RenderFinish() is
+	// called by whoever reads the 3D framebuffer.
+	Task *_pipelineTask;
+	bool _enablePipelinedRender;
+	bool _renderPipelineNeedsFinish;
+	
+	void _RenderPipelineFinish();
+	
+	// Polygon binning for the multithreaded geometry pass. The framebuffer is cut into bins of
+	// SOFTRASTERIZER_BIN_LINES lines, and the rasterizer threads take bins until none are left.
+	size_t _binCount;
+	std::vector<u32> _binPolyIndex;	// Visible polygon indices grouped by bin, each group in render order
+	std::vector<u32> _binStart;		// Bin i owns _binPolyIndex[_binStart[i]] up to _binPolyIndex[_binStart[i+1]]
+	std::vector<u64> _binOrder;		// Non-empty bins, busiest first (polygon count << 32 | bin index)
+	volatile s32 _binNext;
+	
 	bool _enableHighPrecisionColorInterpolation;
 	bool _enableLineHack;
 	
@@ -175,6 +198,7 @@ protected:
 	void _UpdateFogTable(const u8 *fogDensityTable);
 	void _TransformVertices();
 	void _GetPolygonStates();
+	void _BinPolygons();
 	
 	// Base rendering methods
 	virtual Render3DError BeginRender(const GFX3D &engine);
@@ -202,14 +226,18 @@ public:
 	void GetAndLoadAllTextures();
 	void ProcessAllVertices();
 	Render3DError RenderEdgeMarkingAndFog(const SoftRasterizerPostProcessParams &param);
+	bool GetNextBin(u32 &startLine, u32 &endLine, const u32 *&polyIndex, size_t &polyCount);
 	
 	SoftRasterizerTexture* GetLoadedTextureFromPolygon(const POLY &thePoly, bool enableTexturing);
+	Render3DError RenderPipelined();
 	
 	// Base rendering methods
 	virtual Render3DError Reset();
 	virtual Render3DError ApplyRenderingSettings(const GFX3D_State &renderState);
+	virtual Render3DError Render(const GFX3D &engine);
 	virtual Render3DError RenderFinish();
 	virtual Render3DError RenderFlush(bool willFlushBuffer32, bool willFlushBuffer16);
+	virtual Render3DError VramReconfigureSignal();
 	virtual void ClearUsingValues_Execute(const size_t startPixel, const size_t endPixel);
 	virtual Render3DError SetFramebufferSize(size_t w, size_t h);
 };
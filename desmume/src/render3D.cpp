@@ -687,7 +687,7 @@ Render3DError Render3D::RenderPowerOff()
 	return RENDER3DERROR_NOERR;
 }
 
-Render3DError Render3D::Render(const GFX3D &engine)
+Render3DError Render3D::_RenderSetup(const GFX3D &engine)
 {
 	Render3DError error = RENDER3DERROR_NOERR;
 	this->_isPoweredOn = true;
@@ -720,7 +720,12 @@ Render3DError Render3D::Render(const GFX3D &engine)
 		return error;
 	}
 	
-	error = this->RenderGeometry();
+	return RENDER3DERROR_NOERR;
+}
+
+Render3DError Render3D::_RenderDraw()
+{
+	Render3DError error = this->RenderGeometry();
 	if (error != RENDER3DERROR_NOERR)
 	{
 		this->EndRender();
@@ -737,6 +742,17 @@ Render3DError Render3D::Render(const GFX3D &engine)
 	return this->EndRender();
 }
 
+Render3DError Render3D::Render(const GFX3D &engine)
+{
+	Render3DError error = this->_RenderSetup(engine);
+	if (error != RENDER3DERROR_NOERR)
+	{
+		return error;
+	}
+	
+	return this->_RenderDraw();
+}
+
 Render3DError Render3D::RenderFinish()
 {
 	return RENDER3DERROR_NOERR;
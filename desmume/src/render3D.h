@@ -196,6 +196,10 @@ protected:
 	template<bool ISCOLORBLANK, bool ISDEPTHBLANK> void _ClearImageScrolledLoop(const u8 xScroll, const u8 yScroll, const u16 *__restrict inColor16, const u16 *__restrict inDepth16,
 																				u16 *__restrict outColor16, u32 *__restrict outDepth24, u8 *__restrict outFog);
 	
+	// The two halves of Render(). The first one reads the render states, VRAM and the texture cache, the
+	// second one only draws what the first one set up.
+	Render3DError _RenderSetup(const GFX3D &engine);
+	Render3DError _RenderDraw();
 	
 	virtual Render3DError BeginRender(const GFX3D &engine);
 	virtual Render3DError RenderGeometry();
@@ -25,6 +25,8 @@
 #endif
 #include <stack>
 #include <set>
+#include <deque>
+#include <chrono>
 #include <stdio.h>
 #include <string.h>
 #include <sys/stat.h>
@@ -996,7 +998,7 @@ static void savestate_WriteChunk(EMUFILE &os, int type, void (*saveproc)(EMUFILE
 */
 }
 
-static void writechunks(EMUFILE &os);
+static void writechunks(EMUFILE &os, bool withMemory = true);
 
 bool savestate_save(EMUFILE &outstream, int compressionLevel)
 {
@@ -1081,7 +1083,8 @@ static void wifi_savestate(EMUFILE &os)
 	wifiHandler->SaveState(os);
 }
 
-static void writechunks(EMUFILE &os)
+//withMemory=false leaves out the bulk memories in SF_MEM, for the delta savestates which store those by page
+static void writechunks(EMUFILE &os, bool withMemory)
 {
 
 	DateTime tm = DateTime::get_Now();
@@ -1094,7 +1097,7 @@ static void writechunks(EMUFILE &os)
 	savestate_WriteChunk(os,1,SF_ARM9);
 	savestate_WriteChunk(os,2,SF_ARM7);
 	savestate_WriteChunk(os,3,cp15_savestate);
-	savestate_WriteChunk(os,4,SF_MEM);
+	if (withMemory) savestate_WriteChunk(os,4,SF_MEM);
 	savestate_WriteChunk(os,5,SF_NDS);
 	savestate_WriteChunk(os,51,nds_savestate);
 	savestate_WriteChunk(os,60,SF_MMU);
@@ -1252,6 +1255,9 @@ static bool ReadStateChunks(EMUFILE &is, s32 totalsize)
 
 static void loadstate()
 {
+    // vram was replaced wholesale, so anything tracking writes to it must recheck
+    MMU_VRAMmarkAllWritten();
+
     // This should regenerate the vram banks
     for (int i = 0; i < 0xA; i++)
        _MMU_write08<ARMCPU_ARM9>(0x04000240+i, _MMU_read08<ARMCPU_ARM9>(0x04000240+i));
@@ -1373,3 +1379,594 @@ bool savestate_load(const char *file_name)
 
 	return savestate_load(f);
 }
+
+//------------------------------------------------------------------------------
+//delta savestates
+//
+//each snapshot holds every savestate chunk except the bulk memories of SF_MEM, plus the pages of those
+//memories which changed since the previous snapshot. main memory pages are found through the write
+//tracking in the MMU (MMU.mainMemDirtyPage); the remaining memories are small enough that they are
+//simply compared against a shadow copy. every keyframeInterval snapshots a keyframe holding all pages
+//is taken, and the oldest keyframe and its deltas are dropped whenever the chain exceeds its budget.
+//------------------------------------------------------------------------------
+
+#define DELTA_PAGE_SHIFT 12
+#define DELTA_PAGE_SIZE (1 << DELTA_PAGE_SHIFT)
+
+struct SavestateDeltaRegion
+{
+	u8 *mem;
+	u32 size;
+	bool isTracked; //true if writes are tracked by MMU.mainMemDirtyPage, false if compared against the shadow
+	u32 firstPage;  //number of this region's first page across all regions
+	u32 shadowOffset;
+};
+
+struct SavestateDelta
+{
+	u32 id;
+	bool isKeyframe;
+	std::vector<u8> state;    //all savestate chunks except SF_MEM
+	std::vector<u32> pages;   //numbers of the pages stored in pageData, in order
+	std::vector<u8> pageData;
+
+	size_t memoryUsed() const
+	{
+		return state.capacity() + pages.capacity()*sizeof(u32) + pageData.capacity();
+	}
+};
+
+static SavestateDeltaRegion deltaRegion[] = {
+	//these mirror SF_MEM, so that a restored chain leaves the same memory as a full savestate would
+	{ MMU.ARM9_ITCM, sizeof(MMU.ARM9_ITCM), false },
+	{ MMU.ARM9_DTCM, sizeof(MMU.ARM9_DTCM), false },
+	{ MMU.MAIN_MEM,  0x800000,              true  },
+	{ MMU.ARM9_REG,  0x2000,                false },
+	{ MMU.ARM9_VMEM, sizeof(MMU.ARM9_VMEM), false },
+	{ MMU.ARM9_OAM,  sizeof(MMU.ARM9_OAM),  false },
+	{ MMU.ARM9_LCD,  0xA4000,               false },
+};
+static const size_t deltaRegionCount = sizeof(deltaRegion) / sizeof(deltaRegion[0]);
+
+static struct
+{
+	bool isInitialized;
+	u32 pageCount;
+	std::vector<u8> shadow;    //contents of the untracked regions as of the newest snapshot
+	std::vector<u8> pageTaken; //scratch for restores
+	std::deque<SavestateDelta *> chain;
+	std::vector<SavestateDelta *> pool; //retired snapshots, kept so their buffers can be reused
+	u32 nextId;
+	u32 sinceKeyframe;
+	u32 keyframeInterval;
+	size_t maxBytes;
+	size_t usedBytes;
+} delta;
+
+static void savestate_delta_init()
+{
+	if (delta.isInitialized) return;
+
+	u32 shadowSize = 0;
+	delta.pageCount = 0;
+	for (size_t r = 0; r < deltaRegionCount; r++)
+	{
+		deltaRegion[r].firstPage = delta.pageCount;
+		deltaRegion[r].shadowOffset = shadowSize;
+		delta.pageCount += (deltaRegion[r].size + DELTA_PAGE_SIZE - 1) >> DELTA_PAGE_SHIFT;
+		if (!deltaRegion[r].isTracked) shadowSize += deltaRegion[r].size;
+	}
+
+	delta.shadow.resize(shadowSize);
+	delta.pageTaken.resize(delta.pageCount);
+	delta.nextId = 0;
+	delta.sinceKeyframe = 0;
+	delta.usedBytes = 0;
+	if (delta.keyframeInterval == 0) delta.keyframeInterval = 60;
+	if (delta.maxBytes == 0) delta.maxBytes = 64*1024*1024;
+	delta.isInitialized = true;
+}
+
+static void savestate_delta_retire(SavestateDelta *snap)
+{
+	delta.usedBytes -= snap->memoryUsed();
+	delta.pool.push_back(snap);
+}
+
+//the shadow and the main memory write tracking describe the newest snapshot from here on
+static void savestate_delta_rebase()
+{
+	for (size_t r = 0; r < deltaRegionCount; r++)
+	{
+		if (!deltaRegion[r].isTracked)
+			memcpy(&delta.shadow[deltaRegion[r].shadowOffset], deltaRegion[r].mem, deltaRegion[r].size);
+	}
+	memset(MMU.mainMemDirtyPage, 0, sizeof(MMU.mainMemDirtyPage));
+}
+
+static void savestate_delta_addPage(SavestateDelta *snap, const SavestateDeltaRegion &region, u32 page)
+{
+	const u32 ofs = page << DELTA_PAGE_SHIFT;
+	const u32 len = std::min<u32>(DELTA_PAGE_SIZE, region.size - ofs);
+	const size_t pos = snap->pageData.size();
+
+	snap->pages.push_back(region.firstPage + page);
+	snap->pageData.resize(pos + len);
+	memcpy(&snap->pageData[pos], region.mem + ofs, len);
+}
+
+void savestate_delta_configure(u32 keyframeInterval, size_t maxBytes)
+{
+	delta.keyframeInterval = (keyframeInterval == 0) ? 1 : keyframeInterval;
+	delta.maxBytes = maxBytes;
+}
+
+u32 savestate_delta_snapshot()
+{
+#ifdef HAVE_JIT
+	arm_jit_sync();
+#endif
+	savestate_delta_init();
+
+	SavestateDelta *snap;
+	if (delta.pool.empty())
+	{
+		snap = new SavestateDelta();
+	}
+	else
+	{
+		snap = delta.pool.back();
+		delta.pool.pop_back();
+	}
+
+	snap->id = delta.nextId++;
+	snap->isKeyframe = delta.chain.empty() || (delta.sinceKeyframe + 1 >= delta.keyframeInterval);
+	snap->state.clear();
+	snap->pages.clear();
+	snap->pageData.clear();
+
+	EMUFILE_MEMORY os(&snap->state);
+	writechunks(os, false);
+
+	for (size_t r = 0; r < deltaRegionCount; r++)
+	{
+		const SavestateDeltaRegion &region = deltaRegion[r];
+		const u32 pageCount = (region.size + DELTA_PAGE_SIZE - 1) >> DELTA_PAGE_SHIFT;
+		u8 *shadow = region.isTracked ? NULL : &delta.shadow[region.shadowOffset];
+
+		for (u32 page = 0; page < pageCount; page++)
+		{
+			const u32 ofs = page << DELTA_PAGE_SHIFT;
+			const u32 len = std::min<u32>(DELTA_PAGE_SIZE, region.size - ofs);
+			bool isChanged;
+
+			if (snap->isKeyframe)
+				isChanged = true;
+			else if (region.isTracked)
+				isChanged = (MMU.mainMemDirtyPage[(ofs >> MAIN_MEM_DIRTY_PAGE_SHIFT) & (MAIN_MEM_DIRTY_PAGES-1)] != 0);
+			else
+				isChanged = (memcmp(shadow + ofs, region.mem + ofs, len) != 0);
+
+			if (!isChanged) continue;
+
+			savestate_delta_addPage(snap, region, page);
+			if (shadow) memcpy(shadow + ofs, region.mem + ofs, len);
+		}
+	}
+
+	memset(MMU.mainMemDirtyPage, 0, sizeof(MMU.mainMemDirtyPage));
+
+	delta.sinceKeyframe = snap->isKeyframe ? 0 : delta.sinceKeyframe + 1;
+	delta.chain.push_back(snap);
+	delta.usedBytes += snap->memoryUsed();
+
+	//stay within budget by dropping whole keyframe groups from the front, always keeping the newest one
+	while (delta.usedBytes > delta.maxBytes)
+	{
+		size_t nextKeyframe = 1;
+		while (nextKeyframe < delta.chain.size() && !delta.chain[nextKeyframe]->isKeyframe)
+			nextKeyframe++;
+		if (nextKeyframe >= delta.chain.size()) break;
+
+		for (size_t i = 0; i < nextKeyframe; i++)
+		{
+			savestate_delta_retire(delta.chain.front());
+			delta.chain.pop_front();
+		}
+	}
+
+	return snap->id;
+}
+
+bool savestate_delta_restore(u32 id)
+{
+	if (!delta.isInitialized) return false;
+
+	size_t target = 0;
+	while (target < delta.chain.size() && delta.chain[target]->id != id)
+		target++;
+	if (target == delta.chain.size()) return false;
+
+	size_t keyframe = target;
+	while (!delta.chain[keyframe]->isKeyframe)
+		keyframe--;
+
+	//same procedure as savestate_load: full reset, then the chunks
+	extern bool _HACK_DONT_STOPMOVIE;
+	_HACK_DONT_STOPMOVIE = true;
+	NDS_Reset();
+	_HACK_DONT_STOPMOVIE = false;
+	nds._DebugConsole = FALSE;
+
+	SavestateDelta *snap = delta.chain[target];
+	EMUFILE_MEMORY is(&snap->state);
+	if (!ReadStateChunks(is, (s32)snap->state.size()))
+	{
+		msgbox->error("Error restoring a delta savestate. Your current game session is probably corrupt now.");
+		return false;
+	}
+
+	//each page comes from the newest snapshot at or before the target which holds it.
+	//the keyframe holds all of them, so every page gets restored.
+	memset(&delta.pageTaken[0], 0, delta.pageTaken.size());
+	for (size_t i = target + 1; i-- > keyframe; )
+	{
+		const SavestateDelta &d = *delta.chain[i];
+		size_t pos = 0;
+		size_t r = 0;
+
+		for (size_t p = 0; p < d.pages.size(); p++)
+		{
+			const u32 globalPage = d.pages[p];
+			while (r + 1 < deltaRegionCount && globalPage >= deltaRegion[r+1].firstPage) r++;
+			while (r > 0 && globalPage < deltaRegion[r].firstPage) r--;
+
+			const SavestateDeltaRegion &region = deltaRegion[r];
+			const u32 ofs = (globalPage - region.firstPage) << DELTA_PAGE_SHIFT;
+			const u32 len = std::min<u32>(DELTA_PAGE_SIZE, region.size - ofs);
+
+			if (!delta.pageTaken[globalPage])
+			{
+				memcpy(region.mem + ofs, &d.pageData[pos], len);
+				delta.pageTaken[globalPage] = 1;
+			}
+			pos += len;
+		}
+	}
+
+	loadstate();
+
+	//anything newer than the restored snapshot belongs to a future which no longer exists
+	while (delta.chain.size() > target + 1)
+	{
+		savestate_delta_retire(delta.chain.back());
+		delta.chain.pop_back();
+	}
+	delta.sinceKeyframe = (u32)(target - keyframe);
+	savestate_delta_rebase();
+
+	return true;
+}
+
+void savestate_delta_clear()
+{
+	while (!delta.chain.empty())
+	{
+		savestate_delta_retire(delta.chain.back());
+		delta.chain.pop_back();
+	}
+	for (size_t i = 0; i < delta.pool.size(); i++)
+		delete delta.pool[i];
+	delta.pool.clear();
+	delta.usedBytes = 0;
+	delta.sinceKeyframe = 0;
+}
+
+size_t savestate_delta_count()
+{
+	return delta.chain.size();
+}
+
+size_t savestate_delta_memory_used()
+{
+	return delta.usedBytes;
+}
+
+//------------------------------------------------------------------------------
+//rewind
+//
+//the newest pushed state is kept in full. each ring entry holds what is needed to step from the
+//state pushed after it back to itself: the xor of the two states, as 64-bit words, with runs of
+//zero words (unchanged memory) left out. a token is a u32 count of words to skip followed by a
+//u32 count of literal words, then the literal words themselves.
+//------------------------------------------------------------------------------
+
+struct RewindEntry
+{
+	u32 offset;    //where the entry lives in the ring
+	u32 size;      //encoded size of the entry
+	u32 stateSize; //size of the state this entry steps back to
+};
+
+static struct
+{
+	bool isInitialized;
+	std::vector<u8> ring;
+	std::vector<RewindEntry> entry;
+	u32 entryOldest;
+	u32 entryCount;
+	u32 head;
+	bool haveCurrent;
+	u32 currentSize;
+	std::vector<u8> current; //the newest pushed state, padded with zeros to a whole number of words
+	std::vector<u8> scratch;
+	std::vector<u8> encoded;
+	RewindStats stats;
+} rewindRing;
+
+static FORCEINLINE u64 rewind_word(const std::vector<u8> &buf, size_t i)
+{
+	u64 w = 0;
+	if (i*8 < buf.size()) memcpy(&w, &buf[i*8], 8);
+	return w;
+}
+
+static FORCEINLINE void rewind_putword(u8 *&dst, u64 w)
+{
+	memcpy(dst, &w, 8);
+	dst += 8;
+}
+
+static FORCEINLINE void rewind_put32(u8 *&dst, u32 v)
+{
+	memcpy(dst, &v, 4);
+	dst += 4;
+}
+
+static FORCEINLINE u32 rewind_get32(const u8 *&src)
+{
+	u32 v;
+	memcpy(&v, src, 4);
+	src += 4;
+	return v;
+}
+
+//pads a state buffer with zeros to a whole number of words
+static void rewind_pad(std::vector<u8> &buf)
+{
+	buf.resize((buf.size() + 7) & ~(size_t)7, 0);
+}
+
+//encodes newer ^ older into rewindRing.encoded, returning the encoded size
+static size_t rewind_encode(const std::vector<u8> &newer, const std::vector<u8> &older)
+{
+	const size_t words = std::max(newer.size(), older.size()) / 8;
+
+	//worst case is alternating changed and unchanged words, which costs a token per changed word
+	const size_t worstCase = words*8 + (words/2 + 1)*8;
+	if (rewindRing.encoded.size() < worstCase)
+		rewindRing.encoded.resize(worstCase);
+
+	u8 *const start = &rewindRing.encoded[0];
+	u8 *dst = start;
+	size_t i = 0;
+
+	while (i < words)
+	{
+		const size_t skipStart = i;
+		while (i < words && rewind_word(newer,i) == rewind_word(older,i)) i++;
+
+		//a single unchanged word is cheaper to carry along as a literal than to start a new token for
+		const size_t literalStart = i;
+		while (i < words)
+		{
+			if (rewind_word(newer,i) == rewind_word(older,i) && (i+1 >= words || rewind_word(newer,i+1) == rewind_word(older,i+1)))
+				break;
+			i++;
+		}
+
+		if (i == literalStart) break; //nothing but unchanged words left
+
+		rewind_put32(dst, (u32)(literalStart - skipStart));
+		rewind_put32(dst, (u32)(i - literalStart));
+		for (size_t j = literalStart; j < i; j++)
+			rewind_putword(dst, rewind_word(newer,j) ^ rewind_word(older,j));
+	}
+
+	return dst - start;
+}
+
+//applies an entry to buf, which must already be large enough to hold the result
+static void rewind_decode(const u8 *src, size_t size, std::vector<u8> &buf)
+{
+	const u8 *const end = src + size;
+	size_t i = 0;
+
+	while (src < end)
+	{
+		i += rewind_get32(src);
+		const u32 literal = rewind_get32(src);
+		for (u32 j = 0; j < literal; j++, i++)
+		{
+			u64 w, x;
+			memcpy(&w, &buf[i*8], 8);
+			memcpy(&x, src, 8);
+			src += 8;
+			w ^= x;
+			memcpy(&buf[i*8], &w, 8);
+		}
+	}
+}
+
+static void rewind_dropOldest()
+{
+	rewindRing.stats.memoryUsed -= rewindRing.entry[rewindRing.entryOldest].size;
+	rewindRing.entryOldest = (rewindRing.entryOldest + 1) % rewindRing.entry.size();
+	rewindRing.entryCount--;
+}
+
+//finds room for an entry of the given size, overwriting the oldest entries as needed
+static bool rewind_reserve(u32 size, u32 &offset)
+{
+	if (size > rewindRing.ring.size()) return false;
+
+	if (rewindRing.entryCount == rewindRing.entry.size())
+		rewind_dropOldest();
+
+	if (rewindRing.head + size > rewindRing.ring.size())
+	{
+		//entries between the head and the end of the ring are the oldest ones, so they go first
+		while (rewindRing.entryCount > 0 && rewindRing.entry[rewindRing.entryOldest].offset >= rewindRing.head)
+			rewind_dropOldest();
+		rewindRing.head = 0;
+	}
+
+	while (rewindRing.entryCount > 0)
+	{
+		const RewindEntry &oldest = rewindRing.entry[rewindRing.entryOldest];
+		if (oldest.offset >= rewindRing.head + size || oldest.offset + oldest.size <= rewindRing.head)
+			break;
+		rewind_dropOldest();
+	}
+
+	offset = rewindRing.head;
+	rewindRing.head += size;
+	return true;
+}
+
+bool rewind_init(size_t capacity, u32 maxEntries)
+{
+	rewind_deinit();
+	if (capacity == 0 || capacity > 0xFFFFFFFF || maxEntries == 0) return false;
+
+	rewindRing.ring.resize(capacity);
+	rewindRing.entry.resize(maxEntries);
+	rewindRing.isInitialized = true;
+	rewind_clear();
+	return true;
+}
+
+void rewind_deinit()
+{
+	std::vector<u8>().swap(rewindRing.ring);
+	std::vector<RewindEntry>().swap(rewindRing.entry);
+	std::vector<u8>().swap(rewindRing.current);
+	std::vector<u8>().swap(rewindRing.scratch);
+	std::vector<u8>().swap(rewindRing.encoded);
+	rewindRing.isInitialized = false;
+	rewindRing.haveCurrent = false;
+	rewindRing.entryCount = 0;
+}
+
+void rewind_clear()
+{
+	rewindRing.entryOldest = 0;
+	rewindRing.entryCount = 0;
+	rewindRing.head = 0;
+	rewindRing.haveCurrent = false;
+	rewindRing.currentSize = 0;
+	memset(&rewindRing.stats, 0, sizeof(rewindRing.stats));
+	rewindRing.stats.capacity = rewindRing.ring.size();
+}
+
+bool rewind_push()
+{
+	if (!rewindRing.isInitialized) return false;
+
+	const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+	//clear() keeps the capacity, so once the buffers have grown to the size of a state this doesnt allocate
+	rewindRing.scratch.clear();
+	EMUFILE_MEMORY os(&rewindRing.scratch);
+	if (!savestate_save(os, Z_NO_COMPRESSION)) return false;
+	const u32 stateSize = (u32)rewindRing.scratch.size();
+	rewind_pad(rewindRing.scratch);
+
+	RewindStats &stats = rewindRing.stats;
+	stats.lastEntrySize = 0;
+
+	if (rewindRing.haveCurrent)
+	{
+		const size_t encodedSize = rewind_encode(rewindRing.scratch, rewindRing.current);
+		u32 offset;
+
+		if (rewind_reserve((u32)encodedSize, offset))
+		{
+			memcpy(&rewindRing.ring[offset], &rewindRing.encoded[0], encodedSize);
+
+			RewindEntry &newest = rewindRing.entry[(rewindRing.entryOldest + rewindRing.entryCount) % rewindRing.entry.size()];
+			newest.offset = offset;
+			newest.size = (u32)encodedSize;
+			newest.stateSize = rewindRing.currentSize;
+			rewindRing.entryCount++;
+
+			stats.memoryUsed += encodedSize;
+			stats.lastEntrySize = encodedSize;
+		}
+		else
+		{
+			//a single entry bigger than the whole ring; the history cant reach past this state anymore
+			while (rewindRing.entryCount > 0) rewind_dropOldest();
+			rewindRing.head = 0;
+		}
+	}
+
+	stats.memoryUsed -= rewindRing.haveCurrent ? rewindRing.currentSize : 0;
+	stats.memoryUsed += stateSize;
+
+	rewindRing.current.swap(rewindRing.scratch);
+	rewindRing.currentSize = stateSize;
+	rewindRing.haveCurrent = true;
+
+	const u32 elapsed = (u32)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime).count();
+	stats.count = rewindRing.entryCount + 1;
+	stats.lastStateSize = stateSize;
+	stats.lastPushMicroseconds = elapsed;
+	stats.totalPushMicroseconds += elapsed;
+	stats.pushCount++;
+
+	return true;
+}
+
+bool rewind_pop()
+{
+	if (!rewindRing.isInitialized || !rewindRing.haveCurrent) return false;
+
+	EMUFILE_MEMORY is(&rewindRing.current);
+	const bool ok = savestate_load(is);
+
+	//step the newest state back to the one pushed before it
+	RewindStats &stats = rewindRing.stats;
+	stats.memoryUsed -= rewindRing.currentSize;
+
+	if (rewindRing.entryCount > 0)
+	{
+		const RewindEntry &newest = rewindRing.entry[(rewindRing.entryOldest + rewindRing.entryCount - 1) % rewindRing.entry.size()];
+		const size_t olderPadded = ((size_t)newest.stateSize + 7) & ~(size_t)7;
+
+		if (rewindRing.current.size() < olderPadded)
+			rewindRing.current.resize(olderPadded, 0);
+		rewind_decode(&rewindRing.ring[newest.offset], newest.size, rewindRing.current);
+		rewindRing.current.resize(olderPadded);
+
+		rewindRing.currentSize = newest.stateSize;
+		rewindRing.head = newest.offset;
+		rewindRing.entryCount--;
+
+		stats.memoryUsed -= newest.size;
+		stats.memoryUsed += rewindRing.currentSize;
+	}
+	else
+	{
+		rewindRing.haveCurrent = false;
+		rewindRing.currentSize = 0;
+	}
+
+	stats.count = rewindRing.entryCount + (rewindRing.haveCurrent ? 1 : 0);
+	return ok;
+}
+
+void rewind_get_stats(RewindStats &stats)
+{
+	stats = rewindRing.stats;
+}
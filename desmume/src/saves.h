@@ -71,4 +71,40 @@ void loadstate_slot(int num);
 bool savestate_load(class EMUFILE &is);
 bool savestate_save(class EMUFILE &outstream, int compressionLevel = Z_DEFAULT_COMPRESSION);
 
+//delta savestates, for frequent in-memory snapshots (rewind, checkpoints).
+//each snapshot only stores the memory pages changed since the previous one, with a full keyframe
+//every keyframeInterval snapshots. the oldest keyframe and its deltas are dropped to stay under maxBytes.
+//savestate_delta_snapshot returns an id which savestate_delta_restore accepts for as long as the
+//snapshot is kept. restoring a snapshot discards every snapshot newer than it.
+void savestate_delta_configure(u32 keyframeInterval, size_t maxBytes);
+u32 savestate_delta_snapshot();
+bool savestate_delta_restore(u32 id);
+void savestate_delta_clear();
+size_t savestate_delta_count();
+size_t savestate_delta_memory_used();
+
+//rewind: a ring of savestates kept in a single preallocated buffer.
+//each entry is the xor of a state with the one pushed after it, with runs of unchanged words
+//squeezed out, so only the newest state is ever held in full. rewind_pop restores the newest
+//state and steps back, so repeated pops walk further into the past. the oldest entries are
+//overwritten when the ring is full.
+struct RewindStats
+{
+	u32 count;              //number of states which can be popped
+	size_t capacity;        //size of the ring, in bytes
+	size_t memoryUsed;      //bytes held by the ring entries and the state buffers
+	size_t lastStateSize;   //uncompressed size of the last pushed state
+	size_t lastEntrySize;   //compressed size of the last ring entry
+	u32 lastPushMicroseconds;
+	u64 totalPushMicroseconds;
+	u32 pushCount;
+};
+
+bool rewind_init(size_t capacity, u32 maxEntries = 4096);
+void rewind_deinit();
+bool rewind_push();
+bool rewind_pop();
+void rewind_clear();
+void rewind_get_stats(RewindStats &stats);
+
 #endif
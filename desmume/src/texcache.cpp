@@ -21,6 +21,14 @@
 #include <algorithm>
 #include <assert.h>
 
+#include "types.h"
+
+// The texture unpackers call the real SSSE3 and SSE4.1 intrinsics, so they need to be declared before
+// GPU.h can put its SSE2 stand-ins in their place.
+#ifdef ENABLE_SSE2
+#include <immintrin.h>
+#endif
+
 #include "texcache.h"
 
 #include "./utils/bits.h"
@@ -31,7 +39,9 @@
 #include "NDSSystem.h"
 
 #ifdef ENABLE_SSE2
+#include <features/features_cpu.h>
 #include "./utils/colorspacehandler/colorspacehandler_SSE2.h"
+#undef _mm_blendv_epi8
 #endif
 
 using std::min;
@@ -46,6 +56,101 @@ using std::max;
 
 #define CONVERT(color) ((TEXCACHEFORMAT == TexFormat_32bpp)?(COLOR555TO8888_OPAQUE(color)):COLOR555TO6665_OPAQUE(color))
 
+// Constants and rounds for the texture fingerprint, which follows the structure of xxHash64.
+// The main loop runs four independent lanes so that the multiplies can overlap.
+#define FINGERPRINT_PRIME1 0x9E3779B185EBCA87ULL
+#define FINGERPRINT_PRIME2 0xC2B2AE3D27D4EB4FULL
+#define FINGERPRINT_PRIME3 0x165667B19E3779F9ULL
+#define FINGERPRINT_PRIME4 0x85EBCA77C2B2AE63ULL
+#define FINGERPRINT_PRIME5 0x27D4EB2F165667C5ULL
+
+static FORCEINLINE u64 Fingerprint_Rotate(const u64 v, const u32 r)
+{
+	return (v << r) | (v >> (64 - r));
+}
+
+static FORCEINLINE u64 Fingerprint_Read64(const u8 *src)
+{
+	u64 v;
+	memcpy(&v, src, sizeof(u64));
+	return v;
+}
+
+static FORCEINLINE u64 Fingerprint_Round(u64 acc, const u64 input)
+{
+	acc += input * FINGERPRINT_PRIME2;
+	acc = Fingerprint_Rotate(acc, 31);
+	return acc * FINGERPRINT_PRIME1;
+}
+
+static FORCEINLINE u64 Fingerprint_Merge(u64 acc, const u64 lane)
+{
+	acc ^= Fingerprint_Round(0, lane);
+	return acc * FINGERPRINT_PRIME1 + FINGERPRINT_PRIME4;
+}
+
+static FORCEINLINE u64 Fingerprint_Mix(u64 h)
+{
+	h ^= h >> 33;
+	h *= FINGERPRINT_PRIME2;
+	h ^= h >> 29;
+	h *= FINGERPRINT_PRIME3;
+	h ^= h >> 32;
+	return h;
+}
+
+// Fingerprints a buffer. The result only needs to be stable within a single run of the
+// emulator, since it is only ever compared against fingerprints of the same texture.
+static TextureFingerprint Fingerprint_Buffer(const u8 *src, const size_t len, const TextureFingerprint seed)
+{
+	const u8 *p = src;
+	const u8 *const end = src + len;
+	u64 h;
+	
+	if (len >= 32)
+	{
+		u64 v1 = seed + FINGERPRINT_PRIME1 + FINGERPRINT_PRIME2;
+		u64 v2 = seed + FINGERPRINT_PRIME2;
+		u64 v3 = seed;
+		u64 v4 = seed - FINGERPRINT_PRIME1;
+		
+		do
+		{
+			v1 = Fingerprint_Round(v1, Fingerprint_Read64(p +  0));
+			v2 = Fingerprint_Round(v2, Fingerprint_Read64(p +  8));
+			v3 = Fingerprint_Round(v3, Fingerprint_Read64(p + 16));
+			v4 = Fingerprint_Round(v4, Fingerprint_Read64(p + 24));
+			p += 32;
+		} while ((size_t)(end - p) >= 32);
+		
+		h = Fingerprint_Rotate(v1, 1) + Fingerprint_Rotate(v2, 7) + Fingerprint_Rotate(v3, 12) + Fingerprint_Rotate(v4, 18);
+		h = Fingerprint_Merge(h, v1);
+		h = Fingerprint_Merge(h, v2);
+		h = Fingerprint_Merge(h, v3);
+		h = Fingerprint_Merge(h, v4);
+	}
+	else
+	{
+		h = seed + FINGERPRINT_PRIME5;
+	}
+	
+	h += (u64)len;
+	
+	for (; (size_t)(end - p) >= 8; p += 8)
+	{
+		h ^= Fingerprint_Round(0, Fingerprint_Read64(p));
+		h = Fingerprint_Rotate(h, 27) * FINGERPRINT_PRIME1 + FINGERPRINT_PRIME4;
+	}
+	
+	for (; p < end; p++)
+	{
+		h ^= (u64)(*p) * FINGERPRINT_PRIME5;
+		h = Fingerprint_Rotate(h, 11) * FINGERPRINT_PRIME1;
+	}
+	
+	return Fingerprint_Mix(h);
+}
+
 //This class represents a number of regions of memory which should be viewed as contiguous
 class MemSpan
 {
@@ -135,6 +240,32 @@ public:
 		}
 		return done;
 	}
+
+	//fingerprints the contents of the memspan
+	TextureFingerprint fingerprint(TextureFingerprint seed) const
+	{
+		for(int i=0;i<numItems;i++)
+			seed = Fingerprint_Buffer(items[i].ptr, items[i].len, seed);
+		return seed;
+	}
+
+	//fingerprints where the memspan lives in host memory, so that a change of vram mapping can be noticed
+	TextureFingerprint layout(TextureFingerprint seed) const
+	{
+		for(int i=0;i<numItems;i++)
+			seed = Fingerprint_Mix(seed ^ Fingerprint_Round((u64)items[i].len, (u64)(uintptr_t)items[i].ptr));
+		return seed;
+	}
+
+	//returns true if any vram page in the memspan was written at or after the given MMU.vramEpoch
+	bool writtenSince(u32 epoch) const
+	{
+		for(int i=0;i<numItems;i++)
+		{
+			if(MMU_VRAMwrittenSince(items[i].ptr, items[i].len, epoch)) return true;
+		}
+		return false;
+	}
 };
 
 //creates a MemSpan in texture memory
@@ -206,15 +337,151 @@ static bool TextureLRUCompare(TextureStore *tex1, TextureStore *tex2)
 	return (cacheAge1 < cacheAge2);
 }
 
+TextureCacheMap::TextureCacheMap()
+{
+	_count = 0;
+	_Resize(4096);
+}
+
+size_t TextureCacheMap::_GetHomeIndex(const TextureCacheKey key) const
+{
+	return (size_t)Fingerprint_Mix(key) & (this->_entry.size() - 1);
+}
+
+void TextureCacheMap::_Resize(const size_t newCapacity)
+{
+	Entry emptyEntry;
+	emptyEntry.key = 0;
+	emptyEntry.texture = NULL;
+	
+	std::vector<Entry> oldEntry;
+	oldEntry.swap(this->_entry);
+	this->_entry.assign(newCapacity, emptyEntry);
+	this->_count = 0;
+	
+	for (size_t i = 0; i < oldEntry.size(); i++)
+	{
+		if (oldEntry[i].texture != NULL)
+		{
+			this->Insert(oldEntry[i].key, oldEntry[i].texture);
+		}
+	}
+}
+
+size_t TextureCacheMap::GetCount() const
+{
+	return this->_count;
+}
+
+TextureStore* TextureCacheMap::Find(const TextureCacheKey key) const
+{
+	const size_t mask = this->_entry.size() - 1;
+	
+	for (size_t i = this->_GetHomeIndex(key); ; i = (i + 1) & mask)
+	{
+		const Entry &entry = this->_entry[i];
+		
+		if (entry.texture == NULL)
+		{
+			return NULL;
+		}
+		
+		if (entry.key == key)
+		{
+			return entry.texture;
+		}
+	}
+}
+
+void TextureCacheMap::Insert(const TextureCacheKey key, TextureStore *texture)
+{
+	// Keep the load factor at or below 1/2 so that probe sequences stay short.
+	if ( (this->_count + 1) * 2 > this->_entry.size() )
+	{
+		this->_Resize(this->_entry.size() * 2);
+	}
+	
+	const size_t mask = this->_entry.size() - 1;
+	
+	for (size_t i = this->_GetHomeIndex(key); ; i = (i + 1) & mask)
+	{
+		Entry &entry = this->_entry[i];
+		
+		if (entry.texture == NULL)
+		{
+			entry.key = key;
+			entry.texture = texture;
+			this->_count++;
+			return;
+		}
+		
+		if (entry.key == key)
+		{
+			entry.texture = texture;
+			return;
+		}
+	}
+}
+
+void TextureCacheMap::Erase(const TextureCacheKey key)
+{
+	const size_t mask = this->_entry.size() - 1;
+	size_t i = this->_GetHomeIndex(key);
+	
+	for (; ; i = (i + 1) & mask)
+	{
+		if (this->_entry[i].texture == NULL)
+		{
+			return;
+		}
+		
+		if (this->_entry[i].key == key)
+		{
+			break;
+		}
+	}
+	
+	// Shift any displaced entries that follow back into the hole, so that no
+	// probe sequence is broken and no tombstones are needed.
+	for (size_t j = (i + 1) & mask; this->_entry[j].texture != NULL; j = (j + 1) & mask)
+	{
+		const size_t home = this->_GetHomeIndex(this->_entry[j].key);
+		
+		// Leave the entry where it is if its home lies cyclically within (i, j].
+		const bool isHomeInRange = (i <= j) ? ( (i < home) && (home <= j) ) : ( (i < home) || (home <= j) );
+		if (!isHomeInRange)
+		{
+			this->_entry[i] = this->_entry[j];
+			i = j;
+		}
+	}
+	
+	this->_entry[i].key = 0;
+	this->_entry[i].texture = NULL;
+	this->_count--;
+}
+
+void TextureCacheMap::Clear()
+{
+	for (size_t i = 0; i < this->_entry.size(); i++)
+	{
+		this->_entry[i].key = 0;
+		this->_entry[i].texture = NULL;
+	}
+	
+	this->_count = 0;
+}
+
 TextureCache texCache;
 
 TextureCache::TextureCache()
 {
-	_texCacheMap.clear();
 	_texCacheList.reserve(4096);
 	_actualCacheSize = 0;
 	_cacheSizeThreshold = TEXCACHE_DEFAULT_THRESHOLD;
 	memset(_paletteDump, 0, sizeof(_paletteDump));
+	_paletteDumpEpoch = 0;
+	_paletteDumpLayout = 0;
 }
 
 size_t TextureCache::GetActualCacheSize() const
@@ -234,26 +501,40 @@ void TextureCache::SetCacheSizeThreshold(size_t newThreshold)
 
 void TextureCache::Invalidate()
 {
-	//check whether the palette memory changed
-	//TODO - we should handle this instead by setting dirty flags in the vram memory mapping and noting whether palette memory was dirty.
-	//but this will work for now
+	//start a new vram epoch. anything verified from here on only needs to be looked at again
+	//if the pages it lives in are written from this point forward.
+	MMU.vramEpoch++;
+	
+	//check whether the palette memory changed. the compare is only needed if some palette page
+	//was written or remapped since the last check.
 	MemSpan mspal = MemSpan_TexPalette(0, PALETTE_DUMP_SIZE, true);
-	const bool paletteDirty = mspal.memcmp(this->_paletteDump);
-	if (paletteDirty)
+	const TextureFingerprint paletteLayout = mspal.layout(0);
+	bool paletteDirty = false;
+	
+	if ( (paletteLayout != this->_paletteDumpLayout) || mspal.writtenSince(this->_paletteDumpEpoch) )
 	{
-		mspal.dump(this->_paletteDump);
+		paletteDirty = (mspal.memcmp(this->_paletteDump) != 0);
+		if (paletteDirty)
+		{
+			mspal.dump(this->_paletteDump);
+		}
+		
+		this->_paletteDumpLayout = paletteLayout;
 	}
 	
-	for (TextureCacheMap::iterator it(this->_texCacheMap.begin()); it != this->_texCacheMap.end(); ++it)
+	this->_paletteDumpEpoch = MMU.vramEpoch;
+	
+	for (size_t i = 0; i < this->_texCacheList.size(); i++)
 	{
-		it->second->SetSuspectedInvalid();
+		TextureStore *theTexture = this->_texCacheList[i];
+		theTexture->SetSuspectedInvalid();
 		
 		//when the palette changes, we assume all 4x4 textures are dirty.
 		//this is because each 4x4 item doesnt carry along with it a copy of the entire palette, for verification
 		//instead, we just use the one paletteDump for verifying of all 4x4 textures; and if paletteDirty is set, verification has failed
-		if( (it->second->GetPackFormat() == TEXMODE_4X4) && paletteDirty )
+		if( (theTexture->GetPackFormat() == TEXMODE_4X4) && paletteDirty )
 		{
-			it->second->SetAssumedInvalid();
+			theTexture->SetAssumedInvalid();
 		}
 	}
 }
@@ -284,7 +565,7 @@ void TextureCache::Evict()
 	
 	while (this->_actualCacheSize > targetCacheSize)
 	{
-		if (this->_texCacheMap.size() == 0) break; //just in case.. doesnt seem possible, cache_size wouldve been 0
+		if (this->_texCacheMap.GetCount() == 0) break; //just in case.. doesnt seem possible, cache_size wouldve been 0
 		
 		TextureStore *item = this->_texCacheList.back();
 		this->Remove(item);
@@ -307,34 +588,33 @@ void TextureCache::Reset()
 		delete this->_texCacheList[i];
 	}
 	
-	this->_texCacheMap.clear();
+	this->_texCacheMap.Clear();
 	this->_texCacheList.clear();
 	this->_actualCacheSize = 0;
 	memset(this->_paletteDump, 0, sizeof(this->_paletteDump));
+	this->_paletteDumpEpoch = 0;
+	this->_paletteDumpLayout = 0;
 }
 
 void TextureCache::ForceReloadAllTextures()
 {
-	for (TextureCacheMap::iterator it(this->_texCacheMap.begin()); it != this->_texCacheMap.end(); ++it)
+	for (size_t i = 0; i < this->_texCacheList.size(); i++)
 	{
-		it->second->SetLoadNeeded();
+		this->_texCacheList[i]->SetLoadNeeded();
 	}
 }
 
 TextureStore* TextureCache::GetTexture(TEXIMAGE_PARAM texAttributes, u32 palAttributes)
 {
-	TextureStore *theTexture = NULL;
 	const TextureCacheKey key = TextureCache::GenerateKey(texAttributes, palAttributes);
-	const TextureCacheMap::iterator cachedTexture = this->_texCacheMap.find(key);
+	TextureStore *theTexture = this->_texCacheMap.Find(key);
 	
-	if (cachedTexture == this->_texCacheMap.end())
+	if (theTexture == NULL)
 	{
 		return theTexture;
 	}
 	else
 	{
-		theTexture = cachedTexture->second;
-		
 		if (theTexture->IsAssumedInvalid())
 		{
 			theTexture->Update();
@@ -351,7 +631,7 @@ TextureStore* TextureCache::GetTexture(TEXIMAGE_PARAM texAttributes, u32 palAttr
 void TextureCache::Add(TextureStore *texItem)
 {
 	const TextureCacheKey key = texItem->GetCacheKey();
-	this->_texCacheMap[key] = texItem;
+	this->_texCacheMap.Insert(key, texItem);
 	this->_texCacheList.push_back(texItem);
 	this->_actualCacheSize += texItem->GetCacheSize();
 	//printf("allocating: up to %d with %d items\n", this->cache_size, this->cacheTable.size());
@@ -360,7 +640,7 @@ void TextureCache::Add(TextureStore *texItem)
 void TextureCache::Remove(TextureStore *texItem)
 {
 	const TextureCacheKey key = texItem->GetCacheKey();
-	this->_texCacheMap.erase(key);
+	this->_texCacheMap.Erase(key);
 	this->_actualCacheSize -= texItem->GetCacheSize();
 }
 
@@ -401,6 +681,10 @@ TextureStore::TextureStore()
 	_assumedInvalid = false;
 	_isLoadNeeded = false;
 	
+	_vramEpoch = 0;
+	_vramLayout = 0;
+	_packFingerprint = 0;
+	
 	_cacheSize = 0;
 	_cacheAge = 0;
 	_cacheUsageCount = 0;
@@ -466,12 +750,10 @@ TextureStore::TextureStore(const TEXIMAGE_PARAM texAttributes, const u32 palAttr
 		_paletteColorTable = (u16 *)(_packData + _packSize);
 	}
 	
-	_workingData = (u8 *)malloc_alignedCacheLine(_packTotalSize);
+	MemSpan currentPaletteMS = MemSpan_TexPalette(_paletteAddress, _paletteSize, false);
 	
 	if (_paletteSize > 0)
 	{
-		MemSpan currentPaletteMS = MemSpan_TexPalette(_paletteAddress, _paletteSize, false);
-		
 #ifdef MSB_FIRST
 		currentPaletteMS.dump16(_paletteColorTable);
 #else
@@ -487,6 +769,14 @@ TextureStore::TextureStore(const TEXIMAGE_PARAM texAttributes, const u32 palAttr
 	currentPackedTexDataMS.dump(_packData);
 	_packSizeFirstSlot = currentPackedTexDataMS.items[0].len;
 	
+	MemSpan currentPackedTexIndexMS;
+	if (_packFormat == TEXMODE_4X4)
+	{
+		currentPackedTexIndexMS = MemSpan_TexMem(_packIndexAddress, _packIndexSize);
+	}
+	
+	this->SetVRAMState(currentPackedTexDataMS, currentPackedTexIndexMS, currentPaletteMS);
+	
 	_suspectedInvalid = false;
 	_assumedInvalid = false;
 	_isLoadNeeded = true;
@@ -498,7 +788,6 @@ TextureStore::TextureStore(const TEXIMAGE_PARAM texAttributes, const u32 palAttr
 
 TextureStore::~TextureStore()
 {
-	free_aligned(this->_workingData);
 	free_aligned(this->_packData);
 }
 
@@ -610,6 +899,23 @@ void TextureStore::SetTexturePalette(const u16 *paletteBuffer)
 	}
 }
 
+void TextureStore::SetVRAMState(const MemSpan &packedData, const MemSpan &packedIndexData, const MemSpan &packedPalette)
+{
+	// Remember the current contents and mapping of the texture's VRAM, so that later
+	// verifications can tell whether anything has changed.
+	TextureFingerprint fingerprint = packedData.fingerprint(0);
+	fingerprint = packedIndexData.fingerprint(fingerprint);
+	fingerprint = packedPalette.fingerprint(fingerprint);
+	
+	TextureFingerprint layout = packedData.layout(0);
+	layout = packedIndexData.layout(layout);
+	layout = packedPalette.layout(layout);
+	
+	this->_packFingerprint = fingerprint;
+	this->_vramLayout = layout;
+	this->_vramEpoch = MMU.vramEpoch;
+}
+
 size_t TextureStore::GetUnpackSizeUsingFormat(const TextureStoreUnpackFormat texCacheFormat) const
 {
 	return (this->_sizeS * this->_sizeT * sizeof(u32));
@@ -762,6 +1068,7 @@ void TextureStore::Update()
 	
 	this->SetTextureData(currentPackedTexDataMS, currentPackedTexIndexMS);
 	this->SetTexturePalette(currentPaletteMS);
+	this->SetVRAMState(currentPackedTexDataMS, currentPackedTexIndexMS, currentPaletteMS);
 	
 	this->_assumedInvalid = false;
 	this->_suspectedInvalid = false;
@@ -774,49 +1081,46 @@ void TextureStore::VRAMCompareAndUpdate()
 	MemSpan currentPackedTexDataMS = MemSpan_TexMem(this->_packAddress, this->_packSize);
 	MemSpan currentPackedTexIndexMS;
 	
-	currentPackedTexDataMS.dump(this->_workingData);
-	this->_packSizeFirstSlot = currentPackedTexDataMS.items[0].len;
-	
 	if (this->_packFormat == TEXMODE_4X4)
 	{
 		currentPackedTexIndexMS = MemSpan_TexMem(this->_packIndexAddress, this->_packIndexSize);
-		currentPackedTexIndexMS.dump(this->_workingData + this->_packSize);
 	}
 	
-#ifdef MSB_FIRST
-	currentPaletteMS.dump16(this->_workingData + this->_packSize + this->_packIndexSize);
-#else
-	currentPaletteMS.dump(this->_workingData + this->_packSize + this->_packIndexSize);
-#endif
+	// If the texture still maps to the same VRAM pages, and none of those pages have been
+	// written since the texture was last verified, then the texture can't have changed.
+	TextureFingerprint layout = currentPackedTexDataMS.layout(0);
+	layout = currentPackedTexIndexMS.layout(layout);
+	layout = currentPaletteMS.layout(layout);
 	
-	// Compare the texture's packed data with what's being read from VRAM.
-	//
-	// Note that we are considering 4x4 textures to have a palette size of 0.
-	// They really have a potentially HUGE palette, too big for us to handle
-	// like a normal palette, so they go through a different system.
-	if (memcmp(this->_packData, this->_workingData, this->_packTotalSize))
+	const bool isVRAMUntouched = (layout == this->_vramLayout) &&
+	                             !currentPackedTexDataMS.writtenSince(this->_vramEpoch) &&
+	                             !currentPackedTexIndexMS.writtenSince(this->_vramEpoch) &&
+	                             !currentPaletteMS.writtenSince(this->_vramEpoch);
+	
+	if (!isVRAMUntouched)
 	{
-		// If the packed data is different from VRAM, then swap pointers with
-		// the working buffer and flag this texture for reload.
-		u8 *tempDataPtr = this->_packData;
-		
-		this->_packData = this->_workingData;
+		// Compare the texture's fingerprint with what's being read from VRAM, and only
+		// copy the data out of VRAM when it actually differs.
+		//
+		// Note that we are considering 4x4 textures to have a palette size of 0.
+		// They really have a potentially HUGE palette, too big for us to handle
+		// like a normal palette, so they go through a different system.
+		TextureFingerprint fingerprint = currentPackedTexDataMS.fingerprint(0);
+		fingerprint = currentPackedTexIndexMS.fingerprint(fingerprint);
+		fingerprint = currentPaletteMS.fingerprint(fingerprint);
 		
-		if (this->_packIndexSize == 0)
-		{
-			this->_packIndexData = NULL;
-			this->_paletteColorTable = (u16 *)(this->_packData + this->_packSize);
-		}
-		else
+		if (fingerprint != this->_packFingerprint)
 		{
-			this->_packIndexData = this->_packData + this->_packSize;
-			this->_paletteColorTable = (u16 *)(this->_packData + this->_packSize + this->_packIndexSize);
+			this->SetTextureData(currentPackedTexDataMS, currentPackedTexIndexMS);
+			this->SetTexturePalette(currentPaletteMS);
+			this->_packFingerprint = fingerprint;
+			this->_isLoadNeeded = true;
 		}
 		
-		this->_workingData = tempDataPtr;
-		this->_isLoadNeeded = true;
+		this->_vramLayout = layout;
 	}
 	
+	this->_vramEpoch = MMU.vramEpoch;
 	this->_assumedInvalid = false;
 	this->_suspectedInvalid = false;
 }
@@ -833,57 +1137,519 @@ void TextureStore::DebugDump()
 }
 #endif
 
+// The vectorized unpackers are built for the instruction sets that they use, regardless of what the
+// rest of the build targets, and the fastest set that the host cpu supports is picked once at startup.
+// The 128-bit unpackers are named for SSSE3, but their palette blends also need SSE4.1.
+#if defined(ENABLE_SSE2) && defined(__GNUC__)
+	#define TEXCACHE_TARGET(isa) __attribute__((target(isa)))
+#else
+	#define TEXCACHE_TARGET(isa)
+#endif
+
+#define TEXCACHE_TARGET_SSSE3 TEXCACHE_TARGET("ssse3,sse4.1")
+#define TEXCACHE_TARGET_AVX2  TEXCACHE_TARGET("avx2")
+
+#ifdef ENABLE_SSE2
+typedef __m256i v256u8;
+typedef __m256i v256u16;
+typedef __m256i v256u32;
+#endif
+
+enum NDSTextureUnpackKernel
+{
+	NDSTextureUnpackKernel_Scalar	= 0,
+	NDSTextureUnpackKernel_SSSE3	= 1,
+	NDSTextureUnpackKernel_AVX2		= 2
+};
+
+static NDSTextureUnpackKernel NDSTextureUnpackDetectKernel()
+{
+#ifdef ENABLE_SSE2
+	const u64 features = cpu_features_get();
+	
+	if (features & RETRO_SIMD_AVX2)
+	{
+		return NDSTextureUnpackKernel_AVX2;
+	}
+	
+	if ( (features & RETRO_SIMD_SSSE3) && (features & RETRO_SIMD_SSE4) )
+	{
+		return NDSTextureUnpackKernel_SSSE3;
+	}
+#endif
+	
+	return NDSTextureUnpackKernel_Scalar;
+}
+
+static const NDSTextureUnpackKernel _textureUnpackHostKernel = NDSTextureUnpackDetectKernel();
+static NDSTextureUnpackKernel _textureUnpackKernel = _textureUnpackHostKernel;
+static bool _isTextureUnpackVectorized = true;
+
+void NDSTextureUnpackSetVectorized(const bool enable)
+{
+	_isTextureUnpackVectorized = enable;
+	_textureUnpackKernel = (enable) ? _textureUnpackHostKernel : NDSTextureUnpackKernel_Scalar;
+}
+
+bool NDSTextureUnpackIsVectorized()
+{
+	return _isTextureUnpackVectorized;
+}
+
+const char* NDSTextureUnpackKernelName()
+{
+	switch (_textureUnpackKernel)
+	{
+		case NDSTextureUnpackKernel_AVX2:
+			return "avx2";
+			
+		case NDSTextureUnpackKernel_SSSE3:
+			return "ssse3";
+			
+		default:
+			return "none";
+	}
+}
+
+#ifdef ENABLE_SSE2
+// Converts 8 texel colors the same way that CONVERT() does, so that the vectorized unpackers match
+// the scalar ones bit for bit. ColorspaceConvert555To6665_SSE2() can't be used for 15bpp, since it
+// expands a 5-bit channel x to (x << 1) | (x >> 4), while the table behind CONVERT() holds
+// (x << 1) | 1 for every x except 0.
+template <TextureStoreUnpackFormat TEXCACHEFORMAT>
+static FORCEINLINE void NDSTextureConvert8_SSE2(const v128u16 &srcColor, const v128u16 &srcAlphaBits, v128u32 &dstLo, v128u32 &dstHi)
+{
+	if (TEXCACHEFORMAT == TexFormat_32bpp)
+	{
+		ColorspaceConvert555To8888_SSE2<false>(srcColor, srcAlphaBits, dstLo, dstHi);
+		return;
+	}
+	
+	// Each channel sits in its own byte as (x << 1), which is at most 62. Adding 62 to it carries
+	// into bit 6 exactly when x is nonzero, and that carry becomes the channel's low bit.
+	const v128u16 r = _mm_and_si128( _mm_slli_epi16(srcColor, 1), _mm_set1_epi16(0x003E) );
+	const v128u16 b = _mm_and_si128( _mm_srli_epi16(srcColor, 9), _mm_set1_epi16(0x003E) );
+	
+	v128u16 rg = _mm_or_si128( r, _mm_and_si128(_mm_slli_epi16(srcColor, 4), _mm_set1_epi16(0x3E00)) );
+	rg = _mm_or_si128( rg, _mm_and_si128(_mm_srli_epi16(_mm_add_epi16(rg, _mm_set1_epi16(0x3E3E)), 6), _mm_set1_epi16(0x0101)) );
+	
+	v128u16 ba = _mm_or_si128( b, _mm_srli_epi16(_mm_add_epi16(b, _mm_set1_epi16(0x003E)), 6) );
+	ba = _mm_or_si128(ba, srcAlphaBits);
+	
+	dstLo = _mm_unpacklo_epi16(rg, ba);
+	dstHi = _mm_unpackhi_epi16(rg, ba);
+}
+
+// Converts 8 texel colors, with their alpha held in the upper byte of each 16-bit lane, and stores them
+// to dstBuffer. Texels flagged in zeroMask are stored as 0 instead.
+template <TextureStoreUnpackFormat TEXCACHEFORMAT>
+static FORCEINLINE void NDSTextureStore8_SSE2(const v128u16 &color, const v128u16 &alphaBits, const v128u16 &zeroMask, u32 *__restrict dstBuffer)
+{
+	v128u32 convertedColor[2];
+	NDSTextureConvert8_SSE2<TEXCACHEFORMAT>(color, alphaBits, convertedColor[0], convertedColor[1]);
+	
+	convertedColor[0] = _mm_andnot_si128(_mm_unpacklo_epi16(zeroMask, zeroMask), convertedColor[0]);
+	convertedColor[1] = _mm_andnot_si128(_mm_unpackhi_epi16(zeroMask, zeroMask), convertedColor[1]);
+	
+	_mm_store_si128((v128u32 *)(dstBuffer + 0), convertedColor[0]);
+	_mm_store_si128((v128u32 *)(dstBuffer + 4), convertedColor[1]);
+}
+
+// Spreads the 16 2-bit indices packed into srcBits so that each index gets its own byte,
+// in the same order that they were packed.
+static FORCEINLINE TEXCACHE_TARGET_SSSE3 v128u8 NDSTextureSpread2BitIndices_SSSE3(const u32 srcBits)
+{
+	v128u8 idx = _mm_cvtsi32_si128(srcBits);
+	idx = _mm_unpacklo_epi8(idx, idx);
+	idx = _mm_unpacklo_epi8(idx, idx);
+	return _mm_or_si128( _mm_or_si128( _mm_or_si128( _mm_and_si128(idx, _mm_set1_epi32(0x00000003)), _mm_and_si128(_mm_srli_epi32(idx, 2), _mm_set1_epi32(0x00000300)) ), _mm_and_si128(_mm_srli_epi32(idx, 4), _mm_set1_epi32(0x00030000)) ), _mm_and_si128(_mm_srli_epi32(idx, 6), _mm_set1_epi32(0x03000000)) );
+}
+
+// Looks up colors from a 32 entry palette. Each 16-bit lane of idx holds the byte offsets of
+// the low and high bytes of the color it wants.
+static FORCEINLINE TEXCACHE_TARGET_SSSE3 v128u16 NDSTexturePalette32Lookup_SSSE3(const v128u16 *pal, const v128u16 &idx)
+{
+	const v128u8 palSelect16 = _mm_cmpeq_epi8( _mm_and_si128(idx, _mm_set1_epi8(0x10)), _mm_set1_epi8(0x10) );
+	const v128u8 palSelect32 = _mm_cmpeq_epi8( _mm_and_si128(idx, _mm_set1_epi8(0x20)), _mm_set1_epi8(0x20) );
+	
+	const v128u16 palColorA = _mm_blendv_epi8( _mm_shuffle_epi8(pal[0], idx), _mm_shuffle_epi8(pal[1], idx), palSelect16 );
+	const v128u16 palColorB = _mm_blendv_epi8( _mm_shuffle_epi8(pal[2], idx), _mm_shuffle_epi8(pal[3], idx), palSelect16 );
+	
+	return _mm_blendv_epi8(palColorA, palColorB, palSelect32);
+}
+
+// Does the same conversions as NDSTextureConvert8_SSE2() on 16 texel colors.
+template <TextureStoreUnpackFormat TEXCACHEFORMAT>
+static FORCEINLINE TEXCACHE_TARGET_AVX2 void NDSTextureConvert16_AVX2(const v256u16 &srcColor, const v256u16 &srcAlphaBits, v256u32 &dstLo, v256u32 &dstHi)
+{
+	v256u16 rg;
+	v256u16 ba;
+	
+	if (TEXCACHEFORMAT == TexFormat_15bpp)
+	{
+		const v256u16 r = _mm256_and_si256( _mm256_slli_epi16(srcColor, 1), _mm256_set1_epi16(0x003E) );
+		const v256u16 b = _mm256_and_si256( _mm256_srli_epi16(srcColor, 9), _mm256_set1_epi16(0x003E) );
+		
+		rg = _mm256_or_si256( r, _mm256_and_si256(_mm256_slli_epi16(srcColor, 4), _mm256_set1_epi16(0x3E00)) );
+		rg = _mm256_or_si256( rg, _mm256_and_si256(_mm256_srli_epi16(_mm256_add_epi16(rg, _mm256_set1_epi16(0x3E3E)), 6), _mm256_set1_epi16(0x0101)) );
+		ba = _mm256_or_si256( b, _mm256_srli_epi16(_mm256_add_epi16(b, _mm256_set1_epi16(0x003E)), 6) );
+	}
+	else
+	{
+		const v256u16 r = _mm256_and_si256( _mm256_slli_epi16(srcColor, 3), _mm256_set1_epi16(0x00F8) );
+		
+		rg = _mm256_or_si256( r, _mm256_and_si256(_mm256_slli_epi16(srcColor, 6), _mm256_set1_epi16(0xF800)) );
+		rg = _mm256_or_si256( rg, _mm256_and_si256(_mm256_srli_epi16(rg, 5), _mm256_set1_epi16(0x0707)) );
+		ba = _mm256_and_si256( _mm256_srli_epi16(srcColor, 7), _mm256_set1_epi16(0x00F8) );
+		ba = _mm256_or_si256(ba, _mm256_srli_epi16(ba, 5));
+	}
+	
+	ba = _mm256_or_si256(ba, srcAlphaBits);
+	
+	rg = _mm256_permute4x64_epi64(rg, 0xD8);
+	ba = _mm256_permute4x64_epi64(ba, 0xD8);
+	
+	dstLo = _mm256_unpacklo_epi16(rg, ba);
+	dstHi = _mm256_unpackhi_epi16(rg, ba);
+}
+
+// Converts 16 texel colors, with their alpha held in the upper byte of each 16-bit lane, and stores
+// texels 0-7 to dstLo and texels 8-15 to dstHi. Texels flagged in zeroMask are stored as 0 instead.
+template <TextureStoreUnpackFormat TEXCACHEFORMAT>
+static FORCEINLINE TEXCACHE_TARGET_AVX2 void NDSTextureStore16_AVX2(const v256u16 &color, const v256u16 &alphaBits, const v256u16 &zeroMask, u32 *__restrict dstLo, u32 *__restrict dstHi)
+{
+	v256u32 convertedColor[2];
+	NDSTextureConvert16_AVX2<TEXCACHEFORMAT>(color, alphaBits, convertedColor[0], convertedColor[1]);
+	
+	// The converter reorders its 64-bit lanes so that the colors come out in order, so the mask
+	// needs the same reordering before it can be widened.
+	const v256u16 mask = _mm256_permute4x64_epi64(zeroMask, 0xD8);
+	convertedColor[0] = _mm256_andnot_si256(_mm256_unpacklo_epi16(mask, mask), convertedColor[0]);
+	convertedColor[1] = _mm256_andnot_si256(_mm256_unpackhi_epi16(mask, mask), convertedColor[1]);
+	
+	_mm256_storeu_si256((v256u32 *)dstLo, convertedColor[0]);
+	_mm256_storeu_si256((v256u32 *)dstHi, convertedColor[1]);
+}
+
+static FORCEINLINE TEXCACHE_TARGET_AVX2 v256u16 NDSTexturePalette32Lookup_AVX2(const v256u16 *pal, const v256u16 &idx)
+{
+	const v256u8 palSelect16 = _mm256_cmpeq_epi8( _mm256_and_si256(idx, _mm256_set1_epi8(0x10)), _mm256_set1_epi8(0x10) );
+	const v256u8 palSelect32 = _mm256_cmpeq_epi8( _mm256_and_si256(idx, _mm256_set1_epi8(0x20)), _mm256_set1_epi8(0x20) );
+	
+	const v256u16 palColorA = _mm256_blendv_epi8( _mm256_shuffle_epi8(pal[0], idx), _mm256_shuffle_epi8(pal[1], idx), palSelect16 );
+	const v256u16 palColorB = _mm256_blendv_epi8( _mm256_shuffle_epi8(pal[2], idx), _mm256_shuffle_epi8(pal[3], idx), palSelect16 );
+	
+	return _mm256_blendv_epi8(palColorA, palColorB, palSelect32);
+}
+
+// The vectorized unpackers below all work on 32-bit lanes in place, so they handle the texels in
+// 128-bit lanes of 16 (SSSE3) or in pairs of 128-bit lanes (AVX2). With AVX2, the color vectors
+// that come out of the in-lane shuffles hold texels 0-7 and 16-23, or 8-15 and 24-31, which is
+// why their stores are interleaved. Each one returns how many source units it handled, and
+// whatever is left over goes through the scalar code.
+
+template <TextureStoreUnpackFormat TEXCACHEFORMAT>
+static TEXCACHE_TARGET_AVX2 size_t NDSTextureUnpackI2_AVX2(const size_t srcSize, const u8 *__restrict srcData, const u16 *__restrict srcPal, const bool isPalZeroTransparent, u32 *__restrict dstBuffer)
+{
+	const v256u16 pal_vec256 = _mm256_broadcastsi128_si256( _mm_loadl_epi64((v128u16 *)srcPal) );
+	const v256u16 alphaBits = _mm256_set1_epi16((TEXCACHEFORMAT == TexFormat_15bpp) ? 0x1F00 : 0xFF00);
+	const v256u16 zeroIndex = _mm256_set1_epi16((isPalZeroTransparent) ? 0x0100 : 0xFFFF);
+	const size_t vecSize = srcSize - (srcSize % 8);
+	
+	for (size_t i = 0; i < vecSize; i+=8, srcData+=8, dstBuffer+=32)
+	{
+		v256u8 idx = _mm256_inserti128_si256( _mm256_castsi128_si256(_mm_cvtsi32_si128(*(u32 *)(srcData + 0))), _mm_cvtsi32_si128(*(u32 *)(srcData + 4)), 1 );
+		idx = _mm256_unpacklo_epi8(idx, idx);
+		idx = _mm256_unpacklo_epi8(idx, idx);
+		idx = _mm256_or_si256( _mm256_or_si256( _mm256_or_si256( _mm256_and_si256(idx, _mm256_set1_epi32(0x00000003)), _mm256_and_si256(_mm256_srli_epi32(idx, 2), _mm256_set1_epi32(0x00000300)) ), _mm256_and_si256(_mm256_srli_epi32(idx, 4), _mm256_set1_epi32(0x00030000)) ), _mm256_and_si256(_mm256_srli_epi32(idx, 6), _mm256_set1_epi32(0x03000000)) );
+		idx = _mm256_slli_epi16(idx, 1);
+		
+		const v256u16 idx0 = _mm256_add_epi8( _mm256_unpacklo_epi8(idx, idx), _mm256_set1_epi16(0x0100) );
+		const v256u16 idx1 = _mm256_add_epi8( _mm256_unpackhi_epi8(idx, idx), _mm256_set1_epi16(0x0100) );
+		
+		NDSTextureStore16_AVX2<TEXCACHEFORMAT>(_mm256_shuffle_epi8(pal_vec256, idx0), alphaBits, _mm256_cmpeq_epi16(idx0, zeroIndex), dstBuffer +  0, dstBuffer + 16);
+		NDSTextureStore16_AVX2<TEXCACHEFORMAT>(_mm256_shuffle_epi8(pal_vec256, idx1), alphaBits, _mm256_cmpeq_epi16(idx1, zeroIndex), dstBuffer +  8, dstBuffer + 24);
+	}
+	
+	return vecSize;
+}
+
+template <TextureStoreUnpackFormat TEXCACHEFORMAT>
+static TEXCACHE_TARGET_SSSE3 size_t NDSTextureUnpackI2_SSSE3(const size_t srcSize, const u8 *__restrict srcData, const u16 *__restrict srcPal, const bool isPalZeroTransparent, u32 *__restrict dstBuffer)
+{
+	const v128u16 pal_vec128 = _mm_loadl_epi64((v128u16 *)srcPal);
+	const v128u16 alphaBits = _mm_set1_epi16((TEXCACHEFORMAT == TexFormat_15bpp) ? 0x1F00 : 0xFF00);
+	const v128u16 zeroIndex = _mm_set1_epi16((isPalZeroTransparent) ? 0x0100 : 0xFFFF);
+	const size_t vecSize = srcSize - (srcSize % 4);
+	
+	for (size_t i = 0; i < vecSize; i+=4, srcData+=4, dstBuffer+=16)
+	{
+		const v128u8 idx = _mm_slli_epi16(NDSTextureSpread2BitIndices_SSSE3(*(u32 *)srcData), 1);
+		
+		const v128u16 idx0 = _mm_add_epi8( _mm_unpacklo_epi8(idx, idx), _mm_set1_epi16(0x0100) );
+		const v128u16 idx1 = _mm_add_epi8( _mm_unpackhi_epi8(idx, idx), _mm_set1_epi16(0x0100) );
+		
+		// Palette index 0 is cleared to 0 when it is transparent.
+		NDSTextureStore8_SSE2<TEXCACHEFORMAT>(_mm_shuffle_epi8(pal_vec128, idx0), alphaBits, _mm_cmpeq_epi16(idx0, zeroIndex), dstBuffer + 0);
+		NDSTextureStore8_SSE2<TEXCACHEFORMAT>(_mm_shuffle_epi8(pal_vec128, idx1), alphaBits, _mm_cmpeq_epi16(idx1, zeroIndex), dstBuffer + 8);
+	}
+	
+	return vecSize;
+}
+
+template <TextureStoreUnpackFormat TEXCACHEFORMAT>
+static TEXCACHE_TARGET_AVX2 size_t NDSTextureUnpackI4_AVX2(const size_t srcSize, const u8 *__restrict srcData, const u16 *__restrict srcPal, const bool isPalZeroTransparent, u32 *__restrict dstBuffer)
+{
+	const v256u16 palLo = _mm256_broadcastsi128_si256( _mm_load_si128((v128u16 *)srcPal + 0) );
+	const v256u16 palHi = _mm256_broadcastsi128_si256( _mm_load_si128((v128u16 *)srcPal + 1) );
+	const v256u16 alphaBits = _mm256_set1_epi16((TEXCACHEFORMAT == TexFormat_15bpp) ? 0x1F00 : 0xFF00);
+	const v256u16 zeroIndex = _mm256_set1_epi16((isPalZeroTransparent) ? 0x0100 : 0xFFFF);
+	const size_t vecSize = srcSize - (srcSize % 16);
+	
+	for (size_t i = 0; i < vecSize; i+=16, srcData+=16, dstBuffer+=32)
+	{
+		// Put the first 8 bytes in the low lane and the next 8 bytes in the high lane.
+		v256u8 idx = _mm256_permute4x64_epi64( _mm256_castsi128_si256(_mm_loadu_si128((v128u8 *)srcData)), 0x50 );
+		idx = _mm256_unpacklo_epi8(idx, idx);
+		idx = _mm256_or_si256( _mm256_and_si256(idx, _mm256_set1_epi16(0x000F)), _mm256_and_si256(_mm256_srli_epi16(idx, 4), _mm256_set1_epi16(0x0F00)) );
+		idx = _mm256_slli_epi16(idx, 1);
+		
+		const v256u16 idx0 = _mm256_add_epi8( _mm256_unpacklo_epi8(idx, idx), _mm256_set1_epi16(0x0100) );
+		const v256u16 idx1 = _mm256_add_epi8( _mm256_unpackhi_epi8(idx, idx), _mm256_set1_epi16(0x0100) );
+		
+		const v256u8 palSelect0 = _mm256_cmpeq_epi8( _mm256_and_si256(idx0, _mm256_set1_epi8(0x10)), _mm256_set1_epi8(0x10) );
+		const v256u8 palSelect1 = _mm256_cmpeq_epi8( _mm256_and_si256(idx1, _mm256_set1_epi8(0x10)), _mm256_set1_epi8(0x10) );
+		const v256u16 palColor0 = _mm256_blendv_epi8( _mm256_shuffle_epi8(palLo, idx0), _mm256_shuffle_epi8(palHi, idx0), palSelect0 );
+		const v256u16 palColor1 = _mm256_blendv_epi8( _mm256_shuffle_epi8(palLo, idx1), _mm256_shuffle_epi8(palHi, idx1), palSelect1 );
+		
+		NDSTextureStore16_AVX2<TEXCACHEFORMAT>(palColor0, alphaBits, _mm256_cmpeq_epi16(idx0, zeroIndex), dstBuffer +  0, dstBuffer + 16);
+		NDSTextureStore16_AVX2<TEXCACHEFORMAT>(palColor1, alphaBits, _mm256_cmpeq_epi16(idx1, zeroIndex), dstBuffer +  8, dstBuffer + 24);
+	}
+	
+	return vecSize;
+}
+
+template <TextureStoreUnpackFormat TEXCACHEFORMAT>
+static TEXCACHE_TARGET_SSSE3 size_t NDSTextureUnpackI4_SSSE3(const size_t srcSize, const u8 *__restrict srcData, const u16 *__restrict srcPal, const bool isPalZeroTransparent, u32 *__restrict dstBuffer)
+{
+	const v128u16 palLo = _mm_load_si128((v128u16 *)srcPal + 0);
+	const v128u16 palHi = _mm_load_si128((v128u16 *)srcPal + 1);
+	const v128u16 alphaBits = _mm_set1_epi16((TEXCACHEFORMAT == TexFormat_15bpp) ? 0x1F00 : 0xFF00);
+	const v128u16 zeroIndex = _mm_set1_epi16((isPalZeroTransparent) ? 0x0100 : 0xFFFF);
+	const size_t vecSize = srcSize - (srcSize % 8);
+	
+	for (size_t i = 0; i < vecSize; i+=8, srcData+=8, dstBuffer+=16)
+	{
+		v128u8 idx = _mm_loadl_epi64((v128u8 *)srcData);
+		idx = _mm_unpacklo_epi8(idx, idx);
+		idx = _mm_or_si128( _mm_and_si128(idx, _mm_set1_epi16(0x000F)), _mm_and_si128(_mm_srli_epi16(idx, 4), _mm_set1_epi16(0x0F00)) );
+		idx = _mm_slli_epi16(idx, 1);
+		
+		const v128u16 idx0 = _mm_add_epi8( _mm_unpacklo_epi8(idx, idx), _mm_set1_epi16(0x0100) );
+		const v128u16 idx1 = _mm_add_epi8( _mm_unpackhi_epi8(idx, idx), _mm_set1_epi16(0x0100) );
+		
+		const v128u8 palMask = _mm_cmpeq_epi8( _mm_and_si128(idx, _mm_set1_epi8(0x10)), _mm_setzero_si128() );
+		const v128u16 palColor0 = _mm_blendv_epi8( _mm_shuffle_epi8(palHi, idx0), _mm_shuffle_epi8(palLo, idx0), _mm_unpacklo_epi8(palMask, palMask) );
+		const v128u16 palColor1 = _mm_blendv_epi8( _mm_shuffle_epi8(palHi, idx1), _mm_shuffle_epi8(palLo, idx1), _mm_unpackhi_epi8(palMask, palMask) );
+		
+		// Palette index 0 is cleared to 0 when it is transparent.
+		NDSTextureStore8_SSE2<TEXCACHEFORMAT>(palColor0, alphaBits, _mm_cmpeq_epi16(idx0, zeroIndex), dstBuffer + 0);
+		NDSTextureStore8_SSE2<TEXCACHEFORMAT>(palColor1, alphaBits, _mm_cmpeq_epi16(idx1, zeroIndex), dstBuffer + 8);
+	}
+	
+	return vecSize;
+}
+
+static TEXCACHE_TARGET_AVX2 size_t NDSTextureLookupI8_AVX2(const size_t srcSize, const u8 *__restrict srcData, const u32 *__restrict palColor, u32 *__restrict dstBuffer)
+{
+	const size_t vecSize = srcSize - (srcSize % 8);
+	
+	for (size_t i = 0; i < vecSize; i+=8, srcData+=8, dstBuffer+=8)
+	{
+		const v256u32 idx = _mm256_cvtepu8_epi32( _mm_loadl_epi64((v128u8 *)srcData) );
+		_mm256_storeu_si256( (v256u32 *)dstBuffer, _mm256_i32gather_epi32((const int *)palColor, idx, sizeof(u32)) );
+	}
+	
+	return vecSize;
+}
+
+template <TextureStoreUnpackFormat TEXCACHEFORMAT>
+static TEXCACHE_TARGET_AVX2 size_t NDSTextureUnpackA3I5_AVX2(const size_t srcSize, const u8 *__restrict srcData, const u16 *__restrict srcPal, u32 *__restrict dstBuffer)
+{
+	const v256u16 pal[4] = {
+		_mm256_broadcastsi128_si256( _mm_load_si128((v128u16 *)srcPal + 0) ),
+		_mm256_broadcastsi128_si256( _mm_load_si128((v128u16 *)srcPal + 1) ),
+		_mm256_broadcastsi128_si256( _mm_load_si128((v128u16 *)srcPal + 2) ),
+		_mm256_broadcastsi128_si256( _mm_load_si128((v128u16 *)srcPal + 3) )
+	};
+	const v256u8 alphaTable = _mm256_broadcastsi128_si256( _mm_loadl_epi64((v128u8 *)((TEXCACHEFORMAT == TexFormat_15bpp) ? material_3bit_to_5bit : material_3bit_to_8bit)) );
+	const size_t vecSize = srcSize - (srcSize % 32);
+	
+	for (size_t i = 0; i < vecSize; i+=32, srcData+=32, dstBuffer+=32)
+	{
+		const v256u8 bits = _mm256_loadu_si256((v256u8 *)srcData);
+		
+		const v256u8 idx = _mm256_slli_epi16( _mm256_and_si256(bits, _mm256_set1_epi8(0x1F)), 1 );
+		const v256u16 idx0 = _mm256_add_epi8( _mm256_unpacklo_epi8(idx, idx), _mm256_set1_epi16(0x0100) );
+		const v256u16 idx1 = _mm256_add_epi8( _mm256_unpackhi_epi8(idx, idx), _mm256_set1_epi16(0x0100) );
+		
+		const v256u8 alpha = _mm256_shuffle_epi8( alphaTable, _mm256_and_si256(_mm256_srli_epi16(bits, 5), _mm256_set1_epi8(0x07)) );
+		
+		NDSTextureStore16_AVX2<TEXCACHEFORMAT>(NDSTexturePalette32Lookup_AVX2(pal, idx0), _mm256_unpacklo_epi8(_mm256_setzero_si256(), alpha), _mm256_setzero_si256(), dstBuffer +  0, dstBuffer + 16);
+		NDSTextureStore16_AVX2<TEXCACHEFORMAT>(NDSTexturePalette32Lookup_AVX2(pal, idx1), _mm256_unpackhi_epi8(_mm256_setzero_si256(), alpha), _mm256_setzero_si256(), dstBuffer +  8, dstBuffer + 24);
+	}
+	
+	return vecSize;
+}
+
+template <TextureStoreUnpackFormat TEXCACHEFORMAT>
+static TEXCACHE_TARGET_SSSE3 size_t NDSTextureUnpackA3I5_SSSE3(const size_t srcSize, const u8 *__restrict srcData, const u16 *__restrict srcPal, u32 *__restrict dstBuffer)
+{
+	const v128u16 pal[4] = {
+		_mm_load_si128((v128u16 *)srcPal + 0),
+		_mm_load_si128((v128u16 *)srcPal + 1),
+		_mm_load_si128((v128u16 *)srcPal + 2),
+		_mm_load_si128((v128u16 *)srcPal + 3)
+	};
+	const v128u8 alphaTable = _mm_loadl_epi64((v128u8 *)((TEXCACHEFORMAT == TexFormat_15bpp) ? material_3bit_to_5bit : material_3bit_to_8bit));
+	const size_t vecSize = srcSize - (srcSize % 16);
+	
+	for (size_t i = 0; i < vecSize; i+=16, srcData+=16, dstBuffer+=16)
+	{
+		const v128u8 bits = _mm_loadu_si128((v128u8 *)srcData);
+		
+		const v128u8 idx = _mm_slli_epi16( _mm_and_si128(bits, _mm_set1_epi8(0x1F)), 1 );
+		const v128u16 idx0 = _mm_add_epi8( _mm_unpacklo_epi8(idx, idx), _mm_set1_epi16(0x0100) );
+		const v128u16 idx1 = _mm_add_epi8( _mm_unpackhi_epi8(idx, idx), _mm_set1_epi16(0x0100) );
+		
+		const v128u8 alpha = _mm_shuffle_epi8( alphaTable, _mm_and_si128(_mm_srli_epi16(bits, 5), _mm_set1_epi8(0x07)) );
+		
+		NDSTextureStore8_SSE2<TEXCACHEFORMAT>(NDSTexturePalette32Lookup_SSSE3(pal, idx0), _mm_unpacklo_epi8(_mm_setzero_si128(), alpha), _mm_setzero_si128(), dstBuffer + 0);
+		NDSTextureStore8_SSE2<TEXCACHEFORMAT>(NDSTexturePalette32Lookup_SSSE3(pal, idx1), _mm_unpackhi_epi8(_mm_setzero_si128(), alpha), _mm_setzero_si128(), dstBuffer + 8);
+	}
+	
+	return vecSize;
+}
+
+template <TextureStoreUnpackFormat TEXCACHEFORMAT>
+static TEXCACHE_TARGET_AVX2 size_t NDSTextureUnpackA5I3_AVX2(const size_t srcSize, const u8 *__restrict srcData, const u16 *__restrict srcPal, u32 *__restrict dstBuffer)
+{
+	const v256u16 pal_vec256 = _mm256_broadcastsi128_si256( _mm_load_si128((v128u16 *)srcPal) );
+	const size_t vecSize = srcSize - (srcSize % 32);
+	
+	for (size_t i = 0; i < vecSize; i+=32, srcData+=32, dstBuffer+=32)
+	{
+		const v256u8 bits = _mm256_loadu_si256((v256u8 *)srcData);
+		
+		const v256u8 idx = _mm256_slli_epi16( _mm256_and_si256(bits, _mm256_set1_epi8(0x07)), 1 );
+		const v256u16 idx0 = _mm256_add_epi8( _mm256_unpacklo_epi8(idx, idx), _mm256_set1_epi16(0x0100) );
+		const v256u16 idx1 = _mm256_add_epi8( _mm256_unpackhi_epi8(idx, idx), _mm256_set1_epi16(0x0100) );
+		
+		const v256u8 alpha = (TEXCACHEFORMAT == TexFormat_15bpp) ?
+			_mm256_srli_epi16( _mm256_and_si256(bits, _mm256_set1_epi8(0xF8)), 3 ) :
+			_mm256_or_si256( _mm256_and_si256(bits, _mm256_set1_epi8(0xF8)), _mm256_srli_epi16(_mm256_and_si256(bits, _mm256_set1_epi8(0xE0)), 5) );
+		
+		NDSTextureStore16_AVX2<TEXCACHEFORMAT>(_mm256_shuffle_epi8(pal_vec256, idx0), _mm256_unpacklo_epi8(_mm256_setzero_si256(), alpha), _mm256_setzero_si256(), dstBuffer +  0, dstBuffer + 16);
+		NDSTextureStore16_AVX2<TEXCACHEFORMAT>(_mm256_shuffle_epi8(pal_vec256, idx1), _mm256_unpackhi_epi8(_mm256_setzero_si256(), alpha), _mm256_setzero_si256(), dstBuffer +  8, dstBuffer + 24);
+	}
+	
+	return vecSize;
+}
+
+template <TextureStoreUnpackFormat TEXCACHEFORMAT>
+static TEXCACHE_TARGET_SSSE3 size_t NDSTextureUnpackA5I3_SSSE3(const size_t srcSize, const u8 *__restrict srcData, const u16 *__restrict srcPal, u32 *__restrict dstBuffer)
+{
+	const v128u16 pal_vec128 = _mm_load_si128((v128u16 *)srcPal);
+	const size_t vecSize = srcSize - (srcSize % 16);
+	
+	for (size_t i = 0; i < vecSize; i+=16, srcData+=16, dstBuffer+=16)
+	{
+		const v128u8 bits = _mm_loadu_si128((v128u8 *)srcData);
+		
+		const v128u8 idx = _mm_slli_epi16( _mm_and_si128(bits, _mm_set1_epi8(0x07)), 1 );
+		const v128u16 idx0 = _mm_add_epi8( _mm_unpacklo_epi8(idx, idx), _mm_set1_epi16(0x0100) );
+		const v128u16 idx1 = _mm_add_epi8( _mm_unpackhi_epi8(idx, idx), _mm_set1_epi16(0x0100) );
+		
+		const v128u8 alpha = (TEXCACHEFORMAT == TexFormat_15bpp) ?
+			_mm_srli_epi16( _mm_and_si128(bits, _mm_set1_epi8(0xF8)), 3 ) :
+			_mm_or_si128( _mm_and_si128(bits, _mm_set1_epi8(0xF8)), _mm_srli_epi16(_mm_and_si128(bits, _mm_set1_epi8(0xE0)), 5) );
+		
+		NDSTextureStore8_SSE2<TEXCACHEFORMAT>(_mm_shuffle_epi8(pal_vec128, idx0), _mm_unpacklo_epi8(_mm_setzero_si128(), alpha), _mm_setzero_si128(), dstBuffer + 0);
+		NDSTextureStore8_SSE2<TEXCACHEFORMAT>(_mm_shuffle_epi8(pal_vec128, idx1), _mm_unpackhi_epi8(_mm_setzero_si128(), alpha), _mm_setzero_si128(), dstBuffer + 8);
+	}
+	
+	return vecSize;
+}
+
+// Sets the 16 texels of a 4x4 block. Each 2-bit index picks one of the 4 colors, so two rows at a
+// time can be permuted straight out of the color table.
+static TEXCACHE_TARGET_AVX2 void NDSTextureStore4x4Block_AVX2(const u32 *__restrict blockColor, const u32 blockBits, const u32 *rowPos, u32 *__restrict dstBuffer)
+{
+	const v256u32 color = _mm256_castsi128_si256( _mm_load_si128((v128u32 *)blockColor) );
+	const v256u32 block = _mm256_set1_epi32(blockBits);
+	const v256u32 row01 = _mm256_permutevar8x32_epi32( color, _mm256_and_si256(_mm256_srlv_epi32(block, _mm256_setr_epi32( 0,  2,  4,  6,  8, 10, 12, 14)), _mm256_set1_epi32(3)) );
+	const v256u32 row23 = _mm256_permutevar8x32_epi32( color, _mm256_and_si256(_mm256_srlv_epi32(block, _mm256_setr_epi32(16, 18, 20, 22, 24, 26, 28, 30)), _mm256_set1_epi32(3)) );
+	
+	_mm_storeu_si128( (v128u32 *)(dstBuffer + rowPos[0]), _mm256_castsi256_si128(row01) );
+	_mm_storeu_si128( (v128u32 *)(dstBuffer + rowPos[1]), _mm256_extracti128_si256(row01, 1) );
+	_mm_storeu_si128( (v128u32 *)(dstBuffer + rowPos[2]), _mm256_castsi256_si128(row23) );
+	_mm_storeu_si128( (v128u32 *)(dstBuffer + rowPos[3]), _mm256_extracti128_si256(row23, 1) );
+}
+
+// Turns each 2-bit index into the byte offset of its color, then copies that offset into all
+// 4 bytes of the texel so that the color table can be shuffled directly.
+static TEXCACHE_TARGET_SSSE3 void NDSTextureStore4x4Block_SSSE3(const u32 *__restrict blockColor, const u32 blockBits, const u32 *rowPos, u32 *__restrict dstBuffer)
+{
+	const v128u32 color = _mm_load_si128((v128u32 *)blockColor);
+	const v128u8 offset = _mm_slli_epi16(NDSTextureSpread2BitIndices_SSSE3(blockBits), 2);
+	
+	for (size_t sy = 0; sy < 4; sy++)
+	{
+		const u32 spread = 0x01010101 * (sy << 2);
+		const v128u8 texelOffset = _mm_add_epi8( _mm_shuffle_epi8(offset, _mm_set_epi32(spread + 0x03030303, spread + 0x02020202, spread + 0x01010101, spread)), _mm_set1_epi32(0x03020100) );
+		_mm_storeu_si128( (v128u32 *)(dstBuffer + rowPos[sy]), _mm_shuffle_epi8(color, texelOffset) );
+	}
+}
+
+template <TextureStoreUnpackFormat TEXCACHEFORMAT>
+static TEXCACHE_TARGET_AVX2 size_t NDSTextureUnpackDirect16Bit_AVX2(const size_t pixCount, const u16 *__restrict srcData, u32 *__restrict dstBuffer)
+{
+	const v256u16 alphaBits = _mm256_set1_epi16((TEXCACHEFORMAT == TexFormat_15bpp) ? 0x1F00 : 0xFF00);
+	const size_t pixCountVec256 = pixCount - (pixCount % 16);
+	
+	for (size_t i = 0; i < pixCountVec256; i+=16, srcData+=16, dstBuffer+=16)
+	{
+		const v256u16 c = _mm256_loadu_si256((v256u16 *)srcData);
+		const v256u16 isTransparent = _mm256_cmpeq_epi16( _mm256_and_si256(c, _mm256_set1_epi16(0x8000)), _mm256_setzero_si256() );
+		NDSTextureStore16_AVX2<TEXCACHEFORMAT>(c, alphaBits, isTransparent, dstBuffer + 0, dstBuffer + 8);
+	}
+	
+	return pixCountVec256;
+}
+#endif // ENABLE_SSE2
+
 template <TextureStoreUnpackFormat TEXCACHEFORMAT>
 void NDSTextureUnpackI2(const size_t srcSize, const u8 *__restrict srcData, const u16 *__restrict srcPal, const bool isPalZeroTransparent, u32 *__restrict dstBuffer)
 {
-#ifdef ENABLE_SSSE3
-	const __m128i pal_vec128 = _mm_loadl_epi64((__m128i *)srcPal);
+	size_t i = 0;
+
+#ifdef ENABLE_SSE2
+	if (_textureUnpackKernel == NDSTextureUnpackKernel_AVX2)
+	{
+		i = NDSTextureUnpackI2_AVX2<TEXCACHEFORMAT>(srcSize, srcData, srcPal, isPalZeroTransparent, dstBuffer);
+	}
+	else if (_textureUnpackKernel == NDSTextureUnpackKernel_SSSE3)
+	{
+		i = NDSTextureUnpackI2_SSSE3<TEXCACHEFORMAT>(srcSize, srcData, srcPal, isPalZeroTransparent, dstBuffer);
+	}
+	
+	srcData += i;
+	dstBuffer += i * 4;
 #endif
+	
 	if (isPalZeroTransparent)
 	{
-#ifdef ENABLE_SSSE3
-		for (size_t i = 0; i < srcSize; i+=4, srcData+=4, dstBuffer+=16)
-		{
-			__m128i idx = _mm_set_epi32(0, 0, 0, *(u32 *)srcData);
-			idx = _mm_unpacklo_epi8(idx, idx);
-			idx = _mm_unpacklo_epi8(idx, idx);
-			idx = _mm_or_si128( _mm_or_si128( _mm_or_si128( _mm_and_si128(idx, _mm_set1_epi32(0x00000003)), _mm_and_si128(_mm_srli_epi32(idx, 2), _mm_set1_epi32(0x00000300)) ), _mm_and_si128(_mm_srli_epi32(idx, 4), _mm_set1_epi32(0x00030000)) ), _mm_and_si128(_mm_srli_epi32(idx, 6), _mm_set1_epi32(0x03000000)) );
-			idx = _mm_slli_epi16(idx, 1);
-			
-			__m128i idx0 = _mm_add_epi8( _mm_unpacklo_epi8(idx, idx), _mm_set1_epi16(0x0100) );
-			__m128i idx1 = _mm_add_epi8( _mm_unpackhi_epi8(idx, idx), _mm_set1_epi16(0x0100) );
-			
-			const __m128i palColor0 = _mm_shuffle_epi8(pal_vec128, idx0);
-			const __m128i palColor1 = _mm_shuffle_epi8(pal_vec128, idx1);
-			
-			__m128i convertedColor[4];
-			
-			if (TEXCACHEFORMAT == TexFormat_15bpp)
-			{
-				ColorspaceConvert555To6665Opaque_SSE2<false>(palColor0, convertedColor[0], convertedColor[1]);
-				ColorspaceConvert555To6665Opaque_SSE2<false>(palColor1, convertedColor[2], convertedColor[3]);
-			}
-			else
-			{
-				ColorspaceConvert555To8888Opaque_SSE2<false>(palColor0, convertedColor[0], convertedColor[1]);
-				ColorspaceConvert555To8888Opaque_SSE2<false>(palColor1, convertedColor[2], convertedColor[3]);
-			}
-			
-			// Set converted colors to 0 if the palette index is 0.
-			idx0 = _mm_cmpeq_epi16(idx0, _mm_set1_epi16(0x0100));
-			idx1 = _mm_cmpeq_epi16(idx1, _mm_set1_epi16(0x0100));
-			convertedColor[0] = _mm_andnot_si128(_mm_unpacklo_epi16(idx0, idx0), convertedColor[0]);
-			convertedColor[1] = _mm_andnot_si128(_mm_unpackhi_epi16(idx0, idx0), convertedColor[1]);
-			convertedColor[2] = _mm_andnot_si128(_mm_unpacklo_epi16(idx1, idx1), convertedColor[2]);
-			convertedColor[3] = _mm_andnot_si128(_mm_unpackhi_epi16(idx1, idx1), convertedColor[3]);
-			
-			_mm_store_si128((__m128i *)(dstBuffer +  0), convertedColor[0]);
-			_mm_store_si128((__m128i *)(dstBuffer +  4), convertedColor[1]);
-			_mm_store_si128((__m128i *)(dstBuffer +  8), convertedColor[2]);
-			_mm_store_si128((__m128i *)(dstBuffer + 12), convertedColor[3]);
-		}
-#else
-		for (size_t i = 0; i < srcSize; i++, srcData++)
+		for (; i < srcSize; i++, srcData++)
 		{
 			u8 idx;
 			
@@ -899,112 +1665,41 @@ void NDSTextureUnpackI2(const size_t srcSize, const u8 *__restrict srcData, cons
 			idx = (*srcData >> 6) & 0x03;
 			*dstBuffer++ = (idx == 0) ? 0 : CONVERT(srcPal[idx] & 0x7FFF);
 		}
-#endif
 	}
 	else
 	{
-#ifdef ENABLE_SSSE3
-		for (size_t i = 0; i < srcSize; i+=4, srcData+=4, dstBuffer+=16)
-		{
-			__m128i idx = _mm_set_epi32(0, 0, 0, *(u32 *)srcData);
-			idx = _mm_unpacklo_epi8(idx, idx);
-			idx = _mm_unpacklo_epi8(idx, idx);
-			idx = _mm_or_si128( _mm_or_si128( _mm_or_si128( _mm_and_si128(idx, _mm_set1_epi32(0x00000003)), _mm_and_si128(_mm_srli_epi32(idx, 2), _mm_set1_epi32(0x00000300)) ), _mm_and_si128(_mm_srli_epi32(idx, 4), _mm_set1_epi32(0x00030000)) ), _mm_and_si128(_mm_srli_epi32(idx, 6), _mm_set1_epi32(0x03000000)) );
-			idx = _mm_slli_epi16(idx, 1);
-			
-			const __m128i idx0 = _mm_add_epi8( _mm_unpacklo_epi8(idx, idx), _mm_set1_epi16(0x0100) );
-			const __m128i idx1 = _mm_add_epi8( _mm_unpackhi_epi8(idx, idx), _mm_set1_epi16(0x0100) );
-			
-			const __m128i palColor0 = _mm_shuffle_epi8(pal_vec128, idx0);
-			const __m128i palColor1 = _mm_shuffle_epi8(pal_vec128, idx1);
-			
-			__m128i convertedColor[4];
-			
-			if (TEXCACHEFORMAT == TexFormat_15bpp)
-			{
-				ColorspaceConvert555To6665Opaque_SSE2<false>(palColor0, convertedColor[0], convertedColor[1]);
-				ColorspaceConvert555To6665Opaque_SSE2<false>(palColor1, convertedColor[2], convertedColor[3]);
-			}
-			else
-			{
-				ColorspaceConvert555To8888Opaque_SSE2<false>(palColor0, convertedColor[0], convertedColor[1]);
-				ColorspaceConvert555To8888Opaque_SSE2<false>(palColor1, convertedColor[2], convertedColor[3]);
-			}
-			
-			_mm_store_si128((__m128i *)(dstBuffer +  0), convertedColor[0]);
-			_mm_store_si128((__m128i *)(dstBuffer +  4), convertedColor[1]);
-			_mm_store_si128((__m128i *)(dstBuffer +  8), convertedColor[2]);
-			_mm_store_si128((__m128i *)(dstBuffer + 12), convertedColor[3]);
-		}
-#else
-		for (size_t i = 0; i < srcSize; i++, srcData++)
+		for (; i < srcSize; i++, srcData++)
 		{
 			*dstBuffer++ = CONVERT(srcPal[ *srcData       & 0x03] & 0x7FFF);
 			*dstBuffer++ = CONVERT(srcPal[(*srcData >> 2) & 0x03] & 0x7FFF);
 			*dstBuffer++ = CONVERT(srcPal[(*srcData >> 4) & 0x03] & 0x7FFF);
 			*dstBuffer++ = CONVERT(srcPal[(*srcData >> 6) & 0x03] & 0x7FFF);
 		}
-#endif
 	}
 }
 
 template <TextureStoreUnpackFormat TEXCACHEFORMAT>
 void NDSTextureUnpackI4(const size_t srcSize, const u8 *__restrict srcData, const u16 *__restrict srcPal, const bool isPalZeroTransparent, u32 *__restrict dstBuffer)
 {
-#ifdef ENABLE_SSSE3
-	const __m128i palLo = _mm_load_si128((__m128i *)srcPal + 0);
-	const __m128i palHi = _mm_load_si128((__m128i *)srcPal + 1);
+	size_t i = 0;
+	
+#ifdef ENABLE_SSE2
+	if (_textureUnpackKernel == NDSTextureUnpackKernel_AVX2)
+	{
+		i = NDSTextureUnpackI4_AVX2<TEXCACHEFORMAT>(srcSize, srcData, srcPal, isPalZeroTransparent, dstBuffer);
+	}
+	else if (_textureUnpackKernel == NDSTextureUnpackKernel_SSSE3)
+	{
+		i = NDSTextureUnpackI4_SSSE3<TEXCACHEFORMAT>(srcSize, srcData, srcPal, isPalZeroTransparent, dstBuffer);
+	}
+	
+	srcData += i;
+	dstBuffer += i * 2;
 #endif
+	
 	if (isPalZeroTransparent)
 	{
-#ifdef ENABLE_SSSE3
-		for (size_t i = 0; i < srcSize; i+=8, srcData+=8, dstBuffer+=16)
-		{
-			__m128i idx = _mm_loadl_epi64((__m128i *)srcData);
-			idx = _mm_unpacklo_epi8(idx, idx);
-			idx = _mm_or_si128( _mm_and_si128(idx, _mm_set1_epi16(0x000F)), _mm_and_si128(_mm_srli_epi16(idx, 4), _mm_set1_epi16(0x0F00)) );
-			idx = _mm_slli_epi16(idx, 1);
-			
-			__m128i idx0 = _mm_add_epi8( _mm_unpacklo_epi8(idx, idx), _mm_set1_epi16(0x0100) );
-			__m128i idx1 = _mm_add_epi8( _mm_unpackhi_epi8(idx, idx), _mm_set1_epi16(0x0100) );
-			
-			const __m128i palMask = _mm_cmpeq_epi8( _mm_and_si128(idx, _mm_set1_epi8(0x10)), _mm_setzero_si128() );
-			const __m128i palColor0A = _mm_shuffle_epi8(palLo, idx0);
-			const __m128i palColor0B = _mm_shuffle_epi8(palHi, idx0);
-			const __m128i palColor1A = _mm_shuffle_epi8(palLo, idx1);
-			const __m128i palColor1B = _mm_shuffle_epi8(palHi, idx1);
-			
-			const __m128i palColor0 = _mm_blendv_epi8( palColor0B, palColor0A, _mm_unpacklo_epi8(palMask, palMask) );
-			const __m128i palColor1 = _mm_blendv_epi8( palColor1B, palColor1A, _mm_unpackhi_epi8(palMask, palMask) );
-			
-			__m128i convertedColor[4];
-			
-			if (TEXCACHEFORMAT == TexFormat_15bpp)
-			{
-				ColorspaceConvert555To6665Opaque_SSE2<false>(palColor0, convertedColor[0], convertedColor[1]);
-				ColorspaceConvert555To6665Opaque_SSE2<false>(palColor1, convertedColor[2], convertedColor[3]);
-			}
-			else
-			{
-				ColorspaceConvert555To8888Opaque_SSE2<false>(palColor0, convertedColor[0], convertedColor[1]);
-				ColorspaceConvert555To8888Opaque_SSE2<false>(palColor1, convertedColor[2], convertedColor[3]);
-			}
-			
-			// Set converted colors to 0 if the palette index is 0.
-			idx0 = _mm_cmpeq_epi16(idx0, _mm_set1_epi16(0x0100));
-			idx1 = _mm_cmpeq_epi16(idx1, _mm_set1_epi16(0x0100));
-			convertedColor[0] = _mm_andnot_si128(_mm_unpacklo_epi16(idx0, idx0), convertedColor[0]);
-			convertedColor[1] = _mm_andnot_si128(_mm_unpackhi_epi16(idx0, idx0), convertedColor[1]);
-			convertedColor[2] = _mm_andnot_si128(_mm_unpacklo_epi16(idx1, idx1), convertedColor[2]);
-			convertedColor[3] = _mm_andnot_si128(_mm_unpackhi_epi16(idx1, idx1), convertedColor[3]);
-			
-			_mm_store_si128((__m128i *)(dstBuffer +  0), convertedColor[0]);
-			_mm_store_si128((__m128i *)(dstBuffer +  4), convertedColor[1]);
-			_mm_store_si128((__m128i *)(dstBuffer +  8), convertedColor[2]);
-			_mm_store_si128((__m128i *)(dstBuffer + 12), convertedColor[3]);
-		}
-#else
-		for (size_t i = 0; i < srcSize; i++, srcData++)
+		for (; i < srcSize; i++, srcData++)
 		{
 			u8 idx;
 			
@@ -1014,61 +1709,55 @@ void NDSTextureUnpackI4(const size_t srcSize, const u8 *__restrict srcData, cons
 			idx = *srcData >> 4;
 			*dstBuffer++ = (idx == 0) ? 0 : CONVERT(srcPal[idx] & 0x7FFF);
 		}
-#endif
 	}
 	else
 	{
-#ifdef ENABLE_SSSE3
-		for (size_t i = 0; i < srcSize; i+=8, srcData+=8, dstBuffer+=16)
-		{
-			__m128i idx = _mm_loadl_epi64((__m128i *)srcData);
-			idx = _mm_unpacklo_epi8(idx, idx);
-			idx = _mm_or_si128( _mm_and_si128(idx, _mm_set1_epi16(0x000F)), _mm_and_si128(_mm_srli_epi16(idx, 4), _mm_set1_epi16(0x0F00)) );
-			idx = _mm_slli_epi16(idx, 1);
-			
-			const __m128i idx0 = _mm_add_epi8( _mm_unpacklo_epi8(idx, idx), _mm_set1_epi16(0x0100) );
-			const __m128i idx1 = _mm_add_epi8( _mm_unpackhi_epi8(idx, idx), _mm_set1_epi16(0x0100) );
-			
-			const __m128i palMask = _mm_cmpeq_epi8( _mm_and_si128(idx, _mm_set1_epi8(0x10)), _mm_setzero_si128() );
-			const __m128i palColor0A = _mm_shuffle_epi8(palLo, idx0);
-			const __m128i palColor0B = _mm_shuffle_epi8(palHi, idx0);
-			const __m128i palColor1A = _mm_shuffle_epi8(palLo, idx1);
-			const __m128i palColor1B = _mm_shuffle_epi8(palHi, idx1);
-			
-			const __m128i palColor0 = _mm_blendv_epi8( palColor0B, palColor0A, _mm_unpacklo_epi8(palMask, palMask) );
-			const __m128i palColor1 = _mm_blendv_epi8( palColor1B, palColor1A, _mm_unpackhi_epi8(palMask, palMask) );
-			
-			__m128i convertedColor[4];
-			
-			if (TEXCACHEFORMAT == TexFormat_15bpp)
-			{
-				ColorspaceConvert555To6665Opaque_SSE2<false>(palColor0, convertedColor[0], convertedColor[1]);
-				ColorspaceConvert555To6665Opaque_SSE2<false>(palColor1, convertedColor[2], convertedColor[3]);
-			}
-			else
-			{
-				ColorspaceConvert555To8888Opaque_SSE2<false>(palColor0, convertedColor[0], convertedColor[1]);
-				ColorspaceConvert555To8888Opaque_SSE2<false>(palColor1, convertedColor[2], convertedColor[3]);
-			}
-			
-			_mm_store_si128((__m128i *)(dstBuffer +  0), convertedColor[0]);
-			_mm_store_si128((__m128i *)(dstBuffer +  4), convertedColor[1]);
-			_mm_store_si128((__m128i *)(dstBuffer +  8), convertedColor[2]);
-			_mm_store_si128((__m128i *)(dstBuffer + 12), convertedColor[3]);
-		}
-#else
-		for (size_t i = 0; i < srcSize; i++, srcData++)
+		for (; i < srcSize; i++, srcData++)
 		{
 			*dstBuffer++ = CONVERT(srcPal[*srcData & 0x0F] & 0x7FFF);
 			*dstBuffer++ = CONVERT(srcPal[*srcData >> 4] & 0x7FFF);
 		}
-#endif
 	}
 }
 
 template <TextureStoreUnpackFormat TEXCACHEFORMAT>
 void NDSTextureUnpackI8(const size_t srcSize, const u8 *__restrict srcData, const u16 *__restrict srcPal, const bool isPalZeroTransparent, u32 *__restrict dstBuffer)
 {
+	// A 256 color palette is too big to shuffle from registers. Instead, convert the whole palette
+	// up front so that each texel is a single lookup. This only pays off once the texture has at
+	// least as many texels as the palette has colors.
+	if (_isTextureUnpackVectorized && (srcSize >= 256))
+	{
+		CACHE_ALIGN u32 palColor[256];
+		size_t i = 0;
+		
+		// Converted through the same tables as the scalar path below, so that both give the same texels.
+		for (size_t j = 0; j < 256; j++)
+		{
+			palColor[j] = CONVERT(srcPal[j] & 0x7FFF);
+		}
+		
+		if (isPalZeroTransparent)
+		{
+			palColor[0] = 0;
+		}
+		
+#ifdef ENABLE_SSE2
+		if (_textureUnpackKernel == NDSTextureUnpackKernel_AVX2)
+		{
+			i = NDSTextureLookupI8_AVX2(srcSize, srcData, palColor, dstBuffer);
+			srcData += i;
+			dstBuffer += i;
+		}
+#endif
+		for (; i < srcSize; i++, srcData++)
+		{
+			*dstBuffer++ = palColor[*srcData];
+		}
+		
+		return;
+	}
+	
 	if (isPalZeroTransparent)
 	{
 		for (size_t i = 0; i < srcSize; i++, srcData++)
@@ -1089,7 +1778,23 @@ void NDSTextureUnpackI8(const size_t srcSize, const u8 *__restrict srcData, cons
 template <TextureStoreUnpackFormat TEXCACHEFORMAT>
 void NDSTextureUnpackA3I5(const size_t srcSize, const u8 *__restrict srcData, const u16 *__restrict srcPal, u32 *__restrict dstBuffer)
 {
-	for (size_t i = 0; i < srcSize; i++, srcData++)
+	size_t i = 0;
+	
+#ifdef ENABLE_SSE2
+	if (_textureUnpackKernel == NDSTextureUnpackKernel_AVX2)
+	{
+		i = NDSTextureUnpackA3I5_AVX2<TEXCACHEFORMAT>(srcSize, srcData, srcPal, dstBuffer);
+	}
+	else if (_textureUnpackKernel == NDSTextureUnpackKernel_SSSE3)
+	{
+		i = NDSTextureUnpackA3I5_SSSE3<TEXCACHEFORMAT>(srcSize, srcData, srcPal, dstBuffer);
+	}
+	
+	srcData += i;
+	dstBuffer += i;
+#endif
+	
+	for (; i < srcSize; i++, srcData++)
 	{
 		const u16 c = srcPal[*srcData & 0x1F] & 0x7FFF;
 		const u8 alpha = *srcData >> 5;
@@ -1100,54 +1805,28 @@ void NDSTextureUnpackA3I5(const size_t srcSize, const u8 *__restrict srcData, co
 template <TextureStoreUnpackFormat TEXCACHEFORMAT>
 void NDSTextureUnpackA5I3(const size_t srcSize, const u8 *__restrict srcData, const u16 *__restrict srcPal, u32 *__restrict dstBuffer)
 {
-#ifdef ENABLE_SSSE3
-	const __m128i pal_vec128 = _mm_load_si128((__m128i *)srcPal);
+	size_t i = 0;
 	
-	for (size_t i = 0; i < srcSize; i+=16, srcData+=16, dstBuffer+=16)
+#ifdef ENABLE_SSE2
+	if (_textureUnpackKernel == NDSTextureUnpackKernel_AVX2)
 	{
-		const __m128i bits = _mm_loadu_si128((__m128i *)srcData);
-		
-		const __m128i idx = _mm_slli_epi16( _mm_and_si128(bits, _mm_set1_epi8(0x07)), 1 );
-		const __m128i idx0 = _mm_add_epi8( _mm_unpacklo_epi8(idx, idx), _mm_set1_epi16(0x0100) );
-		const __m128i idx1 = _mm_add_epi8( _mm_unpackhi_epi8(idx, idx), _mm_set1_epi16(0x0100) );
-		
-		const __m128i palColor0 = _mm_shuffle_epi8(pal_vec128, idx0);
-		const __m128i palColor1 = _mm_shuffle_epi8(pal_vec128, idx1);
-		
-		__m128i convertedColor[4];
-		
-		if (TEXCACHEFORMAT == TexFormat_15bpp)
-		{
-			const __m128i alpha = _mm_srli_epi16( _mm_and_si128(bits, _mm_set1_epi8(0xF8)), 3 );
-			const __m128i alphaLo = _mm_unpacklo_epi8(_mm_setzero_si128(), alpha);
-			const __m128i alphaHi = _mm_unpackhi_epi8(_mm_setzero_si128(), alpha);
-			
-			ColorspaceConvert555To6665_SSE2<false>(palColor0, alphaLo, convertedColor[0], convertedColor[1]);
-			ColorspaceConvert555To6665_SSE2<false>(palColor1, alphaHi, convertedColor[2], convertedColor[3]);
-		}
-		else
-		{
-			const __m128i alpha = _mm_or_si128( _mm_and_si128(bits, _mm_set1_epi8(0xF8)), _mm_srli_epi16(_mm_and_si128(bits, _mm_set1_epi8(0xE0)), 5) );
-			const __m128i alphaLo = _mm_unpacklo_epi8(_mm_setzero_si128(), alpha);
-			const __m128i alphaHi = _mm_unpackhi_epi8(_mm_setzero_si128(), alpha);
-			
-			ColorspaceConvert555To8888_SSE2<false>(palColor0, alphaLo, convertedColor[0], convertedColor[1]);
-			ColorspaceConvert555To8888_SSE2<false>(palColor1, alphaHi, convertedColor[2], convertedColor[3]);
-		}
-		
-		_mm_store_si128((__m128i *)(dstBuffer +  0), convertedColor[0]);
-		_mm_store_si128((__m128i *)(dstBuffer +  4), convertedColor[1]);
-		_mm_store_si128((__m128i *)(dstBuffer +  8), convertedColor[2]);
-		_mm_store_si128((__m128i *)(dstBuffer + 12), convertedColor[3]);
+		i = NDSTextureUnpackA5I3_AVX2<TEXCACHEFORMAT>(srcSize, srcData, srcPal, dstBuffer);
 	}
-#else
-	for (size_t i = 0; i < srcSize; i++, srcData++)
+	else if (_textureUnpackKernel == NDSTextureUnpackKernel_SSSE3)
+	{
+		i = NDSTextureUnpackA5I3_SSSE3<TEXCACHEFORMAT>(srcSize, srcData, srcPal, dstBuffer);
+	}
+	
+	srcData += i;
+	dstBuffer += i;
+#endif
+	
+	for (; i < srcSize; i++, srcData++)
 	{
 		const u16 c = srcPal[*srcData & 0x07] & 0x7FFF;
 		const u8 alpha = (*srcData >> 3);
 		*dstBuffer++ = (TEXCACHEFORMAT == TexFormat_15bpp) ? COLOR555TO6665(c, alpha) : COLOR555TO8888(c, material_5bit_to_8bit[alpha]);
 	}
-#endif
 }
 
 #define PAL4X4(offset) ( LE_TO_LOCAL_16( *(u16*)( MMU.texInfo.texPalSlot[((palAddress + (offset)*2)>>14)&0x7] + ((palAddress + (offset)*2)&0x3FFF) ) ) & 0x7FFF )
@@ -1265,6 +1944,18 @@ void NDSTextureUnpack4x4(const size_t srcSize, const u32 *__restrict srcData, co
 			//TODO - this could be more precise for 32bpp mode (run it through the color separation table)
 			
 			//set all 16 texels
+#ifdef ENABLE_SSE2
+			if (_textureUnpackKernel == NDSTextureUnpackKernel_AVX2)
+			{
+				NDSTextureStore4x4Block_AVX2(tmp_col, currBlock, tmpPos, dstBuffer + (x<<2));
+				continue;
+			}
+			else if (_textureUnpackKernel == NDSTextureUnpackKernel_SSSE3)
+			{
+				NDSTextureStore4x4Block_SSSE3(tmp_col, currBlock, tmpPos, dstBuffer + (x<<2));
+				continue;
+			}
+#endif
 			for (size_t sy = 0; sy < 4; sy++)
 			{
 				// Texture offset
@@ -1287,27 +1978,20 @@ void NDSTextureUnpackDirect16Bit(const size_t srcSize, const u16 *__restrict src
 	size_t i = 0;
 	
 #ifdef ENABLE_SSE2
-	const size_t pixCountVec128 = pixCount - (pixCount % 8);
+	if (_textureUnpackKernel == NDSTextureUnpackKernel_AVX2)
+	{
+		i = NDSTextureUnpackDirect16Bit_AVX2<TEXCACHEFORMAT>(pixCount, srcData, dstBuffer);
+		srcData += i;
+		dstBuffer += i;
+	}
+	
+	const v128u16 alphaBits = _mm_set1_epi16((TEXCACHEFORMAT == TexFormat_15bpp) ? 0x1F00 : 0xFF00);
+	const size_t pixCountVec128 = (_isTextureUnpackVectorized) ? pixCount - (pixCount % 8) : 0;
 	for (; i < pixCountVec128; i+=8, srcData+=8, dstBuffer+=8)
 	{
 		const v128u16 c = _mm_load_si128((v128u16 *)srcData);
-		const v128u16 alpha = _mm_cmpeq_epi16(_mm_srli_epi16(c, 15), _mm_set1_epi16(1));
-		v128u32 convertedColor[2];
-		
-		if (TEXCACHEFORMAT == TexFormat_15bpp)
-		{
-			ColorspaceConvert555To6665Opaque_SSE2<false>(c, convertedColor[0], convertedColor[1]);
-		}
-		else
-		{
-			ColorspaceConvert555To8888Opaque_SSE2<false>(c, convertedColor[0], convertedColor[1]);
-		}
-		
-		convertedColor[0] = _mm_blendv_epi8(_mm_setzero_si128(), convertedColor[0], _mm_unpacklo_epi16(alpha, alpha));
-		convertedColor[1] = _mm_blendv_epi8(_mm_setzero_si128(), convertedColor[1], _mm_unpackhi_epi16(alpha, alpha));
-		
-		_mm_store_si128((v128u32 *)(dstBuffer + 0), convertedColor[0]);
-		_mm_store_si128((v128u32 *)(dstBuffer + 4), convertedColor[1]);
+		const v128u16 isTransparent = _mm_cmpeq_epi16( _mm_and_si128(c, _mm_set1_epi16(0x8000)), _mm_setzero_si128() );
+		NDSTextureStore8_SSE2<TEXCACHEFORMAT>(c, alphaBits, isTransparent, dstBuffer);
 	}
 #endif
 	
@@ -1320,3 +2004,19 @@ void NDSTextureUnpackDirect16Bit(const size_t srcSize, const u16 *__restrict src
 
 template void TextureStore::Unpack<TexFormat_15bpp>(u32 *unpackBuffer);
 template void TextureStore::Unpack<TexFormat_32bpp>(u32 *unpackBuffer);
+
+template void NDSTextureUnpackI2<TexFormat_15bpp>(const size_t srcSize, const u8 *__restrict srcData, const u16 *__restrict srcPal, const bool isPalZeroTransparent, u32 *__restrict dstBuffer);
+template void NDSTextureUnpackI4<TexFormat_15bpp>(const size_t srcSize, const u8 *__restrict srcData, const u16 *__restrict srcPal, const bool isPalZeroTransparent, u32 *__restrict dstBuffer);
+template void NDSTextureUnpackI8<TexFormat_15bpp>(const size_t srcSize, const u8 *__restrict srcData, const u16 *__restrict srcPal, const bool isPalZeroTransparent, u32 *__restrict dstBuffer);
+template void NDSTextureUnpackA3I5<TexFormat_15bpp>(const size_t srcSize, const u8 *__restrict srcData, const u16 *__restrict srcPal, u32 *__restrict dstBuffer);
+template void NDSTextureUnpackA5I3<TexFormat_15bpp>(const size_t srcSize, const u8 *__restrict srcData, const u16 *__restrict srcPal, u32 *__restrict dstBuffer);
+template void NDSTextureUnpack4x4<TexFormat_15bpp>(const size_t srcSize, const u32 *__restrict srcData, const u16 *__restrict srcIndex, const u32 palAddress, const u32 sizeX, const u32 sizeY, u32 *__restrict dstBuffer);
+template void NDSTextureUnpackDirect16Bit<TexFormat_15bpp>(const size_t srcSize, const u16 *__restrict srcData, u32 *__restrict dstBuffer);
+
+template void NDSTextureUnpackI2<TexFormat_32bpp>(const size_t srcSize, const u8 *__restrict srcData, const u16 *__restrict srcPal, const bool isPalZeroTransparent, u32 *__restrict dstBuffer);
+template void NDSTextureUnpackI4<TexFormat_32bpp>(const size_t srcSize, const u8 *__restrict srcData, const u16 *__restrict srcPal, const bool isPalZeroTransparent, u32 *__restrict dstBuffer);
+template void NDSTextureUnpackI8<TexFormat_32bpp>(const size_t srcSize, const u8 *__restrict srcData, const u16 *__restrict srcPal, const bool isPalZeroTransparent, u32 *__restrict dstBuffer);
+template void NDSTextureUnpackA3I5<TexFormat_32bpp>(const size_t srcSize, const u8 *__restrict srcData, const u16 *__restrict srcPal, u32 *__restrict dstBuffer);
+template void NDSTextureUnpackA5I3<TexFormat_32bpp>(const size_t srcSize, const u8 *__restrict srcData, const u16 *__restrict srcPal, u32 *__restrict dstBuffer);
+template void NDSTextureUnpack4x4<TexFormat_32bpp>(const size_t srcSize, const u32 *__restrict srcData, const u16 *__restrict srcIndex, const u32 palAddress, const u32 sizeX, const u32 sizeY, u32 *__restrict dstBuffer);
+template void NDSTextureUnpackDirect16Bit<TexFormat_32bpp>(const size_t srcSize, const u16 *__restrict srcData, u32 *__restrict dstBuffer);
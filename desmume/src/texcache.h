@@ -20,7 +20,6 @@
 #ifndef _TEXCACHE_H_
 #define _TEXCACHE_H_
 
-#include <map>
 #include <vector>
 
 #include "types.h"
@@ -51,9 +50,36 @@ class MemSpan;
 class TextureStore;
 
 typedef u64 TextureCacheKey;
-typedef std::map<TextureCacheKey, TextureStore *> TextureCacheMap; // Key = A TextureCacheKey that includes a combination of the texture's NDS texture attributes and palette attributes; Value = Pointer to the texture item
 typedef std::vector<TextureStore *> TextureCacheList;
-//typedef u32 TextureFingerprint;
+typedef u64 TextureFingerprint;
+
+// Maps a TextureCacheKey (a combination of the texture's NDS texture attributes and palette
+// attributes) to its texture item. This is an open-addressing hash table with linear probing
+// and backward-shift deletion, so lookups during rendering touch a single contiguous array.
+class TextureCacheMap
+{
+protected:
+	struct Entry
+	{
+		TextureCacheKey key;
+		TextureStore *texture; // NULL marks an empty entry
+	};
+	
+	std::vector<Entry> _entry;
+	size_t _count;
+	
+	size_t _GetHomeIndex(const TextureCacheKey key) const;
+	void _Resize(const size_t newCapacity);
+	
+public:
+	TextureCacheMap();
+	
+	size_t GetCount() const;
+	TextureStore* Find(const TextureCacheKey key) const;
+	void Insert(const TextureCacheKey key, TextureStore *texture);
+	void Erase(const TextureCacheKey key);
+	void Clear();
+};
 
 class TextureCache
 {
@@ -63,6 +89,8 @@ protected:
 	size_t _actualCacheSize;
 	size_t _cacheSizeThreshold;
 	u8 _paletteDump[PALETTE_DUMP_SIZE];
+	u32 _paletteDumpEpoch;
+	TextureFingerprint _paletteDumpLayout;
 	
 public:
 	TextureCache();
@@ -114,7 +142,13 @@ protected:
 	bool _suspectedInvalid;
 	bool _assumedInvalid;
 	bool _isLoadNeeded;
-	u8 *_workingData;
+	
+	// State of VRAM as of the last time this texture was verified. If none of the VRAM pages
+	// backing the texture have been written since _vramEpoch, and the pages are still mapped
+	// the same way, then the texture is known to be unchanged without having to look at it.
+	u32 _vramEpoch;
+	TextureFingerprint _vramLayout;
+	TextureFingerprint _packFingerprint;
 	
 	TextureCacheKey _cacheKey;
 	size_t _cacheSize;
@@ -149,6 +183,7 @@ public:
 	void SetTextureData(const MemSpan &packedData, const MemSpan &packedIndexData);
 	void SetTexturePalette(const MemSpan &packedPalette);
 	void SetTexturePalette(const u16 *paletteBuffer);
+	void SetVRAMState(const MemSpan &packedData, const MemSpan &packedIndexData, const MemSpan &packedPalette);
 	
 	size_t GetUnpackSizeUsingFormat(const TextureStoreUnpackFormat texCacheFormat) const;
 	template<TextureStoreUnpackFormat TEXCACHEFORMAT> void Unpack(u32 *unpackBuffer);
@@ -190,6 +225,13 @@ template<TextureStoreUnpackFormat TEXCACHEFORMAT> void NDSTextureUnpackA5I3(cons
 template<TextureStoreUnpackFormat TEXCACHEFORMAT> void NDSTextureUnpack4x4(const size_t srcSize, const u32 *__restrict srcData, const u16 *__restrict srcIndex, const u32 palAddress, const u32 sizeX, const u32 sizeY, u32 *__restrict dstBuffer);
 template<TextureStoreUnpackFormat TEXCACHEFORMAT> void NDSTextureUnpackDirect16Bit(const size_t srcSize, const u16 *__restrict srcData, u32 *__restrict dstBuffer);
 
+// On x86, the unpackers use SSSE3 or AVX2 kernels when the host cpu supports them. Turning them off makes
+// every format go through the scalar code instead, which is mostly useful for comparing the two.
+void NDSTextureUnpackSetVectorized(const bool enable);
+bool NDSTextureUnpackIsVectorized();
+// Names the kernels the unpackers use right now: "avx2", "ssse3", or "none" for the scalar code.
+const char* NDSTextureUnpackKernelName();
+
 extern TextureCache texCache;
 
 #endif
@@ -97,6 +97,7 @@ uint8_t* Assembler::takeCode()
 {
   uint8_t* code = _buffer.take();
   _relocData.clear();
+  _ptrImmData.clear();
   _zoneMemory.clear();
 
   if (_error != kErrorOk)
@@ -126,6 +127,7 @@ void Assembler::reset()
 
   _labels.reset();
   _relocData.reset();
+  _ptrImmData.reset();
 
   if (_error != kErrorOk)
     setError(kErrorOk);
@@ -144,6 +146,7 @@ void Assembler::_purge()
   
   _labels.clear();
   _relocData.clear();
+  _ptrImmData.clear();
 }
 
 // ============================================================================
@@ -244,6 +244,16 @@ struct Assembler
   inline size_t getTrampolineSize() const
   { return _trampolineSize; }
 
+  //! @brief Get relocation records that @c relocCode() will apply.
+  inline const PodVector<RelocData>& getRelocData() const
+  { return _relocData; }
+
+  //! @brief Get offsets of the 64-bit immediates created by @c imm_ptr() that
+  //! were emitted so far (absolute addresses which @c relocCode() copies as
+  //! they are).
+  inline const PodVector<uint32_t>& getPtrImmData() const
+  { return _ptrImmData; }
+
   // --------------------------------------------------------------------------
   // [Buffer - Getters]
   // --------------------------------------------------------------------------
@@ -487,6 +497,8 @@ struct Assembler
   PodVector<LabelData> _labels;
   //! @brief Relocations data.
   PodVector<RelocData> _relocData;
+  //! @brief Offsets of 64-bit address immediates.
+  PodVector<uint32_t> _ptrImmData;
 };
 
 //! @}
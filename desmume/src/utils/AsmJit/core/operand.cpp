@@ -36,6 +36,14 @@ Imm uimm(sysuint_t i)
   return Imm((sysint_t)i, true);
 }
 
+//! @brief Create immediate operand holding the address @a p.
+Imm imm_ptr(const void* p)
+{
+  Imm i((sysint_t)p, true);
+  i._imm.isPointer = true;
+  return i;
+}
+
 } // AsmJit namespace
 
 // [Api-End]
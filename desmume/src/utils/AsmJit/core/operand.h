@@ -146,8 +146,8 @@ struct _OpImm
   uint8_t size;
   //! @brief @c true if immediate is unsigned.
   uint8_t isUnsigned;
-  //! @brief Not used.
-  uint8_t reserved;
+  //! @brief @c true if immediate is an address (see @c imm_ptr()).
+  uint8_t isPointer;
 
   //! @brief Operand ID.
   uint32_t id;
@@ -426,7 +426,7 @@ struct Imm : public Operand
     _imm.op = kOperandImm;
     _imm.size = 0;
     _imm.isUnsigned = false;
-    _imm.reserved = 0;
+    _imm.isPointer = false;
 
     _imm.id = kInvalidValue;
     _imm.value = 0;
@@ -438,7 +438,7 @@ struct Imm : public Operand
     _imm.op = kOperandImm;
     _imm.size = 0;
     _imm.isUnsigned = false;
-    _imm.reserved = 0;
+    _imm.isPointer = false;
 
     _imm.id = kInvalidValue;
     _imm.value = i;
@@ -450,7 +450,7 @@ struct Imm : public Operand
     _imm.op = kOperandImm;
     _imm.size = 0;
     _imm.isUnsigned = isUnsigned;
-    _imm.reserved = 0;
+    _imm.isPointer = false;
 
     _imm.id = kInvalidValue;
     _imm.value = i;
@@ -469,6 +469,10 @@ struct Imm : public Operand
   inline bool isUnsigned() const
   { return _imm.isUnsigned != 0; }
 
+  //! @brief Get whether an immediate is an address.
+  inline bool isPointer() const
+  { return _imm.isPointer != 0; }
+
   //! @brief Get signed immediate value.
   inline sysint_t getValue() const
   { return _imm.value; }
@@ -512,6 +516,9 @@ ASMJIT_API Imm imm(sysint_t i);
 //! @brief Create unsigned immediate value operand.
 ASMJIT_API Imm uimm(sysuint_t i);
 
+//! @brief Create immediate operand holding the address @a p.
+ASMJIT_API Imm imm_ptr(const void* p);
+
 // ============================================================================
 // [AsmJit::Label]
 // ============================================================================
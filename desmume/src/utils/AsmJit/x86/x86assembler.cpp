@@ -1532,8 +1532,9 @@ _Emit_Mov_Sreg_RM:
 
 #if defined(ASMJIT_X64)
           // Optimize instruction size by using 32-bit immediate if value can
-          // fit into it.
-          if (immSize == 8 && IntUtil::isInt32(src.getValue()))
+          // fit into it. Addresses always get all 64 bits, so they can be
+          // found in the code and relocated (see getPtrImmData()).
+          if (immSize == 8 && IntUtil::isInt32(src.getValue()) && !src.isPointer())
           {
             _emitX86RM(0xC7,
               0, // 16BIT
@@ -2545,7 +2546,7 @@ _EmitImmediate:
       case 2: _emitWord ((uint16_t)(sysuint_t)value); break;
       case 4: _emitDWord((uint32_t)(sysuint_t)value); break;
 #if defined(ASMJIT_X64)
-      case 8: _emitQWord((uint64_t)(sysuint_t)value); break;
+      case 8: if (immOperand->isPointer()) _ptrImmData.append((uint32_t)getOffset()); _emitQWord((uint64_t)(sysuint_t)value); break;
 #endif // ASMJIT_X64
       default: ASMJIT_ASSERT(0);
     }
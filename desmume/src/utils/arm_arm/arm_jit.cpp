@@ -192,6 +192,16 @@ static code_pool* block;
 static register_manager* regman;
 static u8 recompile_counts[(1<<26)/16];
 
+// only the page of each block's entry point is marked, and a write clears just
+// the entry points it hits, same as before the x86 JIT tracked whole blocks
+u32 jit_code_pages[(JIT_CODE_PAGES + 31) / 32];
+
+void FASTCALL arm_jit_invalidate(u32 slot, u32 count)
+{
+   for(u32 i = 0; i < count; i++)
+      JIT_SLOT_BASE[slot + i] = 0;
+}
+
 const reg_t RCPU = 12;
 const reg_t RCYC = 4;
 static uint32_t block_procnum;
@@ -1463,6 +1473,8 @@ static ArmOpCompiled compile_basicblock()
    block->pop(0x8DF0);
 
    void* fn_ptr = block->fn_pointer();
+   const u32 page = JIT_SLOT(&JIT_COMPILED_FUNC(base, PROCNUM)) >> JIT_CODE_PAGE_SHIFT;
+   jit_code_pages[page >> 5] |= 1 << (page & 31);
    JIT_COMPILED_FUNC(base, PROCNUM) = (uintptr_t)fn_ptr;
    return (ArmOpCompiled)fn_ptr;
 }
@@ -1528,6 +1540,7 @@ void arm_jit_reset(bool enable, bool suppress_msg)
             memset(compiled_funcs+128*i, 0, 128*sizeof(*compiled_funcs));
          }
 #endif
+      memset(jit_code_pages, 0, sizeof(jit_code_pages));
 
       delete block;
       block = new code_pool(INSTRUCTION_COUNT);
@@ -1537,6 +1550,33 @@ void arm_jit_reset(bool enable, bool suppress_msg)
    }
 }
 
+// this code pool is flushed as a whole, and its blocks are neither cached on disk nor linked
+template<int PROCNUM> ArmOpCompiled arm_jit_link(ArmOpCompiled prev)
+{
+   return NULL;
+}
+
+template ArmOpCompiled arm_jit_link<0>(ArmOpCompiled prev);
+template ArmOpCompiled arm_jit_link<1>(ArmOpCompiled prev);
+
+const JitCacheStats& arm_jit_cache_stats()
+{
+   static const JitCacheStats none = {0};
+   return none;
+}
+
+const JitCodeStats& arm_jit_code_stats()
+{
+   static const JitCodeStats none = {0};
+   return none;
+}
+
+const JitTierStats& arm_jit_tier_stats()
+{
+   static const JitTierStats none = {0};
+   return none;
+}
+
 void arm_jit_close()
 {
    delete block;